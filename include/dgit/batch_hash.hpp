@@ -0,0 +1,34 @@
+#pragma once
+
+#include "dgit/sha1.hpp"
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace dgit {
+
+// Result of hashing one working-tree file as a Git blob
+struct HashedFile {
+    std::string path;
+    ObjectId id;
+    struct stat st;   // fstat() of the descriptor the content was read from
+};
+
+struct BatchHashOptions {
+    enum class Lanes { Auto, Always, Never };
+
+    size_t threads = 0;                   // 0 = hardware concurrency
+    size_t mmap_threshold = 1 << 20;      // map files at least this large
+    size_t lane_limit = 64 * 1024;        // files this small may share SIMD lanes
+    Lanes lanes = Lanes::Auto;            // Auto: only without SHA instructions
+};
+
+// Blob ID of `size` bytes of content ("blob <size>\0" header included)
+ObjectId hash_blob(const uint8_t* data, size_t size);
+
+// Hashes every path as a blob across a worker pool and returns the results
+// in input order. Throws GitException if any file cannot be read.
+std::vector<HashedFile> hash_files(const std::vector<std::string>& paths,
+                                   const BatchHashOptions& options = {});
+
+} // namespace dgit
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "dgit/index.hpp"
+#include "dgit/object.hpp"
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dgit {
+
+// Where update() finds and puts objects
+struct CacheTreeStore {
+    std::function<bool(const ObjectId&)> has_object;      // cached trees must still exist
+    std::function<void(const IndexEntry&)> ensure_blob;   // entries of every rebuilt tree
+    std::function<void(std::unique_ptr<Tree>)> store_tree;
+};
+
+// Tree ID per index directory, as in git's TREE extension. Changing an
+// entry invalidates its directory and every ancestor, so writing a tree
+// only rebuilds the directories on the paths that changed.
+class CacheTree {
+public:
+    struct Node {
+        std::string name;                              // "" for the root
+        int entry_count = -1;                          // index entries covered; -1 = invalid
+        ObjectId id;
+        std::vector<std::unique_ptr<Node>> subtrees;   // in index order
+
+        bool valid() const { return entry_count >= 0; }
+        Node* find(std::string_view child) const;
+    };
+
+    struct UpdateResult {
+        ObjectId root;
+        size_t trees_written = 0;
+    };
+
+    // Marks the directories holding `path` invalid, up to the root
+    void invalidate(std::string_view path);
+    void clear();
+
+    // Rebuilds every invalid tree from the sorted index entries. Throws
+    // GitException on unmerged entries.
+    UpdateResult update(const std::vector<IndexEntry>& entries, const CacheTreeStore& store);
+
+    const Node* root() const { return root_.get(); }
+    bool changed() const { return changed_; }
+    void mark_saved() { changed_ = false; }
+
+    // TREE extension payload
+    void serialize(std::string& out) const;
+    // Returns false (leaving the cache empty) on malformed data
+    bool parse(const uint8_t* data, size_t size);
+
+private:
+    size_t update_node(Node& node, const std::vector<IndexEntry>& entries, size_t pos, const std::string& prefix,
+                       const CacheTreeStore& store, size_t& written);
+
+    std::unique_ptr<Node> root_;
+    bool changed_ = false;
+};
+
+} // namespace dgit
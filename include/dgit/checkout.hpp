@@ -0,0 +1,37 @@
+#pragma once
+
+#include "dgit/index.hpp"
+#include "dgit/object.hpp"
+#include <cstddef>
+#include <string>
+
+namespace dgit {
+
+class ObjectDatabase;
+
+struct CheckoutOptions {
+    size_t threads = 0;                // file writes; 0 = hardware concurrency
+    bool force = false;                // overwrite local changes and untracked files
+    size_t batch_bytes = 64 << 20;     // blob content held in memory at once
+};
+
+struct CheckoutResult {
+    size_t written = 0;      // files created or replaced
+    size_t removed = 0;
+    size_t trees_read = 0;
+};
+
+// Makes the work tree and index match `tree`, touching only the paths
+// where the index differs from it. Subtrees whose cache-tree entry already
+// matches are skipped without being read. Blobs are read in batches and
+// written across a worker pool once their directories exist, and each
+// written entry takes the stat data of its new file, so the next status
+// need not hash it again.
+//
+// Unless forced, nothing is changed when a path to be replaced or removed
+// has local changes, or when an untracked file is in the way; GitException
+// names the path. The index is updated in memory; Index::save() writes it.
+CheckoutResult checkout_tree(ObjectDatabase& objects, Index& index, const std::string& worktree,
+                             const ObjectId& tree, const CheckoutOptions& options = {});
+
+} // namespace dgit
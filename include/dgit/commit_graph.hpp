@@ -0,0 +1,97 @@
+#pragma once
+
+#include "dgit/mapped_file.hpp"
+#include "dgit/object.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace dgit {
+
+class ObjectDatabase;
+
+// Git's commit-graph file (objects/info/commit-graph), or a chain of split
+// layers under objects/info/commit-graphs/. Each commit has a fixed-width
+// record with its tree, parent positions, generation number and commit
+// date, so history walks read a mapped table instead of inflating commits.
+// Positions are global across layers, base layer first.
+class CommitGraph {
+public:
+    static constexpr uint32_t kGenerationInfinity = 0xFFFFFFFF;   // not in the graph
+    static constexpr uint32_t kGenerationMax = 0x3FFFFFFF;        // 30 bits on disk
+
+    // Returns nullptr when there is no graph. Throws GitException on a
+    // malformed file or a broken chain.
+    static std::unique_ptr<CommitGraph> open(const std::string& objects_dir);
+
+    size_t size() const { return size_; }
+    size_t layer_count() const { return layers_.size(); }
+    // Layer `i`, base first: its commits are positions [start, start + size)
+    uint32_t layer_start(size_t i) const { return layers_[i].base_count; }
+    uint32_t layer_size(size_t i) const { return layers_[i].count; }
+    const ObjectId& layer_checksum(size_t i) const { return layers_[i].checksum; }
+    const std::string& layer_path(size_t i) const { return layers_[i].file.path(); }
+    std::optional<uint32_t> find(const ObjectId& id) const;
+
+    ObjectId id(uint32_t pos) const;
+    ObjectId tree_id(uint32_t pos) const;
+    uint32_t generation(uint32_t pos) const;
+    int64_t commit_time(uint32_t pos) const;
+    // Appends the parent positions of `pos` in order
+    void parents(uint32_t pos, std::vector<uint32_t>& out) const;
+
+private:
+    struct Layer {
+        MappedFile file;
+        ObjectId checksum;
+        uint32_t count = 0;
+        uint32_t base_count = 0;   // commits in the layers below
+        const uint8_t* fanout = nullptr;
+        const uint8_t* ids = nullptr;
+        const uint8_t* data = nullptr;
+        const uint8_t* edges = nullptr;
+        size_t edge_count = 0;
+        const uint8_t* bases = nullptr;   // checksums of the layers below
+    };
+
+    static Layer load_layer(const std::string& path, uint32_t base_count, size_t base_layers);
+    const Layer& layer_for(uint32_t pos) const;
+    const uint8_t* record(uint32_t pos) const;
+
+    std::vector<Layer> layers_;
+    size_t size_ = 0;
+};
+
+struct CommitGraphWriteOptions {
+    bool split = false;       // add a layer instead of rewriting one file
+    size_t size_multiple = 2; // merge a layer into the new one unless this many times larger
+};
+
+struct CommitGraphWriteResult {
+    size_t commits = 0;   // in the file written
+    size_t layers = 0;    // in the graph afterwards
+};
+
+// Writes the commits reachable from `tips`. In split mode only commits
+// missing from the current graph go into a new top layer, merged with
+// layers that are not `size_multiple` times larger than it. Commits already
+// in a graph are never inflated again.
+CommitGraphWriteResult write_commit_graph(ObjectDatabase& objects, const std::vector<ObjectId>& tips,
+                                          const CommitGraphWriteOptions& options = {});
+
+// What history walks need from a commit
+struct CommitInfo {
+    ObjectId tree;
+    std::vector<ObjectId> parents;
+    uint32_t generation = CommitGraph::kGenerationInfinity;
+    int64_t commit_time = 0;
+};
+
+// From the commit-graph when it has `id`, else by parsing the object.
+// Throws GitException if `id` is not a commit.
+CommitInfo read_commit_info(ObjectDatabase& objects, const ObjectId& id);
+
+} // namespace dgit
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <zlib.h>
+
+#ifdef DGIT_USE_LIBDEFLATE
+struct libdeflate_compressor;
+struct libdeflate_decompressor;
+#endif
+
+namespace dgit {
+
+// zlib level used when neither the caller nor config picks one
+constexpr int kDefaultCompressionLevel = Z_DEFAULT_COMPRESSION;
+
+// Reusable deflate context. The z_stream is initialised once and reset
+// between objects, which matters when writing many small objects. Not
+// thread-safe; use for_thread() to get one per worker.
+class Deflater {
+public:
+    explicit Deflater(int level = kDefaultCompressionLevel);
+    ~Deflater();
+
+    Deflater(const Deflater&) = delete;
+    Deflater& operator=(const Deflater&) = delete;
+
+    int level() const { return level_; }
+    void set_level(int level);
+
+    // Compresses a whole buffer into `out`, replacing its contents. `out`
+    // keeps its capacity, so callers can reuse one buffer per thread.
+    void compress(const void* data, size_t size, std::string& out);
+
+    // Resets the stream for incremental use with deflate() directly
+    z_stream& begin();
+
+    // Calling thread's context, switched to `level` if needed
+    static Deflater& for_thread(int level);
+
+private:
+    z_stream zs_;
+    int level_;
+#ifdef DGIT_USE_LIBDEFLATE
+    libdeflate_compressor* one_shot_ = nullptr;
+#endif
+};
+
+// Reusable inflate context, the counterpart of Deflater
+class Inflater {
+public:
+    static constexpr size_t kUnknownSize = static_cast<size_t>(-1);
+
+    Inflater();
+    ~Inflater();
+
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+
+    // Inflates one zlib stream from the start of `data` into `out`. With a
+    // known expected_size the output is sized once and the length is
+    // checked. Trailing input after the stream is ignored; `consumed`
+    // receives the compressed length. Throws GitException on corrupt data.
+    void decompress(const void* data, size_t size, std::string& out,
+                    size_t expected_size = kUnknownSize, size_t* consumed = nullptr);
+
+    // Resets the stream for incremental use with inflate() directly
+    z_stream& begin();
+
+    static Inflater& for_thread();
+
+private:
+    z_stream zs_;
+#ifdef DGIT_USE_LIBDEFLATE
+    libdeflate_decompressor* one_shot_ = nullptr;
+#endif
+};
+
+} // namespace dgit
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace dgit {
+
+class EwahBitmap;
+
+// Plain bit vector that grows on demand; bit i is bit (i % 64) of word
+// i / 64, as in git's bitmaps. Set operations run a word at a time.
+class Bitmap {
+public:
+    Bitmap() = default;
+    explicit Bitmap(size_t bits) : words_((bits + 63) / 64) {}
+
+    void set(size_t bit) {
+        if (bit / 64 >= words_.size()) {
+            words_.resize(bit / 64 + 1);
+        }
+        words_[bit / 64] |= uint64_t{1} << (bit % 64);
+    }
+    bool get(size_t bit) const {
+        return bit / 64 < words_.size() && ((words_[bit / 64] >> (bit % 64)) & 1);
+    }
+
+    void or_with(const Bitmap& other);
+    void and_not(const Bitmap& other);
+    void xor_with(const Bitmap& other);
+    void or_ewah(const EwahBitmap& other);
+    size_t count() const;
+    bool empty() const;
+
+    // Calls fn(bit) for every set bit, in order
+    template <typename F>
+    void for_each(F&& fn) const {
+        for (size_t i = 0; i < words_.size(); ++i) {
+            for (uint64_t word = words_[i]; word; word &= word - 1) {
+                fn(i * 64 + static_cast<size_t>(__builtin_ctzll(word)));
+            }
+        }
+    }
+
+    const std::vector<uint64_t>& words() const { return words_; }
+    bool operator==(const Bitmap& other) const;
+    bool operator!=(const Bitmap& other) const { return !(*this == other); }
+
+private:
+    friend class EwahBitmap;
+    std::vector<uint64_t> words_;
+};
+
+// Git's EWAH compression: each marker word holds a run of all-zero or
+// all-one words (bit 0 the fill bit, bits 1-32 the run length) and the
+// count of literal words that follow it (bits 33-63). Serialized as in
+// .bitmap files: be32 bit count, be32 word count, be64 words, be32
+// position of the last marker.
+class EwahBitmap {
+public:
+    EwahBitmap();
+
+    static EwahBitmap compress(const Bitmap& bitmap);
+    Bitmap decompress() const;
+
+    size_t bit_size() const { return bit_size_; }
+    size_t word_count() const { return buffer_.size(); }
+
+    void serialize(std::string& out) const;
+    // Reads one bitmap at `data` and advances past it. Throws GitException
+    // on truncated or inconsistent input.
+    static EwahBitmap parse(const uint8_t*& data, const uint8_t* end);
+
+    // Calls fn(first_word, count, fill) for each run of clean words with
+    // `fill` set, and fn(word_index, literal) for each literal word
+    template <typename Run, typename Literal>
+    void for_each(Run&& run, Literal&& literal) const {
+        size_t word = 0;
+        for (size_t pos = 0; pos < buffer_.size();) {
+            uint64_t marker = buffer_[pos++];
+            size_t run_length = static_cast<size_t>((marker >> 1) & kMaxRun);
+            size_t literals = static_cast<size_t>(marker >> 33);
+            if (run_length) {
+                run(word, run_length, (marker & 1) != 0);
+                word += run_length;
+            }
+            for (size_t i = 0; i < literals; ++i) {
+                literal(word++, buffer_[pos++]);
+            }
+        }
+    }
+
+private:
+    static constexpr uint64_t kMaxRun = 0xFFFFFFFFu;
+    static constexpr uint64_t kMaxLiterals = 0x7FFFFFFFu;
+
+    std::vector<uint64_t> buffer_;
+    uint32_t bit_size_ = 0;
+    uint32_t last_marker_ = 0;
+};
+
+} // namespace dgit
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "dgit/config.hpp"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dgit {
+
+// What changed in the work tree since a previous query
+struct FsMonitorChanges {
+    std::string token;                // pass back to the next query
+    bool everything = false;          // no usable history: check every path
+    std::vector<std::string> paths;   // relative to the work tree; "dir/" covers a directory
+};
+
+// Source of changed paths, so status only has to look at those. Tokens
+// are opaque; a token the monitor does not recognise yields `everything`.
+class FsMonitor {
+public:
+    virtual ~FsMonitor() = default;
+
+    virtual FsMonitorChanges changes_since(const std::string& token) = 0;
+
+    // core.fsmonitor names a hook command, as in git; unset or false means
+    // no monitor. Returns nullptr when none is configured.
+    static std::unique_ptr<FsMonitor> from_config(const Config& config, const std::string& worktree = ".");
+};
+
+// Runs `<command> 2 <token>` (git's fsmonitor hook protocol, version 2).
+// The hook prints a new token, a NUL, then NUL-terminated changed paths;
+// a lone "/" or a non-zero exit status means everything may have changed.
+class HookFsMonitor : public FsMonitor {
+public:
+    HookFsMonitor(std::string command, std::string worktree);
+
+    FsMonitorChanges changes_since(const std::string& token) override;
+
+private:
+    std::string command_;
+    std::string worktree_;
+};
+
+#ifdef __linux__
+// In-process inotify watcher for long-lived callers such as IDE plugins
+// that link dgit and ask for status repeatedly. Events queue in the kernel
+// between queries, so no thread is needed; each query drains them. Tokens
+// are only meaningful to the instance that issued them.
+class InotifyFsMonitor : public FsMonitor {
+public:
+    explicit InotifyFsMonitor(std::string worktree);
+    ~InotifyFsMonitor() override;
+
+    InotifyFsMonitor(const InotifyFsMonitor&) = delete;
+    InotifyFsMonitor& operator=(const InotifyFsMonitor&) = delete;
+
+    FsMonitorChanges changes_since(const std::string& token) override;
+
+private:
+    void watch_tree(const std::string& path);
+    void drain();
+    void reset_history();
+
+    int fd_ = -1;
+    std::string worktree_;
+    std::string instance_;
+    std::unordered_map<int, std::string> watches_;   // descriptor -> directory
+    std::vector<std::string> history_;               // changed paths, oldest first
+    size_t generation_ = 0;
+};
+#endif
+
+} // namespace dgit
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace dgit {
+
+// Read-only private mapping of a whole file. Empty files map to a null pointer
+// with size 0.
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    // Throws GitException if the file cannot be opened or mapped
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const std::string& path() const { return path_; }
+
+    // Tells the kernel the mapping will be read in random order (lookups)
+    void advise_random() const;
+
+private:
+    void unmap();
+
+    std::string path_;
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Writes a temporary file beside `path` and renames it into place, so
+// readers never see a partial file. Throws GitException naming `what`
+// ("commit-graph", "bitmap") if either step fails.
+void write_file_atomically(const std::string& path, const std::string& contents, const char* what);
+
+// Unaligned big-endian loads for on-disk formats
+inline uint32_t load_be32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+inline uint64_t load_be64(const uint8_t* p) {
+    return (static_cast<uint64_t>(load_be32(p)) << 32) | load_be32(p + 4);
+}
+
+// Big-endian stores, appended to a file image being built
+inline void store_be32(std::string& out, uint32_t value) {
+    char bytes[4] = {static_cast<char>(value >> 24), static_cast<char>(value >> 16), static_cast<char>(value >> 8),
+                     static_cast<char>(value)};
+    out.append(bytes, 4);
+}
+
+inline void store_be64(std::string& out, uint64_t value) {
+    store_be32(out, static_cast<uint32_t>(value >> 32));
+    store_be32(out, static_cast<uint32_t>(value));
+}
+
+} // namespace dgit
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "dgit/object_id.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+namespace dgit {
+
+class CommitGraph;
+class ObjectDatabase;
+
+// Merge-base and reachability queries over commit history. A walk paints
+// commits down from each side through a queue ordered by generation number
+// (commit date for commits outside the commit-graph) and stops once every
+// queued commit is reachable from both sides. Commits are numbered as they
+// are met and carry their paint in a flag byte; parents, once loaded, stay
+// cached across queries on the same engine.
+class MergeBaseEngine {
+public:
+    struct Stats {
+        size_t commits_loaded = 0;   // met by any walk so far
+        size_t commits_walked = 0;   // taken from the queue, over all walks
+    };
+
+    explicit MergeBaseEngine(ObjectDatabase& objects);
+
+    // Best common ancestors of `one` and any of `others`, as `git merge-base
+    // --all one others...`: none is an ancestor of another, newest first.
+    // Throws GitException if an input is not a commit.
+    std::vector<ObjectId> merge_bases(const ObjectId& one, const std::vector<ObjectId>& others);
+    // Best ancestors common to all of `commits` (`git merge-base --octopus`)
+    std::vector<ObjectId> octopus_bases(const std::vector<ObjectId>& commits);
+    // True when `ancestor` is reachable from `descendant` (or the same)
+    bool is_ancestor(const ObjectId& ancestor, const ObjectId& descendant);
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    static constexpr uint32_t kNoNode = UINT32_MAX;
+    static constexpr uint32_t kUnloaded = UINT32_MAX;
+
+    struct Node {
+        ObjectId id;
+        int64_t commit_time = 0;
+        uint32_t generation = 0;
+        uint32_t graph_pos = kNoNode;
+        uint32_t parents_begin = kUnloaded;   // into parents_, once resolved
+        uint32_t parent_count = 0;
+        uint32_t loose_begin = 0;             // into loose_parents_, outside the graph
+        uint32_t queued = 0;                  // entries in the queue
+        uint8_t flags = 0;
+    };
+
+    struct QueueEntry {
+        uint32_t generation;
+        int64_t commit_time;
+        uint32_t node;
+
+        bool operator<(const QueueEntry& other) const {
+            if (generation != other.generation) {
+                return generation < other.generation;
+            }
+            if (commit_time != other.commit_time) {
+                return commit_time < other.commit_time;
+            }
+            return node > other.node;
+        }
+    };
+
+    uint32_t node_for(const ObjectId& id);
+    uint32_t node_at(uint32_t graph_pos);
+    void load_parents(uint32_t node);
+
+    void mark(uint32_t node, uint8_t flags);
+    void push(uint32_t node);
+    uint32_t pop();
+    void clear_flags();
+
+    // Commits painted from both `one` and some of `others`, with nothing
+    // below `min_generation` walked
+    std::vector<uint32_t> paint_down_to_common(uint32_t one, const std::vector<uint32_t>& others,
+                                               uint32_t min_generation);
+    std::vector<uint32_t> remove_redundant(std::vector<uint32_t> candidates);
+    std::vector<uint32_t> merge_bases(uint32_t one, const std::vector<uint32_t>& others);
+    std::vector<ObjectId> sorted_ids(std::vector<uint32_t> nodes) const;
+
+    ObjectDatabase& objects_;
+    const CommitGraph* graph_;
+    std::vector<Node> nodes_;
+    std::vector<uint32_t> by_position_;   // graph position -> node
+    std::unordered_map<ObjectId, uint32_t, ObjectIdHash> by_id_;
+    std::vector<uint32_t> parents_;
+    std::vector<ObjectId> loose_parents_;   // parsed, not yet numbered
+    std::vector<uint32_t> touched_;
+    std::priority_queue<QueueEntry> queue_;
+    size_t nonstale_queued_ = 0;
+    std::vector<uint32_t> scratch_;
+    Stats stats_;
+};
+
+} // namespace dgit
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "dgit/object_id.hpp"
+#include "dgit/rename_detection.hpp"
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dgit {
+
+class ObjectDatabase;
+
+// Line-level three-way merge of one file, as `git merge-file`: hunks only
+// one side changed are taken from it, and overlapping changes that differ
+// become conflict blocks between "<<<<<<<", "=======" and ">>>>>>>" lines.
+struct LineMergeResult {
+    std::string content;
+    size_t conflicts = 0;   // conflict blocks in `content`
+};
+
+LineMergeResult merge_lines(std::string_view base, std::string_view ours, std::string_view theirs,
+                            const std::string& our_label = "ours", const std::string& their_label = "theirs");
+
+struct TreeMergeOptions {
+    size_t threads = 0;                  // content merges; 0 = hardware concurrency
+    std::string our_label = "HEAD";      // after "<<<<<<< "
+    std::string their_label = "theirs";  // after ">>>>>>> "
+    // Follow a file one side renamed when the other side changed it
+    bool detect_renames = true;
+    RenameOptions renames;
+};
+
+enum class TreeConflictKind {
+    Content,          // overlapping edits, or both sides changed a binary
+    ModifyDelete,     // one side changed what the other deleted
+    FileDirectory,    // a file on one side is a directory on the other
+    Mode,             // both sides changed the file mode differently
+};
+
+struct TreeConflict {
+    std::string path;
+    TreeConflictKind kind = TreeConflictKind::Content;
+    ObjectId base, ours, theirs;   // blobs; null where that side has none
+    std::string content;           // text with conflict markers, for Content
+};
+
+struct TreeMergeResult {
+    ObjectId tree;                        // conflicted paths keep our side
+    std::vector<TreeConflict> conflicts;  // sorted by path
+    std::vector<FileRename> renames;      // followed into the result
+    size_t trees_read = 0;
+    size_t blobs_read = 0;
+    size_t content_merges = 0;            // files both sides changed
+};
+
+// Three-way merge of trees (a null base is the empty tree). The walk reads
+// a directory only when all three sides differ there: a subtree one side
+// left alone is taken whole from the other by its ID, so the cost follows
+// the size of the changes, not of the tree. Files both sides changed are
+// read up front and merged line by line across a worker pool; the merged
+// blobs and trees are written to `objects`. Throws GitException when an
+// object is missing.
+//
+// With rename detection, a file one side changed and the other deleted is
+// looked for among the files the deleting side added. If it was renamed,
+// the changes are merged into the file under its new name. Only these
+// modify/delete paths are rename sources, so a merge without such
+// conflicts does no rename work at all.
+TreeMergeResult merge_trees(ObjectDatabase& objects, const ObjectId& base, const ObjectId& ours,
+                            const ObjectId& theirs, const TreeMergeOptions& options = {});
+
+} // namespace dgit
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "dgit/object.hpp"
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <unordered_map>
+
+namespace dgit {
+
+// Byte-budgeted LRU cache of parsed objects. Entries are shared immutable
+// handles, so a hit costs a reference count rather than a deep copy and
+// evicting an entry never invalidates a handle a caller still holds.
+class ObjectCache {
+public:
+    static constexpr size_t kDefaultLimit = 32 << 20;
+
+    struct Stats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t bytes = 0;
+        size_t entries = 0;
+    };
+
+    explicit ObjectCache(size_t limit = kDefaultLimit) : limit_(limit) {}
+
+    // Returns nullptr on a miss; a hit becomes the most recently used entry
+    std::shared_ptr<const Object> get(const ObjectId& id);
+    bool contains(const ObjectId& id) const { return entries_.count(id) != 0; }
+
+    // Objects larger than the whole budget are not cached
+    void put(std::shared_ptr<const Object> object);
+    void erase(const ObjectId& id);
+    void clear();
+
+    void set_limit(size_t bytes);
+    size_t limit() const { return limit_; }
+    const Stats& stats() const { return stats_; }
+
+    // Rough heap footprint used for the budget
+    static size_t approximate_size(const Object& object);
+
+private:
+    struct Entry {
+        std::shared_ptr<const Object> object;
+        size_t size;
+    };
+
+    void trim();
+
+    std::list<Entry> lru_;
+    std::unordered_map<ObjectId, std::list<Entry>::iterator, ObjectIdHash> entries_;
+    size_t limit_;
+    Stats stats_;
+};
+
+} // namespace dgit
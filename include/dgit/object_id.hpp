@@ -0,0 +1,94 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace dgit {
+
+// Binary SHA-1 object name. Trivially copyable and compared with memcmp;
+// hex only appears when an ID is read from or written to text (refs, commit
+// headers, messages). The all-zero value doubles as "no object".
+class ObjectId {
+public:
+    static constexpr size_t kRawSize = 20;
+    static constexpr size_t kHexSize = 40;
+
+    constexpr ObjectId() : bytes_{} {}
+
+    static ObjectId from_raw(const uint8_t* raw) {
+        ObjectId id;
+        std::memcpy(id.bytes_.data(), raw, kRawSize);
+        return id;
+    }
+
+    // Throws GitException unless `hex` is exactly 40 hex digits
+    static ObjectId from_hex(std::string_view hex);
+
+    // Returns nullopt unless `hex` is exactly 40 hex digits
+    static std::optional<ObjectId> parse_hex(std::string_view hex);
+
+    std::string hex() const;
+    void write_hex(char out[kHexSize]) const;
+
+    // First `length` hex digits, e.g. 7 for log output
+    std::string short_hex(size_t length = 7) const { return hex().substr(0, length); }
+
+    bool is_null() const {
+        static const std::array<uint8_t, kRawSize> zero{};
+        return bytes_ == zero;
+    }
+
+    const uint8_t* data() const { return bytes_.data(); }
+    uint8_t* data() { return bytes_.data(); }
+    uint8_t first_byte() const { return bytes_[0]; }
+
+    int compare(const ObjectId& other) const {
+        return std::memcmp(bytes_.data(), other.bytes_.data(), kRawSize);
+    }
+
+    bool operator==(const ObjectId& other) const { return compare(other) == 0; }
+    bool operator!=(const ObjectId& other) const { return compare(other) != 0; }
+    bool operator<(const ObjectId& other) const { return compare(other) < 0; }
+    bool operator>(const ObjectId& other) const { return compare(other) > 0; }
+    bool operator<=(const ObjectId& other) const { return compare(other) <= 0; }
+    bool operator>=(const ObjectId& other) const { return compare(other) >= 0; }
+
+private:
+    std::array<uint8_t, kRawSize> bytes_;
+};
+
+// SHA-1 output is uniformly distributed, so any eight bytes make a good hash
+struct ObjectIdHash {
+    size_t operator()(const ObjectId& id) const {
+        size_t h;
+        std::memcpy(&h, id.data() + 4, sizeof(h));
+        return h;
+    }
+};
+
+inline std::ostream& operator<<(std::ostream& os, const ObjectId& id) {
+    char hex[ObjectId::kHexSize];
+    id.write_hex(hex);
+    return os.write(hex, sizeof(hex));
+}
+
+// Hex <-> binary for whole IDs; vectorised where the target allows it.
+// decode returns false on any non-hex character.
+void encode_hex_id(const uint8_t raw[ObjectId::kRawSize], char out[ObjectId::kHexSize]);
+bool decode_hex_id(const char hex[ObjectId::kHexSize], uint8_t out[ObjectId::kRawSize]);
+
+} // namespace dgit
+
+namespace std {
+template <>
+struct hash<dgit::ObjectId> : dgit::ObjectIdHash {};
+} // namespace std
+
+static_assert(sizeof(dgit::ObjectId) == dgit::ObjectId::kRawSize, "ObjectId must stay 20 bytes");
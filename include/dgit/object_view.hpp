@@ -0,0 +1,83 @@
+#pragma once
+
+#include "dgit/object.hpp"
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+namespace dgit {
+
+// "<type> <size>\0" in front of a loose object's body
+struct ObjectHeader {
+    ObjectType type;
+    size_t size;
+    size_t body_offset;
+};
+
+// Throws GitException on a malformed header or a size that does not match
+ObjectHeader parse_object_header(std::string_view raw);
+
+// "Name <email> <seconds> [<tz>]" from an author, committer or tagger line
+Person parse_person(std::string_view line);
+
+// Read-only view of a commit body. Only the fixed "tree" line is checked
+// up front; parents, other headers and the message are found on demand,
+// so history walks never touch author lines or messages. The viewed
+// bytes must outlive it.
+class CommitView {
+public:
+    // Throws GitException unless the body starts with a tree line
+    explicit CommitView(std::string_view data);
+
+    ObjectId tree_id() const;
+    std::vector<ObjectId> parents() const;
+    size_t parent_count() const;
+    // Calls fn(ObjectId) per parent without building a vector
+    template <typename Fn>
+    void for_each_parent(Fn&& fn) const {
+        for (size_t pos = kParentsOffset; is_parent_line(pos); pos += kParentLineSize) {
+            fn(parent_at(pos));
+        }
+    }
+
+    // Value of the first header line named `key`; empty if absent
+    std::string_view header(std::string_view key) const;
+    std::string_view author() const { return header("author"); }
+    std::string_view committer() const { return header("committer"); }
+    std::string_view message() const;
+    std::string_view data() const { return data_; }
+
+private:
+    static constexpr size_t kParentsOffset = 5 + ObjectId::kHexSize + 1;      // "tree <hex>\n"
+    static constexpr size_t kParentLineSize = 7 + ObjectId::kHexSize + 1;     // "parent <hex>\n"
+
+    bool is_parent_line(size_t pos) const;
+    ObjectId parent_at(size_t pos) const;
+
+    std::string_view data_;
+};
+
+// Read-only view of an annotated tag body
+class TagView {
+public:
+    // Throws GitException unless the body starts with an object line
+    explicit TagView(std::string_view data);
+
+    ObjectId object_id() const;
+    // Throws GitException on a missing or unknown type
+    ObjectType object_type() const;
+    std::string_view tag_name() const { return header("tag"); }
+    std::string_view tagger() const { return header("tagger"); }
+    std::string_view header(std::string_view key) const;
+    std::string_view message() const;
+
+private:
+    std::string_view data_;
+};
+
+// Name used in object headers ("blob", "tree", ...) and its inverse;
+// the latter throws GitException on anything else
+const char* object_type_name(ObjectType type);
+ObjectType parse_object_type(std::string_view name);
+
+} // namespace dgit
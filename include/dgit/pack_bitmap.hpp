@@ -0,0 +1,78 @@
+#pragma once
+
+#include "dgit/ewah_bitmap.hpp"
+#include "dgit/object.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace dgit {
+
+class ObjectDatabase;
+class PackIndex;
+
+// Reachability bitmaps for one pack, in git's .bitmap format (version 1).
+// Bit i stands for the i-th object of the pack by offset. A selected
+// commit's bitmap holds everything reachable from it, all of it in the
+// pack, plus one bitmap per object type.
+class PackBitmapIndex {
+public:
+    // Returns nullptr when the pack has no .bitmap. Throws GitException on
+    // a malformed file or one written for a different pack.
+    static std::unique_ptr<PackBitmapIndex> open(const std::string& pack_path);
+    ~PackBitmapIndex();
+
+    const std::string& pack_path() const { return pack_path_; }
+    size_t object_count() const { return pack_order_.size(); }
+    size_t bitmap_count() const { return entries_.size(); }
+
+    // Pack-order position of `id`, if the pack has it
+    std::optional<uint32_t> position(const ObjectId& id) const;
+    ObjectId object_id(uint32_t position) const;
+    ObjectType object_type(uint32_t position) const;
+    // ORs the stored bitmap of the commit at `position` into `into`;
+    // false if that commit has none
+    bool or_commit_bitmap(uint32_t position, Bitmap& into) const;
+
+private:
+    static constexpr uint32_t kNoXor = UINT32_MAX;
+
+    struct Entry {
+        uint32_t position;
+        uint32_t xor_with = kNoXor;   // entry this one is XORed against
+        EwahBitmap bitmap;
+    };
+
+    explicit PackBitmapIndex(const std::string& pack_path);
+    void load(const std::string& bitmap_path);
+
+    friend size_t write_pack_bitmap(ObjectDatabase& objects, const std::string& pack_path,
+                                    const std::vector<ObjectId>& tips);
+
+    std::string pack_path_;
+    std::unique_ptr<PackIndex> index_;
+    std::vector<uint32_t> pack_order_;   // pack position -> index position
+    std::vector<uint32_t> positions_;    // index position -> pack position
+    Bitmap types_[4];                    // commits, trees, blobs, tags
+    std::vector<Entry> entries_;
+    std::unordered_map<uint32_t, uint32_t> by_position_;   // pack position -> entry
+};
+
+// Writes <pack>.bitmap next to `pack_path`, with bitmaps for the commits
+// `tips` name and for commits spaced along their history. Returns the
+// number of bitmaps. Throws GitException if anything reachable from the
+// tips is missing from the pack.
+size_t write_pack_bitmap(ObjectDatabase& objects, const std::string& pack_path, const std::vector<ObjectId>& tips);
+
+// Objects reachable from `wants` but not from `haves`, as a pack sent for a
+// fetch or push must hold; haves we do not have are ignored. With a
+// bitmapped pack this ORs stored bitmaps and walks only what they do not
+// cover; otherwise it walks everything.
+std::vector<ObjectId> find_objects_to_send(ObjectDatabase& objects, const std::vector<ObjectId>& wants,
+                                           const std::vector<ObjectId>& haves = {});
+
+} // namespace dgit
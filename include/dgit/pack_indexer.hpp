@@ -0,0 +1,90 @@
+#pragma once
+
+#include "dgit/compression.hpp"
+#include "dgit/object.hpp"
+#include "dgit/packfile.hpp"
+#include "dgit/sha1.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace dgit {
+
+// index-pack for a pack that arrives as a stream. write() appends to a
+// temporary file in the pack directory and parses entries as the bytes
+// come in, so memory holds one entry header and the inflate state, never
+// the pack. finish() checks the trailer, resolves deltas from the file and
+// installs pack-<checksum>.pack and .idx. Deltas are resolved on several
+// threads; the arrival pass only records offsets, CRCs and whole objects.
+class PackIndexer {
+public:
+    explicit PackIndexer(const std::string& pack_dir);
+    // Removes the temporary file unless finish() succeeded
+    ~PackIndexer();
+
+    PackIndexer(const PackIndexer&) = delete;
+    PackIndexer& operator=(const PackIndexer&) = delete;
+
+    // Threads for delta resolution; 0 means one per core
+    void set_threads(size_t threads) { threads_ = threads; }
+    // Also install pack-<checksum>.rev, git's pack-order reverse index
+    void set_write_reverse_index(bool write) { write_reverse_index_ = write; }
+
+    // Throws GitException on malformed input
+    void write(const uint8_t* data, size_t size);
+
+    // Returns the installed pack's path. Throws GitException if the pack is
+    // incomplete, its checksum is wrong or a delta base is missing.
+    std::string finish();
+
+    uint32_t object_count() const { return object_count_; }
+    size_t objects_received() const { return entries_.size(); }
+    uint64_t bytes_received() const { return offset_ + trailer_.size(); }
+
+private:
+    enum class State { Header, EntryHeader, EntryData, Trailer };
+
+    struct Entry {
+        size_t offset = 0;
+        size_t data_offset = 0;
+        size_t size = 0;                 // inflated size from the header
+        PackObjectType pack_type = PackObjectType::Blob;
+        ObjectType type = ObjectType::Blob;   // of the resolved object
+        size_t base_offset = 0;          // OFS_DELTA
+        ObjectId base_id;                // REF_DELTA
+        ObjectId id;
+        uint32_t crc32 = 0;
+        bool resolved = false;
+    };
+
+    size_t consume_header(const uint8_t* data, size_t size);
+    size_t consume_entry_header(const uint8_t* data, size_t size);
+    size_t consume_entry_data(const uint8_t* data, size_t size);
+    size_t consume_trailer(const uint8_t* data, size_t size);
+    void append(const uint8_t* data, size_t size);
+    void resolve_deltas();
+
+    std::string pack_dir_;
+    std::string tmp_path_;
+    std::ofstream file_;
+    SHA1 pack_hash_;
+    State state_ = State::Header;
+    std::string pending_;        // header bytes not yet complete
+    std::string trailer_;
+    uint32_t object_count_ = 0;
+    uint64_t offset_ = 0;
+    std::vector<Entry> entries_;
+    Entry current_;
+    Inflater inflater_;
+    z_stream* stream_ = nullptr;
+    SHA1 object_hash_;           // whole objects are hashed while inflating
+    size_t inflated_ = 0;
+    std::string scratch_;
+    size_t threads_ = 0;
+    bool write_reverse_index_ = false;
+    bool installed_ = false;
+};
+
+} // namespace dgit
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "dgit/mapped_file.hpp"
+#include "dgit/object_id.hpp"
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dgit {
+
+struct RefRecord {
+    std::string name;
+    ObjectId id;
+    std::optional<ObjectId> peeled;   // what an annotated tag points at
+};
+
+// Git's packed-refs file: a "# pack-refs with: <traits>" header, then one
+// "<hex> <refname>" line per ref, each annotated tag followed by a
+// "^<hex>" line giving the object it peels to. A file with the "sorted"
+// trait is binary-searched in place through its mapping, so a lookup
+// touches a few pages however many refs there are; an older unsorted file
+// is sorted into memory once.
+class PackedRefs {
+public:
+    // No refs when the file does not exist. Throws GitException if the
+    // header is malformed.
+    explicit PackedRefs(const std::string& path);
+
+    // Throws GitException on a malformed record
+    std::optional<RefRecord> find(std::string_view name) const;
+    // Refs whose names start with `prefix`, in name order
+    void for_each(std::string_view prefix, const std::function<void(const RefRecord&)>& fn) const;
+
+    // Every annotated tag has its peeled line ("fully-peeled")
+    bool fully_peeled() const { return fully_peeled_; }
+    // The file has been replaced or removed since it was read
+    bool stale() const;
+
+private:
+    // Byte offsets into the mapping; records span [body_, end)
+    size_t line_end(size_t pos) const;
+    size_t record_start(size_t pos) const;
+    size_t record_end(size_t pos) const;
+    std::string_view record_name(size_t pos) const;
+    RefRecord parse_record(size_t pos) const;
+    // First record whose name is not less than `name`
+    size_t lower_bound(std::string_view name) const;
+
+    std::string path_;
+    MappedFile file_;
+    size_t body_ = 0;
+    bool sorted_ = false;
+    bool fully_peeled_ = false;
+    std::vector<RefRecord> unsorted_;   // an unsorted file, sorted by name
+    // Identity of the file read, to notice it being replaced
+    bool exists_ = false;
+    uint64_t inode_ = 0;
+    uint64_t size_ = 0;
+    int64_t mtime_ns_ = 0;
+};
+
+// packed-refs.lock, held from before the refs to write are read until
+// commit() renames it over packed-refs, so concurrent writers fail instead
+// of losing each other's refs. Destroying an uncommitted lock removes it.
+class PackedRefsLock {
+public:
+    // Throws GitException if another process holds the lock
+    explicit PackedRefsLock(const std::string& path);
+    ~PackedRefsLock();
+
+    PackedRefsLock(const PackedRefsLock&) = delete;
+    PackedRefsLock& operator=(const PackedRefsLock&) = delete;
+
+    // Writes `refs` sorted, with peeled lines, and installs the file
+    void commit(std::vector<RefRecord> refs);
+
+private:
+    std::string path_;
+    std::string lock_path_;
+    int fd_ = -1;
+};
+
+} // namespace dgit
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+namespace dgit {
+
+// Git's pkt-line framing: four hex digits giving the length including
+// themselves, then the payload. "0000" is a flush packet; protocol v2
+// adds "0001" (delimiter) and "0002" (end of response).
+namespace pkt_line {
+constexpr size_t kMaxPacket = 65520;
+constexpr size_t kMaxPayload = kMaxPacket - 4;
+
+// Throws GitException if the payload does not fit in one packet
+void append(std::string& out, std::string_view payload);
+void append_flush(std::string& out);
+void append_delim(std::string& out);
+}
+
+// Incremental pkt-line parser. feed() takes bytes in whatever chunks the
+// transport delivers; only a packet split across chunks is copied.
+class PktLineReader {
+public:
+    enum class Kind { Data, Flush, Delim, ResponseEnd };
+    using Handler = std::function<void(Kind kind, std::string_view payload)>;
+
+    explicit PktLineReader(Handler handler) : handler_(std::move(handler)) {}
+
+    // Throws GitException on a malformed length
+    void feed(const uint8_t* data, size_t size);
+    // True when no partial packet is buffered
+    bool idle() const { return partial_.empty(); }
+
+private:
+    // Length of the packet at `data`, 0 while fewer than 4 bytes are there
+    size_t packet_length(const char* data, size_t size) const;
+    void dispatch(const char* packet, size_t length);
+
+    Handler handler_;
+    std::string partial_;
+};
+
+// Finds the end of a reply whose packets are passed on unparsed: its first
+// flush packet. Lengths are followed across reads, so a header or payload
+// may be split anywhere.
+class FlushScanner {
+public:
+    // Bytes of `data` up to and including the flush, or all of them.
+    // Throws GitException on a malformed length.
+    size_t feed(const uint8_t* data, size_t size);
+    bool done() const { return done_; }
+
+private:
+    std::string header_;
+    size_t remaining_ = 0;
+    bool done_ = false;
+};
+
+// Splits side-band payloads: band 1 carries the pack, band 2 progress text
+// and band 3 a fatal error from the remote.
+class SidebandDemuxer {
+public:
+    using DataSink = std::function<void(const uint8_t* data, size_t size)>;
+    using ProgressFn = std::function<void(const std::string& line)>;
+
+    SidebandDemuxer(DataSink pack, ProgressFn progress) : pack_(std::move(pack)), progress_(std::move(progress)) {}
+
+    // Throws GitException for band 3 or an unknown band
+    void packet(std::string_view payload);
+
+private:
+    DataSink pack_;
+    ProgressFn progress_;
+    std::string progress_line_;   // progress text up to its \r or \n
+};
+
+} // namespace dgit
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+namespace dgit {
+
+// Single-quotes `arg` for a POSIX shell the way git does: each ' and !
+// closes the quotes, is backslash-escaped and reopens them, so the result
+// is one word to sh and to csh-like login shells alike
+std::string shell_quote(const std::string& arg);
+
+} // namespace dgit
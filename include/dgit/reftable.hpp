@@ -0,0 +1,113 @@
+#pragma once
+
+#include "dgit/object_id.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dgit {
+
+// A ref as a reftable stores it. Deletions are tombstones that hide the
+// ref in older tables until compaction drops them.
+struct ReftableRef {
+    enum class Type : uint8_t { Deletion = 0, Value = 1, Peeled = 2, Symref = 3 };
+
+    std::string name;
+    Type type = Type::Value;
+    uint64_t update_index = 0;
+    ObjectId value;
+    ObjectId peeled;      // Peeled only
+    std::string target;   // Symref only
+};
+
+// One reflog entry, stored in the same table as the ref change it records
+struct ReftableLog {
+    std::string name;
+    uint64_t update_index = 0;
+    ObjectId old_id;
+    ObjectId new_id;
+    std::string committer_name;
+    std::string email;
+    uint64_t time = 0;
+    int16_t tz_offset = 0;   // minutes east of UTC
+    std::string message;
+};
+
+class ReftableTable;
+
+// Git's reftable ref storage: $GIT_DIR/reftable/tables.list names a stack
+// of immutable tables, oldest first, and a ref's value is its record in
+// the newest table that has one. Each table holds sorted, prefix-compressed
+// ref and log blocks with restart points for binary search, so an update
+// writes one small table instead of rewriting anything, and tables are
+// merged geometrically so the stack stays O(log n) deep.
+class ReftableStack {
+public:
+    static constexpr uint32_t kDefaultBlockSize = 4096;
+
+    // Creates the directory and an empty tables.list when missing. Throws
+    // GitException on an unreadable table.
+    explicit ReftableStack(const std::string& dir);
+    ~ReftableStack();
+
+    ReftableStack(const ReftableStack&) = delete;
+    ReftableStack& operator=(const ReftableStack&) = delete;
+
+    // nullopt for a ref that is missing or deleted
+    std::optional<ReftableRef> read(std::string_view name);
+    // Live refs whose names start with `prefix`, in name order
+    std::vector<ReftableRef> list(std::string_view prefix);
+    // Reflog of `name`, newest first
+    std::vector<ReftableLog> logs(std::string_view name);
+
+    // Batched update: `build` runs with tables.list locked and the stack
+    // re-read, gets the update index to stamp on its records and fills in
+    // refs and logs. They are written as one table, fsynced once and added
+    // to the stack with a rename, so readers see all of them or none. An
+    // exception from `build` leaves the stack unchanged.
+    using BuildFn =
+        std::function<void(uint64_t update_index, std::vector<ReftableRef>& refs, std::vector<ReftableLog>& logs)>;
+    void transact(const BuildFn& build);
+
+    // Merges every table into one, dropping deletions
+    void compact_all();
+    // Merge tables after each transaction while a table is not at least
+    // twice the size of all newer ones together (the default)
+    void set_auto_compact(bool enabled) { auto_compact_ = enabled; }
+
+    size_t table_count();
+
+    // Runs each time tables.list has been read and before its tables are
+    // opened, so tests can race another writer against a reload
+    void set_reload_hook(std::function<void()> hook) { reload_hook_ = std::move(hook); }
+
+private:
+    void reload();
+    void reload_if_changed();
+    // The update index the next table starts at
+    uint64_t next_update_index() const;
+    // Merges tables [first, last] into one; tables.list must be locked
+    std::vector<std::string> compact_range(size_t first, size_t last);
+    void auto_compact();
+    // Writes and fsyncs a table, returning its file name
+    std::string write_table(uint64_t min_index, uint64_t max_index, std::vector<ReftableRef> refs,
+                            std::vector<ReftableLog> logs);
+
+    std::string dir_;
+    std::string list_path_;
+    std::vector<std::string> names_;
+    std::vector<std::shared_ptr<ReftableTable>> tables_;
+    bool auto_compact_ = true;
+    std::function<void()> reload_hook_;
+    // Identity of the tables.list read
+    uint64_t list_inode_ = 0;
+    uint64_t list_size_ = 0;
+    int64_t list_mtime_ns_ = -1;
+};
+
+} // namespace dgit
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "dgit/object.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dgit {
+
+class ObjectDatabase;
+
+struct DiffFile {
+    std::string path;
+    FileMode mode = FileMode::Regular;
+    ObjectId id;
+};
+
+// Files that differ between two trees, each list sorted by path
+struct TreeDiff {
+    std::vector<DiffFile> deleted;    // old side only
+    std::vector<DiffFile> added;      // new side only
+    std::vector<DiffFile> modified;   // old side of files changed in place
+    size_t trees_read = 0;
+};
+
+// Subtrees with the same ID on both sides are skipped without being read.
+// A null tree is the empty tree. Throws GitException on a missing tree.
+TreeDiff diff_trees(ObjectDatabase& objects, const ObjectId& old_tree, const ObjectId& new_tree);
+
+// Git's similarity fingerprint (diffcore-delta): the content cut into spans
+// at each newline or after 64 bytes, each span hashed, with the bytes per
+// hash kept as two sorted arrays. Comparing two is one merge pass, so a
+// blob is read and cut once however many candidates it is scored against.
+class SimilaritySignature {
+public:
+    SimilaritySignature() = default;
+    explicit SimilaritySignature(std::string_view data);
+
+    size_t size() const { return size_; }
+    // Bytes of this content that `other` has too, span hash by span hash
+    size_t common_bytes(const SimilaritySignature& other) const;
+
+private:
+    std::vector<uint32_t> hashes_;
+    std::vector<uint32_t> counts_;
+    size_t size_ = 0;
+};
+
+struct RenameOptions {
+    // Inexact detection is skipped when sources x targets exceeds the
+    // square of this (merge.renameLimit, git's default)
+    size_t limit = 7000;
+    int min_score = 50;      // percent of the larger file found in the other
+    bool copies = false;     // modified files are copy sources too
+    size_t threads = 0;      // scoring; 0 = hardware concurrency
+};
+
+struct FileRename {
+    DiffFile source;
+    DiffFile target;
+    int score = 100;    // percent similarity
+    bool copy = false;
+};
+
+struct RenameResult {
+    std::vector<FileRename> renames;   // sorted by target path
+    size_t exact = 0;                  // paired by object ID alone
+    size_t pairs_scored = 0;
+    size_t blobs_read = 0;
+    bool limit_exceeded = false;       // inexact detection was skipped
+};
+
+// Pairs the deleted files of `diff` with its added ones. Identical
+// content is paired first through a hash map of object IDs, so pure moves
+// cost nothing per pair. What is left is scored all against all across a
+// worker pool, with a size check ruling out most pairs before their
+// signatures are compared, and assigned best score first. Each deleted
+// file is renamed at most once; with copies, the modified files and the
+// deleted files already used are also copy sources.
+RenameResult find_renames(ObjectDatabase& objects, const TreeDiff& diff, const RenameOptions& options = {});
+
+} // namespace dgit
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dgit {
+namespace sha1_kernels {
+
+// Compresses `blocks` consecutive 64-byte blocks into the five-word state.
+// The input does not need any particular alignment.
+using CompressFn = void (*)(uint32_t state[5], const uint8_t* data, size_t blocks);
+
+struct Kernel {
+    const char* name;
+    CompressFn compress;
+};
+
+// Portable scalar implementation; always available
+void compress_generic(uint32_t state[5], const uint8_t* data, size_t blocks);
+
+// Kernels supported by the running CPU, fastest first. The last entry is
+// always the generic kernel.
+const std::vector<Kernel>& available();
+
+// Kernel used by SHA1; picked once on first use
+const Kernel& active();
+
+// Multi-buffer hashing: kLanes independent messages advance one block per
+// call in lock-step, using whatever vector width the CPU offers. This pays
+// off for many small inputs on CPUs without SHA instructions.
+constexpr size_t kLanes = 8;
+
+struct LaneState {
+    uint32_t h[5][kLanes];   // word-major so each row is one vector
+};
+
+// Sets lane `lane` back to the SHA-1 initial value
+void reset_lane(LaneState& state, size_t lane);
+
+// Compresses one 64-byte block per lane. Every pointer must be valid; feed a
+// dummy block to idle lanes and ignore their state.
+void compress_lanes(LaneState& state, const uint8_t* const blocks[kLanes]);
+
+// Whether compress_lanes beats running the active single-buffer kernel on
+// each message in turn
+bool lanes_preferred();
+
+} // namespace sha1_kernels
+} // namespace dgit
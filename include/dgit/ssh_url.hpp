@@ -0,0 +1,21 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+namespace dgit {
+
+// Where an ssh:// or scp-like remote lives
+struct SshUrl {
+    std::string user;   // empty: from ssh config, else the login name
+    std::string host;   // without the brackets of [IPv6]
+    int port = 0;       // 0: from ssh config, else 22
+    std::string path;   // "~user/..." for paths relative to a home directory
+};
+
+// Parses ssh://[user@]host[:port]/path and scp-like [user@]host:path.
+// std::nullopt when `url` is in neither form or names no path; throws
+// GitException for an empty host or a port outside 1..65535.
+std::optional<SshUrl> parse_ssh_url(const std::string& url);
+
+} // namespace dgit
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "dgit/fsmonitor.hpp"
+#include "dgit/index.hpp"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace dgit {
+
+struct StatusOptions {
+    size_t threads = 0;                // 0 = hardware concurrency
+    bool untracked = true;             // also look for untracked files
+    FsMonitor* fsmonitor = nullptr;    // limit the checks to reported paths
+};
+
+// Working tree compared against the index. Paths are sorted and relative
+// to the work tree.
+struct WorktreeStatus {
+    std::vector<std::string> modified;
+    std::vector<std::string> deleted;
+    std::vector<std::string> untracked;
+    size_t checked = 0;        // entries stat'ed
+    size_t rehashed = 0;       // entries whose stat data could not decide
+};
+
+// Stats every index entry across a worker pool, relative to one open
+// directory per run of entries sharing a directory. Only entries whose
+// cached stat data is inconclusive (racily clean, smudged, or changed in
+// ways that need not mean new content) are hashed again.
+//
+// With a file system monitor whose token the index holds, only entries
+// under reported paths (plus those dirty last time) are stat'ed at all.
+// The index's monitor token and untracked cache are refreshed in memory;
+// Index::save_caches() persists them.
+WorktreeStatus compute_status(Index& index, const std::string& worktree = ".",
+                              const StatusOptions& options = {});
+
+// Files and symlinks under the work tree (outside .git) with no index
+// entry. Uses the index's untracked cache when enabled, otherwise one
+// directory walk with a hash-set lookup per path. trust_cache skips the
+// directory stat checks, for callers that invalidated from a monitor.
+std::vector<std::string> find_untracked_files(Index& index, const std::string& worktree = ".",
+                                              bool trust_cache = false);
+
+} // namespace dgit
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+namespace dgit {
+
+// Hardware concurrency, never less than one
+size_t default_threads();
+
+// Runs fn(i) for every i in [0, count) on up to `threads` threads (0 means
+// default_threads()). Indices are handed out dynamically so uneven work
+// balances itself. The first exception is rethrown on the calling thread.
+void parallel_for(size_t count, size_t threads, const std::function<void(size_t)>& fn);
+
+} // namespace dgit
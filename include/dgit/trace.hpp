@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace dgit {
+
+enum class TraceCounter : uint8_t {
+    ObjectLoads,          // objects read from the database, cached or not
+    ObjectCacheHits,
+    PackLookups,          // pack index searches for an object
+    BytesInflated,        // zlib output
+    BytesDeflated,        // zlib input
+    StatCalls,            // lstat() of work tree paths
+    NetworkBytesRead,
+    NetworkBytesWritten,
+};
+
+constexpr size_t kTraceCounterCount = 8;
+using TraceCounts = std::array<uint64_t, kTraceCounterCount>;
+
+// Performance tracing in the spirit of git's trace2. Counters live in one
+// block per thread, written by that thread alone without atomics
+// read-modify-write, and are summed when read; a thread's block is folded
+// into a shared total when it ends. Regions time a scope on
+// the current thread. Everything is a relaxed load and a branch while
+// tracing is off.
+//
+// DGIT_TRACE2_PERF selects the target: "1", "2" or "true" for stderr, an
+// absolute path to append to that file. Each event is one JSON object per
+// line (start, region_leave, counter, exit), so several processes can
+// share one file and it feeds jq or a trace converter as it is.
+class Trace2 {
+public:
+    // Reads DGIT_TRACE2_PERF; does nothing when it is unset or not a target
+    static void start_from_environment(int argc, char** argv);
+    // Counting without output, for benchmarks that read totals()
+    static void enable_counters();
+    // Writes the counter totals and the exit event, then closes the target
+    static void finish(int exit_code);
+
+    static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+    static bool emitting() { return emitting_.load(std::memory_order_relaxed); }
+
+    static void count(TraceCounter counter, uint64_t n = 1) {
+        if (enabled()) {
+            add(counter, n);
+        }
+    }
+
+    // Summed over every thread that has counted so far
+    static TraceCounts totals();
+    static const char* category(TraceCounter counter);
+    static const char* name(TraceCounter counter);
+
+private:
+    friend class TraceRegion;
+
+    static void add(TraceCounter counter, uint64_t n);
+    static void region_leave(const char* category, const char* label, std::chrono::steady_clock::time_point start);
+
+    static std::atomic<bool> enabled_;
+    static std::atomic<bool> emitting_;
+};
+
+// Times its scope as a region_leave event. Both strings must outlive it.
+class TraceRegion {
+public:
+    TraceRegion(const char* category, const char* label)
+        : category_(category), label_(label), active_(Trace2::emitting()) {
+        if (active_) {
+            enter();
+        }
+    }
+    ~TraceRegion() {
+        if (active_) {
+            Trace2::region_leave(category_, label_, start_);
+        }
+    }
+
+    TraceRegion(const TraceRegion&) = delete;
+    TraceRegion& operator=(const TraceRegion&) = delete;
+
+private:
+    void enter();
+
+    const char* category_;
+    const char* label_;
+    bool active_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace dgit
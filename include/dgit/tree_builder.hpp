@@ -0,0 +1,33 @@
+#pragma once
+
+#include "dgit/object.hpp"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dgit {
+
+// Git's tree order: names compare bytewise as if directories ended in '/',
+// so "a.txt" sorts before the directory "a" and "a-b" before "a/"
+bool tree_entry_less(std::string_view a, bool a_is_dir, std::string_view b, bool b_is_dir);
+
+// Collects the entries of one tree, then sorts, serializes and hashes them
+// once. Tree::add_entry does all three per call.
+class TreeBuilder {
+public:
+    void reserve(size_t count) { entries_.reserve(count); }
+    void add(FileMode mode, const ObjectId& id, std::string name);
+
+    size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    // Leaves the builder empty. Throws GitException on a duplicate name.
+    std::unique_ptr<Tree> build();
+
+private:
+    std::vector<TreeEntry> entries_;
+};
+
+} // namespace dgit
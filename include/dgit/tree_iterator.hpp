@@ -0,0 +1,66 @@
+#pragma once
+
+#include "dgit/object.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string_view>
+
+namespace dgit {
+
+// One entry of a serialized tree. Points into the tree's bytes, so it is
+// only valid while they are.
+struct TreeEntryView {
+    FileMode mode = FileMode::Regular;
+    std::string_view name;
+    const uint8_t* raw_id = nullptr;
+
+    ObjectId id() const { return ObjectId::from_raw(raw_id); }
+    bool is_directory() const { return mode == FileMode::Directory; }
+};
+
+// Forward iterator over "<octal mode> <name>\0<20-byte id>" records.
+// Advancing past a malformed record throws GitException.
+class TreeIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = TreeEntryView;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const TreeEntryView*;
+    using reference = const TreeEntryView&;
+
+    TreeIterator() = default;
+    TreeIterator(const char* data, const char* end);
+
+    reference operator*() const { return entry_; }
+    pointer operator->() const { return &entry_; }
+    TreeIterator& operator++();
+
+    bool operator==(const TreeIterator& other) const { return pos_ == other.pos_; }
+    bool operator!=(const TreeIterator& other) const { return pos_ != other.pos_; }
+
+private:
+    void parse();
+
+    const char* pos_ = nullptr;    // start of the current record; end_ when done
+    const char* next_ = nullptr;   // start of the following record
+    const char* end_ = nullptr;
+    TreeEntryView entry_;
+};
+
+// Range over the entries of raw tree bytes, without copying them
+class TreeView {
+public:
+    TreeView(const char* data, size_t size) : data_(data), size_(size) {}
+    explicit TreeView(std::string_view data) : data_(data.data()), size_(data.size()) {}
+
+    TreeIterator begin() const { return TreeIterator(data_, data_ + size_); }
+    TreeIterator end() const { return TreeIterator(data_ + size_, data_ + size_); }
+    bool empty() const { return size_ == 0; }
+
+private:
+    const char* data_;
+    size_t size_;
+};
+
+} // namespace dgit
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "dgit/index.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dgit {
+
+// Per-directory memo of the untracked walk, persisted as an index
+// extension. A directory's listing can only change when its own mtime
+// does, so directories whose stat data still matches are not read again;
+// their untracked names and subdirectories come from the cache.
+class UntrackedCache {
+public:
+    struct Directory {
+        IndexStat stat;
+        std::vector<std::string> untracked;   // file and symlink names
+        std::vector<std::string> subdirs;     // directory names, minus .git
+    };
+
+    struct ScanStats {
+        size_t directories_read = 0;
+        size_t directories_reused = 0;
+    };
+
+    // Untracked paths under `worktree`, sorted. With trust_unchanged the
+    // cached directories are used without even an lstat(), for callers
+    // that invalidate from a file system monitor.
+    std::vector<std::string> scan(const std::string& worktree, const std::function<bool(std::string_view)>& is_tracked,
+                                  bool trust_unchanged = false, ScanStats* stats = nullptr);
+
+    // Forget the directory holding `path`, after the index starts or
+    // stops tracking it
+    void invalidate(std::string_view path);
+    // Forget `path` (should it be a directory) and every directory above
+    // it, for a change reported by a monitor: a new subdirectory has to
+    // show up in its parent's cached listing
+    void invalidate_with_parents(std::string_view path);
+
+    void clear();
+    bool empty() const { return dirs_.empty(); }
+    bool changed() const { return changed_; }
+    void mark_saved() { changed_ = false; }
+
+    // Keyed by path relative to the work tree; "" is the root
+    const std::map<std::string, Directory, std::less<>>& directories() const { return dirs_; }
+    void restore(std::string path, Directory dir);
+
+private:
+    void erase_directory(std::string_view dir);
+    void scan_directory(const std::string& worktree, const std::string& path, const std::function<bool(std::string_view)>& is_tracked,
+                        bool trust_unchanged, int64_t recent_sec, std::vector<std::string>& out, ScanStats& stats,
+                        std::map<std::string, Directory, std::less<>>& next);
+
+    std::map<std::string, Directory, std::less<>> dirs_;
+    bool changed_ = false;
+};
+
+} // namespace dgit
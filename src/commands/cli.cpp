@@ -1,4 +1,5 @@
 #include "dgit/commands.hpp"
+#include "dgit/trace.hpp"
 #include <iostream>
 #include <algorithm>
 
@@ -25,6 +26,9 @@ void CLI::register_commands() {
     commands_["pack"] = std::make_unique<PackCommand>();
     commands_["repack"] = std::make_unique<RepackCommand>();
     commands_["gc"] = std::make_unique<GarbageCollectCommand>();
+    commands_["commit-graph"] = std::make_unique<CommitGraphCommand>();
+    commands_["merge-base"] = std::make_unique<MergeBaseCommand>();
+    commands_["pack-refs"] = std::make_unique<PackRefsCommand>();
 }
 
 int CLI::run(int argc, char* argv[]) {
@@ -75,6 +79,7 @@ CommandResult CLI::dispatch_command(const std::string& command_name, const std::
         return {1, "", "Unknown command: " + command_name + "\n"};
     }
 
+    TraceRegion region("cmd", command_name.c_str());
     return it->second->execute(args);
 }
 
@@ -6,15 +6,32 @@
 #include <fstream>
 #include <memory>
 #include "dgit/network.hpp"
+#include "dgit/commit_graph.hpp"
 #include "dgit/merge.hpp"
+#include "dgit/merge_base.hpp"
+#include "dgit/pack_bitmap.hpp"
+#include "dgit/object_view.hpp"
 #include "dgit/packfile.hpp"
 #include "dgit/sha1.hpp"
+#include "dgit/status.hpp"
 
 namespace dgit {
 
 // InitCommand implementation
 CommandResult InitCommand::execute(const std::vector<std::string>& args) {
-    std::string path = args.empty() ? "." : args[0];
+    std::string path = ".";
+    bool reftable = false;
+    for (const auto& arg : args) {
+        if (arg.rfind("--ref-format=", 0) == 0) {
+            std::string format = arg.substr(13);
+            if (format != "files" && format != "reftable") {
+                return {1, "", "Error: unknown ref storage format '" + format + "'\n"};
+            }
+            reftable = format == "reftable";
+        } else {
+            path = arg;
+        }
+    }
 
     try {
         // For now, just create the directory structure manually
@@ -34,15 +51,24 @@ CommandResult InitCommand::execute(const std::vector<std::string>& args) {
         std::ofstream config_file(git_dir + "/config");
         if (config_file) {
             config_file << "[core]\n";
-            config_file << "\trepositoryformatversion = 0\n";
+            // Extensions need format version 1 so older tools refuse the repo
+            config_file << "\trepositoryformatversion = " << (reftable ? 1 : 0) << "\n";
             config_file << "\tfilemode = false\n";
             config_file << "\tbare = false\n";
+            if (reftable) {
+                config_file << "[extensions]\n";
+                config_file << "\trefStorage = reftable\n";
+            }
         }
 
-        // Create initial master ref file
-        std::ofstream master_ref(git_dir + "/refs/heads/master");
-        if (master_ref) {
-            master_ref << "";
+        // Create initial master ref
+        if (reftable) {
+            Refs(git_dir, RefStorage::Reftable).create_ref("refs/heads/master", ObjectId());
+        } else {
+            std::ofstream master_ref(git_dir + "/refs/heads/master");
+            if (master_ref) {
+                master_ref << "";
+            }
         }
 
         return {0, "Initialized empty Git repository in " + git_dir + "\n", ""};
@@ -60,14 +86,31 @@ CommandResult AddCommand::execute(const std::vector<std::string>& args) {
     try {
         auto repo = Repository::open(".");
 
-        for (const auto& filepath : args) {
-            repo->index().add_file(filepath);
+        // Expand directories so the whole set is hashed in one batch
+        std::vector<std::string> files;
+        for (const auto& arg : args) {
+            if (!std::filesystem::is_directory(arg)) {
+                files.push_back(arg);
+                continue;
+            }
+
+            auto it = std::filesystem::recursive_directory_iterator(arg);
+            for (; it != std::filesystem::recursive_directory_iterator(); ++it) {
+                if (it->path().filename() == ".git") {
+                    it.disable_recursion_pending();
+                    continue;
+                }
+                if (it->is_regular_file()) {
+                    files.push_back(it->path().lexically_normal().string());
+                }
+            }
         }
 
+        repo->index().add_files(files);
         repo->index().save();
 
         std::ostringstream oss;
-        oss << "Added " << args.size() << " file(s) to staging area\n";
+        oss << "Added " << files.size() << " file(s) to staging area\n";
         return {0, oss.str(), ""};
     } catch (const GitException& e) {
         return {1, "", "Error: " + std::string(e.what()) + "\n"};
@@ -124,7 +167,7 @@ CommandResult StatusCommand::execute(const std::vector<std::string>& args) {
         }
 
         // Staged changes
-        auto staged = repo->index().get_staged_files();
+        auto staged = repo->staged_files();
         if (!staged.empty()) {
             oss << "Changes to be committed:\n";
             for (const auto& file : staged) {
@@ -133,18 +176,24 @@ CommandResult StatusCommand::execute(const std::vector<std::string>& args) {
             oss << "\n";
         }
 
-        // Modified files
-        auto modified = repo->index().get_modified_files();
-        if (!modified.empty()) {
+        // One pass over the work tree for both modified and untracked files
+        StatusOptions status_options;
+        status_options.fsmonitor = repo->fsmonitor();
+        WorktreeStatus worktree = compute_status(repo->index(), ".", status_options);
+        repo->index().save_caches();
+        if (!worktree.modified.empty() || !worktree.deleted.empty()) {
             oss << "Changes not staged for commit:\n";
-            for (const auto& file : modified) {
-                oss << "  " << file << "\n";
+            for (const auto& file : worktree.modified) {
+                oss << "  modified: " << file << "\n";
+            }
+            for (const auto& file : worktree.deleted) {
+                oss << "  deleted:  " << file << "\n";
             }
             oss << "\n";
         }
 
         // Untracked files
-        auto untracked = repo->index().get_untracked_files();
+        const auto& untracked = worktree.untracked;
         if (!untracked.empty()) {
             oss << "Untracked files:\n";
             for (const auto& file : untracked) {
@@ -153,7 +202,7 @@ CommandResult StatusCommand::execute(const std::vector<std::string>& args) {
             oss << "\n";
         }
 
-        if (staged.empty() && modified.empty() && untracked.empty()) {
+        if (staged.empty() && worktree.modified.empty() && worktree.deleted.empty() && untracked.empty()) {
             oss << "nothing to commit, working tree clean\n";
         }
 
@@ -180,23 +229,23 @@ CommandResult LogCommand::execute(const std::vector<std::string>& args) {
         }
 
         int commits_shown = 0;
-        while (!commit_id.empty() && commits_shown < count) {
-            auto commit = repo->objects().load(commit_id);
-            if (commit->type() != ObjectType::Commit) {
+        while (!commit_id.is_null() && commits_shown < count) {
+            // Read the commit in place; only the lines shown get parsed
+            auto raw = repo->objects().read_raw(commit_id);
+            if (!raw || raw->type != ObjectType::Commit) {
                 break;
             }
+            CommitView commit(raw->data);
+            Person author = parse_person(commit.author());
 
-            // Cast to Commit
-            const Commit* commit_obj = static_cast<const Commit*>(commit.get());
-
-            oss << "commit " << commit_id.substr(0, 7) << "\n";
-            oss << "Author: " << commit_obj->author().name << " <" << commit_obj->author().email << ">\n";
+            oss << "commit " << commit_id.short_hex() << "\n";
+            oss << "Author: " << author.name << " <" << author.email << ">\n";
             oss << "Date: " << std::chrono::duration_cast<std::chrono::seconds>(
-                commit_obj->author().when.time_since_epoch()).count() << "\n\n";
-            oss << "    " << commit_obj->message() << "\n\n";
+                author.when.time_since_epoch()).count() << "\n\n";
+            oss << "    " << commit.message() << "\n\n";
 
             // Get parent
-            auto parents = commit_obj->parent_ids();
+            auto parents = commit.parents();
             if (parents.empty()) {
                 break;
             }
@@ -271,10 +320,10 @@ CommandResult CheckoutCommand::execute(const std::vector<std::string>& args) {
         auto repo = Repository::open(".");
 
         std::string branch_name = args[0];
-        ObjectId commit_id = repo->refs().resolve_ref("refs/heads/" + branch_name);
+        repo->refs().resolve_ref("refs/heads/" + branch_name); // throws if the branch is missing
 
-        // Update HEAD
-        repo->refs().set_head_to_branch(branch_name);
+        // Updates the work tree and index, then HEAD
+        BranchManager(*repo).checkout_branch(branch_name);
 
         std::ostringstream oss;
         oss << "Switched to branch " << branch_name << "\n";
@@ -430,29 +479,50 @@ CommandResult FetchCommand::execute(const std::vector<std::string>& args) {
 
         std::string remote_name = "origin";
         std::string branch_name = "master";
+        std::string filter;
+        bool all = false;
 
         // Parse arguments
-        if (!args.empty()) {
-            remote_name = args[0];
+        for (const auto& arg : args) {
+            if (arg.compare(0, 9, "--filter=") == 0) {
+                filter = arg.substr(9);
+            } else if (arg == "--all") {
+                all = true;
+            } else {
+                remote_name = arg;
+            }
         }
 
-        // Get remote URL
-        std::string remote_url = repo->config().get_string("remote", remote_name, "");
-        if (remote_url.empty()) {
-            return {1, "", "Error: Remote '" + remote_name + "' not found\n"};
+        // remote.<name> holds the URL; remote.<name>.<key> are its settings
+        std::vector<std::pair<std::string, std::string>> remotes;
+        if (all) {
+            for (const auto& entry : repo->config().get_entries("remote")) {
+                if (entry.first.find('.') == std::string::npos) {
+                    remotes.push_back(entry);
+                }
+            }
+        } else {
+            std::string remote_url = repo->config().get_string("remote", remote_name, "");
+            if (remote_url.empty()) {
+                return {1, "", "Error: Remote '" + remote_name + "' not found\n"};
+            }
+            remotes.emplace_back(remote_name, remote_url);
         }
 
-        // Create remote and fetch
-        Remote remote(*repo, remote_name);
-        remote.set_url(remote_url);
-
-        if (remote.fetch(branch_name)) {
-            std::ostringstream oss;
-            oss << "Fetched from " << remote_name << "\n";
-            return {0, oss.str(), ""};
-        } else {
-            return {1, "", "Error: Fetch failed\n"};
+        // Remotes on the same SSH host share one connection
+        std::ostringstream oss;
+        for (const auto& [name, url] : remotes) {
+            Remote remote(*repo, name);
+            remote.set_url(url);
+            if (!filter.empty()) {
+                remote.set_filter(filter);
+            }
+            if (!remote.fetch(branch_name)) {
+                return {1, oss.str(), "Error: Fetch from " + name + " failed\n"};
+            }
+            oss << "Fetched from " << name << "\n";
         }
+        return {0, oss.str(), ""};
     } catch (const GitException& e) {
         return {1, "", "Error: " + std::string(e.what()) + "\n"};
     }
@@ -460,12 +530,22 @@ CommandResult FetchCommand::execute(const std::vector<std::string>& args) {
 
 // CloneCommand implementation
 CommandResult CloneCommand::execute(const std::vector<std::string>& args) {
-    if (args.size() < 2) {
+    // --filter=blob:none or tree:0 makes a partial clone
+    std::string filter;
+    std::vector<std::string> positional;
+    for (const auto& arg : args) {
+        if (arg.compare(0, 9, "--filter=") == 0) {
+            filter = arg.substr(9);
+        } else {
+            positional.push_back(arg);
+        }
+    }
+    if (positional.size() < 2) {
         return {1, "", "Error: clone requires source and destination arguments\n"};
     }
 
-    std::string source_url = args[0];
-    std::string dest_path = args[1];
+    std::string source_url = positional[0];
+    std::string dest_path = positional[1];
 
     try {
         // Create destination directory
@@ -481,6 +561,9 @@ CommandResult CloneCommand::execute(const std::vector<std::string>& args) {
         // Create remote object and fetch
         Remote remote(*repo, "origin");
         remote.set_url(source_url);
+        if (!filter.empty()) {
+            remote.set_filter(filter);
+        }
 
         if (remote.fetch("master")) {
             std::ostringstream oss;
@@ -496,29 +579,75 @@ CommandResult CloneCommand::execute(const std::vector<std::string>& args) {
 
 // MergeCommand is implemented in src/merge/merge.cpp
 
+namespace {
+// Reads --threads, --window and --depth (as "--opt=N" or "--opt N") on top
+// of the pack.threads/pack.window/pack.depth config defaults. The level
+// comes from pack.compression, falling back to core.compression.
+PackWriteOptions parse_pack_options(Repository& repo, const std::vector<std::string>& args) {
+    PackWriteOptions options;
+    options.threads = static_cast<size_t>(repo.config().get_int("pack", "threads", 0));
+    options.window = static_cast<size_t>(repo.config().get_int("pack", "window", static_cast<int>(options.window)));
+    options.depth = static_cast<size_t>(repo.config().get_int("pack", "depth", static_cast<int>(options.depth)));
+    options.compression_level = repo.config().get_int(
+        "pack", "compression", repo.config().get_int("core", "compression", options.compression_level));
+
+    for (size_t i = 0; i < args.size(); ++i) {
+        std::string name = args[i];
+        std::string value;
+        auto eq = name.find('=');
+        if (eq != std::string::npos) {
+            value = name.substr(eq + 1);
+            name = name.substr(0, eq);
+        } else if ((name == "--threads" || name == "--window" || name == "--depth") && i + 1 < args.size()) {
+            value = args[++i];
+        }
+
+        size_t* target = nullptr;
+        if (name == "--threads") {
+            target = &options.threads;
+        } else if (name == "--window") {
+            target = &options.window;
+        } else if (name == "--depth") {
+            target = &options.depth;
+        } else {
+            throw GitException("Unknown option: " + args[i]);
+        }
+
+        try {
+            int parsed = std::stoi(value);
+            if (parsed < 0) {
+                throw std::invalid_argument(value);
+            }
+            *target = static_cast<size_t>(parsed);
+        } catch (const std::exception&) {
+            throw GitException("Invalid value for " + name + ": '" + value + "'");
+        }
+    }
+    return options;
+}
+}
+
 // PackCommand implementation
 CommandResult PackCommand::execute(const std::vector<std::string>& args) {
     try {
         auto repo = Repository::open(".");
+        PackWriteOptions options = parse_pack_options(*repo, args);
 
         std::ostringstream oss;
         oss << "Packing objects...\n";
 
-        // Create packfile
-        std::string packfile_path = repo->git_dir() + "/objects/pack/pack-" +
-                                   SHA1::hash("packfile") + ".pack";
-        std::string index_path = packfile_path.substr(0, packfile_path.length() - 4) + "idx";
-
-        std::vector<std::string> object_ids;
-        // In a real implementation, this would collect all loose objects
-
-        if (packfile::create_packfile(packfile_path, index_path, object_ids)) {
-            oss << "Pack created: " << packfile_path << "\n";
-            oss << "Index created: " << index_path << "\n";
+        std::vector<ObjectId> object_ids = repo->objects().list_loose_objects();
+        if (object_ids.empty()) {
+            oss << "Nothing to pack\n";
             return {0, oss.str(), ""};
-        } else {
-            return {1, "", "Error: Failed to create packfile\n"};
         }
+
+        std::string packfile_path = packfile::write_pack(*repo, object_ids, options);
+        std::string index_path = packfile_path.substr(0, packfile_path.length() - 4) + "idx";
+        oss << "Packed " << object_ids.size() << " objects\n";
+        oss << "Pack created: " << packfile_path << "\n";
+        oss << "Index created: " << index_path << "\n";
+        return {0, oss.str(), ""};
     } catch (const GitException& e) {
         return {1, "", "Error: " + std::string(e.what()) + "\n"};
     }
@@ -529,10 +658,24 @@ CommandResult RepackCommand::execute(const std::vector<std::string>& args) {
     try {
         auto repo = Repository::open(".");
 
+        // Bitmaps by default, as for git's bare repositories: we serve clones
+        bool write_bitmap = repo->config().get_bool("repack", "writeBitmaps", true);
+        std::vector<std::string> pack_args;
+        for (const auto& arg : args) {
+            if (arg == "-b" || arg == "--write-bitmap-index") {
+                write_bitmap = true;
+            } else if (arg == "--no-write-bitmap-index") {
+                write_bitmap = false;
+            } else {
+                pack_args.push_back(arg);
+            }
+        }
+        PackWriteOptions options = parse_pack_options(*repo, pack_args);
+
         std::ostringstream oss;
         oss << "Repacking repository...\n";
 
-        if (packfile::repack_repository(*repo)) {
+        if (packfile::repack_repository(*repo, options, write_bitmap)) {
             oss << "Repository repacked successfully\n";
             return {0, oss.str(), ""};
         } else {
@@ -553,8 +696,10 @@ CommandResult GarbageCollectCommand::execute(const std::vector<std::string>& arg
 
         if (packfile::garbage_collect(*repo)) {
             auto stats = packfile::get_packfile_stats(*repo);
+            // Answered by the bitmaps just written, not by a walk
+            size_t reachable = find_objects_to_send(repo->objects(), repo->commit_tips()).size();
             oss << "Garbage collection completed\n";
-            oss << "Objects: " << stats.object_count << "\n";
+            oss << "Objects: " << stats.object_count << " (" << reachable << " reachable)\n";
             oss << "Packfiles: " << stats.packfiles.size() << "\n";
             return {0, oss.str(), ""};
         } else {
@@ -565,4 +710,153 @@ CommandResult GarbageCollectCommand::execute(const std::vector<std::string>& arg
     }
 }
 
+// CommitGraphCommand implementation
+CommandResult CommitGraphCommand::execute(const std::vector<std::string>& args) {
+    if (args.empty() || args[0] != "write") {
+        return {1, "", "usage: dgit commit-graph write [--split] [--size-multiple=<n>]\n"};
+    }
+
+    try {
+        auto repo = Repository::open(".");
+
+        CommitGraphWriteOptions options;
+        for (size_t i = 1; i < args.size(); ++i) {
+            const std::string& arg = args[i];
+            if (arg == "--split") {
+                options.split = true;
+            } else if (arg.rfind("--size-multiple=", 0) == 0) {
+                options.size_multiple = std::stoul(arg.substr(16));
+            } else if (arg != "--reachable") {
+                return {1, "", "Error: unknown option " + arg + "\n"};
+            }
+        }
+
+        auto result = write_commit_graph(repo->objects(), repo->commit_tips(), options);
+        std::ostringstream oss;
+        if (result.commits == 0 && options.split) {
+            oss << "Commit-graph is up to date\n";
+        } else {
+            oss << "Wrote " << result.commits << " commits to the commit-graph (" << result.layers
+                << (result.layers == 1 ? " layer" : " layers") << ")\n";
+        }
+        return {0, oss.str(), ""};
+    } catch (const std::invalid_argument&) {
+        return {1, "", "Error: bad --size-multiple\n"};
+    } catch (const GitException& e) {
+        return {1, "", "Error: " + std::string(e.what()) + "\n"};
+    }
+}
+
+namespace {
+// A full hex ID, HEAD, or a branch, tag or remote-tracking branch name,
+// peeled to the commit it names
+ObjectId resolve_commit(Repository& repo, const std::string& name) {
+    std::optional<ObjectId> id;
+    if (name == "HEAD") {
+        id = repo.refs().get_head();
+    } else if (auto hex = ObjectId::parse_hex(name)) {
+        id = hex;
+    } else if (name.rfind("refs/", 0) == 0) {
+        id = repo.refs().read_ref(name);
+    } else {
+        for (const char* prefix : {"refs/heads/", "refs/tags/", "refs/remotes/"}) {
+            if ((id = repo.refs().read_ref(prefix + name))) {
+                break;
+            }
+        }
+    }
+
+    while (id) {
+        auto raw = repo.objects().read_raw(*id);
+        if (raw && raw->type == ObjectType::Commit) {
+            return *id;
+        }
+        if (!raw || raw->type != ObjectType::Tag) {
+            break;
+        }
+        id = TagView(raw->data).object_id();
+    }
+    throw GitException("Not a valid commit name: " + name);
+}
+}
+
+// MergeBaseCommand implementation
+CommandResult MergeBaseCommand::execute(const std::vector<std::string>& args) {
+    bool all = false;
+    bool octopus = false;
+    bool ancestor_query = false;
+    std::vector<std::string> names;
+    for (const auto& arg : args) {
+        if (arg == "--all" || arg == "-a") {
+            all = true;
+        } else if (arg == "--octopus") {
+            octopus = true;
+        } else if (arg == "--is-ancestor") {
+            ancestor_query = true;
+        } else if (!arg.empty() && arg[0] == '-') {
+            return {1, "", "Error: unknown option " + arg + "\n"};
+        } else {
+            names.push_back(arg);
+        }
+    }
+    if (ancestor_query ? names.size() != 2 : names.size() < (octopus ? 1u : 2u)) {
+        return {1, "", "usage: dgit merge-base [--all] <commit> <commit>...\n"
+                       "       dgit merge-base [--all] --octopus <commit>...\n"
+                       "       dgit merge-base --is-ancestor <commit> <commit>\n"};
+    }
+
+    try {
+        auto repo = Repository::open(".");
+        std::vector<ObjectId> commits;
+        for (const auto& name : names) {
+            commits.push_back(resolve_commit(*repo, name));
+        }
+
+        MergeBaseEngine history(repo->objects());
+        // Like git, the answer is the exit status alone
+        if (ancestor_query) {
+            return {history.is_ancestor(commits[0], commits[1]) ? 0 : 1, "", ""};
+        }
+
+        std::vector<ObjectId> bases =
+            octopus ? history.octopus_bases(commits)
+                    : history.merge_bases(commits[0], std::vector<ObjectId>(commits.begin() + 1, commits.end()));
+        if (bases.empty()) {
+            return {1, "", ""};
+        }
+        if (!all) {
+            bases.resize(1);
+        }
+        std::ostringstream oss;
+        for (const auto& base : bases) {
+            oss << base.hex() << "\n";
+        }
+        return {0, oss.str(), ""};
+    } catch (const GitException& e) {
+        return {1, "", "Error: " + std::string(e.what()) + "\n"};
+    }
+}
+
+// PackRefsCommand implementation
+CommandResult PackRefsCommand::execute(const std::vector<std::string>& args) {
+    bool all = false;
+    for (const auto& arg : args) {
+        if (arg == "--all") {
+            all = true;
+        } else {
+            return {1, "", "usage: dgit pack-refs [--all]\n"};
+        }
+    }
+
+    try {
+        auto repo = Repository::open(".");
+        size_t packed = repo->refs().pack_refs(repo->objects(), all);
+        std::ostringstream oss;
+        oss << "Packed " << packed << (packed == 1 ? " ref" : " refs") << "\n";
+        return {0, oss.str(), ""};
+    } catch (const GitException& e) {
+        return {1, "", "Error: " + std::string(e.what()) + "\n"};
+    }
+}
+
 } // namespace dgit
@@ -0,0 +1,230 @@
+#include "dgit/batch_hash.hpp"
+#include "dgit/sha1_kernels.hpp"
+#include "dgit/thread_pool.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace dgit {
+
+namespace {
+
+// Files are handed to workers in groups so one worker can keep all of its
+// SIMD lanes busy with small files
+constexpr size_t kMaxFilesPerTask = 64;
+constexpr size_t kReadBufferSize = 128 * 1024;
+
+std::string blob_header(size_t size) {
+    std::string header = "blob " + std::to_string(size);
+    header.push_back('\0');
+    return header;
+}
+
+ObjectId digest_to_id(const uint32_t words[5]) {
+    ObjectId id;
+    uint8_t* bytes = id.data();
+    for (int i = 0; i < 5; ++i) {
+        bytes[i * 4] = static_cast<uint8_t>(words[i] >> 24);
+        bytes[i * 4 + 1] = static_cast<uint8_t>(words[i] >> 16);
+        bytes[i * 4 + 2] = static_cast<uint8_t>(words[i] >> 8);
+        bytes[i * 4 + 3] = static_cast<uint8_t>(words[i]);
+    }
+    return id;
+}
+
+// RAII file descriptor
+class FileHandle {
+public:
+    explicit FileHandle(const std::string& path) : fd_(::open(path.c_str(), O_RDONLY | O_CLOEXEC)) {}
+    ~FileHandle() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    int fd() const { return fd_; }
+
+private:
+    int fd_;
+};
+
+// Reads exactly `size` bytes or throws
+void read_fully(int fd, uint8_t* out, size_t size, const std::string& path) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = ::read(fd, out + done, size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw GitException("File changed while hashing: " + path);
+        }
+        done += static_cast<size_t>(n);
+    }
+}
+
+ObjectId hash_large_file(int fd, size_t size, const std::string& path, const BatchHashOptions& options) {
+    SHA1 sha1;
+    sha1.update(blob_header(size));
+
+    if (size >= options.mmap_threshold) {
+        void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            ::madvise(map, size, MADV_SEQUENTIAL);
+            sha1.update(static_cast<const uint8_t*>(map), size);
+            ::munmap(map, size);
+            return ObjectId::from_raw(sha1.digest().data());
+        }
+        // Fall back to plain reads (e.g. on filesystems without mmap)
+    }
+
+    thread_local std::vector<uint8_t> buffer(kReadBufferSize);
+    size_t remaining = size;
+    while (remaining > 0) {
+        size_t chunk = std::min(remaining, buffer.size());
+        read_fully(fd, buffer.data(), chunk, path);
+        sha1.update(buffer.data(), chunk);
+        remaining -= chunk;
+    }
+
+    return ObjectId::from_raw(sha1.digest().data());
+}
+
+// Small file waiting for, or occupying, a SIMD lane. The message is stored
+// fully padded so the lane only ever sees whole blocks.
+struct LaneJob {
+    size_t result_index;
+    std::vector<uint8_t> message;
+    size_t next_block = 0;
+};
+
+std::vector<uint8_t> padded_blob_message(const std::vector<uint8_t>& content) {
+    std::string header = blob_header(content.size());
+    uint64_t bit_length = static_cast<uint64_t>(header.size() + content.size()) * 8;
+    size_t padded = ((header.size() + content.size() + 8) / 64 + 1) * 64;
+
+    std::vector<uint8_t> message(padded, 0);
+    std::memcpy(message.data(), header.data(), header.size());
+    if (!content.empty()) {
+        std::memcpy(message.data() + header.size(), content.data(), content.size());
+    }
+    message[header.size() + content.size()] = 0x80;
+    for (int i = 0; i < 8; ++i) {
+        message[padded - 1 - i] = static_cast<uint8_t>(bit_length >> (i * 8));
+    }
+    return message;
+}
+
+// Drains `jobs` through the multi-buffer kernel, refilling lanes as soon as
+// their message is done
+void run_lanes(std::deque<LaneJob>& jobs, std::vector<HashedFile>& results) {
+    using namespace sha1_kernels;
+
+    static const uint8_t idle_block[64] = {};
+    LaneState state;
+    LaneJob lanes[kLanes];
+    bool busy[kLanes] = {};
+    size_t active = 0;
+
+    for (;;) {
+        for (size_t lane = 0; lane < kLanes && !jobs.empty(); ++lane) {
+            if (!busy[lane]) {
+                lanes[lane] = std::move(jobs.front());
+                jobs.pop_front();
+                reset_lane(state, lane);
+                busy[lane] = true;
+                ++active;
+            }
+        }
+        if (active == 0) {
+            return;
+        }
+
+        const uint8_t* blocks[kLanes];
+        for (size_t lane = 0; lane < kLanes; ++lane) {
+            blocks[lane] = busy[lane] ? lanes[lane].message.data() + lanes[lane].next_block * 64 : idle_block;
+        }
+        compress_lanes(state, blocks);
+
+        for (size_t lane = 0; lane < kLanes; ++lane) {
+            if (!busy[lane] || ++lanes[lane].next_block * 64 < lanes[lane].message.size()) {
+                continue;
+            }
+            uint32_t words[5];
+            for (int i = 0; i < 5; ++i) {
+                words[i] = state.h[i][lane];
+            }
+            results[lanes[lane].result_index].id = digest_to_id(words);
+            busy[lane] = false;
+            --active;
+        }
+    }
+}
+
+void hash_group(size_t begin, size_t end, bool use_lanes, const BatchHashOptions& options,
+                std::vector<HashedFile>& results) {
+    std::deque<LaneJob> lane_jobs;
+
+    for (size_t i = begin; i < end; ++i) {
+        HashedFile& file = results[i];
+
+        FileHandle handle(file.path);
+        if (handle.fd() < 0) {
+            throw GitException("Cannot open file: " + file.path);
+        }
+        if (::fstat(handle.fd(), &file.st) != 0) {
+            throw GitException("Cannot stat file: " + file.path);
+        }
+
+        size_t size = static_cast<size_t>(file.st.st_size);
+        if (use_lanes && size <= options.lane_limit) {
+            std::vector<uint8_t> content(size);
+            read_fully(handle.fd(), content.data(), size, file.path);
+            lane_jobs.push_back({i, padded_blob_message(content)});
+        } else {
+            file.id = hash_large_file(handle.fd(), size, file.path, options);
+        }
+    }
+
+    run_lanes(lane_jobs, results);
+}
+
+} // namespace
+
+ObjectId hash_blob(const uint8_t* data, size_t size) {
+    SHA1 sha1;
+    sha1.update(blob_header(size));
+    sha1.update(data, size);
+    return ObjectId::from_raw(sha1.digest().data());
+}
+
+std::vector<HashedFile> hash_files(const std::vector<std::string>& paths, const BatchHashOptions& options) {
+    std::vector<HashedFile> results(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        results[i].path = paths[i];
+    }
+
+    bool use_lanes = options.lanes == BatchHashOptions::Lanes::Always ||
+                     (options.lanes == BatchHashOptions::Lanes::Auto && sha1_kernels::lanes_preferred());
+
+    // Aim for a few groups per thread so a handful of big files still spreads
+    size_t threads = options.threads ? options.threads : default_threads();
+    size_t per_task = std::clamp<size_t>(paths.size() / (threads * 4), 1, kMaxFilesPerTask);
+    size_t groups = (paths.size() + per_task - 1) / per_task;
+
+    parallel_for(groups, threads, [&](size_t group) {
+        size_t begin = group * per_task;
+        size_t end = std::min(begin + per_task, paths.size());
+        hash_group(begin, end, use_lanes, options, results);
+    });
+
+    return results;
+}
+
+} // namespace dgit
@@ -0,0 +1,207 @@
+#include "dgit/cache_tree.hpp"
+#include "dgit/tree_builder.hpp"
+#include <cstdlib>
+#include <cstring>
+
+namespace dgit {
+
+namespace {
+constexpr uint16_t kStageMask = 0x3000;
+// Deeper than any real checkout; guards the recursive parser
+constexpr int kMaxDepth = 4096;
+
+void serialize_node(const CacheTree::Node& node, std::string& out) {
+    out += node.name;
+    out.push_back('\0');
+    out += std::to_string(node.entry_count);
+    out.push_back(' ');
+    out += std::to_string(node.subtrees.size());
+    out.push_back('\n');
+    if (node.valid()) {
+        out.append(reinterpret_cast<const char*>(node.id.data()), ObjectId::kRawSize);
+    }
+    for (const auto& subtree : node.subtrees) {
+        serialize_node(*subtree, out);
+    }
+}
+
+// Parses an ASCII decimal (optionally negative) ending in `terminator`
+bool parse_number(const uint8_t*& p, const uint8_t* end, char terminator, long& value) {
+    const uint8_t* stop = static_cast<const uint8_t*>(std::memchr(p, terminator, end - p));
+    if (!stop || stop == p || stop - p > 20) {
+        return false;
+    }
+    std::string digits(reinterpret_cast<const char*>(p), stop - p);
+    char* parsed;
+    value = std::strtol(digits.c_str(), &parsed, 10);
+    if (*parsed != '\0') {
+        return false;
+    }
+    p = stop + 1;
+    return true;
+}
+
+std::unique_ptr<CacheTree::Node> parse_node(const uint8_t*& p, const uint8_t* end, int depth) {
+    if (depth > kMaxDepth || p >= end) {
+        return nullptr;
+    }
+    const uint8_t* nul = static_cast<const uint8_t*>(std::memchr(p, '\0', end - p));
+    if (!nul) {
+        return nullptr;
+    }
+    auto node = std::make_unique<CacheTree::Node>();
+    node->name.assign(reinterpret_cast<const char*>(p), nul - p);
+    p = nul + 1;
+
+    long entry_count;
+    long subtree_count;
+    if (!parse_number(p, end, ' ', entry_count) || !parse_number(p, end, '\n', subtree_count) || subtree_count < 0) {
+        return nullptr;
+    }
+    node->entry_count = entry_count < 0 ? -1 : static_cast<int>(entry_count);
+    if (node->valid()) {
+        if (static_cast<size_t>(end - p) < ObjectId::kRawSize) {
+            return nullptr;
+        }
+        node->id = ObjectId::from_raw(p);
+        p += ObjectId::kRawSize;
+    }
+
+    for (long i = 0; i < subtree_count; ++i) {
+        auto subtree = parse_node(p, end, depth + 1);
+        if (!subtree) {
+            return nullptr;
+        }
+        node->subtrees.push_back(std::move(subtree));
+    }
+    return node;
+}
+}
+
+CacheTree::Node* CacheTree::Node::find(std::string_view child) const {
+    for (const auto& subtree : subtrees) {
+        if (subtree->name == child) {
+            return subtree.get();
+        }
+    }
+    return nullptr;
+}
+
+void CacheTree::invalidate(std::string_view path) {
+    Node* node = root_.get();
+    size_t start = 0;
+    while (node) {
+        if (node->valid()) {
+            node->entry_count = -1;
+            changed_ = true;
+        }
+        size_t slash = path.find('/', start);
+        if (slash == std::string_view::npos) {
+            break;
+        }
+        node = node->find(path.substr(start, slash - start));
+        start = slash + 1;
+    }
+}
+
+void CacheTree::clear() {
+    if (root_) {
+        changed_ = true;
+    }
+    root_.reset();
+}
+
+CacheTree::UpdateResult CacheTree::update(const std::vector<IndexEntry>& entries, const CacheTreeStore& store) {
+    if (!root_) {
+        root_ = std::make_unique<Node>();
+    }
+
+    UpdateResult result;
+    update_node(*root_, entries, 0, "", store, result.trees_written);
+    result.root = root_->id;
+    return result;
+}
+
+size_t CacheTree::update_node(Node& node, const std::vector<IndexEntry>& entries, size_t pos,
+                              const std::string& prefix, const CacheTreeStore& store, size_t& written) {
+    // Nothing below changed since the tree was written
+    if (node.valid() && pos + static_cast<size_t>(node.entry_count) <= entries.size() &&
+        (!store.has_object || store.has_object(node.id))) {
+        return static_cast<size_t>(node.entry_count);
+    }
+
+    TreeBuilder tree;
+    std::vector<std::unique_ptr<Node>> subtrees;
+    size_t next_cached = 0;
+
+    size_t i = pos;
+    while (i < entries.size() && entries[i].path.compare(0, prefix.size(), prefix) == 0) {
+        const IndexEntry& entry = entries[i];
+        if (entry.flags & kStageMask) {
+            throw GitException("Cannot write a tree with unmerged entry: " + entry.path);
+        }
+
+        size_t slash = entry.path.find('/', prefix.size());
+        if (slash == std::string::npos) {
+            if (store.ensure_blob) {
+                store.ensure_blob(entry);
+            }
+            tree.add(entry.mode, entry.blob_id, entry.path.substr(prefix.size()));
+            ++i;
+            continue;
+        }
+
+        // Entries under one directory are contiguous in the sorted index.
+        // Subtrees we wrote are in that order, so the search usually hits
+        // at the cursor; git orders them differently, hence the wrap.
+        std::string name = entry.path.substr(prefix.size(), slash - prefix.size());
+        std::unique_ptr<Node> child;
+        size_t count = node.subtrees.size();
+        for (size_t step = 0; step < count; ++step) {
+            size_t k = (next_cached + step) % count;
+            if (node.subtrees[k] && node.subtrees[k]->name == name) {
+                child = std::move(node.subtrees[k]);
+                next_cached = k + 1;
+                break;
+            }
+        }
+        if (!child) {
+            child = std::make_unique<Node>();
+            child->name = name;
+        }
+
+        i += update_node(*child, entries, i, prefix + name + "/", store, written);
+        tree.add(FileMode::Directory, child->id, name);
+        subtrees.push_back(std::move(child));
+    }
+
+    // Directories that no longer have entries drop out here
+    node.subtrees = std::move(subtrees);
+    node.entry_count = static_cast<int>(i - pos);
+    auto built = tree.build();
+    node.id = built->id();
+    store.store_tree(std::move(built));
+    written++;
+    changed_ = true;
+    return i - pos;
+}
+
+void CacheTree::serialize(std::string& out) const {
+    if (root_) {
+        serialize_node(*root_, out);
+    }
+}
+
+bool CacheTree::parse(const uint8_t* data, size_t size) {
+    const uint8_t* p = data;
+    auto root = parse_node(p, data + size, 0);
+    if (!root || p != data + size) {
+        root_.reset();
+        return false;
+    }
+    root_ = std::move(root);
+    changed_ = false;
+    return true;
+}
+
+} // namespace dgit
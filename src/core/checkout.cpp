@@ -0,0 +1,386 @@
+#include "dgit/checkout.hpp"
+#include "dgit/batch_hash.hpp"
+#include "dgit/cache_tree.hpp"
+#include "dgit/object_database.hpp"
+#include "dgit/thread_pool.hpp"
+#include "dgit/trace.hpp"
+#include "dgit/tree_iterator.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <set>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+namespace dgit {
+
+namespace {
+struct TreeItem {
+    std::string path;
+    FileMode mode;
+    ObjectId id;
+};
+
+// One path where the index and the target tree differ
+struct Change {
+    std::string path;
+    std::optional<IndexEntry> old;     // absent: not in the index
+    std::optional<TreeItem> target;    // absent: not in the tree
+};
+
+bool is_gitlink(FileMode mode) {
+    return mode == FileMode::Gitlink;
+}
+
+std::string join_path(const std::string& worktree, const std::string& path) {
+    return worktree == "." ? path : worktree + "/" + path;
+}
+
+std::string error_text() {
+    return std::strerror(errno);
+}
+
+// The blobs of a tree, recursively. Subtrees matching a valid cache-tree
+// node are recorded in `same_dirs` ("dir/") instead.
+void flatten_tree(ObjectDatabase& objects, const ObjectId& tree_id, const std::string& prefix,
+                  const CacheTree::Node* cached, std::vector<TreeItem>& files, std::vector<std::string>& same_dirs,
+                  size_t& trees_read) {
+    if (cached && cached->valid() && cached->id == tree_id) {
+        same_dirs.push_back(prefix);
+        return;
+    }
+
+    auto raw = objects.read_raw(tree_id);
+    if (!raw || raw->type != ObjectType::Tree) {
+        throw GitException("Cannot read tree " + tree_id.hex());
+    }
+    ++trees_read;
+
+    for (const auto& entry : TreeView(raw->data)) {
+        if (entry.is_directory()) {
+            flatten_tree(objects, entry.id(), prefix + std::string(entry.name) + "/",
+                         cached ? cached->find(entry.name) : nullptr, files, same_dirs, trees_read);
+        } else {
+            files.push_back(TreeItem{prefix + std::string(entry.name), entry.mode, entry.id()});
+        }
+    }
+}
+
+bool symlink_matches(const std::string& path, const ObjectId& expected) {
+    std::string target(PATH_MAX, '\0');
+    ssize_t length = ::readlink(path.c_str(), &target[0], target.size());
+    if (length < 0) {
+        return false;
+    }
+    return hash_blob(reinterpret_cast<const uint8_t*>(target.data()), static_cast<size_t>(length)) == expected;
+}
+
+// Refuses to go on when a file checkout would replace or remove differs
+// from its index entry. Stat data settles most entries; the rest are hashed.
+void check_local_changes(const Index& index, const std::vector<Change>& changes, const std::string& worktree,
+                         size_t threads) {
+    auto refuse = [](const std::string& path) {
+        throw GitException("Your local changes to '" + path + "' would be overwritten by checkout");
+    };
+
+    std::vector<const Change*> to_hash;
+    std::vector<std::string> paths;
+    for (const auto& change : changes) {
+        if (!change.old || is_gitlink(change.old->mode)) {
+            continue;
+        }
+        const IndexEntry& entry = *change.old;
+        std::string path = join_path(worktree, change.path);
+        struct stat st;
+        Trace2::count(TraceCounter::StatCalls);
+        if (::lstat(path.c_str(), &st) != 0) {
+            continue;   // deleted locally; nothing to lose
+        }
+        if (file_mode_from_stat(st) != entry.mode) {
+            refuse(change.path);
+        }
+        if (entry.stat.matches(st) && !index.is_racy(entry)) {
+            continue;
+        }
+        if (entry.stat.size != 0 && entry.stat.size != static_cast<uint32_t>(st.st_size)) {
+            refuse(change.path);
+        }
+        if (entry.mode == FileMode::Symlink) {
+            if (!symlink_matches(path, entry.blob_id)) {
+                refuse(change.path);
+            }
+        } else {
+            to_hash.push_back(&change);
+            paths.push_back(std::move(path));
+        }
+    }
+    if (paths.empty()) {
+        return;
+    }
+
+    BatchHashOptions options;
+    options.threads = threads;
+    std::vector<HashedFile> hashed = hash_files(paths, options);
+    for (size_t i = 0; i < to_hash.size(); ++i) {
+        if (hashed[i].id != to_hash[i]->old->blob_id) {
+            refuse(to_hash[i]->path);
+        }
+    }
+}
+
+// Makes way for a new file or directory at `path`
+void clear_path(const std::string& path, bool keep_directory, bool force) {
+    struct stat st;
+    if (::lstat(path.c_str(), &st) != 0) {
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        if (::unlink(path.c_str()) != 0 && errno != ENOENT) {
+            throw GitException("Cannot remove " + path + ": " + error_text());
+        }
+        return;
+    }
+    if (keep_directory) {
+        return;
+    }
+    // Tracked files below were removed already; anything left is untracked
+    std::error_code ec;
+    if (force ? fs::remove_all(path, ec) == static_cast<std::uintmax_t>(-1) : ::rmdir(path.c_str()) != 0) {
+        throw GitException("Cannot replace directory " + path + " with a file");
+    }
+}
+
+IndexStat write_entry(const std::string& path, const TreeItem& item, const std::string& content, bool force) {
+    clear_path(path, is_gitlink(item.mode), force);
+    struct stat st;
+    if (is_gitlink(item.mode)) {
+        // Submodules are not checked out; their directory is left empty
+        if (::mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+            throw GitException("Cannot create directory " + path + ": " + error_text());
+        }
+        return IndexStat();
+    }
+    if (item.mode == FileMode::Symlink) {
+        if (::symlink(content.c_str(), path.c_str()) != 0 || ::lstat(path.c_str(), &st) != 0) {
+            throw GitException("Cannot create symlink " + path + ": " + error_text());
+        }
+        return IndexStat::from_stat(st);
+    }
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                    item.mode == FileMode::Executable ? 0777 : 0666);
+    if (fd < 0) {
+        throw GitException("Cannot write file: " + path + ": " + error_text());
+    }
+    const char* p = content.data();
+    size_t left = content.size();
+    while (left > 0) {
+        ssize_t n = ::write(fd, p, left);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            std::string error = error_text();
+            ::close(fd);
+            throw GitException("Cannot write file: " + path + ": " + error);
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+    // Stat data taken after the last write is what the next status sees
+    bool ok = ::fstat(fd, &st) == 0;
+    if (::close(fd) != 0 || !ok) {
+        throw GitException("Cannot write file: " + path + ": " + error_text());
+    }
+    return IndexStat::from_stat(st);
+}
+}
+
+CheckoutResult checkout_tree(ObjectDatabase& objects, Index& index, const std::string& worktree,
+                             const ObjectId& tree, const CheckoutOptions& options) {
+    TraceRegion region("checkout", "worktree");
+    CheckoutResult result;
+
+    // Directories whose cache-tree entry matches the target already hold
+    // the right entries, so switching between close branches reads only
+    // the trees along the changed paths
+    std::vector<TreeItem> files;
+    std::vector<std::string> same_dirs;
+    flatten_tree(objects, tree, "", index.cache_tree().root(), files, same_dirs, result.trees_read);
+    std::sort(files.begin(), files.end(), [](const TreeItem& a, const TreeItem& b) { return a.path < b.path; });
+    std::sort(same_dirs.begin(), same_dirs.end());
+
+    auto in_same_dir = [&same_dirs](const std::string& path) {
+        auto it = std::upper_bound(same_dirs.begin(), same_dirs.end(), path);
+        return it != same_dirs.begin() && path.compare(0, (it - 1)->size(), *(it - 1)) == 0;
+    };
+
+    std::vector<Change> changes;
+    auto item = files.begin();
+    for (const auto& entry : index.entries()) {
+        if (in_same_dir(entry.path)) {
+            continue;
+        }
+        while (item != files.end() && item->path < entry.path) {
+            changes.push_back({item->path, std::nullopt, *item});
+            ++item;
+        }
+        if (item != files.end() && item->path == entry.path) {
+            if (item->id != entry.blob_id || item->mode != entry.mode) {
+                changes.push_back({entry.path, entry, *item});
+            }
+            ++item;
+        } else {
+            changes.push_back({entry.path, entry, std::nullopt});
+        }
+    }
+    for (; item != files.end(); ++item) {
+        changes.push_back({item->path, std::nullopt, *item});
+    }
+    if (changes.empty()) {
+        return result;
+    }
+
+    // Sorted, as `changes` is
+    std::vector<std::string> removed;
+    std::set<std::string> dirs;
+    for (const auto& change : changes) {
+        if (!change.target) {
+            removed.push_back(change.path);
+            continue;
+        }
+        for (size_t slash = change.path.find('/'); slash != std::string::npos;
+             slash = change.path.find('/', slash + 1)) {
+            dirs.insert(change.path.substr(0, slash));
+        }
+    }
+    auto is_removed = [&removed](const std::string& path) {
+        return std::binary_search(removed.begin(), removed.end(), path);
+    };
+    auto removes_below = [&removed](const std::string& path) {
+        std::string prefix = path + "/";
+        auto it = std::lower_bound(removed.begin(), removed.end(), prefix);
+        return it != removed.end() && it->compare(0, prefix.size(), prefix) == 0;
+    };
+
+    // Every check comes before the first change to the work tree
+    if (!options.force) {
+        check_local_changes(index, changes, worktree, options.threads);
+        auto untracked = [](const std::string& path) {
+            throw GitException("Untracked working tree file '" + path + "' would be overwritten by checkout");
+        };
+        struct stat st;
+        for (const auto& change : changes) {
+            if (change.old || !change.target ||
+                ::lstat(join_path(worktree, change.path).c_str(), &st) != 0) {
+                continue;
+            }
+            bool directory = S_ISDIR(st.st_mode);
+            if (!(directory && (is_gitlink(change.target->mode) || removes_below(change.path)))) {
+                untracked(change.path);
+            }
+        }
+        for (const auto& dir : dirs) {
+            if (::lstat(join_path(worktree, dir).c_str(), &st) == 0 && !S_ISDIR(st.st_mode) && !is_removed(dir)) {
+                untracked(dir);
+            }
+        }
+    }
+
+    // Removals first, pruning the directories they leave empty deepest
+    // first, so a file may take the place of a directory and back
+    std::set<std::string> emptied;
+    for (const auto& change : changes) {
+        if (change.target) {
+            continue;
+        }
+        std::string path = join_path(worktree, change.path);
+        int status = is_gitlink(change.old->mode) ? ::rmdir(path.c_str()) : ::unlink(path.c_str());
+        if (status != 0 && errno != ENOENT && !is_gitlink(change.old->mode)) {
+            throw GitException("Cannot remove " + path + ": " + error_text());
+        }
+        for (size_t slash = change.path.find('/'); slash != std::string::npos;
+             slash = change.path.find('/', slash + 1)) {
+            emptied.insert(change.path.substr(0, slash));
+        }
+        ++result.removed;
+    }
+    for (auto it = emptied.rbegin(); it != emptied.rend(); ++it) {
+        if (!dirs.count(*it)) {
+            ::rmdir(join_path(worktree, *it).c_str());   // fails while anything is left
+        }
+    }
+
+    // Parents sort before their children, so each mkdir finds its parent
+    for (const auto& dir : dirs) {
+        std::string path = join_path(worktree, dir);
+        if (::mkdir(path.c_str(), 0777) == 0) {
+            continue;
+        }
+        struct stat st;
+        if (errno == EEXIST && ::lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            continue;
+        }
+        clear_path(path, false, options.force);
+        if (::mkdir(path.c_str(), 0777) != 0) {
+            throw GitException("Cannot create directory " + path + ": " + error_text());
+        }
+    }
+
+    // The database is single-threaded: each batch of blobs is read in
+    // order, then written out and stat'ed across the pool
+    std::vector<size_t> writes;
+    std::vector<ObjectId> ids;
+    for (size_t i = 0; i < changes.size(); ++i) {
+        if (changes[i].target) {
+            writes.push_back(i);
+            ids.push_back(changes[i].target->id);
+        }
+    }
+    objects.prefetch(ids);
+    std::vector<IndexStat> stats(changes.size());
+    size_t next = 0;
+    while (next < writes.size()) {
+        size_t begin = next;
+        size_t bytes = 0;
+        std::vector<std::string> contents;
+        while (next < writes.size() && (next == begin || bytes < options.batch_bytes)) {
+            const TreeItem& target = *changes[writes[next]].target;
+            ++next;
+            if (is_gitlink(target.mode)) {
+                contents.emplace_back();
+                continue;
+            }
+            auto raw = objects.read_raw(target.id);
+            if (!raw || raw->type != ObjectType::Blob) {
+                throw GitException("Cannot read blob " + target.id.hex() + " for " + target.path);
+            }
+            bytes += raw->data.size();
+            contents.push_back(std::move(raw->data));
+        }
+        parallel_for(next - begin, options.threads, [&](size_t k) {
+            size_t i = writes[begin + k];
+            stats[i] = write_entry(join_path(worktree, changes[i].path), *changes[i].target, contents[k],
+                                   options.force);
+            std::string().swap(contents[k]);
+        });
+    }
+
+    for (size_t i = 0; i < changes.size(); ++i) {
+        const Change& change = changes[i];
+        if (change.target) {
+            index.add_entry(change.path, change.target->id, change.target->mode, stats[i]);
+            ++result.written;
+        } else {
+            index.remove_entry(change.path);
+        }
+    }
+    return result;
+}
+
+} // namespace dgit
@@ -0,0 +1,212 @@
+#include "dgit/compression.hpp"
+#include "dgit/sha1.hpp"
+#include "dgit/trace.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#ifdef DGIT_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+namespace dgit {
+
+namespace {
+// zlib counts in uInt; larger buffers are fed in slices of this size
+constexpr size_t kMaxZlibChunk = UINT_MAX;
+
+#ifdef DGIT_USE_LIBDEFLATE
+// libdeflate has no "default" level and goes up to 12; zlib's 0-9 map as-is
+int libdeflate_level(int level) {
+    return level < 0 ? 6 : std::min(level, 12);
+}
+#endif
+}
+
+// Deflater implementation
+Deflater::Deflater(int level) : level_(level) {
+    std::memset(&zs_, 0, sizeof(zs_));
+    if (deflateInit(&zs_, level) != Z_OK) {
+        throw GitException("Failed to initialize zlib compression");
+    }
+#ifdef DGIT_USE_LIBDEFLATE
+    one_shot_ = libdeflate_alloc_compressor(libdeflate_level(level));
+    if (!one_shot_) {
+        deflateEnd(&zs_);
+        throw GitException("Failed to initialize libdeflate compression");
+    }
+#endif
+}
+
+Deflater::~Deflater() {
+    deflateEnd(&zs_);
+#ifdef DGIT_USE_LIBDEFLATE
+    libdeflate_free_compressor(one_shot_);
+#endif
+}
+
+void Deflater::set_level(int level) {
+    if (level == level_) {
+        return;
+    }
+
+    deflateReset(&zs_);
+    if (deflateParams(&zs_, level, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw GitException("Invalid compression level: " + std::to_string(level));
+    }
+#ifdef DGIT_USE_LIBDEFLATE
+    libdeflate_free_compressor(one_shot_);
+    one_shot_ = libdeflate_alloc_compressor(libdeflate_level(level));
+    if (!one_shot_) {
+        throw GitException("Failed to initialize libdeflate compression");
+    }
+#endif
+    level_ = level;
+}
+
+void Deflater::compress(const void* data, size_t size, std::string& out) {
+    Trace2::count(TraceCounter::BytesDeflated, size);
+#ifdef DGIT_USE_LIBDEFLATE
+    out.resize(libdeflate_zlib_compress_bound(one_shot_, size));
+    size_t written = libdeflate_zlib_compress(one_shot_, data, size, &out[0], out.size());
+    if (written == 0) {
+        throw GitException("Failed to compress data");
+    }
+    out.resize(written);
+#else
+    z_stream& zs = begin();
+    out.resize(deflateBound(&zs, size));
+
+    const Bytef* in = static_cast<const Bytef*>(data);
+    size_t in_left = size;
+    size_t produced = 0;
+    int ret;
+    do {
+        size_t in_chunk = std::min(in_left, kMaxZlibChunk);
+        size_t out_room = std::min(out.size() - produced, kMaxZlibChunk);
+        zs.next_in = const_cast<Bytef*>(in);
+        zs.avail_in = static_cast<uInt>(in_chunk);
+        zs.next_out = reinterpret_cast<Bytef*>(&out[0]) + produced;
+        zs.avail_out = static_cast<uInt>(out_room);
+
+        ret = deflate(&zs, in_chunk == in_left ? Z_FINISH : Z_NO_FLUSH);
+        in += in_chunk - zs.avail_in;
+        in_left -= in_chunk - zs.avail_in;
+        produced += out_room - zs.avail_out;
+    } while (ret == Z_OK);
+
+    if (ret != Z_STREAM_END) {
+        throw GitException("Failed to compress data");
+    }
+    out.resize(produced);
+#endif
+}
+
+z_stream& Deflater::begin() {
+    deflateReset(&zs_);
+    return zs_;
+}
+
+Deflater& Deflater::for_thread(int level) {
+    thread_local Deflater deflater(level);
+    deflater.set_level(level);
+    return deflater;
+}
+
+// Inflater implementation
+Inflater::Inflater() {
+    std::memset(&zs_, 0, sizeof(zs_));
+    if (inflateInit(&zs_) != Z_OK) {
+        throw GitException("Failed to initialize zlib decompression");
+    }
+#ifdef DGIT_USE_LIBDEFLATE
+    one_shot_ = libdeflate_alloc_decompressor();
+    if (!one_shot_) {
+        inflateEnd(&zs_);
+        throw GitException("Failed to initialize libdeflate decompression");
+    }
+#endif
+}
+
+Inflater::~Inflater() {
+    inflateEnd(&zs_);
+#ifdef DGIT_USE_LIBDEFLATE
+    libdeflate_free_decompressor(one_shot_);
+#endif
+}
+
+void Inflater::decompress(const void* data, size_t size, std::string& out, size_t expected_size,
+                          size_t* consumed) {
+#ifdef DGIT_USE_LIBDEFLATE
+    // libdeflate needs the output size up front; unknown sizes use zlib
+    if (expected_size != kUnknownSize) {
+        out.resize(expected_size);
+        size_t in_used = 0;
+        size_t out_used = 0;
+        auto result = libdeflate_zlib_decompress_ex(one_shot_, data, size, &out[0], expected_size,
+                                                    &in_used, &out_used);
+        if (result != LIBDEFLATE_SUCCESS || out_used != expected_size) {
+            throw GitException("Corrupt zlib data");
+        }
+        if (consumed) {
+            *consumed = in_used;
+        }
+        Trace2::count(TraceCounter::BytesInflated, out_used);
+        return;
+    }
+#endif
+
+    z_stream& zs = begin();
+    const Bytef* in = static_cast<const Bytef*>(data);
+    size_t in_left = size;
+
+    bool exact = expected_size != kUnknownSize;
+    out.resize(exact ? expected_size : std::max<size_t>(size * 2, 256));
+    size_t produced = 0;
+
+    // inflate needs a non-null output buffer even for empty objects
+    Bytef dummy;
+    int ret;
+    do {
+        if (!exact && produced == out.size()) {
+            out.resize(out.size() * 2);
+        }
+        size_t in_chunk = std::min(in_left, kMaxZlibChunk);
+        size_t out_room = std::min(out.size() - produced, kMaxZlibChunk);
+        zs.next_in = const_cast<Bytef*>(in);
+        zs.avail_in = static_cast<uInt>(in_chunk);
+        zs.next_out = out_room ? reinterpret_cast<Bytef*>(&out[0]) + produced : &dummy;
+        zs.avail_out = static_cast<uInt>(out_room);
+
+        ret = inflate(&zs, Z_NO_FLUSH);
+        in += in_chunk - zs.avail_in;
+        in_left -= in_chunk - zs.avail_in;
+        produced += out_room - zs.avail_out;
+
+        // No progress possible: out of input, or a known size overrun
+        if (ret == Z_BUF_ERROR && (in_left == 0 || (exact && produced == out.size()))) {
+            break;
+        }
+    } while (ret == Z_OK || ret == Z_BUF_ERROR);
+
+    if (ret != Z_STREAM_END || (exact && produced != expected_size)) {
+        throw GitException("Corrupt zlib data");
+    }
+    out.resize(produced);
+    if (consumed) {
+        *consumed = size - in_left;
+    }
+    Trace2::count(TraceCounter::BytesInflated, produced);
+}
+
+z_stream& Inflater::begin() {
+    inflateReset(&zs_);
+    return zs_;
+}
+
+Inflater& Inflater::for_thread() {
+    thread_local Inflater inflater;
+    return inflater;
+}
+
+} // namespace dgit
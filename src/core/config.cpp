@@ -63,6 +63,33 @@ int Config::get_int(const std::string& section, const std::string& key, int defa
     }
 }
 
+size_t Config::get_size(const std::string& section, const std::string& key, size_t default_value) const {
+    auto value = get_value(section, key);
+    if (!value || value->empty()) return default_value;
+
+    // Same unit suffixes as git: k, m and g (case-insensitive)
+    size_t pos = 0;
+    unsigned long long number;
+    try {
+        number = std::stoull(*value, &pos);
+    } catch (const std::exception&) {
+        return default_value;
+    }
+
+    std::string suffix = value->substr(pos);
+    std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+    if (suffix == "k") {
+        number <<= 10;
+    } else if (suffix == "m") {
+        number <<= 20;
+    } else if (suffix == "g") {
+        number <<= 30;
+    } else if (!suffix.empty()) {
+        return default_value;
+    }
+    return static_cast<size_t>(number);
+}
+
 std::vector<std::string> Config::get_sections() const {
     std::vector<std::string> sections;
     std::string current_section;
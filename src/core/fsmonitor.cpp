@@ -0,0 +1,216 @@
+#include "dgit/fsmonitor.hpp"
+#include "dgit/quote.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/inotify.h>
+#endif
+
+namespace dgit {
+
+namespace {
+std::string join(const std::string& dir, const std::string& name) {
+    return dir.empty() ? name : dir + "/" + name;
+}
+}
+
+std::unique_ptr<FsMonitor> FsMonitor::from_config(const Config& config, const std::string& worktree) {
+    std::string command = config.get_string("core", "fsmonitor");
+    std::string lower = command;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+
+    // git's "true" selects its built-in daemon, which a short-lived process
+    // cannot stand in for; only hook commands are honoured here
+    if (command.empty() || lower == "false" || lower == "no" || lower == "off" || lower == "0" ||
+        lower == "true" || lower == "yes" || lower == "on" || lower == "1") {
+        return nullptr;
+    }
+    return std::make_unique<HookFsMonitor>(command, worktree);
+}
+
+// HookFsMonitor implementation
+HookFsMonitor::HookFsMonitor(std::string command, std::string worktree)
+    : command_(std::move(command)), worktree_(std::move(worktree)) {}
+
+FsMonitorChanges HookFsMonitor::changes_since(const std::string& token) {
+    FsMonitorChanges changes;
+    changes.everything = true;
+
+    std::string shell = "cd " + shell_quote(worktree_) + " && " + command_ + " 2 " + shell_quote(token);
+    FILE* pipe = ::popen(shell.c_str(), "r");
+    if (!pipe) {
+        return changes;
+    }
+
+    std::string output;
+    char buffer[64 * 1024];
+    size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+        output.append(buffer, n);
+    }
+    int status = ::pclose(pipe);
+    if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return changes;
+    }
+
+    size_t nul = output.find('\0');
+    if (nul == std::string::npos) {
+        return changes;
+    }
+    changes.token = output.substr(0, nul);
+
+    bool trivial = false;
+    for (size_t pos = nul + 1; pos < output.size();) {
+        size_t end = output.find('\0', pos);
+        if (end == std::string::npos) {
+            end = output.size();
+        }
+        std::string path = output.substr(pos, end - pos);
+        if (path == "/") {
+            trivial = true;
+        } else if (!path.empty()) {
+            changes.paths.push_back(std::move(path));
+        }
+        pos = end + 1;
+    }
+
+    // Without a previous token there is nothing to be relative to
+    changes.everything = trivial || token.empty();
+    if (changes.everything) {
+        changes.paths.clear();
+    }
+    return changes;
+}
+
+#ifdef __linux__
+namespace {
+constexpr uint32_t kWatchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO |
+                                IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK;
+// Past this many recorded changes older tokens stop being honoured
+constexpr size_t kHistoryLimit = 1 << 20;
+
+std::atomic<unsigned> next_instance{0};
+}
+
+// InotifyFsMonitor implementation
+InotifyFsMonitor::InotifyFsMonitor(std::string worktree) : worktree_(std::move(worktree)) {
+    fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd_ < 0) {
+        throw GitException("Cannot initialize inotify: " + std::string(std::strerror(errno)));
+    }
+    instance_ = "inotify:" + std::to_string(::getpid()) + "." + std::to_string(next_instance++);
+    watch_tree("");
+}
+
+InotifyFsMonitor::~InotifyFsMonitor() {
+    ::close(fd_);
+}
+
+void InotifyFsMonitor::watch_tree(const std::string& path) {
+    std::string full = path.empty() ? worktree_ : worktree_ + "/" + path;
+    int wd = ::inotify_add_watch(fd_, full.c_str(), kWatchMask);
+    if (wd < 0) {
+        // Out of watches (fs.inotify.max_user_watches): stop vouching for
+        // anything rather than silently missing changes
+        if (errno == ENOSPC) {
+            reset_history();
+        }
+        return;
+    }
+    watches_[wd] = path;
+
+    DIR* dir = ::opendir(full.c_str());
+    if (!dir) {
+        return;
+    }
+    std::vector<std::string> subdirs;
+    while (struct dirent* entry = ::readdir(dir)) {
+        const char* name = entry->d_name;
+        if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0 ||
+            (path.empty() && std::strcmp(name, ".git") == 0)) {
+            continue;
+        }
+        if (entry->d_type == DT_DIR || entry->d_type == DT_UNKNOWN) {
+            subdirs.push_back(join(path, name));
+        }
+    }
+    ::closedir(dir);
+
+    for (const auto& subdir : subdirs) {
+        watch_tree(subdir);
+    }
+}
+
+void InotifyFsMonitor::drain() {
+    alignas(struct inotify_event) char buffer[64 * 1024];
+    for (;;) {
+        ssize_t length = ::read(fd_, buffer, sizeof(buffer));
+        if (length <= 0) {
+            break;   // EAGAIN once the queue is empty
+        }
+
+        for (char* p = buffer; p < buffer + length;) {
+            auto* event = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                reset_history();
+                continue;
+            }
+            auto it = watches_.find(event->wd);
+            if (it == watches_.end()) {
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches_.erase(it);
+                continue;
+            }
+
+            std::string path = event->len ? join(it->second, event->name) : it->second;
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+                watch_tree(path);
+            }
+            history_.push_back((event->mask & IN_ISDIR) ? path + "/" : path);
+        }
+    }
+
+    if (history_.size() > kHistoryLimit) {
+        reset_history();
+    }
+}
+
+void InotifyFsMonitor::reset_history() {
+    history_.clear();
+    generation_++;
+}
+
+FsMonitorChanges InotifyFsMonitor::changes_since(const std::string& token) {
+    size_t generation = generation_;
+    drain();
+
+    FsMonitorChanges changes;
+    std::string prefix = instance_ + ":" + std::to_string(generation_) + ":";
+    changes.everything = true;
+    if (generation == generation_ && token.compare(0, prefix.size(), prefix) == 0) {
+        size_t seen = std::strtoull(token.c_str() + prefix.size(), nullptr, 10);
+        if (seen <= history_.size()) {
+            changes.everything = false;
+            changes.paths.assign(history_.begin() + static_cast<std::ptrdiff_t>(seen), history_.end());
+            std::sort(changes.paths.begin(), changes.paths.end());
+            changes.paths.erase(std::unique(changes.paths.begin(), changes.paths.end()), changes.paths.end());
+        }
+    }
+    changes.token = prefix + std::to_string(history_.size());
+    return changes;
+}
+#endif
+
+} // namespace dgit
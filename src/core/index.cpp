@@ -1,77 +1,448 @@
 #include "dgit/index.hpp"
-#include "dgit/sha1.hpp"
+#include "dgit/batch_hash.hpp"
+#include "dgit/cache_tree.hpp"
+#include "dgit/mapped_file.hpp"
+#include "dgit/status.hpp"
+#include "dgit/trace.hpp"
+#include "dgit/untracked_cache.hpp"
 #include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <cstring>
 
 namespace fs = std::filesystem;
 namespace dgit {
 
-Index::Index(const std::string& git_dir) : git_dir_(git_dir), index_file_(git_dir + "/index") {
-    load();
+namespace {
+constexpr char kIndexSignature[] = "DIRC";
+constexpr size_t kIndexHeaderSize = 12;
+constexpr size_t kIndexChecksumSize = 20;
+// ctime, mtime, dev, ino, mode, uid, gid, size (4 bytes each), id, flags
+constexpr size_t kEntryFixedSize = 40 + ObjectId::kRawSize + 2;
+constexpr uint16_t kFlagNameMask = 0x0FFF;
+constexpr uint16_t kFlagStageMask = 0x3000;
+constexpr uint16_t kFlagExtended = 0x4000;
+constexpr uint16_t kFlagAssumeValid = 0x8000;
+constexpr size_t kWriteBufferSize = 128 * 1024;
+constexpr char kCacheTreeSignature[] = "TREE";
+// dgit's own optional extensions (upper-case, so git skips them)
+constexpr char kUntrackedCacheSignature[] = "DGUC";
+constexpr char kFsMonitorSignature[] = "DGFM";
+constexpr uint32_t kExtensionVersion = 1;
+// Entry stat fields minus the mode, as stored in extensions
+constexpr size_t kStatSize = 36;
+// Index edits the monitor cannot see; beyond this the token is dropped
+constexpr size_t kFsMonitorDirtyLimit = 1024;
+
+void append_be16(std::string& out, uint16_t value) {
+    out.push_back(static_cast<char>(value >> 8));
+    out.push_back(static_cast<char>(value));
 }
 
-void Index::add_entry(const std::string& path, const ObjectId& blob_id, FileMode mode) {
-    // Remove existing entry if present
-    auto it = path_index_.find(path);
-    if (it != path_index_.end()) {
-        entries_.erase(entries_.begin() + it->second);
+// Unmerged paths have one entry per stage (1 base, 2 ours, 3 theirs),
+// ordered by stage after the path
+bool entry_less(const IndexEntry& a, const IndexEntry& b) {
+    if (a.path != b.path) {
+        return a.path < b.path;
+    }
+    return (a.flags & kFlagStageMask) < (b.flags & kFlagStageMask);
+}
+
+bool same_entry_key(const IndexEntry& a, const IndexEntry& b) {
+    return a.path == b.path && (a.flags & kFlagStageMask) == (b.flags & kFlagStageMask);
+}
+
+uint16_t load_be16(const uint8_t* p) {
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+
+// Git's offset varint: big-endian 7-bit groups with an implicit +1 per
+// continuation byte (the same encoding as OFS_DELTA distances)
+void append_varint(std::string& out, size_t value) {
+    uint8_t buf[16];
+    size_t pos = sizeof(buf) - 1;
+    buf[pos] = static_cast<uint8_t>(value & 0x7F);
+    while (value >>= 7) {
+        buf[--pos] = static_cast<uint8_t>(0x80 | (--value & 0x7F));
+    }
+    out.append(reinterpret_cast<const char*>(buf + pos), sizeof(buf) - pos);
+}
+
+const uint8_t* decode_varint(const uint8_t* p, const uint8_t* end, size_t& value) {
+    if (p >= end) {
+        return nullptr;
+    }
+    uint8_t byte = *p++;
+    value = byte & 0x7F;
+    while (byte & 0x80) {
+        if (p >= end || value > (SIZE_MAX >> 8)) {
+            return nullptr;
+        }
+        byte = *p++;
+        value = ((value + 1) << 7) | (byte & 0x7F);
+    }
+    return p;
+}
+
+void append_stat(std::string& out, const IndexStat& stat) {
+    for (uint32_t field : {stat.ctime_sec, stat.ctime_nsec, stat.mtime_sec, stat.mtime_nsec, stat.dev, stat.ino,
+                           stat.uid, stat.gid, stat.size}) {
+        store_be32(out, field);
+    }
+}
+
+IndexStat load_stat(const uint8_t* p) {
+    IndexStat stat;
+    stat.ctime_sec = load_be32(p);
+    stat.ctime_nsec = load_be32(p + 4);
+    stat.mtime_sec = load_be32(p + 8);
+    stat.mtime_nsec = load_be32(p + 12);
+    stat.dev = load_be32(p + 16);
+    stat.ino = load_be32(p + 20);
+    stat.uid = load_be32(p + 24);
+    stat.gid = load_be32(p + 28);
+    stat.size = load_be32(p + 32);
+    return stat;
+}
+
+// Cursor over an extension payload; any overrun marks it bad
+class ExtensionReader {
+public:
+    ExtensionReader(const uint8_t* p, const uint8_t* end) : p_(p), end_(end) {}
+
+    bool ok() const { return p_ != nullptr; }
+    bool at_end() const { return p_ == end_; }
+
+    uint32_t be32() {
+        if (!p_ || end_ - p_ < 4) {
+            p_ = nullptr;
+            return 0;
+        }
+        uint32_t value = load_be32(p_);
+        p_ += 4;
+        return value;
+    }
+
+    size_t varint() {
+        size_t value = 0;
+        if (p_) {
+            p_ = decode_varint(p_, end_, value);
+        }
+        return value;
+    }
+
+    std::string string() {
+        const uint8_t* nul = p_ ? static_cast<const uint8_t*>(std::memchr(p_, '\0', end_ - p_)) : nullptr;
+        if (!nul) {
+            p_ = nullptr;
+            return {};
+        }
+        std::string value(reinterpret_cast<const char*>(p_), nul - p_);
+        p_ = nul + 1;
+        return value;
+    }
+
+    IndexStat stat() {
+        if (!p_ || static_cast<size_t>(end_ - p_) < kStatSize) {
+            p_ = nullptr;
+            return {};
+        }
+        IndexStat value = load_stat(p_);
+        p_ += kStatSize;
+        return value;
+    }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+};
+
+void append_extension(std::string& out, const char* signature, const std::string& payload) {
+    out.append(signature, 4);
+    store_be32(out, static_cast<uint32_t>(payload.size()));
+    out += payload;
+}
+
+bool valid_index_mode(uint32_t mode) {
+    return mode == 0100644 || mode == 0100755 || mode == 0120000 || mode == 0160000;
+}
+
+bool modified_at_or_after(const IndexStat& stat, uint32_t sec, uint32_t nsec) {
+    return stat.mtime_sec > sec || (stat.mtime_sec == sec && stat.mtime_nsec >= nsec);
+}
+
+// Streams the index through a fixed buffer into the lock file while
+// hashing it for the trailer
+class IndexFileWriter {
+public:
+    explicit IndexFileWriter(int fd) : fd_(fd) {
+        buffer_.reserve(kWriteBufferSize);
+    }
+
+    std::string& buffer() { return buffer_; }
+
+    void maybe_flush() {
+        if (buffer_.size() >= kWriteBufferSize) {
+            flush();
+        }
     }
 
-    // Add new entry
+    void finish() {
+        flush();
+        auto digest = hash_.digest();
+        buffer_.assign(reinterpret_cast<const char*>(digest.data()), digest.size());
+        write_all();
+    }
+
+private:
+    void flush() {
+        hash_.update(reinterpret_cast<const uint8_t*>(buffer_.data()), buffer_.size());
+        write_all();
+    }
+
+    void write_all() {
+        const char* data = buffer_.data();
+        size_t left = buffer_.size();
+        while (left > 0) {
+            ssize_t written = ::write(fd_, data, left);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw GitException("Failed to write index file");
+            }
+            data += written;
+            left -= static_cast<size_t>(written);
+        }
+        buffer_.clear();
+    }
+
+    int fd_;
+    std::string buffer_;
+    SHA1 hash_;
+};
+}
+
+IndexStat IndexStat::from_stat(const struct stat& st) {
+    // The on-disk format keeps the low 32 bits of every field
+    IndexStat result;
+    result.ctime_sec = static_cast<uint32_t>(st.st_ctim.tv_sec);
+    result.ctime_nsec = static_cast<uint32_t>(st.st_ctim.tv_nsec);
+    result.mtime_sec = static_cast<uint32_t>(st.st_mtim.tv_sec);
+    result.mtime_nsec = static_cast<uint32_t>(st.st_mtim.tv_nsec);
+    result.dev = static_cast<uint32_t>(st.st_dev);
+    result.ino = static_cast<uint32_t>(st.st_ino);
+    result.uid = static_cast<uint32_t>(st.st_uid);
+    result.gid = static_cast<uint32_t>(st.st_gid);
+    result.size = static_cast<uint32_t>(st.st_size);
+    return result;
+}
+
+bool IndexStat::matches(const struct stat& st) const {
+    IndexStat current = from_stat(st);
+    return mtime_sec == current.mtime_sec && mtime_nsec == current.mtime_nsec &&
+           ctime_sec == current.ctime_sec && ctime_nsec == current.ctime_nsec &&
+           size == current.size && ino == current.ino && dev == current.dev &&
+           uid == current.uid && gid == current.gid;
+}
+
+Index::Index(const std::string& git_dir)
+    : git_dir_(git_dir), index_file_(git_dir + "/index"), cache_tree_(std::make_unique<CacheTree>()) {
+    // The file is mapped and parsed on first use
+}
+
+Index::~Index() = default;
+
+void Index::add_entry(const std::string& path, const ObjectId& blob_id, FileMode mode) {
     struct stat st;
     if (stat(path.c_str(), &st) != 0) {
         throw GitException("Cannot stat file: " + path);
     }
+    add_entry(path, blob_id, mode, IndexStat::from_stat(st));
+}
 
-    IndexEntry entry(path, blob_id, mode, st.st_mtime, st.st_size);
-    entries_.push_back(entry);
-    update_path_index();
+void Index::add_entry(const std::string& path, const ObjectId& blob_id, FileMode mode, const IndexStat& stat) {
+    ensure_loaded();
+    dirty_ = true;
+
+    // Appending in order or replacing an existing path needs no re-sort
+    note_path_changed(path);
+    cache_tree_->invalidate(path);
+    if (pending_.empty()) {
+        if (entries_.empty() || entries_.back().path < path) {
+            note_tracking_changed(path);
+            entries_.emplace_back(path, blob_id, mode, stat);
+            return;
+        }
+        // An unmerged path's stages all collapse into the new entry
+        auto it = lower_bound(path);
+        if (it != entries_.end() && it->path == path && (it + 1 == entries_.end() || (it + 1)->path != path)) {
+            *it = IndexEntry(path, blob_id, mode, stat);
+            return;
+        }
+    }
+
+    // Anything else is batched and merged in one sorted pass on next read
+    note_tracking_changed(path);
+    pending_.push_back(PendingChange{IndexEntry(path, blob_id, mode, stat), false});
 }
 
 void Index::remove_entry(const std::string& path) {
-    auto it = path_index_.find(path);
-    if (it != path_index_.end()) {
-        entries_.erase(entries_.begin() + it->second);
-        update_path_index();
+    ensure_loaded();
+    note_path_changed(path);
+    note_tracking_changed(path);
+    cache_tree_->invalidate(path);
+    pending_.push_back(PendingChange{IndexEntry(path, ObjectId(), FileMode::Regular), true});
+    dirty_ = true;
+}
+
+void Index::note_tracking_changed(const std::string& path) {
+    // The directory's cached untracked list may now be wrong
+    if (untracked_cache_) {
+        untracked_cache_->invalidate(path);
+    }
+}
+
+void Index::note_path_changed(const std::string& path) {
+    // The monitor only reports work tree changes, so index edits have to
+    // be rechecked by hand on the next status
+    if (fsmonitor_token_.empty()) {
+        return;
+    }
+    if (fsmonitor_dirty_.size() >= kFsMonitorDirtyLimit) {
+        fsmonitor_token_.clear();
+        fsmonitor_dirty_.clear();
+    } else {
+        fsmonitor_dirty_.push_back(path);
+    }
+    fsmonitor_changed_ = true;
+}
+
+void Index::set_untracked_cache_enabled(bool enabled) {
+    if (enabled && !untracked_cache_) {
+        untracked_cache_ = std::make_unique<UntrackedCache>();
+    } else if (!enabled && untracked_cache_) {
+        untracked_cache_.reset();
+        // Drop the extension from the file on the next write
+        dirty_ = true;
+    }
+}
+
+void Index::set_fsmonitor_state(std::string token, std::vector<std::string> dirty) {
+    ensure_loaded();
+    if (token != fsmonitor_token_ || dirty != fsmonitor_dirty_) {
+        fsmonitor_token_ = std::move(token);
+        fsmonitor_dirty_ = std::move(dirty);
+        fsmonitor_changed_ = true;
+    }
+}
+
+void Index::save_caches() {
+    ensure_loaded();
+    bool caches_changed = fsmonitor_changed_ || cache_tree_->changed() ||
+                          (untracked_cache_ && untracked_cache_->changed());
+    if (!caches_changed || !fs::exists(index_file_)) {
+        return;
+    }
+    try {
+        save();
+    } catch (const GitException&) {
+        // Someone else holds the lock; the caches are rebuilt next time
     }
 }
 
 bool Index::has_entry(const std::string& path) const {
-    return path_index_.find(path) != path_index_.end();
+    return find_entry(path) != nullptr;
 }
 
 IndexEntry Index::get_entry(const std::string& path) const {
-    auto it = path_index_.find(path);
-    if (it == path_index_.end()) {
+    const IndexEntry* entry = find_entry(path);
+    if (!entry) {
         throw GitException("Entry not found: " + path);
     }
-    return entries_[it->second];
+    return *entry;
 }
 
-void Index::add_file(const std::string& filepath) {
-    // Create blob object for the file
-    ObjectId blob_id = dgit::SHA1::hash_file(filepath);
+const IndexEntry* Index::find_entry(const std::string& path) const {
+    ensure_current();
+    auto it = const_cast<Index*>(this)->lower_bound(path);
+    return it != entries_.end() && it->path == path ? &*it : nullptr;
+}
 
-    // Determine file mode
-    struct stat st;
-    if (stat(filepath.c_str(), &st) != 0) {
-        throw GitException("Cannot stat file: " + filepath);
+std::vector<IndexEntry>::iterator Index::lower_bound(const std::string& path) {
+    return std::lower_bound(entries_.begin(), entries_.end(), path,
+                            [](const IndexEntry& entry, const std::string& key) { return entry.path < key; });
+}
+
+void Index::ensure_current() const {
+    ensure_loaded();
+    if (!pending_.empty()) {
+        const_cast<Index*>(this)->apply_pending();
     }
+}
+
+void Index::apply_pending() {
+    // Later changes to the same path win, so sort stably and keep the last
+    std::stable_sort(pending_.begin(), pending_.end(), [](const PendingChange& a, const PendingChange& b) {
+        return a.entry.path < b.entry.path;
+    });
+
+    std::vector<IndexEntry> merged;
+    merged.reserve(entries_.size() + pending_.size());
 
-    FileMode mode = static_cast<FileMode>(st.st_mode & 0777);
+    auto existing = entries_.begin();
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        const std::string& path = pending_[i].entry.path;
+        if (i + 1 < pending_.size() && pending_[i + 1].entry.path == path) {
+            continue;
+        }
+
+        while (existing != entries_.end() && existing->path < path) {
+            merged.push_back(std::move(*existing++));
+        }
+        // Every stage of the path is replaced
+        while (existing != entries_.end() && existing->path == path) {
+            ++existing;
+        }
+        if (!pending_[i].remove) {
+            merged.push_back(std::move(pending_[i].entry));
+        }
+    }
+    std::move(existing, entries_.end(), std::back_inserter(merged));
+
+    entries_ = std::move(merged);
+    pending_.clear();
+}
+
+FileMode file_mode_from_stat(const struct stat& st) {
     if (S_ISDIR(st.st_mode)) {
-        mode = FileMode::Directory;
+        return FileMode::Directory;
+    } else if (S_ISLNK(st.st_mode)) {
+        return FileMode::Symlink;
     } else if (st.st_mode & S_IXUSR) {
-        mode = FileMode::Executable;
-    } else {
-        mode = FileMode::Regular;
+        return FileMode::Executable;
     }
+    return FileMode::Regular;
+}
 
-    add_entry(filepath, blob_id, mode);
+void Index::add_file(const std::string& filepath) {
+    add_files({filepath});
+}
+
+void Index::add_files(const std::vector<std::string>& filepaths) {
+    // Hash every file as a blob in parallel, then stage the results
+    for (const auto& file : hash_files(filepaths)) {
+        // Record the stat of the descriptor the content was hashed from
+        add_entry(file.path, file.id, file_mode_from_stat(file.st), IndexStat::from_stat(file.st));
+    }
 }
 
 void Index::remove_file(const std::string& filepath) {
@@ -79,6 +450,7 @@ void Index::remove_file(const std::string& filepath) {
 }
 
 std::vector<std::string> Index::list_files() const {
+    ensure_current();
     std::vector<std::string> files;
     for (const auto& entry : entries_) {
         files.push_back(entry.path);
@@ -87,14 +459,14 @@ std::vector<std::string> Index::list_files() const {
 }
 
 std::vector<std::string> Index::get_modified_files() const {
-    std::vector<std::string> modified;
-
-    for (const auto& entry : entries_) {
-        if (is_file_modified(entry, entry.path)) {
-            modified.push_back(entry.path);
-        }
-    }
-
+    StatusOptions options;
+    options.untracked = false;
+    // Status refreshes the caches this index carries, hence the cast
+    WorktreeStatus status = compute_status(const_cast<Index&>(*this), ".", options);
+
+    std::vector<std::string> modified = std::move(status.modified);
+    modified.insert(modified.end(), status.deleted.begin(), status.deleted.end());
+    std::sort(modified.begin(), modified.end());
     return modified;
 }
 
@@ -103,166 +475,441 @@ std::vector<std::string> Index::get_staged_files() const {
 }
 
 std::vector<std::string> Index::get_untracked_files() const {
-    std::vector<std::string> untracked;
-    std::vector<std::string> tracked = list_files();
-
-    // Get all files in working directory
-    for (const auto& entry : fs::recursive_directory_iterator(".")) {
-        if (entry.is_regular_file()) {
-            std::string path = fs::relative(entry.path()).string();
-
-            // Skip files in .git directory
-            if (path.find(".git/") == 0) {
-                continue;
-            }
-
-            // Check if file is tracked
-            bool is_tracked = false;
-            for (const auto& tracked_file : tracked) {
-                if (tracked_file == path) {
-                    is_tracked = true;
-                    break;
-                }
-            }
+    return find_untracked_files(const_cast<Index&>(*this));
+}
 
-            if (!is_tracked) {
-                untracked.push_back(path);
-            }
-        }
+bool Index::is_racy(const IndexEntry& entry) const {
+    // Written no earlier than the index itself: a change in the same clock
+    // tick would leave the stat data unchanged
+    if (timestamp_sec_ == 0 && timestamp_nsec_ == 0) {
+        return false;
     }
+    return modified_at_or_after(entry.stat, timestamp_sec_, timestamp_nsec_);
+}
 
-    return untracked;
+void Index::ensure_loaded() const {
+    // The parsed entries are a cache of the file, filled on first use
+    if (!loaded_) {
+        const_cast<Index*>(this)->load();
+    }
 }
 
 void Index::load() {
-    if (!fs::exists(index_file_)) {
+    TraceRegion region("index", "read");
+    entries_.clear();
+    pending_.clear();
+    loaded_ = true;
+    dirty_ = false;
+    version_ = default_version_;
+    timestamp_sec_ = 0;
+    timestamp_nsec_ = 0;
+    fsmonitor_token_.clear();
+    fsmonitor_dirty_.clear();
+    fsmonitor_changed_ = false;
+    cache_tree_ = std::make_unique<CacheTree>();
+    if (untracked_cache_) {
+        untracked_cache_ = std::make_unique<UntrackedCache>();
+    }
+
+    struct stat index_st;
+    if (::stat(index_file_.c_str(), &index_st) != 0) {
         return;
     }
 
-    std::ifstream file(index_file_, std::ios::binary);
-    if (!file) {
-        throw GitException("Cannot read index file: " + index_file_);
+    MappedFile map(index_file_);
+    const uint8_t* data = map.data();
+    size_t size = map.size();
+    if (size < kIndexHeaderSize + kIndexChecksumSize || std::memcmp(data, kIndexSignature, 4) != 0) {
+        throw GitException("Invalid index file header: " + index_file_);
     }
 
-    // Read header
-    char header[12];
-    file.read(header, 12);
+    uint32_t version = load_be32(data + 4);
+    if (version < 2 || version > 4) {
+        throw GitException("Unsupported index version " + std::to_string(version));
+    }
 
-    if (std::string(header, 4) != "DIRC") {
-        throw GitException("Invalid index file header");
+    size_t body_size = size - kIndexChecksumSize;
+    auto checksum = SHA1::hash_raw(data, body_size);
+    if (std::memcmp(checksum.data(), data + body_size, kIndexChecksumSize) != 0) {
+        throw GitException("Index file checksum mismatch: " + index_file_);
     }
 
-    // Read version and entry count
-    uint32_t version, entry_count;
-    std::memcpy(&version, header + 4, 4);
-    std::memcpy(&entry_count, header + 8, 4);
+    uint32_t entry_count = load_be32(data + 8);
+    entries_.reserve(entry_count);
 
-    entries_.clear();
+    const uint8_t* p = data + kIndexHeaderSize;
+    const uint8_t* end = data + body_size;
+    std::string previous_path;
     for (uint32_t i = 0; i < entry_count; ++i) {
-        // Read entry data (simplified - real Git index is more complex)
-        IndexEntry entry("", "", FileMode::Regular, 0, 0);
+        p = parse_entry(p, end, version, previous_path);
+        previous_path = entries_.back().path;
+    }
 
-        // Read path length
-        uint16_t path_len;
-        file.read(reinterpret_cast<char*>(&path_len), 2);
+    // Extensions: upper-case signatures are optional and may be skipped,
+    // anything else is required to read the index correctly
+    while (p < end) {
+        if (static_cast<size_t>(end - p) < 8) {
+            throw GitException("Corrupt index extension header");
+        }
+        std::string signature(reinterpret_cast<const char*>(p), 4);
+        uint32_t length = load_be32(p + 4);
+        if (length > static_cast<size_t>(end - p) - 8) {
+            throw GitException("Corrupt index extension: " + signature);
+        }
+        if (signature[0] < 'A' || signature[0] > 'Z') {
+            throw GitException("Index uses " + signature + " extension, which we do not understand");
+        }
+        read_extension(signature, p + 8, p + 8 + length);
+        p += 8 + length;
+    }
 
-        // Read path
-        std::string path(path_len, '\0');
-        file.read(&path[0], path_len);
+    version_ = version;
+    timestamp_sec_ = static_cast<uint32_t>(index_st.st_mtim.tv_sec);
+    timestamp_nsec_ = static_cast<uint32_t>(index_st.st_mtim.tv_nsec);
 
-        // Skip null terminator
-        file.read(reinterpret_cast<char*>(&path_len), 1);
+    // Git writes entries sorted by path and stage; anything else gets
+    // sorted (and de-duplicated, keeping the last) once here
+    if (!std::is_sorted(entries_.begin(), entries_.end(), entry_less)) {
+        std::stable_sort(entries_.begin(), entries_.end(), entry_less);
+    }
+    auto last = std::unique(entries_.rbegin(), entries_.rend(), same_entry_key);
+    entries_.erase(entries_.begin(), last.base());
+}
 
-        // Read other fields (simplified)
-        char id_bytes[20];
-        file.read(id_bytes, 20);
+const uint8_t* Index::parse_entry(const uint8_t* p, const uint8_t* end, uint32_t version,
+                                  const std::string& previous_path) {
+    if (static_cast<size_t>(end - p) < kEntryFixedSize) {
+        throw GitException("Truncated index entry");
+    }
 
-        // Convert to hex string
-        std::string id_str;
-        for (int j = 0; j < 20; ++j) {
-            char buf[3];
-            sprintf(buf, "%02x", static_cast<unsigned char>(id_bytes[j]));
-            id_str += buf;
+    IndexStat stat;
+    stat.ctime_sec = load_be32(p);
+    stat.ctime_nsec = load_be32(p + 4);
+    stat.mtime_sec = load_be32(p + 8);
+    stat.mtime_nsec = load_be32(p + 12);
+    stat.dev = load_be32(p + 16);
+    stat.ino = load_be32(p + 20);
+    uint32_t mode = load_be32(p + 24);
+    stat.uid = load_be32(p + 28);
+    stat.gid = load_be32(p + 32);
+    stat.size = load_be32(p + 36);
+    ObjectId id = ObjectId::from_raw(p + 40);
+    uint16_t flags = load_be16(p + 40 + ObjectId::kRawSize);
+
+    if (!valid_index_mode(mode)) {
+        throw GitException("Invalid mode in index entry: " + std::to_string(mode));
+    }
+
+    const uint8_t* entry_start = p;
+    p += kEntryFixedSize;
+    if (flags & kFlagExtended) {
+        if (version < 3 || end - p < 2) {
+            throw GitException("Unexpected extended flags in index entry");
         }
+        p += 2;
+    }
 
-        entry.path = path;
-        entry.blob_id = id_str;
+    std::string path;
+    if (version == 4) {
+        // Path is "strip N bytes from the previous path, then append"
+        size_t strip;
+        p = decode_varint(p, end, strip);
+        if (!p || strip > previous_path.size()) {
+            throw GitException("Corrupt prefix-compressed path in index");
+        }
+        const uint8_t* nul = static_cast<const uint8_t*>(std::memchr(p, '\0', end - p));
+        if (!nul) {
+            throw GitException("Unterminated path in index");
+        }
+        path.reserve(previous_path.size() - strip + (nul - p));
+        path.assign(previous_path, 0, previous_path.size() - strip);
+        path.append(reinterpret_cast<const char*>(p), nul - p);
+        p = nul + 1;
+    } else {
+        size_t name_length = flags & kFlagNameMask;
+        const uint8_t* nul;
+        if (name_length < kFlagNameMask) {
+            nul = p + name_length;
+            if (nul >= end || *nul != '\0') {
+                throw GitException("Corrupt path in index entry");
+            }
+        } else {
+            // Very long names don't fit the 12-bit length; scan for the NUL
+            nul = static_cast<const uint8_t*>(std::memchr(p, '\0', end - p));
+            if (!nul) {
+                throw GitException("Unterminated path in index");
+            }
+        }
+        path.assign(reinterpret_cast<const char*>(p), nul - p);
 
-        entries_.push_back(entry);
+        // 1-8 NULs pad each entry to a multiple of eight bytes
+        size_t entry_size = (static_cast<size_t>(nul - entry_start) + 8) & ~static_cast<size_t>(7);
+        p = entry_start + entry_size;
+        if (p > end) {
+            throw GitException("Truncated index entry");
+        }
     }
 
-    update_path_index();
+    entries_.emplace_back(std::move(path), id, static_cast<FileMode>(mode), stat);
+    entries_.back().flags = flags & (kFlagStageMask | kFlagAssumeValid);
+    return p;
 }
 
 void Index::save() {
-    std::ofstream file(index_file_, std::ios::binary);
-    if (!file) {
-        throw GitException("Cannot write index file: " + index_file_);
+    ensure_current();
+    bool caches_changed = fsmonitor_changed_ || cache_tree_->changed() ||
+                          (untracked_cache_ && untracked_cache_->changed());
+    if (!dirty_ && !caches_changed && fs::exists(index_file_)) {
+        return;
+    }
+    TraceRegion region("index", "write");
+
+    // Write index.lock and rename it over the index, as git does, so a
+    // crash never leaves a half-written index and concurrent writers fail
+    std::string lock_path = index_file_ + ".lock";
+    int fd = ::open(lock_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        if (errno == EEXIST) {
+            throw GitException("Unable to create '" + lock_path + "': File exists");
+        }
+        throw GitException("Cannot write index file: " + lock_path);
     }
 
-    // Write header
-    std::string header = "DIRC";
-    uint32_t version = 2;
-    uint32_t entry_count = entries_.size();
+    try {
+        // The lock file's mtime is "now" on the file system's own clock
+        struct stat lock_st;
+        if (::fstat(fd, &lock_st) != 0) {
+            throw GitException("Cannot stat index lock: " + lock_path);
+        }
+        smudge_racy_entries(static_cast<uint32_t>(lock_st.st_mtim.tv_sec),
+                            static_cast<uint32_t>(lock_st.st_mtim.tv_nsec));
+
+        IndexFileWriter writer(fd);
+        std::string& out = writer.buffer();
+        out.append(kIndexSignature, 4);
+        store_be32(out, version_);
+        store_be32(out, static_cast<uint32_t>(entries_.size()));
+
+        // entries_ is kept sorted by path and stage, as the format requires
+        const std::string empty;
+        const std::string* previous = &empty;
+        for (const IndexEntry& entry : entries_) {
+            serialize_entry(entry, *previous, out);
+            previous = &entry.path;
+            writer.maybe_flush();
+        }
+        write_extensions(out);
+        writer.finish();
 
-    file.write(header.c_str(), 4);
-    file.write(reinterpret_cast<char*>(&version), 4);
-    file.write(reinterpret_cast<char*>(&entry_count), 4);
+        if (::fstat(fd, &lock_st) == 0) {
+            timestamp_sec_ = static_cast<uint32_t>(lock_st.st_mtim.tv_sec);
+            timestamp_nsec_ = static_cast<uint32_t>(lock_st.st_mtim.tv_nsec);
+        }
+    } catch (...) {
+        ::close(fd);
+        ::unlink(lock_path.c_str());
+        throw;
+    }
 
-    // Write entries (simplified)
-    for (const auto& entry : entries_) {
-        // Write path
-        uint16_t path_len = entry.path.length();
-        file.write(reinterpret_cast<char*>(&path_len), 2);
-        file.write(entry.path.c_str(), path_len);
-        file.write("\0", 1);
+    if (::close(fd) != 0 || ::rename(lock_path.c_str(), index_file_.c_str()) != 0) {
+        ::unlink(lock_path.c_str());
+        throw GitException("Cannot write index file: " + index_file_);
+    }
+    dirty_ = false;
+    fsmonitor_changed_ = false;
+    cache_tree_->mark_saved();
+    if (untracked_cache_) {
+        untracked_cache_->mark_saved();
+    }
+}
 
-        // Write SHA-1
-        std::string id_hex = entry.blob_id;
-        for (size_t i = 0; i < 20; ++i) {
-            uint8_t byte = std::stoi(id_hex.substr(i * 2, 2), nullptr, 16);
-            file.write(reinterpret_cast<char*>(&byte), 1);
+void Index::read_extension(const std::string& signature, const uint8_t* p, const uint8_t* end) {
+    // Optional data: anything malformed is dropped rather than fatal
+    ExtensionReader in(p, end);
+    if (signature == kCacheTreeSignature) {
+        cache_tree_->parse(p, static_cast<size_t>(end - p));
+    } else if (signature == kUntrackedCacheSignature && untracked_cache_) {
+        if (in.be32() != kExtensionVersion) {
+            return;
+        }
+        UntrackedCache cache;
+        size_t count = in.varint();
+        for (size_t i = 0; i < count && in.ok(); ++i) {
+            std::string path = in.string();
+            UntrackedCache::Directory dir;
+            dir.stat = in.stat();
+            size_t files = in.varint();
+            for (size_t k = 0; k < files && in.ok(); ++k) {
+                dir.untracked.push_back(in.string());
+            }
+            size_t subdirs = in.varint();
+            for (size_t k = 0; k < subdirs && in.ok(); ++k) {
+                dir.subdirs.push_back(in.string());
+            }
+            cache.restore(std::move(path), std::move(dir));
+        }
+        if (in.ok() && in.at_end()) {
+            *untracked_cache_ = std::move(cache);
+            untracked_cache_->mark_saved();
+        }
+    } else if (signature == kFsMonitorSignature) {
+        if (in.be32() != kExtensionVersion) {
+            return;
+        }
+        std::string token = in.string();
+        std::vector<std::string> dirty;
+        size_t count = in.varint();
+        for (size_t i = 0; i < count && in.ok(); ++i) {
+            dirty.push_back(in.string());
+        }
+        if (in.ok() && in.at_end()) {
+            fsmonitor_token_ = std::move(token);
+            fsmonitor_dirty_ = std::move(dirty);
         }
     }
 }
 
-void Index::clear() {
-    entries_.clear();
-    path_index_.clear();
-}
+void Index::write_extensions(std::string& out) const {
+    if (cache_tree_->root()) {
+        std::string payload;
+        cache_tree_->serialize(payload);
+        append_extension(out, kCacheTreeSignature, payload);
+    }
 
-void Index::update_path_index() {
-    path_index_.clear();
-    for (size_t i = 0; i < entries_.size(); ++i) {
-        path_index_[entries_[i].path] = i;
+    if (untracked_cache_ && !untracked_cache_->empty()) {
+        std::string payload;
+        store_be32(payload, kExtensionVersion);
+        const auto& dirs = untracked_cache_->directories();
+        append_varint(payload, dirs.size());
+        for (const auto& [path, dir] : dirs) {
+            payload.append(path).push_back('\0');
+            append_stat(payload, dir.stat);
+            append_varint(payload, dir.untracked.size());
+            for (const auto& name : dir.untracked) {
+                payload.append(name).push_back('\0');
+            }
+            append_varint(payload, dir.subdirs.size());
+            for (const auto& name : dir.subdirs) {
+                payload.append(name).push_back('\0');
+            }
+        }
+        append_extension(out, kUntrackedCacheSignature, payload);
+    }
+
+    if (!fsmonitor_token_.empty()) {
+        std::string payload;
+        store_be32(payload, kExtensionVersion);
+        payload.append(fsmonitor_token_).push_back('\0');
+        append_varint(payload, fsmonitor_dirty_.size());
+        for (const auto& path : fsmonitor_dirty_) {
+            payload.append(path).push_back('\0');
+        }
+        append_extension(out, kFsMonitorSignature, payload);
     }
 }
 
-bool Index::is_file_modified(const IndexEntry& entry, const std::string& filepath) const {
-    struct stat st;
-    if (stat(filepath.c_str(), &st) != 0) {
-        return true; // File doesn't exist
+void Index::smudge_racy_entries(uint32_t now_sec, uint32_t now_nsec) {
+    // Entries modified in the same tick the index is written would look
+    // clean forever once a later write moves the index timestamp on. As
+    // git does, check their content now and zero the size of any that no
+    // longer match, which forces a rehash on every status until re-added.
+    std::vector<IndexEntry*> racy;
+    std::vector<std::string> paths;
+    for (IndexEntry& entry : entries_) {
+        if (entry.stat.size != 0 && modified_at_or_after(entry.stat, now_sec, now_nsec)) {
+            if (entry.mode == FileMode::Symlink) {
+                entry.stat.size = 0;
+                continue;
+            }
+            racy.push_back(&entry);
+            paths.push_back(entry.path);
+        }
+    }
+    if (racy.empty()) {
+        return;
     }
 
-    return st.st_mtime != entry.mtime || st.st_size != entry.size;
+    std::vector<HashedFile> hashed;
+    try {
+        hashed = hash_files(paths);
+    } catch (const GitException&) {
+        // Unreadable now: smudge the lot rather than trust any of them
+        for (IndexEntry* entry : racy) {
+            entry->stat.size = 0;
+        }
+        return;
+    }
+    for (size_t i = 0; i < racy.size(); ++i) {
+        if (hashed[i].id != racy[i]->blob_id) {
+            racy[i]->stat.size = 0;
+        }
+    }
 }
 
-// Utility functions for index format
-std::string Index::serialize_entry(const IndexEntry& entry) const {
-    // Simplified serialization
-    return entry.path + "\0" + entry.blob_id;
+void Index::clear() {
+    ensure_loaded();
+    entries_.clear();
+    pending_.clear();
+    if (untracked_cache_) {
+        untracked_cache_->clear();
+    }
+    cache_tree_->clear();
+    fsmonitor_token_.clear();
+    fsmonitor_dirty_.clear();
+    dirty_ = true;
 }
 
-IndexEntry Index::deserialize_entry(const std::string& data) {
-    size_t null_pos = data.find('\0');
-    if (null_pos == std::string::npos) {
-        throw GitException("Invalid index entry format");
+void Index::set_version(uint32_t version) {
+    if (version < 2 || version > 4) {
+        throw GitException("Unsupported index version " + std::to_string(version));
+    }
+    ensure_loaded();
+    if (version != version_) {
+        version_ = version;
+        dirty_ = true;
     }
+}
 
-    std::string path = data.substr(0, null_pos);
-    std::string blob_id = data.substr(null_pos + 1);
+void Index::set_default_version(uint32_t version) {
+    if (version < 2 || version > 4) {
+        throw GitException("Unsupported index version " + std::to_string(version));
+    }
+    default_version_ = version;
+}
 
-    return IndexEntry(path, blob_id, FileMode::Regular, 0, 0);
+// Utility functions for index format
+void Index::serialize_entry(const IndexEntry& entry, const std::string& previous_path, std::string& out) const {
+    size_t entry_start = out.size();
+    const IndexStat& stat = entry.stat;
+    store_be32(out, stat.ctime_sec);
+    store_be32(out, stat.ctime_nsec);
+    store_be32(out, stat.mtime_sec);
+    store_be32(out, stat.mtime_nsec);
+    store_be32(out, stat.dev);
+    store_be32(out, stat.ino);
+    store_be32(out, static_cast<uint32_t>(entry.mode));
+    store_be32(out, stat.uid);
+    store_be32(out, stat.gid);
+    store_be32(out, stat.size);
+    out.append(reinterpret_cast<const char*>(entry.blob_id.data()), ObjectId::kRawSize);
+
+    uint16_t name_length = static_cast<uint16_t>(std::min<size_t>(entry.path.size(), kFlagNameMask));
+    append_be16(out, static_cast<uint16_t>((entry.flags & (kFlagStageMask | kFlagAssumeValid)) | name_length));
+
+    if (version_ == 4) {
+        size_t common = 0;
+        size_t limit = std::min(previous_path.size(), entry.path.size());
+        while (common < limit && previous_path[common] == entry.path[common]) {
+            ++common;
+        }
+        append_varint(out, previous_path.size() - common);
+        out.append(entry.path, common, std::string::npos);
+        out.push_back('\0');
+    } else {
+        out += entry.path;
+        size_t padded = (out.size() - entry_start + 8) & ~static_cast<size_t>(7);
+        out.append(padded - (out.size() - entry_start), '\0');
+    }
 }
 
 } // namespace dgit
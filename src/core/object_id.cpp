@@ -0,0 +1,149 @@
+#include "dgit/object_id.hpp"
+#include "dgit/sha1.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace dgit {
+
+namespace {
+
+constexpr char kHexDigits[] = "0123456789abcdef";
+
+// 0xFF marks a non-hex character
+struct HexDecodeTable {
+    uint8_t values[256];
+
+    constexpr HexDecodeTable() : values{} {
+        for (int i = 0; i < 256; ++i) {
+            values[i] = 0xFF;
+        }
+        for (int i = 0; i < 10; ++i) {
+            values['0' + i] = static_cast<uint8_t>(i);
+        }
+        for (int i = 0; i < 6; ++i) {
+            values['a' + i] = static_cast<uint8_t>(10 + i);
+            values['A' + i] = static_cast<uint8_t>(10 + i);
+        }
+    }
+};
+
+constexpr HexDecodeTable kHexDecode;
+
+void encode_scalar(const uint8_t* raw, size_t length, char* out) {
+    for (size_t i = 0; i < length; ++i) {
+        out[i * 2] = kHexDigits[raw[i] >> 4];
+        out[i * 2 + 1] = kHexDigits[raw[i] & 0x0F];
+    }
+}
+
+bool decode_scalar(const char* hex, size_t length, uint8_t* out) {
+    uint8_t invalid = 0;
+    for (size_t i = 0; i < length; ++i) {
+        uint8_t hi = kHexDecode.values[static_cast<uint8_t>(hex[i * 2])];
+        uint8_t lo = kHexDecode.values[static_cast<uint8_t>(hex[i * 2 + 1])];
+        invalid |= (hi | lo) & 0xF0;
+        out[i] = static_cast<uint8_t>((hi << 4) | lo);
+    }
+    return invalid == 0;
+}
+
+#if defined(__SSE2__)
+
+// Nibbles 0-15 to '0'-'9' / 'a'-'f': add '0', plus 39 more for 10-15
+inline __m128i nibbles_to_ascii(__m128i nibbles) {
+    __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibbles, _mm_set1_epi8('0')), letters);
+}
+
+// 16 bytes -> 32 hex characters
+inline void encode_16(const uint8_t* raw, char* out) {
+    const __m128i low_mask = _mm_set1_epi8(0x0F);
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(raw));
+    __m128i hi = nibbles_to_ascii(_mm_and_si128(_mm_srli_epi16(bytes, 4), low_mask));
+    __m128i lo = nibbles_to_ascii(_mm_and_si128(bytes, low_mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(hi, lo));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(hi, lo));
+}
+
+inline __m128i in_range(__m128i c, char first, char last) {
+    // Signed compares: bytes >= 0x80 are negative and fall outside every range
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(static_cast<char>(first - 1))),
+                         _mm_cmpgt_epi8(_mm_set1_epi8(static_cast<char>(last + 1)), c));
+}
+
+// 16 hex characters -> 8 bytes, stored to out[0..7]
+inline bool decode_16(const char* hex, uint8_t* out) {
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex));
+    __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+
+    __m128i is_digit = in_range(c, '0', '9');
+    __m128i is_alpha = in_range(lower, 'a', 'f');
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha)) != 0xFFFF) {
+        return false;
+    }
+
+    __m128i values = _mm_or_si128(
+        _mm_and_si128(is_digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+        _mm_and_si128(is_alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+
+    // Each 16-bit lane holds (high nibble, low nibble) in memory order
+    __m128i hi = _mm_slli_epi16(_mm_and_si128(values, _mm_set1_epi16(0x00FF)), 4);
+    __m128i lo = _mm_srli_epi16(values, 8);
+    __m128i packed = _mm_packus_epi16(_mm_or_si128(hi, lo), _mm_setzero_si128());
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out), packed);
+    return true;
+}
+
+#endif
+
+} // anonymous namespace
+
+void encode_hex_id(const uint8_t raw[ObjectId::kRawSize], char out[ObjectId::kHexSize]) {
+#if defined(__SSE2__)
+    encode_16(raw, out);
+    encode_scalar(raw + 16, 4, out + 32);
+#else
+    encode_scalar(raw, ObjectId::kRawSize, out);
+#endif
+}
+
+bool decode_hex_id(const char hex[ObjectId::kHexSize], uint8_t out[ObjectId::kRawSize]) {
+#if defined(__SSE2__)
+    return decode_16(hex, out) && decode_16(hex + 16, out + 8) && decode_scalar(hex + 32, 4, out + 16);
+#else
+    return decode_scalar(hex, ObjectId::kRawSize, out);
+#endif
+}
+
+ObjectId ObjectId::from_hex(std::string_view hex) {
+    auto id = parse_hex(hex);
+    if (!id) {
+        throw GitException("Invalid object id: " + std::string(hex));
+    }
+    return *id;
+}
+
+std::optional<ObjectId> ObjectId::parse_hex(std::string_view hex) {
+    if (hex.size() != kHexSize) {
+        return std::nullopt;
+    }
+    ObjectId id;
+    if (!decode_hex_id(hex.data(), id.bytes_.data())) {
+        return std::nullopt;
+    }
+    return id;
+}
+
+std::string ObjectId::hex() const {
+    std::string result(kHexSize, '\0');
+    encode_hex_id(bytes_.data(), &result[0]);
+    return result;
+}
+
+void ObjectId::write_hex(char out[kHexSize]) const {
+    encode_hex_id(bytes_.data(), out);
+}
+
+} // namespace dgit
@@ -0,0 +1,19 @@
+#include "dgit/quote.hpp"
+
+namespace dgit {
+
+std::string shell_quote(const std::string& arg) {
+    std::string quoted = "'";
+    for (char c : arg) {
+        if (c == '\'' || c == '!') {
+            quoted += "'\\";
+            quoted += c;
+            quoted += '\'';
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "'";
+}
+
+} // namespace dgit
@@ -1,4 +1,12 @@
 #include "dgit/repository.hpp"
+#include "dgit/batch_hash.hpp"
+#include "dgit/cache_tree.hpp"
+#include "dgit/compression.hpp"
+#include "dgit/network.hpp"
+#include "dgit/object_view.hpp"
+#include "dgit/packfile.hpp"
+#include "dgit/trace.hpp"
+#include "dgit/tree_iterator.hpp"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -6,6 +14,38 @@
 namespace fs = std::filesystem;
 namespace dgit {
 
+namespace {
+struct TreeItem {
+    std::string path;
+    FileMode mode;
+    ObjectId id;
+};
+
+// Lists the blobs of a tree recursively. Subtrees matching a valid
+// cache-tree node are recorded in `same_dirs` ("dir/") instead.
+void flatten_tree(ObjectDatabase& objects, const ObjectId& tree_id, const std::string& prefix,
+                  const CacheTree::Node* cached, std::vector<TreeItem>& files, std::vector<std::string>& same_dirs) {
+    if (cached && cached->valid() && cached->id == tree_id) {
+        same_dirs.push_back(prefix);
+        return;
+    }
+
+    auto raw = objects.read_raw(tree_id);
+    if (!raw || raw->type != ObjectType::Tree) {
+        throw GitException("Cannot read tree " + tree_id.hex());
+    }
+
+    for (const auto& entry : TreeView(raw->data)) {
+        if (entry.is_directory()) {
+            flatten_tree(objects, entry.id(), prefix + std::string(entry.name) + "/",
+                         cached ? cached->find(entry.name) : nullptr, files, same_dirs);
+        } else {
+            files.push_back(TreeItem{prefix + std::string(entry.name), entry.mode, entry.id()});
+        }
+    }
+}
+}
+
 std::unique_ptr<Repository> Repository::create(const std::string& path) {
     auto repo = std::unique_ptr<Repository>(new Repository(path, path + "/.git"));
     repo->init();
@@ -30,9 +70,41 @@ Repository::Repository(const std::string& path, const std::string& git_dir)
 
     // Initialize components
     objects_ = std::make_unique<ObjectDatabase>(git_dir_);
-    refs_ = std::make_unique<Refs>(git_dir_);
     config_ = std::make_unique<Config>(git_dir_);
+
+    // extensions.refStorage picks the ref backend, as in git
+    std::string ref_storage = config_->get_string("extensions", "refStorage", "files");
+    if (ref_storage != "files" && ref_storage != "reftable") {
+        throw GitException("Unknown ref storage format: " + ref_storage);
+    }
+    refs_ = std::make_unique<Refs>(git_dir_, ref_storage == "reftable" ? RefStorage::Reftable : RefStorage::Files);
     index_ = std::make_unique<Index>(git_dir_);
+
+    // index.version only applies when a new index file is created
+    index_->set_default_version(static_cast<uint32_t>(config_->get_int("index", "version", 2)));
+    index_->set_untracked_cache_enabled(config_->get_bool("core", "untrackedCache", false));
+    fsmonitor_ = FsMonitor::from_config(*config_, path_);
+
+    // core.looseCompression falls back to core.compression, as in git
+    int compression = config_->get_int("core", "compression", kDefaultCompressionLevel);
+    objects_->set_compression_level(config_->get_int("core", "looseCompression", compression));
+    objects_->set_cache_limit(config_->get_size("core", "objectCacheLimit", ObjectCache::kDefaultLimit));
+    objects_->set_delta_base_cache_limit(
+        config_->get_size("core", "deltaBaseCacheLimit", PackReader::kDefaultDeltaBaseCacheLimit));
+
+    // A partial clone fetches what its filter left out on first use
+    std::string promisor = config_->get_string("extensions", "partialClone", "");
+    if (!promisor.empty()) {
+        set_promisor_remote(promisor);
+    }
+}
+
+void Repository::set_promisor_remote(const std::string& name) {
+    objects_->set_promisor([this, name](const std::vector<ObjectId>& ids) {
+        Remote remote(*this, name);
+        remote.set_url(config_->get_string("remote", name, ""));
+        remote.fetch_objects(ids);
+    });
 }
 
 void Repository::init() {
@@ -57,17 +129,13 @@ void Repository::init() {
     config_->save();
 
     // Create initial branch
-    refs_->create_ref("refs/heads/master", "");
+    refs_->create_ref("refs/heads/master", ObjectId());
 
     std::cout << "Initialized empty Git repository in " << git_dir_ << "\n";
 }
 
 void Repository::commit(const std::string& message, const Person& author, const Person& committer) {
-    // Check if there are staged changes
-    if (index_->entry_count() == 0) {
-        throw GitException("Nothing to commit");
-    }
-
+    TraceRegion region("commit", "write");
     // Get current HEAD
     ObjectId head_id;
     try {
@@ -76,12 +144,18 @@ void Repository::commit(const std::string& message, const Person& author, const
         // No commits yet
     }
 
-    // Create tree object
+    // Create tree object; only directories changed since the last one are
+    // rebuilt
     ObjectId tree_id = write_tree();
 
+    // Check if there are staged changes
+    if (head_id.is_null() ? index_->entry_count() == 0 : tree_id == commit_tree(head_id)) {
+        throw GitException("Nothing to commit");
+    }
+
     // Create parent list
-    std::vector<std::string> parents;
-    if (!head_id.empty()) {
+    std::vector<ObjectId> parents;
+    if (!head_id.is_null()) {
         parents.push_back(head_id);
     }
 
@@ -93,87 +167,132 @@ void Repository::commit(const std::string& message, const Person& author, const
     // Update HEAD
     refs_->update_ref("refs/heads/master", commit_id);
 
-    // Clear index
-    index_->clear();
+    // The index now matches the commit; keep it, with its cache-tree, as
+    // the base of the next one
     index_->save();
 
-    std::cout << "Created commit " << commit_id.substr(0, 7) << "\n";
+    std::cout << "Created commit " << commit_id.short_hex() << "\n";
 }
 
 ObjectId Repository::write_blob(const std::string& filepath) {
-    // Create blob from file
-    auto blob = std::make_unique<Blob>("");
-    std::ifstream file(filepath, std::ios::binary);
-
-    if (!file) {
-        throw GitException("Cannot read file: " + filepath);
-    }
+    // Streamed from disk in chunks; the content is never held in memory
+    return objects_->store_blob_file(filepath);
+}
 
-    std::string content((std::istreambuf_iterator<char>(file)),
-                        std::istreambuf_iterator<char>());
+ObjectId Repository::write_tree() {
+    CacheTreeStore store;
+    store.has_object = [this](const ObjectId& id) { return objects_->exists(id); };
+    store.ensure_blob = [this](const IndexEntry& entry) {
+        if (entry.mode == FileMode::Gitlink || objects_->exists(entry.blob_id)) {
+            return;
+        }
 
-    blob = std::make_unique<Blob>(content);
-    ObjectId blob_id = blob->id();
-    objects_->store(std::move(blob));
+        // `add` only hashes; store the content now if it is unchanged
+        ObjectId stored;
+        if (entry.mode == FileMode::Symlink) {
+            std::error_code ec;
+            std::string target = fs::read_symlink(entry.path, ec).string();
+            if (!ec) {
+                auto blob = std::make_unique<Blob>(target);
+                stored = blob->id();
+                objects_->store(std::move(blob));
+            }
+        } else if (fs::is_regular_file(entry.path)) {
+            stored = write_blob(entry.path);
+        }
+        if (stored != entry.blob_id) {
+            throw GitException("Staged content of '" + entry.path + "' is not in the object database");
+        }
+    };
+    store.store_tree = [this](std::unique_ptr<Tree> tree) { objects_->store(std::move(tree)); };
 
-    return blob_id;
+    return index_->cache_tree().update(index_->entries(), store).root;
 }
 
-ObjectId Repository::write_tree(const std::string& directory) {
-    return write_tree_recursive(directory);
+ObjectId Repository::commit_tree(const ObjectId& commit_id) {
+    auto raw = objects_->read_raw(commit_id);
+    if (!raw || raw->type != ObjectType::Commit) {
+        throw GitException("Cannot read commit " + commit_id.hex());
+    }
+    return CommitView(raw->data).tree_id();
 }
 
-ObjectId Repository::write_tree_recursive(const std::string& directory, const std::string& base_path) {
-    auto tree = std::make_unique<Tree>();
+std::vector<ObjectId> Repository::commit_tips() {
+    return refs_->commit_tips(*objects_);
+}
 
-    for (const auto& entry : fs::directory_iterator(directory)) {
-        std::string name = entry.path().filename().string();
-        std::string full_path = entry.path().string();
+std::vector<std::string> Repository::staged_files() {
+    const auto& entries = index_->entries();
+    ObjectId head_id;
+    try {
+        head_id = refs_->get_head();
+    } catch (const GitException&) {
+    }
+    if (head_id.is_null()) {
+        return index_->list_files();
+    }
 
-        // Skip .git directory
-        if (name == ".git") {
+    // Subtrees whose cache-tree entry still matches HEAD are identical and
+    // never read, so an unchanged index costs one comparison
+    std::vector<TreeItem> head_files;
+    std::vector<std::string> same_dirs;
+    flatten_tree(*objects_, commit_tree(head_id), "", index_->cache_tree().root(), head_files, same_dirs);
+    std::sort(head_files.begin(), head_files.end(),
+              [](const TreeItem& a, const TreeItem& b) { return a.path < b.path; });
+    std::sort(same_dirs.begin(), same_dirs.end());
+
+    auto in_same_dir = [&same_dirs](const std::string& path) {
+        auto it = std::upper_bound(same_dirs.begin(), same_dirs.end(), path);
+        return it != same_dirs.begin() && path.compare(0, (it - 1)->size(), *(it - 1)) == 0;
+    };
+
+    std::vector<std::string> staged;
+    auto head = head_files.begin();
+    for (const auto& entry : entries) {
+        if (in_same_dir(entry.path)) {
             continue;
         }
-
-        if (entry.is_regular_file()) {
-            // Check if file is in index
-            std::string relative_path = base_path.empty() ? name : base_path + "/" + name;
-            if (index_->has_entry(relative_path)) {
-                IndexEntry index_entry = index_->get_entry(relative_path);
-                tree->add_entry(FileMode::Regular, index_entry.blob_id, name);
-            } else {
-                // Create blob for new file
-                ObjectId blob_id = write_blob(full_path);
-                tree->add_entry(FileMode::Regular, blob_id, name);
+        while (head != head_files.end() && head->path < entry.path) {
+            staged.push_back(head->path);   // deleted
+            ++head;
+        }
+        if (head != head_files.end() && head->path == entry.path) {
+            if (head->id != entry.blob_id || head->mode != entry.mode) {
+                staged.push_back(entry.path);
             }
-        } else if (entry.is_directory()) {
-            // Recursively create subtree
-            ObjectId subtree_id = write_tree_recursive(full_path, base_path.empty() ? name : base_path + "/" + name);
-            tree->add_entry(FileMode::Directory, subtree_id, name);
+            ++head;
+        } else {
+            staged.push_back(entry.path);   // added
         }
     }
+    for (; head != head_files.end(); ++head) {
+        staged.push_back(head->path);
+    }
 
-    ObjectId tree_id = tree->id();
-    objects_->store(std::move(tree));
-    return tree_id;
+    std::sort(staged.begin(), staged.end());
+    return staged;
 }
 
+
 std::string Repository::read_file(const ObjectId& blob_id, const std::string& filepath) {
-    auto blob = objects_->load(blob_id);
-    if (blob->type() != ObjectType::Blob) {
-        throw GitException("Object is not a blob: " + blob_id);
+    // Read once and handed out, so the blob need not stay in the cache
+    auto raw = objects_->read_raw(blob_id);
+    if (!raw) {
+        throw GitException("Object not found: " + blob_id.hex());
+    }
+    if (raw->type != ObjectType::Blob) {
+        throw GitException("Object is not a blob: " + blob_id.hex());
     }
 
     // Write content to file if path provided
     if (!filepath.empty()) {
         std::ofstream file(filepath, std::ios::binary);
-        if (!file) {
+        if (!file || !file.write(raw->data.data(), static_cast<std::streamsize>(raw->data.size()))) {
             throw GitException("Cannot write file: " + filepath);
         }
-        file << blob->data();
     }
 
-    return blob->data();
+    return std::move(raw->data);
 }
 
 } // namespace dgit
@@ -1,21 +1,11 @@
 #include "dgit/sha1.hpp"
+#include "dgit/sha1_kernels.hpp"
+#include <algorithm>
 #include <fstream>
-#include <iomanip>
-#include <sstream>
 #include <cstring>
 
 namespace dgit {
 
-// SHA-1 constants
-static const uint32_t K[4] = {
-    0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
-};
-
-// Left rotate helper
-inline uint32_t left_rotate(uint32_t value, uint32_t count) {
-    return (value << count) | (value >> (32 - count));
-}
-
 SHA1::SHA1() : h0_(0x67452301), h1_(0xEFCDAB89), h2_(0x98BADCFE),
                h3_(0x10325476), h4_(0xC3D2E1F0), message_length_(0),
                buffer_length_(0), finalized_(false) {}
@@ -25,108 +15,95 @@ void SHA1::update(const uint8_t* data, size_t length) {
         throw GitException("SHA1: Cannot update after finalization");
     }
 
-    for (size_t i = 0; i < length; ++i) {
-        buffer_[buffer_length_++] = data[i];
-        message_length_ += 8;
+    message_length_ += static_cast<uint64_t>(length) * 8;
 
-        if (buffer_length_ == 64) {
-            process_block();
-            buffer_length_ = 0;
+    // Top up a partially filled block first
+    if (buffer_length_ > 0) {
+        size_t take = std::min(length, sizeof(buffer_) - buffer_length_);
+        std::memcpy(buffer_ + buffer_length_, data, take);
+        buffer_length_ += take;
+        data += take;
+        length -= take;
+
+        if (buffer_length_ < sizeof(buffer_)) {
+            return;
         }
+        process_blocks(buffer_, 1);
+        buffer_length_ = 0;
     }
-}
-
-void SHA1::update(const std::string& data) {
-    update(reinterpret_cast<const uint8_t*>(data.c_str()), data.length());
-}
 
-std::string SHA1::final() {
-    if (finalized_) {
-        return binary_to_hex(reinterpret_cast<uint8_t*>(&h0_), 20);
+    // Hash whole blocks straight out of the caller's buffer
+    size_t blocks = length / 64;
+    if (blocks > 0) {
+        process_blocks(data, blocks);
+        data += blocks * 64;
+        length -= blocks * 64;
     }
 
-    pad_message();
-    process_block();
-    finalized_ = true;
-
-    // Convert hash to hex string
-    uint8_t hash[20];
-    uint32_t* hash_words = reinterpret_cast<uint32_t*>(hash);
-    hash_words[0] = h0_;
-    hash_words[1] = h1_;
-    hash_words[2] = h2_;
-    hash_words[3] = h3_;
-    hash_words[4] = h4_;
-
-    return binary_to_hex(hash, 20);
+    if (length > 0) {
+        std::memcpy(buffer_, data, length);
+        buffer_length_ = length;
+    }
 }
 
-void SHA1::process_block() {
-    uint32_t w[80];
+void SHA1::update(const std::string& data) {
+    update(reinterpret_cast<const uint8_t*>(data.data()), data.length());
+}
 
-    // Prepare message schedule
-    for (int i = 0; i < 16; ++i) {
-        w[i] = (buffer_[i * 4] << 24) | (buffer_[i * 4 + 1] << 16) |
-               (buffer_[i * 4 + 2] << 8) | buffer_[i * 4 + 3];
+SHA1::Digest SHA1::digest() {
+    if (!finalized_) {
+        pad_message();
+        finalized_ = true;
     }
 
-    for (int i = 16; i < 80; ++i) {
-        w[i] = left_rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    Digest out;
+    const uint32_t words[5] = {h0_, h1_, h2_, h3_, h4_};
+    for (int i = 0; i < 5; ++i) {
+        out[i * 4] = static_cast<uint8_t>(words[i] >> 24);
+        out[i * 4 + 1] = static_cast<uint8_t>(words[i] >> 16);
+        out[i * 4 + 2] = static_cast<uint8_t>(words[i] >> 8);
+        out[i * 4 + 3] = static_cast<uint8_t>(words[i]);
     }
+    return out;
+}
 
-    // Initialize working variables
-    uint32_t a = h0_, b = h1_, c = h2_, d = h3_, e = h4_;
-
-    // Main rounds
-    for (int i = 0; i < 80; ++i) {
-        uint32_t f, k;
-        if (i < 20) {
-            f = (b & c) | (~b & d);
-            k = K[0];
-        } else if (i < 40) {
-            f = b ^ c ^ d;
-            k = K[1];
-        } else if (i < 60) {
-            f = (b & c) | (b & d) | (c & d);
-            k = K[2];
-        } else {
-            f = b ^ c ^ d;
-            k = K[3];
-        }
+std::string SHA1::final() {
+    Digest out = digest();
+    return binary_to_hex(out.data(), out.size());
+}
 
-        uint32_t temp = left_rotate(a, 5) + f + e + k + w[i];
-        e = d;
-        d = c;
-        c = left_rotate(b, 30);
-        b = a;
-        a = temp;
-    }
+void SHA1::process_blocks(const uint8_t* data, size_t blocks) {
+    uint32_t state[5] = {h0_, h1_, h2_, h3_, h4_};
+    sha1_kernels::active().compress(state, data, blocks);
 
-    // Update hash values
-    h0_ += a;
-    h1_ += b;
-    h2_ += c;
-    h3_ += d;
-    h4_ += e;
+    h0_ = state[0];
+    h1_ = state[1];
+    h2_ = state[2];
+    h3_ = state[3];
+    h4_ = state[4];
 }
 
 void SHA1::pad_message() {
     // Append '1' bit
     buffer_[buffer_length_++] = 0x80;
 
-    // Pad with zeros until buffer length is 56 mod 64
-    while (buffer_length_ % 64 != 56) {
-        if (buffer_length_ == 64) {
-            process_block();
-            buffer_length_ = 0;
-        }
-        buffer_[buffer_length_++] = 0x00;
+    // No room left for the length: flush this block and start a fresh one
+    if (buffer_length_ > 56) {
+        std::memset(buffer_ + buffer_length_, 0, sizeof(buffer_) - buffer_length_);
+        process_blocks(buffer_, 1);
+        buffer_length_ = 0;
     }
 
+    // Pad with zeros until buffer length is 56
+    std::memset(buffer_ + buffer_length_, 0, 56 - buffer_length_);
+
     // Append original message length in bits
-    for (int i = 7; i >= 0; --i) {
-        buffer_[buffer_length_++] = (message_length_ >> (i * 8)) & 0xFF;
+    for (int i = 0; i < 8; ++i) {
+        buffer_[56 + i] = static_cast<uint8_t>(message_length_ >> ((7 - i) * 8));
     }
+
+    process_blocks(buffer_, 1);
+    buffer_length_ = 0;
 }
 
 std::string SHA1::hash(const std::string& data) {
@@ -135,6 +112,12 @@ std::string SHA1::hash(const std::string& data) {
     return sha1.final();
 }
 
+SHA1::Digest SHA1::hash_raw(const uint8_t* data, size_t length) {
+    SHA1 sha1;
+    sha1.update(data, length);
+    return sha1.digest();
+}
+
 std::string SHA1::hash_file(const std::string& filepath) {
     std::ifstream file(filepath, std::ios::binary);
     if (!file) {
@@ -152,27 +135,41 @@ std::string SHA1::hash_file(const std::string& filepath) {
 }
 
 // Utility functions
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
 std::string hex_to_binary(const std::string& hex) {
-    std::string binary;
-    binary.reserve(hex.length() / 2);
+    if (hex.length() % 2 != 0) {
+        throw GitException("Invalid hex string: " + hex);
+    }
 
-    for (size_t i = 0; i < hex.length(); i += 2) {
-        uint8_t byte = std::stoi(hex.substr(i, 2), nullptr, 16);
-        binary.push_back(static_cast<char>(byte));
+    std::string binary(hex.length() / 2, '\0');
+    for (size_t i = 0; i < binary.size(); ++i) {
+        int hi = hex_value(hex[i * 2]);
+        int lo = hex_value(hex[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            throw GitException("Invalid hex string: " + hex);
+        }
+        binary[i] = static_cast<char>((hi << 4) | lo);
     }
 
     return binary;
 }
 
 std::string binary_to_hex(const uint8_t* data, size_t length) {
-    std::ostringstream oss;
-    oss << std::hex << std::setfill('0');
+    static const char digits[] = "0123456789abcdef";
 
+    std::string hex(length * 2, '\0');
     for (size_t i = 0; i < length; ++i) {
-        oss << std::setw(2) << static_cast<int>(data[i]);
+        hex[i * 2] = digits[data[i] >> 4];
+        hex[i * 2 + 1] = digits[data[i] & 0x0F];
     }
 
-    return oss.str();
+    return hex;
 }
 
 } // namespace dgit
@@ -0,0 +1,448 @@
+#include "dgit/sha1_kernels.hpp"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define DGIT_SHA1_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define DGIT_SHA1_ARM 1
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+#endif
+
+namespace dgit {
+namespace sha1_kernels {
+
+// SHA-1 constants
+static const uint32_t K[4] = {
+    0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+};
+
+// Left rotate helper
+static inline uint32_t left_rotate(uint32_t value, uint32_t count) {
+    return (value << count) | (value >> (32 - count));
+}
+
+void compress_generic(uint32_t state[5], const uint8_t* data, size_t blocks) {
+    uint32_t w[80];
+
+    for (; blocks > 0; --blocks, data += 64) {
+        // Prepare message schedule
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (static_cast<uint32_t>(data[i * 4]) << 24) |
+                   (static_cast<uint32_t>(data[i * 4 + 1]) << 16) |
+                   (static_cast<uint32_t>(data[i * 4 + 2]) << 8) |
+                   static_cast<uint32_t>(data[i * 4 + 3]);
+        }
+
+        for (int i = 16; i < 80; ++i) {
+            w[i] = left_rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+
+        // Initialize working variables
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+        // Main rounds
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = K[0];
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = K[1];
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = K[2];
+            } else {
+                f = b ^ c ^ d;
+                k = K[3];
+            }
+
+            uint32_t temp = left_rotate(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = left_rotate(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        // Update hash values
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+#if defined(DGIT_SHA1_X86)
+
+// Four rounds of the SHA-NI schedule. `E_NEXT` receives the rotated state for
+// the following group, `FUNC` selects the round function (0..3).
+#define SHANI_ROUNDS(E_NEXT, E_CUR, FUNC)                  \
+    E_NEXT = abcd;                                         \
+    abcd = _mm_sha1rnds4_epu32(abcd, E_CUR, FUNC)
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void compress_shani(uint32_t state[5], const uint8_t* data, size_t blocks) {
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+    __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    __m128i e1;
+    abcd = _mm_shuffle_epi32(abcd, 0x1B);
+
+    for (; blocks > 0; --blocks, data += 64) {
+        const __m128i abcd_save = abcd;
+        const __m128i e0_save = e0;
+
+        __m128i msg0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0)), mask);
+        __m128i msg1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)), mask);
+        __m128i msg2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)), mask);
+        __m128i msg3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48)), mask);
+
+        // Rounds 0-3
+        e0 = _mm_add_epi32(e0, msg0);
+        SHANI_ROUNDS(e1, e0, 0);
+
+        // Rounds 4-7
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        SHANI_ROUNDS(e0, e1, 0);
+        msg0 = _mm_sha1msg1_epu32(msg0, msg1);
+
+        // Rounds 8-11
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        SHANI_ROUNDS(e1, e0, 0);
+        msg1 = _mm_sha1msg1_epu32(msg1, msg2);
+        msg0 = _mm_xor_si128(msg0, msg2);
+
+        // Rounds 12-15
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        msg0 = _mm_sha1msg2_epu32(msg0, msg3);
+        SHANI_ROUNDS(e0, e1, 0);
+        msg2 = _mm_sha1msg1_epu32(msg2, msg3);
+        msg1 = _mm_xor_si128(msg1, msg3);
+
+        // Rounds 16-63 follow a fixed pattern over the rotating message words
+#define SHANI_GROUP(EA, EB, MA, MB, MC, MD, FUNC)          \
+        EA = _mm_sha1nexte_epu32(EA, MA);                  \
+        MB = _mm_sha1msg2_epu32(MB, MA);                   \
+        SHANI_ROUNDS(EB, EA, FUNC);                        \
+        MD = _mm_sha1msg1_epu32(MD, MA);                   \
+        MC = _mm_xor_si128(MC, MA)
+
+        SHANI_GROUP(e0, e1, msg0, msg1, msg2, msg3, 0);    // 16-19
+        SHANI_GROUP(e1, e0, msg1, msg2, msg3, msg0, 1);    // 20-23
+        SHANI_GROUP(e0, e1, msg2, msg3, msg0, msg1, 1);    // 24-27
+        SHANI_GROUP(e1, e0, msg3, msg0, msg1, msg2, 1);    // 28-31
+        SHANI_GROUP(e0, e1, msg0, msg1, msg2, msg3, 1);    // 32-35
+        SHANI_GROUP(e1, e0, msg1, msg2, msg3, msg0, 1);    // 36-39
+        SHANI_GROUP(e0, e1, msg2, msg3, msg0, msg1, 2);    // 40-43
+        SHANI_GROUP(e1, e0, msg3, msg0, msg1, msg2, 2);    // 44-47
+        SHANI_GROUP(e0, e1, msg0, msg1, msg2, msg3, 2);    // 48-51
+        SHANI_GROUP(e1, e0, msg1, msg2, msg3, msg0, 2);    // 52-55
+        SHANI_GROUP(e0, e1, msg2, msg3, msg0, msg1, 2);    // 56-59
+        SHANI_GROUP(e1, e0, msg3, msg0, msg1, msg2, 3);    // 60-63
+#undef SHANI_GROUP
+
+        // Rounds 64-67
+        e0 = _mm_sha1nexte_epu32(e0, msg0);
+        msg1 = _mm_sha1msg2_epu32(msg1, msg0);
+        SHANI_ROUNDS(e1, e0, 3);
+        msg3 = _mm_sha1msg1_epu32(msg3, msg0);
+        msg2 = _mm_xor_si128(msg2, msg0);
+
+        // Rounds 68-71
+        e1 = _mm_sha1nexte_epu32(e1, msg1);
+        msg2 = _mm_sha1msg2_epu32(msg2, msg1);
+        SHANI_ROUNDS(e0, e1, 3);
+        msg3 = _mm_xor_si128(msg3, msg1);
+
+        // Rounds 72-75
+        e0 = _mm_sha1nexte_epu32(e0, msg2);
+        msg3 = _mm_sha1msg2_epu32(msg3, msg2);
+        SHANI_ROUNDS(e1, e0, 3);
+
+        // Rounds 76-79
+        e1 = _mm_sha1nexte_epu32(e1, msg3);
+        SHANI_ROUNDS(e0, e1, 3);
+
+        // Combine state
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    abcd = _mm_shuffle_epi32(abcd, 0x1B);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), abcd);
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+#undef SHANI_ROUNDS
+
+static bool cpu_has_shani() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    const bool has_ssse3 = (ecx & bit_SSSE3) != 0;
+    const bool has_sse41 = (ecx & bit_SSE4_1) != 0;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    const bool has_sha = (ebx & (1u << 29)) != 0;
+
+    return has_ssse3 && has_sse41 && has_sha;
+}
+
+#endif // DGIT_SHA1_X86
+
+#if defined(DGIT_SHA1_ARM)
+
+__attribute__((target("+crypto")))
+static void compress_armv8(uint32_t state[5], const uint8_t* data, size_t blocks) {
+    const uint32x4_t k0 = vdupq_n_u32(K[0]);
+    const uint32x4_t k1 = vdupq_n_u32(K[1]);
+    const uint32x4_t k2 = vdupq_n_u32(K[2]);
+    const uint32x4_t k3 = vdupq_n_u32(K[3]);
+
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32_t e0 = state[4];
+
+    for (; blocks > 0; --blocks, data += 64) {
+        const uint32x4_t abcd_save = abcd;
+        const uint32_t e0_save = e0;
+        uint32_t e1;
+
+        uint32x4_t msg0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+        uint32x4_t msg1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+        uint32x4_t msg2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+        uint32x4_t msg3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+        uint32x4_t tmp0 = vaddq_u32(msg0, k0);
+        uint32x4_t tmp1 = vaddq_u32(msg1, k0);
+
+        // Four rounds using round function OP, then schedule the next words
+#define ARM_ROUNDS(OP, E_NEXT, E_CUR, TMP, MSG_K, K_NEXT)  \
+        E_NEXT = vsha1h_u32(vgetq_lane_u32(abcd, 0));      \
+        abcd = OP(abcd, E_CUR, TMP);                       \
+        TMP = vaddq_u32(MSG_K, K_NEXT)
+
+        ARM_ROUNDS(vsha1cq_u32, e1, e0, tmp0, msg2, k0);   // 0-3
+        msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+        ARM_ROUNDS(vsha1cq_u32, e0, e1, tmp1, msg3, k0);   // 4-7
+        msg0 = vsha1su1q_u32(msg0, msg3);
+        msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+        ARM_ROUNDS(vsha1cq_u32, e1, e0, tmp0, msg0, k0);   // 8-11
+        msg1 = vsha1su1q_u32(msg1, msg0);
+        msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+        ARM_ROUNDS(vsha1cq_u32, e0, e1, tmp1, msg1, k1);   // 12-15
+        msg2 = vsha1su1q_u32(msg2, msg1);
+        msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+        ARM_ROUNDS(vsha1cq_u32, e1, e0, tmp0, msg2, k1);   // 16-19
+        msg3 = vsha1su1q_u32(msg3, msg2);
+        msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+        ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp1, msg3, k1);   // 20-23
+        msg0 = vsha1su1q_u32(msg0, msg3);
+        msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+        ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp0, msg0, k1);   // 24-27
+        msg1 = vsha1su1q_u32(msg1, msg0);
+        msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+        ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp1, msg1, k1);   // 28-31
+        msg2 = vsha1su1q_u32(msg2, msg1);
+        msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+        ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp0, msg2, k2);   // 32-35
+        msg3 = vsha1su1q_u32(msg3, msg2);
+        msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+        ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp1, msg3, k2);   // 36-39
+        msg0 = vsha1su1q_u32(msg0, msg3);
+        msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+        ARM_ROUNDS(vsha1mq_u32, e1, e0, tmp0, msg0, k2);   // 40-43
+        msg1 = vsha1su1q_u32(msg1, msg0);
+        msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+        ARM_ROUNDS(vsha1mq_u32, e0, e1, tmp1, msg1, k2);   // 44-47
+        msg2 = vsha1su1q_u32(msg2, msg1);
+        msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+        ARM_ROUNDS(vsha1mq_u32, e1, e0, tmp0, msg2, k2);   // 48-51
+        msg3 = vsha1su1q_u32(msg3, msg2);
+        msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+        ARM_ROUNDS(vsha1mq_u32, e0, e1, tmp1, msg3, k3);   // 52-55
+        msg0 = vsha1su1q_u32(msg0, msg3);
+        msg1 = vsha1su0q_u32(msg1, msg2, msg3);
+        ARM_ROUNDS(vsha1mq_u32, e1, e0, tmp0, msg0, k3);   // 56-59
+        msg1 = vsha1su1q_u32(msg1, msg0);
+        msg2 = vsha1su0q_u32(msg2, msg3, msg0);
+        ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp1, msg1, k3);   // 60-63
+        msg2 = vsha1su1q_u32(msg2, msg1);
+        msg3 = vsha1su0q_u32(msg3, msg0, msg1);
+        ARM_ROUNDS(vsha1pq_u32, e1, e0, tmp0, msg2, k3);   // 64-67
+        msg3 = vsha1su1q_u32(msg3, msg2);
+        msg0 = vsha1su0q_u32(msg0, msg1, msg2);
+        ARM_ROUNDS(vsha1pq_u32, e0, e1, tmp1, msg3, k3);   // 68-71
+        msg0 = vsha1su1q_u32(msg0, msg3);
+#undef ARM_ROUNDS
+
+        // Rounds 72-79
+        e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+        abcd = vsha1pq_u32(abcd, e0, tmp0);
+        e0 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+        abcd = vsha1pq_u32(abcd, e1, tmp1);
+
+        e0 += e0_save;
+        abcd = vaddq_u32(abcd_save, abcd);
+    }
+
+    vst1q_u32(state, abcd);
+    state[4] = e0;
+}
+
+static bool cpu_has_armv8_sha1() {
+#if defined(__APPLE__)
+    return true;
+#elif defined(__linux__) && defined(HWCAP_SHA1)
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif // DGIT_SHA1_ARM
+
+// Multi-buffer kernel. Each vector element carries one lane; the compiler
+// lowers the generic vector type to SSE2/AVX2/NEON as available.
+typedef uint32_t lane_vec __attribute__((vector_size(kLanes * sizeof(uint32_t))));
+
+#define LANE_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+static inline __attribute__((always_inline))
+void lanes_body(LaneState& state, const uint8_t* const blocks[kLanes]) {
+    lane_vec w[16];
+    for (int i = 0; i < 16; ++i) {
+        uint32_t words[kLanes];
+        for (size_t lane = 0; lane < kLanes; ++lane) {
+            const uint8_t* p = blocks[lane] + i * 4;
+            words[lane] = (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+                          (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+        }
+        std::memcpy(&w[i], words, sizeof(words));
+    }
+
+    lane_vec a, b, c, d, e;
+    std::memcpy(&a, state.h[0], sizeof(a));
+    std::memcpy(&b, state.h[1], sizeof(b));
+    std::memcpy(&c, state.h[2], sizeof(c));
+    std::memcpy(&d, state.h[3], sizeof(d));
+    std::memcpy(&e, state.h[4], sizeof(e));
+    const lane_vec a0 = a, b0 = b, c0 = c, d0 = d, e0 = e;
+
+#define LANE_SCHEDULE(i)                                                        \
+    ((i) < 16 ? w[(i) & 15]                                                     \
+              : (w[(i) & 15] = LANE_ROTL(w[((i) - 3) & 15] ^ w[((i) - 8) & 15] ^ \
+                                         w[((i) - 14) & 15] ^ w[(i) & 15], 1)))
+#define LANE_ROUND(i, f, k)                                                     \
+    do {                                                                        \
+        lane_vec temp = LANE_ROTL(a, 5) + (f) + e + (k) + LANE_SCHEDULE(i);     \
+        e = d;                                                                  \
+        d = c;                                                                  \
+        c = LANE_ROTL(b, 30);                                                   \
+        b = a;                                                                  \
+        a = temp;                                                               \
+    } while (0)
+
+    for (int i = 0; i < 20; ++i) LANE_ROUND(i, (b & c) | (~b & d), K[0]);
+    for (int i = 20; i < 40; ++i) LANE_ROUND(i, b ^ c ^ d, K[1]);
+    for (int i = 40; i < 60; ++i) LANE_ROUND(i, (b & c) | (b & d) | (c & d), K[2]);
+    for (int i = 60; i < 80; ++i) LANE_ROUND(i, b ^ c ^ d, K[3]);
+
+#undef LANE_ROUND
+#undef LANE_SCHEDULE
+
+    a += a0;
+    b += b0;
+    c += c0;
+    d += d0;
+    e += e0;
+    std::memcpy(state.h[0], &a, sizeof(a));
+    std::memcpy(state.h[1], &b, sizeof(b));
+    std::memcpy(state.h[2], &c, sizeof(c));
+    std::memcpy(state.h[3], &d, sizeof(d));
+    std::memcpy(state.h[4], &e, sizeof(e));
+}
+
+#undef LANE_ROTL
+
+static void compress_lanes_default(LaneState& state, const uint8_t* const blocks[kLanes]) {
+    lanes_body(state, blocks);
+}
+
+#if defined(DGIT_SHA1_X86)
+__attribute__((target("avx2")))
+static void compress_lanes_avx2(LaneState& state, const uint8_t* const blocks[kLanes]) {
+    lanes_body(state, blocks);
+}
+#endif
+
+using LanesFn = void (*)(LaneState&, const uint8_t* const[kLanes]);
+
+static LanesFn detect_lanes() {
+#if defined(DGIT_SHA1_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return compress_lanes_avx2;
+    }
+#endif
+    return compress_lanes_default;
+}
+
+void reset_lane(LaneState& state, size_t lane) {
+    static const uint32_t iv[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+    for (int i = 0; i < 5; ++i) {
+        state.h[i][lane] = iv[i];
+    }
+}
+
+void compress_lanes(LaneState& state, const uint8_t* const blocks[kLanes]) {
+    static const LanesFn fn = detect_lanes();
+    fn(state, blocks);
+}
+
+static std::vector<Kernel> detect_kernels() {
+    std::vector<Kernel> kernels;
+
+#if defined(DGIT_SHA1_X86)
+    if (cpu_has_shani()) {
+        kernels.push_back({"sha-ni", compress_shani});
+    }
+#elif defined(DGIT_SHA1_ARM)
+    if (cpu_has_armv8_sha1()) {
+        kernels.push_back({"armv8-ce", compress_armv8});
+    }
+#endif
+
+    kernels.push_back({"generic", compress_generic});
+    return kernels;
+}
+
+const std::vector<Kernel>& available() {
+    static const std::vector<Kernel> kernels = detect_kernels();
+    return kernels;
+}
+
+const Kernel& active() {
+    static const Kernel& kernel = available().front();
+    return kernel;
+}
+
+bool lanes_preferred() {
+    // Dedicated SHA instructions outrun the vector lanes on every CPU we
+    // have measured, so multi-buffer hashing only replaces the scalar path
+    return active().compress == compress_generic;
+}
+
+} // namespace sha1_kernels
+} // namespace dgit
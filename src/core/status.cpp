@@ -0,0 +1,316 @@
+#include "dgit/status.hpp"
+#include "dgit/batch_hash.hpp"
+#include "dgit/thread_pool.hpp"
+#include "dgit/trace.hpp"
+#include "dgit/untracked_cache.hpp"
+#include <algorithm>
+#include <climits>
+#include <filesystem>
+#include <string_view>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+namespace dgit {
+
+namespace {
+// Sorted neighbours share directories, so contiguous runs keep the
+// directory cursor warm
+constexpr size_t kEntriesPerTask = 512;
+
+enum class EntryState : uint8_t { Clean, Modified, Deleted, NeedsHash };
+
+// lstat() relative to the entry's directory, reopening the directory only
+// when the path moves to a different one
+class DirectoryCursor {
+public:
+    explicit DirectoryCursor(int root_fd) : root_fd_(root_fd) {}
+    ~DirectoryCursor() { close_dir(); }
+
+    DirectoryCursor(const DirectoryCursor&) = delete;
+    DirectoryCursor& operator=(const DirectoryCursor&) = delete;
+
+    bool lstat(const std::string& path, struct stat& st) {
+        Trace2::count(TraceCounter::StatCalls);
+        size_t slash = path.rfind('/');
+        if (slash == std::string::npos) {
+            return ::fstatat(root_fd_, path.c_str(), &st, AT_SYMLINK_NOFOLLOW) == 0;
+        }
+
+        std::string_view dir(path.data(), slash);
+        if (!has_dir_ || dir != dir_) {
+            close_dir();
+            dir_.assign(dir);
+            dir_fd_ = ::openat(root_fd_, dir_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            has_dir_ = true;
+        }
+        // A missing directory means every entry below it is gone
+        return dir_fd_ >= 0 && ::fstatat(dir_fd_, path.c_str() + slash + 1, &st, AT_SYMLINK_NOFOLLOW) == 0;
+    }
+
+private:
+    void close_dir() {
+        if (dir_fd_ >= 0) {
+            ::close(dir_fd_);
+        }
+        dir_fd_ = -1;
+        has_dir_ = false;
+    }
+
+    int root_fd_;
+    int dir_fd_ = -1;
+    bool has_dir_ = false;
+    std::string dir_;
+};
+
+EntryState classify(const Index& index, const IndexEntry& entry, DirectoryCursor& cursor) {
+    struct stat st;
+    if (!cursor.lstat(entry.path, st)) {
+        return EntryState::Deleted;
+    }
+
+    // Submodules are only checked for presence
+    if (entry.mode == FileMode::Gitlink) {
+        return S_ISDIR(st.st_mode) ? EntryState::Clean : EntryState::Modified;
+    }
+    if (file_mode_from_stat(st) != entry.mode) {
+        return EntryState::Modified;
+    }
+
+    if (entry.stat.matches(st)) {
+        // The file may have changed within the timestamp granularity of
+        // the index write, so identical stat data proves nothing
+        return index.is_racy(entry) ? EntryState::NeedsHash : EntryState::Clean;
+    }
+
+    // A different size is conclusive, except for entries smudged to zero
+    if (entry.stat.size != 0 && entry.stat.size != static_cast<uint32_t>(st.st_size)) {
+        return EntryState::Modified;
+    }
+    return EntryState::NeedsHash;
+}
+
+std::string join_path(const std::string& worktree, const std::string& path) {
+    return worktree == "." ? path : worktree + "/" + path;
+}
+
+bool symlink_matches(const std::string& path, const ObjectId& expected) {
+    std::string target(PATH_MAX, '\0');
+    ssize_t length = ::readlink(path.c_str(), &target[0], target.size());
+    if (length < 0) {
+        return false;
+    }
+    return hash_blob(reinterpret_cast<const uint8_t*>(target.data()), static_cast<size_t>(length)) == expected;
+}
+
+// Rehashes the inconclusive entries, marking the ones whose content differs
+void rehash_entries(const std::vector<IndexEntry>& entries, const std::vector<size_t>& candidates,
+                    const std::string& worktree, size_t threads, std::vector<EntryState>& states) {
+    std::vector<size_t> files;
+    std::vector<std::string> paths;
+    for (size_t i : candidates) {
+        const IndexEntry& entry = entries[i];
+        if (entry.mode == FileMode::Symlink) {
+            states[i] = symlink_matches(join_path(worktree, entry.path), entry.blob_id)
+                            ? EntryState::Clean : EntryState::Modified;
+        } else {
+            files.push_back(i);
+            paths.push_back(join_path(worktree, entry.path));
+        }
+    }
+    if (files.empty()) {
+        return;
+    }
+
+    BatchHashOptions options;
+    options.threads = threads;
+    try {
+        std::vector<HashedFile> hashed = hash_files(paths, options);
+        for (size_t k = 0; k < files.size(); ++k) {
+            states[files[k]] = hashed[k].id == entries[files[k]].blob_id ? EntryState::Clean : EntryState::Modified;
+        }
+    } catch (const GitException&) {
+        // Something vanished or became unreadable since the stat pass;
+        // fall back to one file at a time so only that entry is affected
+        for (size_t k = 0; k < files.size(); ++k) {
+            try {
+                std::vector<HashedFile> hashed = hash_files({paths[k]}, options);
+                states[files[k]] = hashed[0].id == entries[files[k]].blob_id ? EntryState::Clean : EntryState::Modified;
+            } catch (const GitException&) {
+                states[files[k]] = EntryState::Modified;
+            }
+        }
+    }
+}
+
+// Indices of the entries at or below any of `paths`, in index order. A
+// path may name a file or a directory, with or without a trailing slash.
+std::vector<size_t> entries_under(const std::vector<IndexEntry>& entries, const std::vector<std::string>& paths) {
+    std::vector<size_t> selected;
+    auto first_at_or_after = [&entries](const std::string& key) {
+        return std::lower_bound(entries.begin(), entries.end(), key,
+                                [](const IndexEntry& entry, const std::string& k) { return entry.path < k; });
+    };
+
+    for (std::string path : paths) {
+        while (!path.empty() && path.back() == '/') {
+            path.pop_back();
+        }
+        if (path.empty()) {
+            continue;
+        }
+        auto it = first_at_or_after(path);
+        if (it != entries.end() && it->path == path) {
+            selected.push_back(static_cast<size_t>(it - entries.begin()));
+        }
+        std::string prefix = path + "/";
+        for (it = first_at_or_after(prefix); it != entries.end() && it->path.compare(0, prefix.size(), prefix) == 0;
+             ++it) {
+            selected.push_back(static_cast<size_t>(it - entries.begin()));
+        }
+    }
+
+    std::sort(selected.begin(), selected.end());
+    selected.erase(std::unique(selected.begin(), selected.end()), selected.end());
+    return selected;
+}
+}
+
+WorktreeStatus compute_status(Index& index, const std::string& worktree, const StatusOptions& options) {
+    TraceRegion region("status", "worktree");
+    const std::vector<IndexEntry>& entries = index.entries();
+    size_t threads = options.threads ? options.threads : default_threads();
+
+    // The monitor narrows the entries to check; without one (or without a
+    // usable token) every entry is checked
+    FsMonitorChanges changes;
+    bool narrowed = false;
+    std::vector<size_t> selected;
+    if (options.fsmonitor) {
+        changes = options.fsmonitor->changes_since(index.fsmonitor_token());
+        narrowed = !changes.everything;
+        if (narrowed) {
+            std::vector<std::string> paths = changes.paths;
+            paths.insert(paths.end(), index.fsmonitor_dirty().begin(), index.fsmonitor_dirty().end());
+            selected = entries_under(entries, paths);
+            if (UntrackedCache* cache = index.untracked_cache()) {
+                for (const auto& path : changes.paths) {
+                    cache->invalidate_with_parents(path);
+                }
+            }
+        }
+    }
+    size_t count = narrowed ? selected.size() : entries.size();
+
+    int root_fd = ::open(worktree.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd < 0) {
+        throw GitException("Cannot open work tree: " + worktree);
+    }
+
+    std::vector<EntryState> states(entries.size(), EntryState::Clean);
+    try {
+        size_t tasks = (count + kEntriesPerTask - 1) / kEntriesPerTask;
+        parallel_for(tasks, threads, [&](size_t task) {
+            DirectoryCursor cursor(root_fd);
+            size_t begin = task * kEntriesPerTask;
+            size_t end = std::min(begin + kEntriesPerTask, count);
+            for (size_t k = begin; k < end; ++k) {
+                size_t i = narrowed ? selected[k] : k;
+                states[i] = classify(index, entries[i], cursor);
+            }
+        });
+    } catch (...) {
+        ::close(root_fd);
+        throw;
+    }
+    ::close(root_fd);
+
+    WorktreeStatus result;
+    result.checked = count;
+    std::vector<size_t> candidates;
+    for (size_t i = 0; i < states.size(); ++i) {
+        if (states[i] == EntryState::NeedsHash) {
+            candidates.push_back(i);
+        }
+    }
+    result.rehashed = candidates.size();
+    rehash_entries(entries, candidates, worktree, threads, states);
+
+    for (size_t i = 0; i < states.size(); ++i) {
+        if (states[i] == EntryState::Modified) {
+            result.modified.push_back(entries[i].path);
+        } else if (states[i] == EntryState::Deleted) {
+            result.deleted.push_back(entries[i].path);
+        }
+    }
+
+    if (options.untracked) {
+        result.untracked = find_untracked_files(index, worktree, narrowed);
+    }
+
+    if (options.fsmonitor) {
+        // Whatever is still dirty has to be looked at again next time,
+        // whether or not the monitor reports it
+        std::vector<std::string> dirty = result.modified;
+        dirty.insert(dirty.end(), result.deleted.begin(), result.deleted.end());
+        std::sort(dirty.begin(), dirty.end());
+        index.set_fsmonitor_state(changes.token, std::move(dirty));
+    }
+    return result;
+}
+
+std::vector<std::string> find_untracked_files(Index& index, const std::string& worktree, bool trust_cache) {
+    TraceRegion region("status", "untracked");
+    const std::vector<IndexEntry>& entries = index.entries();
+
+    // The cache only asks about names in directories it has to read, so a
+    // binary search beats building a set of every tracked path
+    if (UntrackedCache* cache = index.untracked_cache()) {
+        auto is_tracked = [&entries](std::string_view path) {
+            auto it = std::lower_bound(entries.begin(), entries.end(), path,
+                                       [](const IndexEntry& entry, std::string_view key) { return entry.path < key; });
+            return it != entries.end() && it->path == path;
+        };
+        return cache->scan(worktree, is_tracked, trust_cache);
+    }
+
+    std::unordered_set<std::string_view> tracked;
+    tracked.reserve(entries.size());
+    for (const auto& entry : entries) {
+        tracked.insert(entry.path);
+    }
+
+    std::vector<std::string> untracked;
+    size_t prefix = worktree.size() + 1;
+    std::error_code ec;
+    fs::recursive_directory_iterator it(worktree, fs::directory_options::skip_permission_denied, ec);
+    for (; !ec && it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        const std::string& native = it->path().native();
+        std::string_view path(native);
+        path.remove_prefix(std::min(prefix, path.size()));
+
+        fs::file_status status = it->symlink_status(ec);
+        if (ec) {
+            break;
+        }
+        if (fs::is_directory(status)) {
+            if (path == ".git") {
+                it.disable_recursion_pending();
+            }
+            continue;
+        }
+        if ((fs::is_regular_file(status) || fs::is_symlink(status)) && !tracked.count(path)) {
+            untracked.emplace_back(path);
+        }
+    }
+    if (ec) {
+        throw GitException("Cannot scan work tree: " + ec.message());
+    }
+
+    std::sort(untracked.begin(), untracked.end());
+    return untracked;
+}
+
+} // namespace dgit
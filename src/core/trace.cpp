@@ -0,0 +1,272 @@
+#include "dgit/trace.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace dgit {
+
+namespace {
+struct CounterInfo {
+    const char* category;
+    const char* name;
+};
+
+constexpr CounterInfo kCounters[kTraceCounterCount] = {
+    {"object", "loads"},
+    {"object", "cache_hits"},
+    {"pack", "lookups"},
+    {"zlib", "inflated_bytes"},
+    {"zlib", "deflated_bytes"},
+    {"fs", "stat_calls"},
+    {"network", "bytes_read"},
+    {"network", "bytes_written"},
+};
+
+// One per live thread that has counted or timed anything
+struct ThreadState {
+    std::array<std::atomic<uint64_t>, kTraceCounterCount> counts{};
+    std::string name;
+    int depth = 0;
+};
+
+struct TraceState {
+    std::mutex mutex;
+    std::vector<ThreadState*> threads;
+    TraceCounts exited{};          // counts of threads that have ended
+    size_t started = 0;            // threads registered so far, for names
+    int fd = -1;
+    bool close_fd = false;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
+TraceState& state() {
+    static TraceState instance;
+    return instance;
+}
+
+// Registers its thread on first use and, when the thread ends, folds the
+// thread's counts into TraceState::exited. parallel_for starts fresh
+// threads on every call, so the registry holds only the live ones.
+class ThreadSlot {
+public:
+    ThreadSlot() {
+        TraceState& trace = state();
+        std::lock_guard<std::mutex> lock(trace.mutex);
+        // The first thread to register is the one that started tracing
+        char name[16];
+        std::snprintf(name, sizeof(name), "th%02zu", trace.started);
+        thread_.name = trace.started++ == 0 ? "main" : name;
+        trace.threads.push_back(&thread_);
+    }
+
+    ~ThreadSlot() {
+        TraceState& trace = state();
+        std::lock_guard<std::mutex> lock(trace.mutex);
+        for (size_t i = 0; i < kTraceCounterCount; ++i) {
+            trace.exited[i] += thread_.counts[i].load(std::memory_order_relaxed);
+        }
+        trace.threads.erase(std::find(trace.threads.begin(), trace.threads.end(), &thread_));
+    }
+
+    ThreadSlot(const ThreadSlot&) = delete;
+    ThreadSlot& operator=(const ThreadSlot&) = delete;
+
+    ThreadState& thread() { return thread_; }
+
+private:
+    ThreadState thread_;
+};
+
+ThreadState& this_thread() {
+    thread_local ThreadSlot slot;
+    return slot.thread();
+}
+
+void append_json_string(std::string& out, const char* text) {
+    out += '"';
+    for (const char* p = text; *p; ++p) {
+        unsigned char c = static_cast<unsigned char>(*p);
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+        } else if (c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += static_cast<char>(c);
+        }
+    }
+    out += '"';
+}
+
+// `"event":...,"thread":...,"t_abs":...` for a line to be completed
+std::string event_head(const char* event, const ThreadState& thread) {
+    double t_abs = std::chrono::duration<double>(std::chrono::steady_clock::now() - state().start).count();
+    char time[32];
+    std::snprintf(time, sizeof(time), "%.6f", t_abs);
+    std::string line = "{\"event\":\"";
+    line += event;
+    line += "\",\"thread\":";
+    append_json_string(line, thread.name.c_str());
+    line += ",\"t_abs\":";
+    line += time;
+    return line;
+}
+
+// A whole line per write() keeps lines intact in a file other processes
+// append to as well
+void emit(std::string line) {
+    line += "}\n";
+    TraceState& trace = state();
+    std::lock_guard<std::mutex> lock(trace.mutex);
+    if (trace.fd < 0) {
+        return;
+    }
+    const char* p = line.data();
+    size_t left = line.size();
+    while (left > 0) {
+        ssize_t n = ::write(trace.fd, p, left);
+        if (n <= 0) {
+            return;   // tracing never fails the command
+        }
+        p += n;
+        left -= static_cast<size_t>(n);
+    }
+}
+}
+
+std::atomic<bool> Trace2::enabled_{false};
+std::atomic<bool> Trace2::emitting_{false};
+
+void Trace2::start_from_environment(int argc, char** argv) {
+    const char* target = std::getenv("DGIT_TRACE2_PERF");
+    if (!target || !*target) {
+        return;
+    }
+
+    int fd = -1;
+    bool close_fd = false;
+    if (std::strcmp(target, "1") == 0 || std::strcmp(target, "2") == 0 || std::strcmp(target, "true") == 0) {
+        fd = STDERR_FILENO;
+    } else if (target[0] == '/') {
+        fd = ::open(target, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0666);
+        if (fd < 0) {
+            std::cerr << "warning: cannot open trace2 target " << target << ": " << std::strerror(errno) << "\n";
+            return;
+        }
+        close_fd = true;
+    } else {
+        return;   // "0", "false" and relative paths, as in git
+    }
+
+    TraceState& trace = state();
+    ThreadState& main = this_thread();
+    {
+        std::lock_guard<std::mutex> lock(trace.mutex);
+        trace.fd = fd;
+        trace.close_fd = close_fd;
+    }
+    enabled_.store(true, std::memory_order_relaxed);
+    emitting_.store(true, std::memory_order_relaxed);
+
+    std::string line = event_head("start", main) + ",\"argv\":[";
+    for (int i = 0; i < argc; ++i) {
+        if (i > 0) {
+            line += ',';
+        }
+        append_json_string(line, argv[i]);
+    }
+    line += ']';
+    emit(std::move(line));
+}
+
+void Trace2::enable_counters() {
+    this_thread();
+    enabled_.store(true, std::memory_order_relaxed);
+}
+
+void Trace2::finish(int exit_code) {
+    if (!emitting()) {
+        return;
+    }
+
+    // Workers have usually ended by now, so counters are process totals
+    ThreadState& main = this_thread();
+    TraceCounts counts = totals();
+    for (size_t i = 0; i < kTraceCounterCount; ++i) {
+        if (counts[i] == 0) {
+            continue;
+        }
+        std::string line = event_head("counter", main) + ",\"category\":";
+        append_json_string(line, kCounters[i].category);
+        line += ",\"name\":";
+        append_json_string(line, kCounters[i].name);
+        line += ",\"count\":" + std::to_string(counts[i]);
+        emit(std::move(line));
+    }
+    emit(event_head("exit", main) + ",\"code\":" + std::to_string(exit_code));
+
+    emitting_.store(false, std::memory_order_relaxed);
+    enabled_.store(false, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(state().mutex);
+    if (state().close_fd) {
+        ::close(state().fd);
+    }
+    state().fd = -1;
+}
+
+TraceCounts Trace2::totals() {
+    std::lock_guard<std::mutex> lock(state().mutex);
+    TraceCounts totals = state().exited;
+    for (const ThreadState* thread : state().threads) {
+        for (size_t i = 0; i < kTraceCounterCount; ++i) {
+            totals[i] += thread->counts[i].load(std::memory_order_relaxed);
+        }
+    }
+    return totals;
+}
+
+const char* Trace2::category(TraceCounter counter) {
+    return kCounters[static_cast<size_t>(counter)].category;
+}
+
+const char* Trace2::name(TraceCounter counter) {
+    return kCounters[static_cast<size_t>(counter)].name;
+}
+
+void Trace2::add(TraceCounter counter, uint64_t n) {
+    // Only this thread writes its block; readers may see a slightly old value
+    auto& slot = this_thread().counts[static_cast<size_t>(counter)];
+    slot.store(slot.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void Trace2::region_leave(const char* category, const char* label, std::chrono::steady_clock::time_point start) {
+    ThreadState& thread = this_thread();
+    --thread.depth;
+    double t_rel = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    char time[32];
+    std::snprintf(time, sizeof(time), "%.6f", t_rel);
+
+    std::string line = event_head("region_leave", thread) + ",\"t_rel\":" + time +
+                       ",\"nesting\":" + std::to_string(thread.depth + 1) + ",\"category\":";
+    append_json_string(line, category);
+    line += ",\"label\":";
+    append_json_string(line, label);
+    emit(std::move(line));
+}
+
+void TraceRegion::enter() {
+    ++this_thread().depth;
+    start_ = std::chrono::steady_clock::now();
+}
+
+} // namespace dgit
@@ -0,0 +1,152 @@
+#include "dgit/untracked_cache.hpp"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
+
+namespace dgit {
+
+namespace {
+std::string join(const std::string& dir, const char* name) {
+    return dir.empty() ? std::string(name) : dir + "/" + name;
+}
+
+std::string_view parent_of(std::string_view path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string_view::npos ? std::string_view() : path.substr(0, slash);
+}
+}
+
+std::vector<std::string> UntrackedCache::scan(const std::string& worktree,
+                                              const std::function<bool(std::string_view)>& is_tracked,
+                                              bool trust_unchanged, ScanStats* stats) {
+    // A directory changed within the last second may change again without
+    // its mtime moving, so it is read but not remembered
+    int64_t recent_sec = static_cast<int64_t>(std::time(nullptr)) - 1;
+
+    ScanStats local;
+    std::vector<std::string> untracked;
+    std::map<std::string, Directory, std::less<>> next;
+    scan_directory(worktree, "", is_tracked, trust_unchanged, recent_sec, untracked, local, next);
+
+    // Directories that were not visited no longer exist
+    if (local.directories_read > 0 || next.size() != dirs_.size()) {
+        changed_ = true;
+    }
+    dirs_ = std::move(next);
+
+    if (stats) {
+        *stats = local;
+    }
+    std::sort(untracked.begin(), untracked.end());
+    return untracked;
+}
+
+void UntrackedCache::scan_directory(const std::string& worktree, const std::string& path,
+                                    const std::function<bool(std::string_view)>& is_tracked, bool trust_unchanged,
+                                    int64_t recent_sec, std::vector<std::string>& out, ScanStats& stats,
+                                    std::map<std::string, Directory, std::less<>>& next) {
+    std::string full = path.empty() ? worktree : worktree + "/" + path;
+    auto cached = dirs_.find(path);
+
+    struct stat st;
+    bool have_stat = false;
+    if (cached == dirs_.end() || !trust_unchanged) {
+        if (::lstat(full.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            return;
+        }
+        have_stat = true;
+    }
+
+    if (cached != dirs_.end() && (!have_stat || cached->second.stat.matches(st))) {
+        stats.directories_reused++;
+        Directory& dir = next.emplace(path, std::move(cached->second)).first->second;
+        for (const auto& name : dir.untracked) {
+            out.push_back(join(path, name.c_str()));
+        }
+        for (const auto& name : dir.subdirs) {
+            scan_directory(worktree, join(path, name.c_str()), is_tracked, trust_unchanged, recent_sec, out, stats, next);
+        }
+        return;
+    }
+
+    stats.directories_read++;
+    Directory dir;
+    dir.stat = IndexStat::from_stat(st);
+
+    DIR* handle = ::opendir(full.c_str());
+    if (!handle) {
+        return;
+    }
+    while (struct dirent* entry = ::readdir(handle)) {
+        const char* name = entry->d_name;
+        if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0 ||
+            (path.empty() && std::strcmp(name, ".git") == 0)) {
+            continue;
+        }
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat child;
+            if (::lstat((full + "/" + name).c_str(), &child) != 0) {
+                continue;
+            }
+            type = S_ISDIR(child.st_mode) ? DT_DIR : S_ISLNK(child.st_mode) ? DT_LNK
+                                                   : S_ISREG(child.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR) {
+            dir.subdirs.emplace_back(name);
+        } else if ((type == DT_REG || type == DT_LNK) && !is_tracked(join(path, name))) {
+            dir.untracked.emplace_back(name);
+        }
+    }
+    ::closedir(handle);
+
+    for (const auto& name : dir.untracked) {
+        out.push_back(join(path, name.c_str()));
+    }
+    for (const auto& name : dir.subdirs) {
+        scan_directory(worktree, join(path, name.c_str()), is_tracked, trust_unchanged, recent_sec, out, stats, next);
+    }
+    if (static_cast<int64_t>(st.st_mtim.tv_sec) < recent_sec) {
+        next.emplace(path, std::move(dir));
+    }
+}
+
+void UntrackedCache::invalidate(std::string_view path) {
+    erase_directory(parent_of(path));
+}
+
+void UntrackedCache::invalidate_with_parents(std::string_view path) {
+    while (!path.empty() && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    erase_directory(path);
+    while (!path.empty()) {
+        path = parent_of(path);
+        erase_directory(path);
+    }
+}
+
+void UntrackedCache::erase_directory(std::string_view dir) {
+    auto it = dirs_.find(dir);
+    if (it != dirs_.end()) {
+        dirs_.erase(it);
+        changed_ = true;
+    }
+}
+
+void UntrackedCache::clear() {
+    if (!dirs_.empty()) {
+        changed_ = true;
+    }
+    dirs_.clear();
+}
+
+void UntrackedCache::restore(std::string path, Directory dir) {
+    dirs_[std::move(path)] = std::move(dir);
+}
+
+} // namespace dgit
@@ -1,15 +1,20 @@
 #include "dgit/commands.hpp"
+#include "dgit/trace.hpp"
 #include <iostream>
 
 int main(int argc, char* argv[]) {
     dgit::CLI cli;
+    dgit::Trace2::start_from_environment(argc, argv);
 
+    int code;
     try {
-        return cli.run(argc, argv);
+        code = cli.run(argc, argv);
     } catch (const std::exception& e) {
         std::cerr << "Fatal error: " << e.what() << std::endl;
-        return 1;
+        code = 1;
     }
+    dgit::Trace2::finish(code);
+    return code;
 }
 
 // Simple test function to demonstrate basic functionality
@@ -1,20 +1,34 @@
 #include "dgit/merge.hpp"
 #include <algorithm>
+#include <filesystem>
 #include <sstream>
 #include <fstream>
 #include <regex>
-#include <set>
 #include <iostream>
+#include "dgit/checkout.hpp"
 #include "dgit/commands.hpp"
+#include "dgit/merge_base.hpp"
+#include "dgit/merge_tree.hpp"
 
 namespace dgit {
 
+namespace {
+// merge.renameLimit falls back to diff.renameLimit, as in git
+RenameOptions rename_options(Repository& repo) {
+    RenameOptions options;
+    int limit = repo.config().get_int("diff", "renameLimit", static_cast<int>(options.limit));
+    limit = repo.config().get_int("merge", "renameLimit", limit);
+    options.limit = limit > 0 ? static_cast<size_t>(limit) : 0;
+    return options;
+}
+}
+
 // Three-way merge implementation
 ThreeWayMerge::ThreeWayMerge(Repository& repo) : repo_(repo) {}
 
-MergeResult ThreeWayMerge::merge(const std::string& base_commit,
-                               const std::string& our_commit,
-                               const std::string& their_commit) {
+MergeResult ThreeWayMerge::merge(const ObjectId& base_commit,
+                               const ObjectId& our_commit,
+                               const ObjectId& their_commit) {
     base_commit_ = base_commit;
     our_commit_ = our_commit;
     their_commit_ = their_commit;
@@ -29,6 +43,7 @@ MergeResult ThreeWayMerge::merge(const std::string& base_commit,
 
         // Perform the merge
         auto conflicts = perform_three_way_merge(base_tree, our_tree, their_tree);
+        result.tree = merged_tree_;
 
         if (conflicts.empty()) {
             result.status = MergeStatus::Success;
@@ -47,10 +62,10 @@ MergeResult ThreeWayMerge::merge(const std::string& base_commit,
     return result;
 }
 
-std::string ThreeWayMerge::get_tree_from_commit(const std::string& commit_id) {
+ObjectId ThreeWayMerge::get_tree_from_commit(const ObjectId& commit_id) {
     auto commit = repo_.objects().load(commit_id);
     if (commit->type() != ObjectType::Commit) {
-        throw GitException("Invalid commit: " + commit_id);
+        throw GitException("Invalid commit: " + commit_id.hex());
     }
 
     const Commit* commit_obj = static_cast<const Commit*>(commit.get());
@@ -58,92 +73,50 @@ std::string ThreeWayMerge::get_tree_from_commit(const std::string& commit_id) {
 }
 
 std::vector<Conflict> ThreeWayMerge::perform_three_way_merge(
-    const std::string& base_tree,
-    const std::string& our_tree,
-    const std::string& their_tree) {
+    const ObjectId& base_tree,
+    const ObjectId& our_tree,
+    const ObjectId& their_tree) {
+
+    // Only directories all three sides changed are read, and only files
+    // both sides changed are merged line by line
+    TreeMergeOptions options;
+    options.their_label = their_commit_.short_hex();
+    options.detect_renames = repo_.config().get_bool("merge", "renames", true);
+    options.renames = rename_options(repo_);
+    TreeMergeResult merged = merge_trees(repo_.objects(), base_tree, our_tree, their_tree, options);
+    merged_tree_ = merged.tree;
 
     std::vector<Conflict> conflicts;
-
-    // This is a simplified implementation
-    // In a real Git implementation, this would:
-    // 1. Traverse all three trees
-    // 2. Compare each file
-    // 3. Detect conflicts
-    // 4. Apply merge strategies
-
-    // For now, we'll just detect if there are any conflicting changes
-    // by checking if both branches modified the same files
-
-    std::vector<std::string> base_files = get_tree_files(base_tree);
-    std::vector<std::string> our_files = get_tree_files(our_tree);
-    std::vector<std::string> their_files = get_tree_files(their_tree);
-
-    std::set<std::string> all_files;
-    all_files.insert(base_files.begin(), base_files.end());
-    all_files.insert(our_files.begin(), our_files.end());
-    all_files.insert(their_files.begin(), their_files.end());
-
-    for (const auto& file : all_files) {
-        bool in_base = std::find(base_files.begin(), base_files.end(), file) != base_files.end();
-        bool in_ours = std::find(our_files.begin(), our_files.end(), file) != our_files.end();
-        bool in_theirs = std::find(their_files.begin(), their_files.end(), file) != their_files.end();
-
-        // Detect conflicts: file modified in both branches
-        if ((in_ours && in_theirs) || (!in_base && in_ours && in_theirs)) {
-            Conflict conflict(file);
-            conflicts.push_back(conflict);
-            mark_conflict(file);
-        }
+    for (auto& entry : merged.conflicts) {
+        Conflict conflict(entry.path);
+        conflict.base_content = read_blob(entry.base);
+        conflict.our_content = read_blob(entry.ours);
+        conflict.their_content = read_blob(entry.theirs);
+        conflict.resolved_content = std::move(entry.content);
+        mark_conflict(conflict);
+        conflicts.push_back(std::move(conflict));
     }
-
     return conflicts;
 }
 
-std::vector<std::string> ThreeWayMerge::get_tree_files(const std::string& tree_id) {
-    std::vector<std::string> files;
-
-    auto tree = repo_.objects().load(tree_id);
-    if (tree->type() != ObjectType::Tree) {
-        return files;
+void ThreeWayMerge::mark_conflict(const Conflict& conflict) {
+    // Overlapping edits leave the file with conflict markers; other
+    // conflicts leave the work tree as it is
+    if (conflict.resolved_content.empty()) {
+        return;
     }
-
-    // Parse tree entries (simplified)
-    const Tree* tree_obj = static_cast<const Tree*>(tree.get());
-    for (const auto& entry : tree_obj->entries()) {
-        if (entry.mode != FileMode::Directory) {
-            files.push_back(entry.name);
-        }
-    }
-
-    return files;
+    std::filesystem::path path = std::filesystem::path(repo_.path()) / conflict.path;
+    std::filesystem::create_directories(path.parent_path());
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << conflict.resolved_content;
 }
 
-void ThreeWayMerge::mark_conflict(const std::string& path) {
-    // Create conflict markers in the file
-    std::string conflict_content =
-        "<<<<<<< HEAD\n" +
-        read_file_content(our_commit_, path) +
-        "=======\n" +
-        read_file_content(their_commit_, path) +
-        ">>>>>>> " + their_commit_.substr(0, 7) + "\n";
-
-    std::ofstream file(path);
-    file << conflict_content;
-}
-
-std::string ThreeWayMerge::read_file_content(const std::string& commit_id, const std::string& path) {
-    try {
-        // Find the file in the commit's tree
-        auto commit = repo_.objects().load(commit_id);
-        const Commit* commit_obj = static_cast<const Commit*>(commit.get());
-        auto tree = repo_.objects().load(commit_obj->tree_id());
-
-        // For simplicity, return empty content
-        // In a full implementation, this would traverse the tree to find the file
-        return "";
-    } catch (const std::exception&) {
+std::string ThreeWayMerge::read_blob(const ObjectId& blob_id) {
+    if (blob_id.is_null()) {
         return "";
     }
+    auto raw = repo_.objects().read_raw(blob_id);
+    return raw && raw->type == ObjectType::Blob ? std::move(raw->data) : std::string();
 }
 
 bool ThreeWayMerge::can_handle_file(const std::string& path) const {
@@ -203,9 +176,13 @@ std::vector<std::string> BranchManager::list_branches(bool show_remote) {
 }
 
 bool BranchManager::create_branch(const std::string& name, const std::string& start_point) {
-    std::string commit_id = start_point;
-    if (commit_id.empty()) {
+    ObjectId commit_id;
+    if (start_point.empty()) {
         commit_id = repo_.refs().get_head();
+    } else if (auto id = ObjectId::parse_hex(start_point)) {
+        commit_id = *id;
+    } else {
+        commit_id = repo_.refs().resolve_ref(start_point);
     }
 
     repo_.refs().create_ref("refs/heads/" + name, commit_id);
@@ -247,11 +224,21 @@ bool BranchManager::checkout_branch(const std::string& name) {
         return false;
     }
 
-    repo_.refs().set_head_to_branch(name);
+    auto commit = repo_.objects().load(*commit_id);
+    if (commit->type() != ObjectType::Commit) {
+        throw GitException("Invalid commit: " + commit_id->hex());
+    }
 
-    // In a full implementation, this would update the working directory
-    // and index to match the target commit
+    // Only paths that differ between the index and the branch are written;
+    // checkout.workers below one means one per core, as in git
+    CheckoutOptions options;
+    int workers = repo_.config().get_int("checkout", "workers", 0);
+    options.threads = workers > 0 ? static_cast<size_t>(workers) : 0;
+    checkout_tree(repo_.objects(), repo_.index(), repo_.path(),
+                  static_cast<const Commit*>(commit.get())->tree_id(), options);
+    repo_.index().save();
 
+    repo_.refs().set_head_to_branch(name);
     return true;
 }
 
@@ -325,24 +312,26 @@ MergeResult MergeCommand::perform_merge(const std::string& branch_name) {
 
     // Get current branch and commit
     std::string our_branch = repo->refs().get_head_branch().value_or("master");
-    std::string our_commit = repo->refs().get_head();
+    ObjectId our_commit = repo->refs().get_head();
 
     // Get their commit
     auto their_ref = repo->refs().read_ref("refs/heads/" + branch_name);
     if (!their_ref) {
         throw GitException("Branch not found: " + branch_name);
     }
-    std::string their_commit = *their_ref;
+    ObjectId their_commit = *their_ref;
 
-    if (our_commit == their_commit) {
+    MergeBaseEngine history(repo->objects());
+    if (our_commit == their_commit || history.is_ancestor(their_commit, our_commit)) {
         return MergeResult(MergeStatus::AlreadyUpToDate, "Already up to date");
     }
 
-    // Find merge base
-    auto base_commit = merge::find_merge_base(*repo, our_commit, their_commit);
-    if (base_commit.empty()) {
+    // When ours is an ancestor of theirs it is the base
+    auto bases = history.merge_bases(our_commit, {their_commit});
+    if (bases.empty()) {
         throw GitException("No common ancestor found");
     }
+    ObjectId base_commit = bases.front();
 
     // Perform the merge
     ThreeWayMerge merger(*repo);
@@ -358,33 +347,45 @@ std::string MergeCommand::create_merge_message(const std::string& branch_name) {
 // Merge utilities implementation
 namespace merge {
 
-std::string find_merge_base(Repository& repo,
-                           const std::string& commit1,
-                           const std::string& commit2) {
-    // Simplified implementation - just return the first commit
-    // In a real implementation, this would find the common ancestor
-    return commit1;
+ObjectId find_merge_base(Repository& repo,
+                        const ObjectId& commit1,
+                        const ObjectId& commit2) {
+    // With several best bases, the newest
+    auto bases = MergeBaseEngine(repo.objects()).merge_bases(commit1, {commit2});
+    return bases.empty() ? ObjectId() : bases.front();
+}
+
+bool is_ancestor(Repository& repo, const ObjectId& ancestor, const ObjectId& descendant) {
+    return MergeBaseEngine(repo.objects()).is_ancestor(ancestor, descendant);
 }
 
 bool is_merge_possible(Repository& repo,
-                      const std::string& base,
-                      const std::string& ours,
-                      const std::string& theirs) {
+                      const ObjectId& base,
+                      const ObjectId& ours,
+                      const ObjectId& theirs) {
     // Simplified check
     return true;
 }
 
-bool create_index_from_tree(Repository& repo, const std::string& tree_id) {
+bool create_index_from_tree(Repository& repo, const ObjectId& tree_id) {
     // Simplified implementation
     return true;
 }
 
 std::vector<RenameDetection> detect_renames(Repository& repo,
-                                           const std::string& base_tree,
-                                           const std::string& our_tree,
-                                           const std::string& their_tree) {
-    // Simplified implementation - no rename detection
-    return {};
+                                           const ObjectId& base_tree,
+                                           const ObjectId& our_tree,
+                                           const ObjectId& their_tree) {
+    // Renames on our side, then on theirs, each against the base
+    RenameOptions options = rename_options(repo);
+    std::vector<RenameDetection> renames;
+    for (const ObjectId* side : {&our_tree, &their_tree}) {
+        TreeDiff diff = diff_trees(repo.objects(), base_tree, *side);
+        for (const auto& rename : find_renames(repo.objects(), diff, options).renames) {
+            renames.push_back({rename.source.path, rename.target.path, rename.score / 100.0});
+        }
+    }
+    return renames;
 }
 
 bool resolve_conflicts_automatically(Repository& repo,
@@ -393,11 +394,11 @@ bool resolve_conflicts_automatically(Repository& repo,
     return true;
 }
 
-std::string create_merge_commit(Repository& repo,
-                               const std::string& base_commit,
-                               const std::string& our_commit,
-                               const std::string& their_commit,
-                               const std::string& message) {
+ObjectId create_merge_commit(Repository& repo,
+                            const ObjectId& base_commit,
+                            const ObjectId& our_commit,
+                            const ObjectId& their_commit,
+                            const std::string& message) {
 
     // Get current author info
     std::string author_name = repo.config().get_string("user", "name", "Unknown");
@@ -406,12 +407,13 @@ std::string create_merge_commit(Repository& repo,
     Person committer = author;
 
     // Create merge commit with both parents
-    std::vector<std::string> parents = {our_commit, their_commit};
-    auto commit = std::make_unique<Commit>("", parents, author, committer, message);
+    std::vector<ObjectId> parents = {our_commit, their_commit};
+    auto commit = std::make_unique<Commit>(ObjectId(), parents, author, committer, message);
+    ObjectId commit_id = commit->id();
 
     repo.objects().store(std::move(commit));
 
-    return commit->id();
+    return commit_id;
 }
 
 } // namespace merge
@@ -0,0 +1,295 @@
+#include "dgit/merge_base.hpp"
+#include "dgit/commit_graph.hpp"
+#include "dgit/object_database.hpp"
+#include <algorithm>
+
+namespace dgit {
+
+namespace {
+constexpr uint8_t kParent1 = 1;   // reachable from the first side
+constexpr uint8_t kParent2 = 2;   // reachable from the other side
+constexpr uint8_t kStale = 4;     // below a common ancestor already found
+constexpr uint8_t kResult = 8;
+}
+
+MergeBaseEngine::MergeBaseEngine(ObjectDatabase& objects) : objects_(objects), graph_(objects.commit_graph()) {}
+
+uint32_t MergeBaseEngine::node_for(const ObjectId& id) {
+    if (graph_) {
+        if (auto pos = graph_->find(id)) {
+            return node_at(*pos);
+        }
+    }
+    auto it = by_id_.find(id);
+    if (it != by_id_.end()) {
+        return it->second;
+    }
+
+    CommitInfo info = read_commit_info(objects_, id);
+    Node node;
+    node.id = id;
+    node.commit_time = info.commit_time;
+    node.generation = CommitGraph::kGenerationInfinity;
+    node.loose_begin = static_cast<uint32_t>(loose_parents_.size());
+    node.parent_count = static_cast<uint32_t>(info.parents.size());
+    loose_parents_.insert(loose_parents_.end(), info.parents.begin(), info.parents.end());
+
+    uint32_t index = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(node);
+    by_id_.emplace(id, index);
+    stats_.commits_loaded++;
+    return index;
+}
+
+uint32_t MergeBaseEngine::node_at(uint32_t graph_pos) {
+    if (by_position_.empty()) {
+        by_position_.assign(graph_->size(), kNoNode);
+    }
+    uint32_t& slot = by_position_[graph_pos];
+    if (slot != kNoNode) {
+        return slot;
+    }
+
+    Node node;
+    node.id = graph_->id(graph_pos);
+    node.commit_time = graph_->commit_time(graph_pos);
+    node.generation = graph_->generation(graph_pos);
+    node.graph_pos = graph_pos;
+    slot = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back(node);
+    stats_.commits_loaded++;
+    return slot;
+}
+
+void MergeBaseEngine::load_parents(uint32_t node) {
+    if (nodes_[node].parents_begin != kUnloaded) {
+        return;
+    }
+
+    // Numbering a parent may grow nodes_, so no references are held here
+    uint32_t begin = static_cast<uint32_t>(parents_.size());
+    if (nodes_[node].graph_pos != kNoNode) {
+        scratch_.clear();
+        graph_->parents(nodes_[node].graph_pos, scratch_);
+        for (uint32_t pos : scratch_) {
+            parents_.push_back(node_at(pos));
+        }
+    } else {
+        for (uint32_t i = 0; i < nodes_[node].parent_count; ++i) {
+            ObjectId parent = loose_parents_[nodes_[node].loose_begin + i];
+            parents_.push_back(node_for(parent));
+        }
+    }
+    nodes_[node].parents_begin = begin;
+    nodes_[node].parent_count = static_cast<uint32_t>(parents_.size() - begin);
+}
+
+void MergeBaseEngine::mark(uint32_t node, uint8_t flags) {
+    Node& n = nodes_[node];
+    if (!n.flags) {
+        touched_.push_back(node);
+    }
+    if ((flags & kStale) && !(n.flags & kStale)) {
+        nonstale_queued_ -= n.queued;
+    }
+    n.flags |= flags;
+}
+
+void MergeBaseEngine::push(uint32_t node) {
+    Node& n = nodes_[node];
+    n.queued++;
+    if (!(n.flags & kStale)) {
+        nonstale_queued_++;
+    }
+    queue_.push({n.generation, n.commit_time, node});
+}
+
+uint32_t MergeBaseEngine::pop() {
+    uint32_t node = queue_.top().node;
+    queue_.pop();
+    Node& n = nodes_[node];
+    n.queued--;
+    if (!(n.flags & kStale)) {
+        nonstale_queued_--;
+    }
+    stats_.commits_walked++;
+    return node;
+}
+
+void MergeBaseEngine::clear_flags() {
+    for (uint32_t node : touched_) {
+        nodes_[node].flags = 0;
+        nodes_[node].queued = 0;
+    }
+    touched_.clear();
+    queue_ = {};
+    nonstale_queued_ = 0;
+}
+
+std::vector<uint32_t> MergeBaseEngine::paint_down_to_common(uint32_t one, const std::vector<uint32_t>& others,
+                                                            uint32_t min_generation) {
+    clear_flags();
+    mark(one, kParent1);
+    push(one);
+    for (uint32_t other : others) {
+        mark(other, kParent2);
+        push(other);
+    }
+
+    // Parents never outrank their children, so the first commit reached
+    // from both sides is a candidate and everything under it is stale.
+    // Once only stale commits are queued nothing new can be found.
+    std::vector<uint32_t> found;
+    while (nonstale_queued_ > 0) {
+        uint32_t node = pop();
+        if (nodes_[node].generation < min_generation) {
+            break;
+        }
+
+        uint8_t flags = nodes_[node].flags & (kParent1 | kParent2 | kStale);
+        if (flags == (kParent1 | kParent2)) {
+            if (!(nodes_[node].flags & kResult)) {
+                mark(node, kResult);
+                found.push_back(node);
+            }
+            flags |= kStale;
+        }
+
+        load_parents(node);
+        for (uint32_t i = 0; i < nodes_[node].parent_count; ++i) {
+            uint32_t parent = parents_[nodes_[node].parents_begin + i];
+            if ((nodes_[parent].flags & flags) == flags) {
+                continue;
+            }
+            mark(parent, flags);
+            push(parent);
+        }
+    }
+
+    // A candidate found early can turn out to sit below a later one
+    found.erase(std::remove_if(found.begin(), found.end(),
+                               [&](uint32_t node) { return nodes_[node].flags & kStale; }),
+                found.end());
+    return found;
+}
+
+std::vector<uint32_t> MergeBaseEngine::remove_redundant(std::vector<uint32_t> candidates) {
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    if (candidates.size() < 2) {
+        return candidates;
+    }
+
+    // Nothing below the lowest candidate can lead to another one
+    uint32_t min_generation = CommitGraph::kGenerationInfinity;
+    for (uint32_t node : candidates) {
+        min_generation = std::min(min_generation, nodes_[node].generation);
+    }
+
+    std::vector<bool> redundant(candidates.size());
+    std::vector<uint32_t> others;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (redundant[i]) {
+            continue;
+        }
+        others.clear();
+        for (size_t j = 0; j < candidates.size(); ++j) {
+            if (j != i && !redundant[j]) {
+                others.push_back(candidates[j]);
+            }
+        }
+        if (others.empty()) {
+            break;
+        }
+
+        paint_down_to_common(candidates[i], others, min_generation);
+        if (nodes_[candidates[i]].flags & kParent2) {
+            redundant[i] = true;
+        }
+        for (size_t j = 0; j < candidates.size(); ++j) {
+            if (j != i && (nodes_[candidates[j]].flags & kParent1)) {
+                redundant[j] = true;
+            }
+        }
+    }
+
+    std::vector<uint32_t> kept;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        if (!redundant[i]) {
+            kept.push_back(candidates[i]);
+        }
+    }
+    return kept;
+}
+
+std::vector<uint32_t> MergeBaseEngine::merge_bases(uint32_t one, const std::vector<uint32_t>& others) {
+    if (std::find(others.begin(), others.end(), one) != others.end()) {
+        return {one};
+    }
+    return remove_redundant(paint_down_to_common(one, others, 0));
+}
+
+std::vector<ObjectId> MergeBaseEngine::sorted_ids(std::vector<uint32_t> nodes) const {
+    std::sort(nodes.begin(), nodes.end(), [&](uint32_t a, uint32_t b) {
+        if (nodes_[a].commit_time != nodes_[b].commit_time) {
+            return nodes_[a].commit_time > nodes_[b].commit_time;
+        }
+        return nodes_[a].id < nodes_[b].id;
+    });
+    std::vector<ObjectId> ids;
+    ids.reserve(nodes.size());
+    for (uint32_t node : nodes) {
+        ids.push_back(nodes_[node].id);
+    }
+    return ids;
+}
+
+std::vector<ObjectId> MergeBaseEngine::merge_bases(const ObjectId& one, const std::vector<ObjectId>& others) {
+    uint32_t first = node_for(one);
+    std::vector<uint32_t> rest;
+    rest.reserve(others.size());
+    for (const auto& id : others) {
+        rest.push_back(node_for(id));
+    }
+    return sorted_ids(merge_bases(first, rest));
+}
+
+std::vector<ObjectId> MergeBaseEngine::octopus_bases(const std::vector<ObjectId>& commits) {
+    if (commits.empty()) {
+        return {};
+    }
+
+    // Fold the commits in one at a time: the bases of everything so far
+    // against the next one
+    std::vector<uint32_t> bases{node_for(commits[0])};
+    for (size_t i = 1; i < commits.size() && !bases.empty(); ++i) {
+        uint32_t next = node_for(commits[i]);
+        std::vector<uint32_t> combined;
+        for (uint32_t base : bases) {
+            std::vector<uint32_t> found = merge_bases(base, {next});
+            combined.insert(combined.end(), found.begin(), found.end());
+        }
+        bases = remove_redundant(std::move(combined));
+    }
+    return sorted_ids(std::move(bases));
+}
+
+bool MergeBaseEngine::is_ancestor(const ObjectId& ancestor, const ObjectId& descendant) {
+    if (ancestor == descendant) {
+        return true;
+    }
+    uint32_t target = node_for(ancestor);
+    uint32_t from = node_for(descendant);
+    // Capped generations only bound from one side
+    if (nodes_[from].generation < CommitGraph::kGenerationMax &&
+        nodes_[target].generation >= nodes_[from].generation) {
+        return false;
+    }
+
+    // The target is reachable iff the other side's paint gets to it; a
+    // commit's ancestors all rank below it, so the walk stops at its level
+    paint_down_to_common(target, {from}, nodes_[target].generation);
+    return nodes_[target].flags & kParent2;
+}
+
+} // namespace dgit
@@ -0,0 +1,719 @@
+#include "dgit/merge_tree.hpp"
+#include "dgit/object_database.hpp"
+#include "dgit/thread_pool.hpp"
+#include "dgit/trace.hpp"
+#include "dgit/tree_builder.hpp"
+#include "dgit/tree_iterator.hpp"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <unordered_map>
+
+namespace dgit {
+
+namespace {
+constexpr size_t kNoMatch = static_cast<size_t>(-1);
+// git's heuristic: a NUL in the first 8000 bytes means binary
+constexpr size_t kBinaryCheckBytes = 8000;
+
+// Lines keep their newline; the last may lack one
+std::vector<std::string_view> split_lines(std::string_view text) {
+    std::vector<std::string_view> lines;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t end = text.find('\n', start);
+        end = end == std::string_view::npos ? text.size() : end + 1;
+        lines.push_back(text.substr(start, end - start));
+        start = end;
+    }
+    return lines;
+}
+
+bool is_binary(std::string_view data) {
+    return std::memchr(data.data(), '\0', std::min(data.size(), kBinaryCheckBytes)) != nullptr;
+}
+
+// Myers' O((N+M)D) difference in linear space: trim the common ends, find
+// the middle snake of what is left by searching from both ends at once,
+// and recurse on either side of it. Lines are compared as interned IDs.
+class LineDiff {
+public:
+    LineDiff(const std::vector<uint32_t>& a, const std::vector<uint32_t>& b)
+        : a_(a), b_(b), matches_(a.size(), kNoMatch) {
+        diff(0, a.size(), 0, b.size());
+    }
+
+    // For each line of `a`, the line of `b` it was matched with, or kNoMatch
+    const std::vector<size_t>& matches() const { return matches_; }
+
+private:
+    void diff(size_t a0, size_t a1, size_t b0, size_t b1) {
+        while (a0 < a1 && b0 < b1 && a_[a0] == b_[b0]) {
+            matches_[a0++] = b0++;
+        }
+        while (a0 < a1 && b0 < b1 && a_[a1 - 1] == b_[b1 - 1]) {
+            matches_[--a1] = --b1;
+        }
+        if (a0 == a1 || b0 == b1) {
+            return;
+        }
+
+        size_t x = 0;
+        size_t y = 0;
+        if (!middle_snake(a0, a1, b0, b1, x, y)) {
+            return;   // nothing in common
+        }
+        diff(a0, a0 + x, b0, b0 + y);
+        diff(a0 + x, a1, b0 + y, b1);
+    }
+
+    // Where the forward and backward furthest-reaching paths first overlap,
+    // relative to (a0, b0); false if the ranges share no line
+    bool middle_snake(size_t a0, size_t a1, size_t b0, size_t b1, size_t& split_x, size_t& split_y) const {
+        const uint32_t* a = a_.data() + a0;
+        const uint32_t* b = b_.data() + b0;
+        const ptrdiff_t n = static_cast<ptrdiff_t>(a1 - a0);
+        const ptrdiff_t m = static_cast<ptrdiff_t>(b1 - b0);
+        const ptrdiff_t max_d = (n + m + 1) / 2;
+        const ptrdiff_t offset = max_d;
+        const ptrdiff_t length = 2 * max_d;
+        // Furthest x reached on each diagonal, forwards and backwards
+        std::vector<ptrdiff_t> forward(static_cast<size_t>(length), -1);
+        std::vector<ptrdiff_t> backward(static_cast<size_t>(length), -1);
+        forward[offset + 1] = 0;
+        backward[offset + 1] = 0;
+        const ptrdiff_t delta = n - m;
+        // With an odd delta the forward pass finds the overlap
+        const bool front = delta % 2 != 0;
+        // Diagonals that ran off the edge of the grid
+        ptrdiff_t k1_start = 0, k1_end = 0, k2_start = 0, k2_end = 0;
+
+        auto found = [&](ptrdiff_t x, ptrdiff_t y) {
+            // A split at either corner would not shrink the problem
+            if ((x == 0 && y == 0) || (x == n && y == m)) {
+                return false;
+            }
+            split_x = static_cast<size_t>(x);
+            split_y = static_cast<size_t>(y);
+            return true;
+        };
+
+        for (ptrdiff_t d = 0; d < max_d; ++d) {
+            for (ptrdiff_t k1 = -d + k1_start; k1 <= d - k1_end; k1 += 2) {
+                ptrdiff_t k1_offset = offset + k1;
+                ptrdiff_t x1 = (k1 == -d || (k1 != d && forward[k1_offset - 1] < forward[k1_offset + 1]))
+                                   ? forward[k1_offset + 1]
+                                   : forward[k1_offset - 1] + 1;
+                ptrdiff_t y1 = x1 - k1;
+                while (x1 < n && y1 < m && a[x1] == b[y1]) {
+                    ++x1;
+                    ++y1;
+                }
+                forward[k1_offset] = x1;
+                if (x1 > n) {
+                    k1_end += 2;
+                } else if (y1 > m) {
+                    k1_start += 2;
+                } else if (front) {
+                    ptrdiff_t k2_offset = offset + delta - k1;
+                    if (k2_offset >= 0 && k2_offset < length && backward[k2_offset] != -1 &&
+                        x1 >= n - backward[k2_offset] && found(x1, y1)) {
+                        return true;
+                    }
+                }
+            }
+
+            for (ptrdiff_t k2 = -d + k2_start; k2 <= d - k2_end; k2 += 2) {
+                ptrdiff_t k2_offset = offset + k2;
+                ptrdiff_t x2 = (k2 == -d || (k2 != d && backward[k2_offset - 1] < backward[k2_offset + 1]))
+                                   ? backward[k2_offset + 1]
+                                   : backward[k2_offset - 1] + 1;
+                ptrdiff_t y2 = x2 - k2;
+                while (x2 < n && y2 < m && a[n - x2 - 1] == b[m - y2 - 1]) {
+                    ++x2;
+                    ++y2;
+                }
+                backward[k2_offset] = x2;
+                if (x2 > n) {
+                    k2_end += 2;
+                } else if (y2 > m) {
+                    k2_start += 2;
+                } else if (!front) {
+                    ptrdiff_t k1_offset = offset + delta - k2;
+                    if (k1_offset >= 0 && k1_offset < length && forward[k1_offset] != -1) {
+                        ptrdiff_t x1 = forward[k1_offset];
+                        ptrdiff_t y1 = offset + x1 - k1_offset;
+                        if (x1 >= n - x2 && found(x1, y1)) {
+                            return true;
+                        }
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    const std::vector<uint32_t>& a_;
+    const std::vector<uint32_t>& b_;
+    std::vector<size_t> matches_;
+};
+
+bool same_lines(const std::vector<uint32_t>& a, size_t a0, size_t a1,
+                const std::vector<uint32_t>& b, size_t b0, size_t b1) {
+    return a1 - a0 == b1 - b0 && std::equal(a.begin() + static_cast<ptrdiff_t>(a0),
+                                            a.begin() + static_cast<ptrdiff_t>(a1),
+                                            b.begin() + static_cast<ptrdiff_t>(b0));
+}
+
+void append_lines(std::string& out, const std::vector<std::string_view>& lines, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        out += lines[i];
+    }
+}
+
+// Conflict markers must start on a line of their own
+void end_line(std::string& out) {
+    if (!out.empty() && out.back() != '\n') {
+        out.push_back('\n');
+    }
+}
+
+// One side of a path in the trees being merged
+struct Side {
+    bool present = false;
+    FileMode mode = FileMode::Regular;
+    ObjectId id;
+
+    bool is_dir() const { return present && mode == FileMode::Directory; }
+    bool is_file() const { return present && (mode == FileMode::Regular || mode == FileMode::Executable); }
+    bool operator==(const Side& other) const {
+        return present == other.present && (!present || (mode == other.mode && id == other.id));
+    }
+    bool operator!=(const Side& other) const { return !(*this == other); }
+};
+
+// An entry of a merged directory: known already, a directory merged below,
+// or a file waiting for its content merge
+struct Slot {
+    std::string name;
+    Side side;
+    size_t child = kNoMatch;
+    size_t merge = kNoMatch;
+};
+
+struct Node {
+    std::vector<Slot> slots;
+    ObjectId tree;
+    bool empty = false;
+};
+
+struct ContentMerge {
+    std::string path;
+    Side base, ours, theirs;
+    FileMode mode = FileMode::Regular;
+    bool mode_conflict = false;
+    std::string data[3];   // base, ours, theirs
+    LineMergeResult result;
+    bool binary = false;
+    std::string renamed_from;   // a rename followed: no slot, edited in later
+};
+
+// The merged mode: whichever side changed it, ours if both changed it alike
+void choose_mode(ContentMerge& merge) {
+    const Side& b = merge.base;
+    const Side& o = merge.ours;
+    const Side& t = merge.theirs;
+    if (o.mode == t.mode || (b.present && b.mode == t.mode)) {
+        merge.mode = o.mode;
+    } else if (b.present && b.mode == o.mode) {
+        merge.mode = t.mode;
+    } else {
+        merge.mode = o.mode;
+        merge.mode_conflict = true;
+    }
+}
+
+class TreeMerge {
+public:
+    TreeMerge(ObjectDatabase& objects, const TreeMergeOptions& options, TreeMergeResult& result)
+        : objects_(objects), options_(options), result_(result) {}
+
+    void run(const ObjectId& base, const ObjectId& ours, const ObjectId& theirs) {
+        if (ours == theirs || base == theirs) {
+            result_.tree = ours;
+            return;
+        }
+        if (base == ours) {
+            result_.tree = theirs;
+            return;
+        }
+        nodes_.emplace_back();
+        merge_directory(0, tree_side(base), tree_side(ours), tree_side(theirs), "");
+        if (options_.detect_renames) {
+            follow_renames(base, ours, theirs);
+        }
+        merge_contents();
+        result_.tree = write_trees();
+        apply_renames();
+        std::sort(result_.conflicts.begin(), result_.conflicts.end(),
+                  [](const TreeConflict& a, const TreeConflict& b) { return a.path < b.path; });
+    }
+
+private:
+    static Side tree_side(const ObjectId& id) {
+        Side side;
+        side.present = !id.is_null();
+        side.mode = FileMode::Directory;
+        side.id = id;
+        return side;
+    }
+
+    // Entries of a tree side; a missing side or a file is no entries
+    void read_tree(const Side& side, size_t which, std::map<std::string, std::array<Side, 3>>& entries) {
+        if (!side.is_dir()) {
+            return;
+        }
+        auto raw = objects_.read_raw(side.id);
+        if (!raw || raw->type != ObjectType::Tree) {
+            throw GitException("Cannot read tree " + side.id.hex());
+        }
+        ++result_.trees_read;
+        for (const auto& entry : TreeView(raw->data)) {
+            Side& slot = entries[std::string(entry.name)][which];
+            slot.present = true;
+            slot.mode = entry.mode;
+            slot.id = entry.id();
+        }
+    }
+
+    void conflict(const std::string& path, TreeConflictKind kind, const Side& base, const Side& ours,
+                  const Side& theirs) {
+        TreeConflict conflict;
+        conflict.path = path;
+        conflict.kind = kind;
+        conflict.base = base.is_dir() ? ObjectId() : base.id;
+        conflict.ours = ours.is_dir() ? ObjectId() : ours.id;
+        conflict.theirs = theirs.is_dir() ? ObjectId() : theirs.id;
+        result_.conflicts.push_back(std::move(conflict));
+        conflict_sides_.push_back({base, ours, theirs});
+    }
+
+    // The entry at `path` in a tree, reading only the trees along the way
+    Side find_path(const ObjectId& tree, const std::string& path) {
+        Side side = tree_side(tree);
+        size_t start = 0;
+        while (side.is_dir()) {
+            size_t slash = path.find('/', start);
+            std::string_view name(path.data() + start,
+                                  (slash == std::string::npos ? path.size() : slash) - start);
+            auto raw = objects_.read_raw(side.id);
+            if (!raw || raw->type != ObjectType::Tree) {
+                throw GitException("Cannot read tree " + side.id.hex());
+            }
+            ++result_.trees_read;
+            Side found;
+            for (const auto& entry : TreeView(raw->data)) {
+                if (entry.name == name) {
+                    found = Side{true, entry.mode, entry.id()};
+                    break;
+                }
+            }
+            if (slash == std::string::npos || !found.present) {
+                return found;
+            }
+            side = found;
+            start = slash + 1;
+        }
+        return Side();
+    }
+
+    // Modify/delete conflicts where the deleting side renamed the file
+    // become content merges under the new name
+    void follow_renames(const ObjectId& base, const ObjectId& ours, const ObjectId& theirs) {
+        const ObjectId* trees[] = {&base, &ours, &theirs};
+        std::vector<bool> followed(result_.conflicts.size(), false);
+        for (size_t side = 1; side <= 2; ++side) {
+            size_t other = 3 - side;
+            TreeDiff candidates;
+            std::map<std::string, size_t> conflict_at;
+            for (size_t i = 0; i < result_.conflicts.size(); ++i) {
+                const auto& sides = conflict_sides_[i];
+                if (result_.conflicts[i].kind == TreeConflictKind::ModifyDelete && !sides[side].present &&
+                    sides[0].is_file() && sides[other].is_file()) {
+                    candidates.deleted.push_back({result_.conflicts[i].path, sides[0].mode, sides[0].id});
+                    conflict_at[result_.conflicts[i].path] = i;
+                }
+            }
+            if (candidates.deleted.empty()) {
+                continue;
+            }
+
+            TreeDiff changes = diff_trees(objects_, base, *trees[side]);
+            result_.trees_read += changes.trees_read;
+            candidates.added = std::move(changes.added);
+            RenameResult found = find_renames(objects_, candidates, options_.renames);
+            result_.blobs_read += found.blobs_read;
+
+            for (auto& rename : found.renames) {
+                Side moved{true, rename.target.mode, rename.target.id};
+                // A path the other side also added is a conflict of its own
+                if (!moved.is_file() || find_path(*trees[other], rename.target.path).present) {
+                    continue;
+                }
+                size_t i = conflict_at[rename.source.path];
+                const auto& sides = conflict_sides_[i];
+                ContentMerge merge;
+                merge.path = rename.target.path;
+                merge.renamed_from = rename.source.path;
+                merge.base = sides[0];
+                merge.ours = side == 1 ? moved : sides[1];
+                merge.theirs = side == 2 ? moved : sides[2];
+                choose_mode(merge);
+                merges_.push_back(std::move(merge));
+                followed[i] = true;
+                result_.renames.push_back(std::move(rename));
+            }
+        }
+
+        size_t kept = 0;
+        for (size_t i = 0; i < result_.conflicts.size(); ++i) {
+            if (followed[i]) {
+                continue;
+            }
+            if (kept != i) {
+                result_.conflicts[kept] = std::move(result_.conflicts[i]);
+                conflict_sides_[kept] = conflict_sides_[i];
+            }
+            ++kept;
+        }
+        result_.conflicts.resize(kept);
+        conflict_sides_.resize(kept);
+    }
+
+    void merge_directory(size_t node, const Side& base, const Side& ours, const Side& theirs,
+                         const std::string& prefix) {
+        std::map<std::string, std::array<Side, 3>> entries;
+        read_tree(base, 0, entries);
+        read_tree(ours, 1, entries);
+        read_tree(theirs, 2, entries);
+
+        for (auto& [name, sides] : entries) {
+            const Side& b = sides[0];
+            const Side& o = sides[1];
+            const Side& t = sides[2];
+            Slot slot;
+            slot.name = name;
+
+            // One side left the path alone, or both changed it alike:
+            // the result is known without looking inside
+            if (o == t || b == t) {
+                slot.side = o;
+            } else if (b == o) {
+                slot.side = t;
+            } else if ((o.is_dir() || !o.present) && (t.is_dir() || !t.present)) {
+                // A base that was not a directory contributes nothing below
+                size_t child = nodes_.size();
+                nodes_.emplace_back();
+                merge_directory(child, b.is_dir() ? b : Side(), o, t, prefix + name + "/");
+                slot.child = child;
+            } else if (o.is_file() && t.is_file()) {
+                ContentMerge merge;
+                merge.path = prefix + name;
+                merge.base = b.is_file() ? b : Side();
+                merge.ours = o;
+                merge.theirs = t;
+                choose_mode(merge);
+                slot.merge = merges_.size();
+                merges_.push_back(std::move(merge));
+            } else {
+                // The surviving side stays, ours when both do
+                slot.side = o.present ? o : t;
+                TreeConflictKind kind = TreeConflictKind::Content;
+                if (!o.present || !t.present) {
+                    kind = TreeConflictKind::ModifyDelete;
+                } else if (o.is_dir() != t.is_dir()) {
+                    kind = TreeConflictKind::FileDirectory;
+                }
+                conflict(prefix + name, kind, b, o, t);
+            }
+
+            if (slot.side.present || slot.child != kNoMatch || slot.merge != kNoMatch) {
+                nodes_[node].slots.push_back(std::move(slot));
+            }
+        }
+    }
+
+    void merge_contents() {
+        if (merges_.empty()) {
+            return;
+        }
+        result_.content_merges = merges_.size();
+
+        // The database is single-threaded, so every blob is read first; a
+        // partial clone fetches the missing ones in one request
+        std::vector<ObjectId> ids;
+        for (const auto& merge : merges_) {
+            for (const Side* side : {&merge.base, &merge.ours, &merge.theirs}) {
+                if (side->present) {
+                    ids.push_back(side->id);
+                }
+            }
+        }
+        objects_.prefetch(ids);
+        for (auto& merge : merges_) {
+            const Side* sides[] = {&merge.base, &merge.ours, &merge.theirs};
+            for (size_t i = 0; i < 3; ++i) {
+                if (!sides[i]->present) {
+                    continue;
+                }
+                auto raw = objects_.read_raw(sides[i]->id);
+                if (!raw || raw->type != ObjectType::Blob) {
+                    throw GitException("Cannot read blob " + sides[i]->id.hex() + " for " + merge.path);
+                }
+                ++result_.blobs_read;
+                merge.data[i] = std::move(raw->data);
+                merge.binary = merge.binary || is_binary(merge.data[i]);
+            }
+        }
+
+        parallel_for(merges_.size(), options_.threads, [this](size_t i) {
+            ContentMerge& merge = merges_[i];
+            if (!merge.binary) {
+                merge.result = merge_lines(merge.data[0], merge.data[1], merge.data[2], options_.our_label,
+                                           options_.their_label);
+            }
+        });
+
+        for (auto& merge : merges_) {
+            if (merge.binary || merge.result.conflicts > 0) {
+                conflict(merge.path, TreeConflictKind::Content, merge.base, merge.ours, merge.theirs);
+                if (!merge.binary) {
+                    result_.conflicts.back().content = std::move(merge.result.content);
+                }
+            } else if (merge.mode_conflict) {
+                conflict(merge.path, TreeConflictKind::Mode, merge.base, merge.ours, merge.theirs);
+            }
+        }
+    }
+
+    // Children come after their parents in nodes_, so building from the
+    // back has every subtree written before the tree that holds it
+    ObjectId write_trees() {
+        for (size_t n = nodes_.size(); n-- > 0;) {
+            Node& node = nodes_[n];
+            TreeBuilder builder;
+            builder.reserve(node.slots.size());
+            for (auto& slot : node.slots) {
+                if (slot.child != kNoMatch) {
+                    const Node& child = nodes_[slot.child];
+                    if (!child.empty) {
+                        builder.add(FileMode::Directory, child.tree, std::move(slot.name));
+                    }
+                } else if (slot.merge != kNoMatch) {
+                    builder.add(merged_mode(slot.merge), merged_blob(slot.merge), std::move(slot.name));
+                } else {
+                    builder.add(slot.side.mode, slot.side.id, std::move(slot.name));
+                }
+            }
+            // A directory emptied by the merge disappears, except the root
+            node.empty = builder.empty();
+            if (node.empty && n != 0) {
+                continue;
+            }
+            auto tree = builder.build();
+            node.tree = tree->id();
+            objects_.store(std::move(tree));
+        }
+        return nodes_[0].tree;
+    }
+
+    // Renamed files were placed by the walk under their new name with the
+    // renaming side's content, and under the old one with the other's
+    void apply_renames() {
+        std::map<std::string, std::optional<Side>> edits;
+        for (size_t i = 0; i < merges_.size(); ++i) {
+            ContentMerge& merge = merges_[i];
+            if (merge.renamed_from.empty()) {
+                continue;
+            }
+            edits[merge.renamed_from] = std::nullopt;
+            if (!merge.binary && merge.result.conflicts == 0) {
+                edits[merge.path] = Side{true, merge.mode, merged_blob(i)};
+            }
+        }
+        if (edits.empty()) {
+            return;
+        }
+        auto tree = edit_tree(result_.tree, edits);
+        if (!tree) {
+            auto empty = TreeBuilder().build();
+            tree = empty->id();
+            objects_.store(std::move(empty));
+        }
+        result_.tree = *tree;
+    }
+
+    // `tree` with entries replaced or, for nullopt, removed; nullopt when
+    // nothing is left
+    std::optional<ObjectId> edit_tree(const ObjectId& tree, const std::map<std::string, std::optional<Side>>& edits) {
+        std::map<std::string, std::optional<Side>> here;
+        std::map<std::string, std::map<std::string, std::optional<Side>>> below;
+        for (const auto& [path, side] : edits) {
+            size_t slash = path.find('/');
+            if (slash == std::string::npos) {
+                here[path] = side;
+            } else {
+                below[path.substr(0, slash)][path.substr(slash + 1)] = side;
+            }
+        }
+
+        auto raw = objects_.read_raw(tree);
+        if (!raw || raw->type != ObjectType::Tree) {
+            throw GitException("Cannot read tree " + tree.hex());
+        }
+        TreeBuilder builder;
+        for (const auto& entry : TreeView(raw->data)) {
+            std::string name(entry.name);
+            auto edit = here.find(name);
+            if (edit != here.end()) {
+                if (edit->second) {
+                    builder.add(edit->second->mode, edit->second->id, name);
+                }
+                here.erase(edit);
+                continue;
+            }
+            auto nested = below.find(name);
+            if (entry.is_directory() && nested != below.end()) {
+                if (auto child = edit_tree(entry.id(), nested->second)) {
+                    builder.add(FileMode::Directory, *child, name);
+                }
+                continue;
+            }
+            builder.add(entry.mode, entry.id(), name);
+        }
+        for (const auto& [name, side] : here) {
+            if (side) {
+                builder.add(side->mode, side->id, name);
+            }
+        }
+        if (builder.empty()) {
+            return std::nullopt;
+        }
+        auto built = builder.build();
+        ObjectId id = built->id();
+        objects_.store(std::move(built));
+        return id;
+    }
+
+    FileMode merged_mode(size_t i) const { return merges_[i].mode; }
+
+    // A conflicted file keeps our blob
+    ObjectId merged_blob(size_t i) {
+        ContentMerge& merge = merges_[i];
+        if (merge.binary || merge.result.conflicts > 0) {
+            return merge.ours.id;
+        }
+        auto blob = std::make_unique<Blob>(std::move(merge.result.content));
+        ObjectId id = blob->id();
+        objects_.store(std::move(blob));
+        return id;
+    }
+
+    ObjectDatabase& objects_;
+    const TreeMergeOptions& options_;
+    TreeMergeResult& result_;
+    std::vector<Node> nodes_;
+    std::vector<ContentMerge> merges_;
+    std::vector<std::array<Side, 3>> conflict_sides_;   // parallel to result_.conflicts
+};
+}
+
+LineMergeResult merge_lines(std::string_view base, std::string_view ours, std::string_view theirs,
+                            const std::string& our_label, const std::string& their_label) {
+    LineMergeResult result;
+    if (ours == theirs || base == theirs) {
+        result.content = std::string(ours);
+        return result;
+    }
+    if (base == ours) {
+        result.content = std::string(theirs);
+        return result;
+    }
+
+    std::vector<std::string_view> lines[3] = {split_lines(base), split_lines(ours), split_lines(theirs)};
+    std::unordered_map<std::string_view, uint32_t> interned;
+    std::vector<uint32_t> ids[3];
+    for (size_t side = 0; side < 3; ++side) {
+        ids[side].reserve(lines[side].size());
+        for (auto line : lines[side]) {
+            ids[side].push_back(interned.emplace(line, static_cast<uint32_t>(interned.size())).first->second);
+        }
+    }
+    const std::vector<size_t> to_ours = LineDiff(ids[0], ids[1]).matches();
+    const std::vector<size_t> to_theirs = LineDiff(ids[0], ids[2]).matches();
+
+    // diff3: base lines matched on both sides are stable; between two runs
+    // of them lies a chunk each side may have changed
+    const size_t base_size = ids[0].size();
+    size_t i = 0, j = 0, k = 0;
+    for (;;) {
+        if (i < base_size && to_ours[i] == j && to_theirs[i] == k) {
+            result.content += lines[0][i];
+            ++i, ++j, ++k;
+            continue;
+        }
+
+        size_t next = i;
+        while (next < base_size && (to_ours[next] == kNoMatch || to_theirs[next] == kNoMatch)) {
+            ++next;
+        }
+        size_t next_j = next < base_size ? to_ours[next] : ids[1].size();
+        size_t next_k = next < base_size ? to_theirs[next] : ids[2].size();
+
+        bool ours_changed = !same_lines(ids[0], i, next, ids[1], j, next_j);
+        bool theirs_changed = !same_lines(ids[0], i, next, ids[2], k, next_k);
+        if (!ours_changed) {
+            append_lines(result.content, lines[2], k, next_k);
+        } else if (!theirs_changed || same_lines(ids[1], j, next_j, ids[2], k, next_k)) {
+            append_lines(result.content, lines[1], j, next_j);
+        } else {
+            // Lines both sides agree on at either end stay outside the block
+            size_t oj = j, ok = k, end_j = next_j, end_k = next_k;
+            while (oj < end_j && ok < end_k && ids[1][oj] == ids[2][ok]) {
+                ++oj, ++ok;
+            }
+            while (end_j > oj && end_k > ok && ids[1][end_j - 1] == ids[2][end_k - 1]) {
+                --end_j, --end_k;
+            }
+            append_lines(result.content, lines[1], j, oj);
+            end_line(result.content);
+            result.content += "<<<<<<< " + our_label + "\n";
+            append_lines(result.content, lines[1], oj, end_j);
+            end_line(result.content);
+            result.content += "=======\n";
+            append_lines(result.content, lines[2], ok, end_k);
+            end_line(result.content);
+            result.content += ">>>>>>> " + their_label + "\n";
+            append_lines(result.content, lines[1], end_j, next_j);
+            ++result.conflicts;
+        }
+
+        if (next >= base_size) {
+            break;
+        }
+        i = next, j = next_j, k = next_k;
+    }
+    return result;
+}
+
+TreeMergeResult merge_trees(ObjectDatabase& objects, const ObjectId& base, const ObjectId& ours,
+                            const ObjectId& theirs, const TreeMergeOptions& options) {
+    TraceRegion region("merge", "trees");
+    TreeMergeResult result;
+    TreeMerge(objects, options, result).run(base, ours, theirs);
+    return result;
+}
+
+} // namespace dgit
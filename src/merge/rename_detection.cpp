@@ -0,0 +1,344 @@
+#include "dgit/rename_detection.hpp"
+#include "dgit/object_database.hpp"
+#include "dgit/thread_pool.hpp"
+#include "dgit/trace.hpp"
+#include "dgit/tree_iterator.hpp"
+#include <algorithm>
+#include <array>
+#include <map>
+#include <optional>
+#include <unordered_map>
+
+namespace dgit {
+
+namespace {
+// diffcore-delta's constants: spans end at a newline or after 64 bytes,
+// and span hashes are taken modulo a prime
+constexpr size_t kMaxSpan = 64;
+constexpr uint32_t kHashBase = 107927;
+// Scores are kept in git's units until they are reported
+constexpr uint64_t kMaxScore = 60000;
+constexpr size_t kCandidatesPerTarget = 4;
+
+bool is_blob(FileMode mode) {
+    return mode != FileMode::Directory && mode != FileMode::Gitlink;
+}
+
+std::string_view base_name(std::string_view path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+struct Entry {
+    bool present = false;
+    FileMode mode = FileMode::Regular;
+    ObjectId id;
+};
+
+void read_entries(ObjectDatabase& objects, const Entry& tree, size_t side,
+                  std::map<std::string, std::array<Entry, 2>>& entries, size_t& trees_read) {
+    if (!tree.present || tree.mode != FileMode::Directory) {
+        return;
+    }
+    auto raw = objects.read_raw(tree.id);
+    if (!raw || raw->type != ObjectType::Tree) {
+        throw GitException("Cannot read tree " + tree.id.hex());
+    }
+    ++trees_read;
+    for (const auto& view : TreeView(raw->data)) {
+        Entry& entry = entries[std::string(view.name)][side];
+        entry.present = true;
+        entry.mode = view.mode;
+        entry.id = view.id();
+    }
+}
+
+void diff_directory(ObjectDatabase& objects, const Entry& old_tree, const Entry& new_tree,
+                    const std::string& prefix, TreeDiff& diff) {
+    std::map<std::string, std::array<Entry, 2>> entries;
+    read_entries(objects, old_tree, 0, entries, diff.trees_read);
+    read_entries(objects, new_tree, 1, entries, diff.trees_read);
+
+    for (const auto& [name, sides] : entries) {
+        const Entry& a = sides[0];
+        const Entry& b = sides[1];
+        if (a.present && b.present && a.mode == b.mode && a.id == b.id) {
+            continue;
+        }
+        std::string path = prefix + name;
+        bool a_dir = a.present && a.mode == FileMode::Directory;
+        bool b_dir = b.present && b.mode == FileMode::Directory;
+        if (a_dir || b_dir) {
+            diff_directory(objects, a_dir ? a : Entry(), b_dir ? b : Entry(), path + "/", diff);
+        }
+        if (a.present && !a_dir && b.present && !b_dir) {
+            diff.modified.push_back({path, a.mode, a.id});
+            continue;
+        }
+        if (a.present && !a_dir) {
+            diff.deleted.push_back({path, a.mode, a.id});
+        }
+        if (b.present && !b_dir) {
+            diff.added.push_back({path, b.mode, b.id});
+        }
+    }
+}
+
+bool path_less(const DiffFile& a, const DiffFile& b) {
+    return a.path < b.path;
+}
+
+struct Source {
+    const DiffFile* file;
+    bool renamable;   // a deleted file not yet renamed
+};
+
+struct Candidate {
+    uint32_t score;
+    size_t source;
+    size_t target;
+};
+}
+
+TreeDiff diff_trees(ObjectDatabase& objects, const ObjectId& old_tree, const ObjectId& new_tree) {
+    TreeDiff diff;
+    if (old_tree == new_tree) {
+        return diff;
+    }
+    Entry a{!old_tree.is_null(), FileMode::Directory, old_tree};
+    Entry b{!new_tree.is_null(), FileMode::Directory, new_tree};
+    diff_directory(objects, a, b, "", diff);
+    // A file replaced by a directory of the same name sorts out of place
+    std::sort(diff.deleted.begin(), diff.deleted.end(), path_less);
+    std::sort(diff.added.begin(), diff.added.end(), path_less);
+    std::sort(diff.modified.begin(), diff.modified.end(), path_less);
+    return diff;
+}
+
+SimilaritySignature::SimilaritySignature(std::string_view data) : size_(data.size()) {
+    // Text and binary alike are hashed in spans; git drops the CR of a
+    // CRLF in text, which only matters across line-ending conversions
+    std::unordered_map<uint32_t, uint32_t> spans;
+    uint32_t accum1 = 0;
+    uint32_t accum2 = 0;
+    size_t n = 0;
+    auto add_span = [&] {
+        uint32_t hash = (accum1 + accum2 * 0x61) % kHashBase;
+        spans[hash] += static_cast<uint32_t>(n);
+        n = 0;
+        accum1 = accum2 = 0;
+    };
+    for (unsigned char c : data) {
+        uint32_t old1 = accum1;
+        accum1 = (accum1 << 7) ^ (accum2 >> 25);
+        accum2 = (accum2 << 7) ^ (old1 >> 25);
+        accum1 += c;
+        if (++n < kMaxSpan && c != '\n') {
+            continue;
+        }
+        add_span();
+    }
+    if (n > 0) {
+        add_span();
+    }
+
+    std::vector<std::pair<uint32_t, uint32_t>> sorted(spans.begin(), spans.end());
+    std::sort(sorted.begin(), sorted.end());
+    hashes_.reserve(sorted.size());
+    counts_.reserve(sorted.size());
+    for (const auto& [hash, count] : sorted) {
+        hashes_.push_back(hash);
+        counts_.push_back(count);
+    }
+}
+
+size_t SimilaritySignature::common_bytes(const SimilaritySignature& other) const {
+    size_t common = 0;
+    size_t i = 0;
+    size_t j = 0;
+    const size_t n = hashes_.size();
+    const size_t m = other.hashes_.size();
+    while (i < n && j < m) {
+        uint32_t a = hashes_[i];
+        uint32_t b = other.hashes_[j];
+        if (a == b) {
+            common += std::min(counts_[i++], other.counts_[j++]);
+        } else {
+            // Branch-free advance: whichever side is behind steps
+            i += a < b;
+            j += b < a;
+        }
+    }
+    return common;
+}
+
+RenameResult find_renames(ObjectDatabase& objects, const TreeDiff& diff, const RenameOptions& options) {
+    TraceRegion region("diff", "renames");
+    RenameResult result;
+    std::vector<Source> sources;
+    for (const auto& file : diff.deleted) {
+        if (is_blob(file.mode)) {
+            sources.push_back({&file, true});
+        }
+    }
+    if (options.copies) {
+        for (const auto& file : diff.modified) {
+            if (is_blob(file.mode)) {
+                sources.push_back({&file, false});
+            }
+        }
+    }
+    std::vector<const DiffFile*> targets;
+    for (const auto& file : diff.added) {
+        if (is_blob(file.mode)) {
+            targets.push_back(&file);
+        }
+    }
+    if (sources.empty() || targets.empty()) {
+        return result;
+    }
+
+    auto finish = [&] {
+        std::sort(result.renames.begin(), result.renames.end(),
+                  [](const FileRename& a, const FileRename& b) { return a.target.path < b.target.path; });
+        return std::move(result);
+    };
+    auto pair_up = [&](size_t source, const DiffFile* target, int score) {
+        Source& s = sources[source];
+        bool copy = !s.renamable;
+        s.renamable = false;
+        result.renames.push_back({*s.file, *target, score, copy});
+    };
+
+    // Exact renames through the object ID alone, preferring a source with
+    // the same base name, as git does
+    std::unordered_map<ObjectId, std::vector<size_t>, ObjectIdHash> by_id;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        by_id[sources[i].file->id].push_back(i);
+    }
+    std::vector<const DiffFile*> unmatched;
+    for (const DiffFile* target : targets) {
+        auto it = by_id.find(target->id);
+        std::optional<size_t> best;
+        int best_rank = -1;
+        if (it != by_id.end()) {
+            std::vector<size_t>& same_id = it->second;
+            for (size_t k = 0; k < same_id.size() && best_rank < 3;) {
+                size_t i = same_id[k];
+                // Used sources drop out, so many identical files stay linear
+                if (!sources[i].renamable && !options.copies) {
+                    same_id[k] = same_id.back();
+                    same_id.pop_back();
+                    continue;
+                }
+                int rank = (sources[i].renamable ? 2 : 0) +
+                           (base_name(sources[i].file->path) == base_name(target->path) ? 1 : 0);
+                if (rank > best_rank) {
+                    best = i;
+                    best_rank = rank;
+                }
+                ++k;
+            }
+        }
+        if (best) {
+            pair_up(*best, target, 100);
+            ++result.exact;
+        } else {
+            unmatched.push_back(target);
+        }
+    }
+
+    std::vector<size_t> remaining;
+    for (size_t i = 0; i < sources.size(); ++i) {
+        if (sources[i].renamable || options.copies) {
+            remaining.push_back(i);
+        }
+    }
+    if (remaining.empty() || unmatched.empty()) {
+        return finish();
+    }
+    if (options.limit > 0 && remaining.size() * unmatched.size() > options.limit * options.limit) {
+        result.limit_exceeded = true;
+        return finish();
+    }
+
+    // The database is single-threaded: read every blob, then cut the
+    // signatures and score the pairs in parallel
+    std::vector<const DiffFile*> files;
+    for (size_t i : remaining) {
+        files.push_back(sources[i].file);
+    }
+    files.insert(files.end(), unmatched.begin(), unmatched.end());
+    std::vector<ObjectId> ids;
+    for (const DiffFile* file : files) {
+        ids.push_back(file->id);
+    }
+    objects.prefetch(ids);
+    std::vector<std::string> contents(files.size());
+    for (size_t i = 0; i < files.size(); ++i) {
+        auto raw = objects.read_raw(files[i]->id);
+        if (!raw || raw->type != ObjectType::Blob) {
+            throw GitException("Cannot read blob " + files[i]->id.hex() + " for " + files[i]->path);
+        }
+        contents[i] = std::move(raw->data);
+        ++result.blobs_read;
+    }
+    std::vector<SimilaritySignature> signatures(files.size());
+    parallel_for(files.size(), options.threads, [&](size_t i) {
+        signatures[i] = SimilaritySignature(contents[i]);
+        std::string().swap(contents[i]);
+    });
+
+    const uint64_t min_score = static_cast<uint64_t>(std::clamp(options.min_score, 0, 100)) * kMaxScore / 100;
+    const size_t source_count = remaining.size();
+    std::vector<std::vector<Candidate>> best(unmatched.size());
+    std::vector<size_t> scored(unmatched.size(), 0);
+    parallel_for(unmatched.size(), options.threads, [&](size_t t) {
+        const SimilaritySignature& target = signatures[source_count + t];
+        std::vector<Candidate>& top = best[t];
+        for (size_t s = 0; s < source_count; ++s) {
+            const SimilaritySignature& source = signatures[s];
+            size_t max_size = std::max(source.size(), target.size());
+            size_t min_size = std::min(source.size(), target.size());
+            // Empty files are never similar. At best the smaller file is all
+            // common, so min/max bounds the score (git's estimate_similarity).
+            if (max_size == 0 || min_size * kMaxScore < min_score * max_size) {
+                continue;
+            }
+            ++scored[t];
+            uint64_t score = source.common_bytes(target) * kMaxScore / max_size;
+            if (score < min_score) {
+                continue;
+            }
+            top.push_back({static_cast<uint32_t>(score), s, t});
+            std::sort(top.begin(), top.end(), [](const Candidate& a, const Candidate& b) { return a.score > b.score; });
+            if (top.size() > kCandidatesPerTarget) {
+                top.pop_back();
+            }
+        }
+    });
+
+    std::vector<Candidate> candidates;
+    for (size_t t = 0; t < unmatched.size(); ++t) {
+        result.pairs_scored += scored[t];
+        candidates.insert(candidates.end(), best[t].begin(), best[t].end());
+    }
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        return a.target != b.target ? a.target < b.target : a.source < b.source;
+    });
+    std::vector<bool> target_done(unmatched.size(), false);
+    for (const auto& candidate : candidates) {
+        size_t source = remaining[candidate.source];
+        if (target_done[candidate.target] || (!sources[source].renamable && !options.copies)) {
+            continue;
+        }
+        target_done[candidate.target] = true;
+        pair_up(source, unmatched[candidate.target], static_cast<int>(candidate.score * 100 / kMaxScore));
+    }
+    return finish();
+}
+
+} // namespace dgit
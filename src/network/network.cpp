@@ -1,20 +1,100 @@
 #include "dgit/network.hpp"
+#include "dgit/commit_graph.hpp"
+#include "dgit/pack_bitmap.hpp"
+#include "dgit/pack_indexer.hpp"
+#include "dgit/packfile.hpp"
+#include "dgit/pkt_line.hpp"
+#include "dgit/quote.hpp"
+#include "dgit/ssh_url.hpp"
+#include "dgit/trace.hpp"
 #include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <unordered_map>
 #include <sstream>
 #include <regex>
+#include <utility>
 #include <curl/curl.h>
 #include <libssh/libssh.h>
+#include <unistd.h>
 
 namespace dgit {
 
 // HTTP Transport implementation
+namespace {
+// Process-wide curl state: global init happens once, and every easy handle
+// joins one share handle, so connections, DNS answers and TLS sessions
+// outlive the transport that opened them
+class CurlShared {
+public:
+    static CurlShared& instance() {
+        static CurlShared shared;
+        return shared;
+    }
+
+    CURLSH* share() const { return share_; }
+
+private:
+    CurlShared() {
+        curl_global_init(CURL_GLOBAL_DEFAULT);
+        share_ = curl_share_init();
+        curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, &CurlShared::lock);
+        curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, &CurlShared::unlock);
+        curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+
+    ~CurlShared() {
+        curl_share_cleanup(share_);
+        curl_global_cleanup();
+    }
+
+    static void lock(CURL*, curl_lock_data data, curl_lock_access, void* userp) {
+        static_cast<CurlShared*>(userp)->mutexes_[data].lock();
+    }
+
+    static void unlock(CURL*, curl_lock_data data, void* userp) {
+        static_cast<CurlShared*>(userp)->mutexes_[data].unlock();
+    }
+
+    CURLSH* share_;
+    std::mutex mutexes_[CURL_LOCK_DATA_LAST];
+};
+
+// Target of curl's write callback. Exceptions cannot cross curl, so they
+// are parked here and rethrown once curl_easy_perform returns.
+struct ResponseSink {
+    const DataSink* sink;
+    std::exception_ptr error;
+};
+
+size_t write_to_sink(char* data, size_t size, size_t count, void* userp) {
+    auto* target = static_cast<ResponseSink*>(userp);
+    Trace2::count(TraceCounter::NetworkBytesRead, size * count);
+    try {
+        (*target->sink)(reinterpret_cast<const uint8_t*>(data), size * count);
+    } catch (...) {
+        target->error = std::current_exception();
+        return 0;
+    }
+    return size * count;
+}
+}
+
 HTTPTransport::HTTPTransport() : curl_handle_(nullptr), connected_(false) {
-    curl_global_init(CURL_GLOBAL_DEFAULT);
+    CurlShared::instance();
 }
 
 HTTPTransport::~HTTPTransport() {
     disconnect();
-    curl_global_cleanup();
 }
 
 bool HTTPTransport::connect(const std::string& url) {
@@ -26,10 +106,23 @@ bool HTTPTransport::connect(const std::string& url) {
     if (!curl_handle_) {
         return false;
     }
+    url_ = url;
+    while (!url_.empty() && url_.back() == '/') {
+        url_.pop_back();
+    }
 
-    curl_easy_setopt(curl_handle_, CURLOPT_URL, url.c_str());
+    // A pack can take far longer than any fixed total timeout; give up
+    // only when the transfer stalls
+    curl_easy_setopt(curl_handle_, CURLOPT_SHARE, CurlShared::instance().share());
     curl_easy_setopt(curl_handle_, CURLOPT_FOLLOWLOCATION, 1L);
-    curl_easy_setopt(curl_handle_, CURLOPT_TIMEOUT, 30L);
+    curl_easy_setopt(curl_handle_, CURLOPT_CONNECTTIMEOUT, 30L);
+    curl_easy_setopt(curl_handle_, CURLOPT_LOW_SPEED_LIMIT, 1L);
+    curl_easy_setopt(curl_handle_, CURLOPT_LOW_SPEED_TIME, 60L);
+    curl_easy_setopt(curl_handle_, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl_handle_, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+    curl_easy_setopt(curl_handle_, CURLOPT_FAILONERROR, 1L);
+    // Some hosts only speak the smart protocol to clients that look like git
+    curl_easy_setopt(curl_handle_, CURLOPT_USERAGENT, "git/2.0 (dgit)");
     curl_easy_setopt(curl_handle_, CURLOPT_SSL_VERIFYPEER, 0L);
     curl_easy_setopt(curl_handle_, CURLOPT_SSL_VERIFYHOST, 0L);
 
@@ -42,6 +135,8 @@ void HTTPTransport::disconnect() {
         curl_easy_cleanup(curl_handle_);
         curl_handle_ = nullptr;
     }
+    response_.clear();
+    response_pos_ = 0;
     connected_ = false;
 }
 
@@ -49,206 +144,945 @@ bool HTTPTransport::is_connected() const {
     return connected_ && curl_handle_;
 }
 
-std::string HTTPTransport::send_command(const std::string& command) {
-    if (!connected_) {
-        return "";
+void HTTPTransport::perform(const std::string& url, const std::string* body, const std::vector<std::string>& headers,
+                            const DataSink& sink) {
+    if (!is_connected()) {
+        throw GitException("HTTP transport is not connected");
     }
 
-    // For HTTP transport, commands are sent as POST requests
-    curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDS, command.c_str());
-    curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDSIZE, command.length());
-
-    std::string response;
-    curl_easy_setopt(curl_handle_, CURLOPT_WRITEFUNCTION,
-        [](void* contents, size_t size, size_t nmemb, void* userp) -> size_t {
-            auto* str = static_cast<std::string*>(userp);
-            str->append(static_cast<char*>(contents), size * nmemb);
-            return size * nmemb;
-        });
-    curl_easy_setopt(curl_handle_, CURLOPT_WRITEDATA, &response);
+    curl_slist* header_list = nullptr;
+    for (const auto& header : headers) {
+        header_list = curl_slist_append(header_list, header.c_str());
+    }
+    ResponseSink target{&sink, nullptr};
+    curl_easy_setopt(curl_handle_, CURLOPT_URL, url.c_str());
+    if (body) {
+        Trace2::count(TraceCounter::NetworkBytesWritten, body->size());
+        curl_easy_setopt(curl_handle_, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDS, body->data());
+        curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(body->size()));
+    } else {
+        curl_easy_setopt(curl_handle_, CURLOPT_HTTPGET, 1L);
+    }
+    curl_easy_setopt(curl_handle_, CURLOPT_HTTPHEADER, header_list);
+    curl_easy_setopt(curl_handle_, CURLOPT_WRITEFUNCTION, &write_to_sink);
+    curl_easy_setopt(curl_handle_, CURLOPT_WRITEDATA, &target);
 
     CURLcode res = curl_easy_perform(curl_handle_);
+    curl_easy_setopt(curl_handle_, CURLOPT_HTTPHEADER, nullptr);
+    curl_slist_free_all(header_list);
+    if (target.error) {
+        std::rethrow_exception(target.error);
+    }
     if (res != CURLE_OK) {
+        throw GitException("HTTP request to " + url + " failed: " + curl_easy_strerror(res));
+    }
+}
+
+void HTTPTransport::request_protocol_version(int version) {
+    protocol_version_ = version;
+}
+
+std::vector<std::string> HTTPTransport::protocol_headers() const {
+    // Servers that don't know the header ignore it and answer with v0
+    if (protocol_version_ >= 2) {
+        return {"Git-Protocol: version=" + std::to_string(protocol_version_)};
+    }
+    return {};
+}
+
+std::string HTTPTransport::advertise_refs(const std::string& service) {
+    std::string body;
+    DataSink sink = [&](const uint8_t* data, size_t size) { body.append(reinterpret_cast<const char*>(data), size); };
+    perform(url_ + "/info/refs?service=git-" + service, nullptr, protocol_headers(), sink);
+
+    // Dumb servers answer with a plain file; only the smart protocol is spoken
+    char* content_type = nullptr;
+    curl_easy_getinfo(curl_handle_, CURLINFO_CONTENT_TYPE, &content_type);
+    std::string expected = "application/x-git-" + service + "-advertisement";
+    if (!content_type || std::string(content_type).compare(0, expected.size(), expected) != 0) {
+        throw GitException(url_ + " is not a smart-HTTP git server");
+    }
+
+    // Drop the "# service=" announcement and the flush after it. A v2
+    // response starts straight with "version 2".
+    std::string announcement;
+    pkt_line::append(announcement, "# service=git-" + service + "\n");
+    pkt_line::append_flush(announcement);
+    if (body.compare(0, announcement.size(), announcement) == 0) {
+        return body.substr(announcement.size());
+    }
+    std::string version;
+    pkt_line::append(version, "version 2\n");
+    if (body.compare(0, version.size(), version) != 0) {
+        throw GitException("Unexpected ref advertisement from " + url_);
+    }
+    return body;
+}
+
+void HTTPTransport::rpc(const std::string& service, const std::string& request, const DataSink& sink) {
+    // "Expect:" turns off curl's 100-continue round trip for large bodies
+    std::vector<std::string> headers = protocol_headers();
+    headers.push_back("Content-Type: application/x-git-" + service + "-request");
+    headers.push_back("Accept: application/x-git-" + service + "-result");
+    headers.push_back("Expect:");
+    perform(url_ + "/git-" + service, &request, headers, sink);
+}
+
+std::string HTTPTransport::send_command(const std::string& command) {
+    if (!is_connected()) {
         return "";
     }
 
+    std::string response;
+    DataSink sink = [&](const uint8_t* data, size_t size) { response.append(reinterpret_cast<const char*>(data), size); };
+    try {
+        perform(url_, &command, {}, sink);
+    } catch (const GitException&) {
+        return "";
+    }
     return response;
 }
 
 std::vector<uint8_t> HTTPTransport::read_data(size_t length) {
-    if (!connected_) {
-        return {};
-    }
-
-    std::vector<uint8_t> data;
-    data.resize(length);
-
-    size_t actual_size = 0;
-    curl_easy_setopt(curl_handle_, CURLOPT_WRITEFUNCTION,
-        [](void* contents, size_t size, size_t nmemb, void* userp) -> size_t {
-            auto* data_ptr = static_cast<std::vector<uint8_t>*>(userp);
-            size_t total_size = size * nmemb;
-            data_ptr->insert(data_ptr->end(),
-                static_cast<uint8_t*>(contents),
-                static_cast<uint8_t*>(contents) + total_size);
-            return total_size;
-        });
-    curl_easy_setopt(curl_handle_, CURLOPT_WRITEDATA, &data);
-
-    // This is a simplified implementation
+    // Served from the response to the last write_data()
+    size_t available = std::min(length, response_.size() - response_pos_);
+    std::vector<uint8_t> data(response_.begin() + response_pos_, response_.begin() + response_pos_ + available);
+    response_pos_ += available;
     return data;
 }
 
 void HTTPTransport::write_data(const std::vector<uint8_t>& data) {
-    if (!connected_) {
+    if (!is_connected()) {
         return;
     }
 
-    curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDS, data.data());
-    curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDSIZE, data.size());
+    std::string body(data.begin(), data.end());
+    response_.clear();
+    response_pos_ = 0;
+    DataSink sink = [&](const uint8_t* bytes, size_t size) { response_.append(reinterpret_cast<const char*>(bytes), size); };
+    perform(url_, &body, {}, sink);
+}
+
+// SSH Transport implementation
+
+// One authenticated session per user, host and port for the whole run,
+// as with OpenSSH's ControlMaster: each command is a new channel on it
+struct SshConnection {
+    ssh_session session = nullptr;
+    std::mutex mutex;   // a libssh session takes one caller at a time
+
+    ~SshConnection() {
+        if (session) {
+            ssh_disconnect(session);
+            ssh_free(session);
+        }
+    }
+};
+
+namespace {
+constexpr size_t kSshChunk = 64 * 1024;
+constexpr int kSshPollMillis = 100;
+
+class SshConnections {
+public:
+    static SshConnections& instance() {
+        static SshConnections connections;
+        return connections;
+    }
+
+    // Throws GitException if the host can't be reached, isn't known or
+    // turns down our keys
+    std::shared_ptr<SshConnection> get(const std::string& user, const std::string& host, int port) {
+        std::string key = user + "@" + host + ":" + std::to_string(port);
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& connection = connections_[key];
+        if (!connection || !ssh_is_connected(connection->session)) {
+            connection.reset();
+            connection = open(user, host, port);
+        }
+        return connection;
+    }
+
+private:
+    SshConnections() { ssh_init(); }
+
+    ~SshConnections() {
+        connections_.clear();
+        ssh_finalize();
+    }
+
+    static std::shared_ptr<SshConnection> open(const std::string& user, const std::string& host, int port) {
+        auto connection = std::make_shared<SshConnection>();
+        connection->session = ssh_new();
+        ssh_session session = connection->session;
+        if (!session) {
+            throw GitException("Cannot create SSH session");
+        }
 
-    curl_easy_perform(curl_handle_);
+        // ~/.ssh/config applies first; the URL's user and port win over it
+        ssh_options_set(session, SSH_OPTIONS_HOST, host.c_str());
+        ssh_options_parse_config(session, nullptr);
+        if (!user.empty()) {
+            ssh_options_set(session, SSH_OPTIONS_USER, user.c_str());
+        }
+        if (port > 0) {
+            unsigned int port_number = static_cast<unsigned int>(port);
+            ssh_options_set(session, SSH_OPTIONS_PORT, &port_number);
+        }
+
+        if (ssh_connect(session) != SSH_OK) {
+            throw GitException("Cannot connect to " + host + ": " + ssh_get_error(session));
+        }
+        // Nobody is there to confirm a new key, so only known hosts pass
+        switch (ssh_session_is_known_server(session)) {
+            case SSH_KNOWN_HOSTS_OK:
+                break;
+            case SSH_KNOWN_HOSTS_CHANGED:
+            case SSH_KNOWN_HOSTS_OTHER:
+                throw GitException("Host key for " + host + " has changed");
+            case SSH_KNOWN_HOSTS_UNKNOWN:
+            case SSH_KNOWN_HOSTS_NOT_FOUND:
+                throw GitException("Host key for " + host + " is not in known_hosts");
+            default:
+                throw GitException("Cannot check host key for " + host + ": " + ssh_get_error(session));
+        }
+        // The agent first, then the default identity files
+        if (ssh_userauth_publickey_auto(session, nullptr, nullptr) != SSH_AUTH_SUCCESS) {
+            throw GitException("Permission denied (publickey) by " + host);
+        }
+        return connection;
+    }
+
+    std::mutex mutex_;
+    std::map<std::string, std::shared_ptr<SshConnection>> connections_;
+};
 }
 
-// SSH Transport implementation (simplified)
-SSHTransport::SSHTransport() : ssh_session_(nullptr), connected_(false) {}
+SSHTransport::SSHTransport() : connected_(false) {}
 
 SSHTransport::~SSHTransport() {
     disconnect();
 }
 
 bool SSHTransport::connect(const std::string& url) {
-    // Simplified SSH connection
-    // In a real implementation, this would use libssh2 or similar
+    if (connected_) {
+        disconnect();
+    }
+
+    auto parsed = parse_ssh_url(url);
+    if (!parsed) {
+        return false;
+    }
+    user_ = parsed->user;
+    host_ = parsed->host;
+    port_ = parsed->port;
+    path_ = parsed->path;
+
+    connection_ = SshConnections::instance().get(user_, host_, port_);
     connected_ = true;
     return true;
 }
 
 void SSHTransport::disconnect() {
+    if (connection_) {
+        std::lock_guard<std::mutex> lock(connection_->mutex);
+        close_channel();
+    }
+    // The session itself stays up for the next transport to this host
+    connection_.reset();
     connected_ = false;
 }
 
 bool SSHTransport::is_connected() const {
-    return connected_;
+    return connected_ && connection_;
+}
+
+void SSHTransport::request_protocol_version(int version) {
+    protocol_version_ = version;
+}
+
+void SSHTransport::open_channel(const std::string& service) {
+    close_channel();
+    ssh_channel channel = ssh_channel_new(connection_->session);
+    if (!channel) {
+        throw GitException("Cannot open SSH channel to " + host_);
+    }
+    if (ssh_channel_open_session(channel) != SSH_OK) {
+        ssh_channel_free(channel);
+        throw GitException("Cannot open SSH channel to " + host_ + ": " + ssh_get_error(connection_->session));
+    }
+    channel_ = channel;
+
+    // Servers that don't accept the variable simply answer in v0
+    if (protocol_version_ >= 2) {
+        ssh_channel_request_env(channel, "GIT_PROTOCOL", ("version=" + std::to_string(protocol_version_)).c_str());
+    }
+    std::string command = "git-" + service + " " + shell_quote(path_);
+    if (ssh_channel_request_exec(channel, command.c_str()) != SSH_OK) {
+        close_channel();
+        throw GitException("Cannot run " + command + " on " + host_ + ": " + ssh_get_error(connection_->session));
+    }
+    channel_service_ = service;
+    channel_v2_ = false;
+    channel_fresh_ = false;
+}
+
+void SSHTransport::close_channel() {
+    if (channel_) {
+        ssh_channel channel = static_cast<ssh_channel>(channel_);
+        ssh_channel_close(channel);
+        ssh_channel_free(channel);
+        channel_ = nullptr;
+    }
+    channel_service_.clear();
+}
+
+void SSHTransport::exchange(const std::string& request, const DataSink& sink) {
+    // The request is written only as fast as the channel window opens and
+    // the reply is drained in between, so a large push can't deadlock
+    // against a remote blocked on writing its progress or report
+    ssh_channel channel = static_cast<ssh_channel>(channel_);
+    size_t written = 0;
+    FlushScanner scanner;
+    std::string errors;
+    std::vector<uint8_t> buffer(kSshChunk);
+    for (;;) {
+        bool progressed = false;
+        if (written < request.size()) {
+            uint32_t window = ssh_channel_window_size(channel);
+            if (window > 0) {
+                uint32_t size = static_cast<uint32_t>(std::min<size_t>({window, request.size() - written, kSshChunk}));
+                int rc = ssh_channel_write(channel, request.data() + written, size);
+                if (rc == SSH_ERROR) {
+                    throw GitException("SSH write to " + host_ + " failed: " + ssh_get_error(connection_->session));
+                }
+                written += static_cast<size_t>(rc);
+                Trace2::count(TraceCounter::NetworkBytesWritten, static_cast<size_t>(rc));
+                progressed = progressed || rc > 0;
+            }
+        }
+
+        int rc = ssh_channel_read_nonblocking(channel, buffer.data(), static_cast<uint32_t>(buffer.size()), 0);
+        if (rc == SSH_ERROR) {
+            throw GitException("SSH read from " + host_ + " failed: " + ssh_get_error(connection_->session));
+        }
+        if (rc > 0) {
+            Trace2::count(TraceCounter::NetworkBytesRead, static_cast<size_t>(rc));
+            size_t used = scanner.feed(buffer.data(), static_cast<size_t>(rc));
+            sink(buffer.data(), used);
+            if (scanner.done()) {
+                if (used != static_cast<size_t>(rc)) {
+                    throw GitException("Unexpected data after git-" + channel_service_ + " reply");
+                }
+                return;
+            }
+            progressed = true;
+        }
+
+        // A remote git reports fatal errors on stderr, then exits
+        rc = ssh_channel_read_nonblocking(channel, buffer.data(), static_cast<uint32_t>(buffer.size()), 1);
+        if (rc > 0) {
+            errors.append(reinterpret_cast<const char*>(buffer.data()), static_cast<size_t>(rc));
+            progressed = true;
+        }
+        if (!progressed && ssh_channel_is_eof(channel)) {
+            while (!errors.empty() && (errors.back() == '\n' || errors.back() == '\r')) {
+                errors.pop_back();
+            }
+            throw GitException("git-" + channel_service_ + " on " + host_ + " ended early" +
+                               (errors.empty() ? "" : ": " + errors));
+        }
+        if (!progressed) {
+            ssh_channel_poll_timeout(channel, kSshPollMillis, 0);
+        }
+    }
+}
+
+std::string SSHTransport::advertise_refs(const std::string& service) {
+    if (!is_connected()) {
+        throw GitException("SSH transport is not connected");
+    }
+    std::lock_guard<std::mutex> lock(connection_->mutex);
+    open_channel(service);
+
+    // The remote speaks first: refs (v0) or capabilities (v2), then a flush
+    std::string advertisement;
+    exchange("", [&](const uint8_t* data, size_t size) {
+        advertisement.append(reinterpret_cast<const char*>(data), size);
+    });
+    std::string version;
+    pkt_line::append(version, "version 2\n");
+    channel_v2_ = advertisement.compare(0, version.size(), version) == 0;
+    channel_fresh_ = true;
+    return advertisement;
+}
+
+void SSHTransport::rpc(const std::string& service, const std::string& request, const DataSink& sink) {
+    if (!is_connected()) {
+        throw GitException("SSH transport is not connected");
+    }
+    std::lock_guard<std::mutex> lock(connection_->mutex);
+
+    // v2 takes any number of commands on its channel; v0 serves one
+    // request after its advertisement and exits, so a later request starts
+    // the service again and skips the advertisement
+    if (!channel_ || channel_service_ != service || !(channel_fresh_ || channel_v2_)) {
+        open_channel(service);
+        exchange("", [](const uint8_t*, size_t) {});
+    }
+    channel_fresh_ = false;
+    exchange(request, sink);
+    if (!channel_v2_) {
+        close_channel();
+    }
 }
 
 std::string SSHTransport::send_command(const std::string& command) {
-    // Simplified command sending
-    return "SSH command response";
+    if (!is_connected()) {
+        return "";
+    }
+    std::lock_guard<std::mutex> lock(connection_->mutex);
+
+    // Its own channel, so a service channel in use is left alone
+    ssh_channel channel = ssh_channel_new(connection_->session);
+    if (!channel) {
+        return "";
+    }
+    std::string output;
+    if (ssh_channel_open_session(channel) == SSH_OK && ssh_channel_request_exec(channel, command.c_str()) == SSH_OK) {
+        std::vector<char> buffer(kSshChunk);
+        int rc;
+        while ((rc = ssh_channel_read(channel, buffer.data(), static_cast<uint32_t>(buffer.size()), 0)) > 0) {
+            Trace2::count(TraceCounter::NetworkBytesRead, static_cast<size_t>(rc));
+            output.append(buffer.data(), static_cast<size_t>(rc));
+        }
+    }
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+    return output;
 }
 
 std::vector<uint8_t> SSHTransport::read_data(size_t length) {
-    return std::vector<uint8_t>(length, 0);
+    // Raw bytes from the open service channel, whatever has arrived
+    std::vector<uint8_t> data;
+    if (!is_connected() || !channel_) {
+        return data;
+    }
+    std::lock_guard<std::mutex> lock(connection_->mutex);
+    data.resize(std::min(length, kSshChunk));
+    int rc = ssh_channel_read(static_cast<ssh_channel>(channel_), data.data(), static_cast<uint32_t>(data.size()), 0);
+    data.resize(rc > 0 ? static_cast<size_t>(rc) : 0);
+    Trace2::count(TraceCounter::NetworkBytesRead, data.size());
+    return data;
 }
 
 void SSHTransport::write_data(const std::vector<uint8_t>& data) {
-    // Simplified data writing
+    if (!is_connected() || !channel_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(connection_->mutex);
+    if (ssh_channel_write(static_cast<ssh_channel>(channel_), data.data(), static_cast<uint32_t>(data.size())) ==
+        SSH_ERROR) {
+        throw GitException("SSH write to " + host_ + " failed: " + ssh_get_error(connection_->session));
+    }
+    Trace2::count(TraceCounter::NetworkBytesWritten, data.size());
 }
 
 // Git Protocol implementation
-GitProtocol::GitProtocol(std::unique_ptr<Transport> transport)
-    : transport_(std::move(transport)), connected_(false) {}
+namespace {
+constexpr char kAgent[] = "agent=dgit/1.0";
+
+// Capabilities are space-separated, some as name=value
+bool has_capability(const std::string& capabilities, const std::string& name) {
+    size_t pos = 0;
+    while (pos < capabilities.size()) {
+        size_t end = capabilities.find(' ', pos);
+        if (end == std::string::npos) {
+            end = capabilities.size();
+        }
+        std::string_view capability(capabilities.data() + pos, end - pos);
+        if (capability.substr(0, name.size()) == name &&
+            (capability.size() == name.size() || capability[name.size()] == '=')) {
+            return true;
+        }
+        pos = end + 1;
+    }
+    return false;
+}
 
-std::vector<std::string> GitProtocol::get_service_refs(const std::string& service) {
-    if (!transport_->connect("git://example.com/repo.git")) {
-        return {};
+// Throws GitException for a remote "ERR <message>" line
+void check_remote_error(std::string_view payload) {
+    if (payload.substr(0, 4) == "ERR ") {
+        throw GitException("remote error: " + std::string(payload.substr(4)));
     }
+}
 
-    transport_->send_command("git-" + service + "\0host=example.com\0");
+bool has_prefix(const std::string& name, const std::vector<std::string>& prefixes) {
+    if (prefixes.empty()) {
+        return true;
+    }
+    for (const auto& prefix : prefixes) {
+        if (name.compare(0, prefix.size(), prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    std::vector<std::string> refs;
-    std::string line = read_packet_line();
-    while (!line.empty() && line != "0000") {
-        refs.push_back(line);
-        line = read_packet_line();
+// An upload-pack response: ACK/NAK lines, then side-band packets carrying
+// the pack and progress, then a flush. Protocol v2 wraps the same thing in
+// sections, the pack coming last after a "packfile" line. Bytes are
+// handled as they arrive.
+class UploadPackResponse {
+public:
+    UploadPackResponse(const DataSink& pack, const std::function<void(const std::string&)>& progress, bool sections)
+        : demuxer_(pack, progress),
+          reader_([this](PktLineReader::Kind kind, std::string_view payload) { packet(kind, payload); }),
+          sections_(sections) {}
+
+    void feed(const uint8_t* data, size_t size) { reader_.feed(data, size); }
+
+    // Throws GitException if the response stopped before its flush
+    void finish() const {
+        if (!done_ || !reader_.idle()) {
+            throw GitException("upload-pack response ended early");
+        }
     }
 
-    transport_->disconnect();
+    const std::string& negotiation() const { return negotiation_; }
+
+private:
+    void packet(PktLineReader::Kind kind, std::string_view payload) {
+        if (done_) {
+            throw GitException("Unexpected data after upload-pack response");
+        }
+        if (kind == PktLineReader::Kind::Flush) {
+            done_ = true;
+            return;
+        }
+        if (kind == PktLineReader::Kind::Delim && sections_ && !in_pack_) {
+            return;
+        }
+        if (kind != PktLineReader::Kind::Data) {
+            throw GitException("Unexpected packet in upload-pack response");
+        }
+        if (!in_pack_ && sections_) {
+            check_remote_error(payload);
+            if (payload == "packfile\n") {
+                in_pack_ = true;
+            } else {
+                negotiation_.append(payload.data(), payload.size());
+            }
+            return;
+        }
+        // Band numbers are 1-3; negotiation lines start with text
+        if (!in_pack_ && !payload.empty() && payload[0] > 3) {
+            check_remote_error(payload);
+            negotiation_.append(payload.data(), payload.size());
+            return;
+        }
+        in_pack_ = true;
+        demuxer_.packet(payload);
+    }
+
+    SidebandDemuxer demuxer_;
+    PktLineReader reader_;
+    std::string negotiation_;
+    bool sections_;
+    bool in_pack_ = false;
+    bool done_ = false;
+};
+}
+
+GitProtocol::GitProtocol(std::unique_ptr<Transport> transport, const std::string& url)
+    : transport_(std::move(transport)), url_(url), connected_(false) {}
+
+void GitProtocol::ensure_connected() {
+    // The transport stays up between commands so they share its connection
+    if (!transport_->is_connected() && !transport_->connect(url_)) {
+        throw GitException("Cannot connect to " + url_);
+    }
+}
+
+void GitProtocol::set_protocol_version(int version) {
+    protocol_version_ = version;
+}
+
+void GitProtocol::read_advertisement(const std::string& service) {
+    ensure_connected();
+    // receive-pack has no v2; asking would only cost the server a fallback
+    transport_->request_protocol_version(service == "upload-pack" ? protocol_version_ : 0);
+    std::string advertisement = transport_->advertise_refs(service);
+
+    // v0: "<id> <ref>" per packet, the first also carrying capabilities
+    // after a NUL. v2: "version 2", then one capability per packet.
+    advertised_refs_.clear();
+    capabilities_.clear();
+    v2_capabilities_.clear();
+    server_version_ = 0;
+    bool first = true;
+    PktLineReader reader([&](PktLineReader::Kind kind, std::string_view payload) {
+        if (kind != PktLineReader::Kind::Data) {
+            return;
+        }
+        if (!payload.empty() && payload.back() == '\n') {
+            payload.remove_suffix(1);
+        }
+        if (std::exchange(first, false) && payload == "version 2") {
+            server_version_ = 2;
+            return;
+        }
+        if (server_version_ == 2) {
+            v2_capabilities_.emplace_back(payload);
+            return;
+        }
+        size_t nul = payload.find('\0');
+        if (nul != std::string_view::npos) {
+            capabilities_ = std::string(payload.substr(nul + 1));
+            payload = payload.substr(0, nul);
+        }
+        // An empty repository names a placeholder to carry its capabilities
+        if (payload.size() > ObjectId::kHexSize && payload.substr(ObjectId::kHexSize + 1) == "capabilities^{}") {
+            return;
+        }
+        advertised_refs_.emplace_back(payload);
+    });
+    reader.feed(reinterpret_cast<const uint8_t*>(advertisement.data()), advertisement.size());
+    capabilities_service_ = service;
+}
+
+std::optional<std::string> GitProtocol::v2_capability(const std::string& name) const {
+    for (const auto& capability : v2_capabilities_) {
+        if (capability.compare(0, name.size(), name) == 0) {
+            if (capability.size() == name.size()) {
+                return std::string();
+            }
+            if (capability[name.size()] == '=') {
+                return capability.substr(name.size() + 1);
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+std::string GitProtocol::v2_command(const std::string& command) const {
+    std::string body;
+    pkt_line::append(body, "command=" + command + "\n");
+    if (v2_capability("agent")) {
+        pkt_line::append(body, std::string(kAgent) + "\n");
+    }
+    if (v2_capability("object-format")) {
+        pkt_line::append(body, "object-format=sha1\n");
+    }
+    pkt_line::append_delim(body);
+    return body;
+}
+
+std::vector<std::string> GitProtocol::get_service_refs(const std::string& service) {
+    read_advertisement(service);
+    if (server_version_ != 2) {
+        return advertised_refs_;
+    }
+
+    // A v2 advertisement carries no refs; list them all in the v0 format
+    std::vector<std::string> refs;
+    for (const auto& ref : ls_refs({})) {
+        refs.push_back(ref.id.hex() + " " + ref.name);
+        if (!ref.peeled.is_null()) {
+            refs.push_back(ref.peeled.hex() + " " + ref.name + "^{}");
+        }
+    }
     return refs;
 }
 
-std::pair<std::string, std::vector<uint8_t>> GitProtocol::upload_pack(const PackRequest& request) {
-    if (!transport_->connect("git://example.com/repo.git")) {
-        return {};
+std::vector<GitProtocol::RemoteRef> GitProtocol::list_refs(const std::vector<std::string>& prefixes) {
+    if (capabilities_service_ != "upload-pack") {
+        read_advertisement("upload-pack");
+    }
+    if (server_version_ == 2) {
+        return ls_refs(prefixes);
     }
 
-    // Send wants and haves
-    for (const auto& want : request.wants) {
-        write_packet_line("want " + want);
+    // v0 has already sent every ref; peeled tags follow as "<ref>^{}"
+    std::vector<RemoteRef> refs;
+    for (const auto& line : advertised_refs_) {
+        ObjectId id = ObjectId::from_hex(line.substr(0, ObjectId::kHexSize));
+        std::string name = line.substr(ObjectId::kHexSize + 1);
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "^{}") == 0) {
+            if (!refs.empty() && refs.back().name.size() == name.size() - 3 &&
+                name.compare(0, name.size() - 3, refs.back().name) == 0) {
+                refs.back().peeled = id;
+            }
+            continue;
+        }
+        if (has_prefix(name, prefixes)) {
+            refs.push_back({id, std::move(name), ObjectId(), ""});
+        }
     }
+    return refs;
+}
 
-    for (const auto& have : request.haves) {
-        write_packet_line("have " + have);
+std::vector<GitProtocol::RemoteRef> GitProtocol::ls_refs(const std::vector<std::string>& prefixes) {
+    if (!v2_capability("ls-refs")) {
+        throw GitException("Remote does not support ls-refs");
     }
 
-    write_packet_line("done");
+    // The server filters by prefix, so only the refs asked about travel
+    std::string body = v2_command("ls-refs");
+    pkt_line::append(body, "peel\n");
+    pkt_line::append(body, "symrefs\n");
+    for (const auto& prefix : prefixes) {
+        pkt_line::append(body, "ref-prefix " + prefix + "\n");
+    }
+    pkt_line::append_flush(body);
+
+    // "<id> <ref>" with optional "symref-target:<ref>" and "peeled:<id>"
+    std::vector<RemoteRef> refs;
+    bool done = false;
+    PktLineReader reader([&](PktLineReader::Kind kind, std::string_view payload) {
+        if (done || kind == PktLineReader::Kind::Delim || kind == PktLineReader::Kind::ResponseEnd) {
+            throw GitException("Unexpected packet in ls-refs response");
+        }
+        if (kind == PktLineReader::Kind::Flush) {
+            done = true;
+            return;
+        }
+        check_remote_error(payload);
+        if (!payload.empty() && payload.back() == '\n') {
+            payload.remove_suffix(1);
+        }
+        if (payload.size() <= ObjectId::kHexSize + 1 || payload[ObjectId::kHexSize] != ' ') {
+            throw GitException("Malformed ls-refs line: " + std::string(payload));
+        }
+        RemoteRef ref;
+        ref.id = ObjectId::from_hex(std::string(payload.substr(0, ObjectId::kHexSize)));
+        std::string_view rest = payload.substr(ObjectId::kHexSize + 1);
+        size_t space = rest.find(' ');
+        ref.name = std::string(rest.substr(0, space));
+        while (space != std::string_view::npos) {
+            rest = rest.substr(space + 1);
+            space = rest.find(' ');
+            std::string_view attribute = rest.substr(0, space);
+            if (attribute.substr(0, 14) == "symref-target:") {
+                ref.symref_target = std::string(attribute.substr(14));
+            } else if (attribute.substr(0, 7) == "peeled:") {
+                ref.peeled = ObjectId::from_hex(std::string(attribute.substr(7)));
+            }
+        }
+        refs.push_back(std::move(ref));
+    });
+    transport_->rpc("upload-pack", body, [&](const uint8_t* data, size_t size) { reader.feed(data, size); });
+    if (!done || !reader.idle()) {
+        throw GitException("ls-refs response ended early");
+    }
+    return refs;
+}
 
-    // Read response
-    std::string response;
-    std::vector<uint8_t> pack_data;
+std::string GitProtocol::fetch_request_v0(const PackRequest& request) const {
+    // Side-band lets progress and errors share the stream with the pack
+    std::string capabilities;
+    if (has_capability(capabilities_, "side-band-64k")) {
+        capabilities = "side-band-64k";
+    } else if (has_capability(capabilities_, "side-band")) {
+        capabilities = "side-band";
+    } else {
+        throw GitException("Remote upload-pack does not support side-band");
+    }
+    if (has_capability(capabilities_, "ofs-delta")) {
+        capabilities += " ofs-delta";
+    }
+    if (!request.progress && has_capability(capabilities_, "no-progress")) {
+        capabilities += " no-progress";
+    }
+    if (!request.filter.empty()) {
+        if (!has_capability(capabilities_, "filter")) {
+            throw GitException("Remote upload-pack does not support filters");
+        }
+        capabilities += " filter";
+    }
+    if (has_capability(capabilities_, "agent")) {
+        capabilities += std::string(" ") + kAgent;
+    }
 
-    std::string line = read_packet_line();
-    while (!line.empty()) {
-        response += line + "\n";
-        if (line.substr(0, 4) == "PACK") {
-            // Read packfile data
-            pack_data = read_packet_data();
-            break;
+    std::string body;
+    for (size_t i = 0; i < request.wants.size(); ++i) {
+        pkt_line::append(body, "want " + request.wants[i] + (i == 0 ? " " + capabilities : "") + "\n");
+    }
+    if (!request.filter.empty()) {
+        pkt_line::append(body, "filter " + request.filter + "\n");
+    }
+    pkt_line::append_flush(body);
+    for (const auto& have : request.haves) {
+        pkt_line::append(body, "have " + have + "\n");
+    }
+    pkt_line::append(body, "done\n");
+    return body;
+}
+
+std::string GitProtocol::fetch_request_v2(const PackRequest& request) const {
+    // v2 always multiplexes the pack and takes ofs-delta as an argument
+    std::optional<std::string> features = v2_capability("fetch");
+    if (!features) {
+        throw GitException("Remote does not support the v2 fetch command");
+    }
+    std::string body = v2_command("fetch");
+    pkt_line::append(body, "ofs-delta\n");
+    if (!request.progress) {
+        pkt_line::append(body, "no-progress\n");
+    }
+    if (!request.filter.empty()) {
+        if (!has_capability(*features, "filter")) {
+            throw GitException("Remote upload-pack does not support filters");
         }
-        line = read_packet_line();
+        pkt_line::append(body, "filter " + request.filter + "\n");
+    }
+    for (const auto& want : request.wants) {
+        pkt_line::append(body, "want " + want + "\n");
+    }
+    for (const auto& have : request.haves) {
+        pkt_line::append(body, "have " + have + "\n");
+    }
+    pkt_line::append(body, "done\n");
+    pkt_line::append_flush(body);
+    return body;
+}
+
+std::string GitProtocol::upload_pack(const PackRequest& request, const DataSink& pack_sink) {
+    if (request.wants.empty()) {
+        return "";
+    }
+    // Stateless RPC: the capabilities come from this service's advertisement
+    if (capabilities_service_ != "upload-pack") {
+        read_advertisement("upload-pack");
     }
 
-    transport_->disconnect();
-    return {response, pack_data};
+    bool v2 = server_version_ == 2;
+    std::string body = v2 ? fetch_request_v2(request) : fetch_request_v0(request);
+    UploadPackResponse response(pack_sink, request.progress, v2);
+    transport_->rpc("upload-pack", body, [&](const uint8_t* data, size_t size) { response.feed(data, size); });
+    response.finish();
+    return response.negotiation();
 }
 
 std::string GitProtocol::receive_pack(const std::vector<PushRequest>& requests) {
-    if (!transport_->connect("git://example.com/repo.git")) {
+    if (requests.empty()) {
         return "";
     }
+    if (capabilities_service_ != "receive-pack") {
+        read_advertisement("receive-pack");
+    }
 
-    std::string response;
-
-    for (const auto& req : requests) {
-        write_packet_line("old-sha1 " + req.old_commit_id);
-        write_packet_line("new-sha1 " + req.new_commit_id);
-        write_packet_line("ref-name " + req.dst_ref);
+    std::string capabilities = "report-status";
+    if (has_capability(capabilities_, "agent")) {
+        capabilities += std::string(" ") + kAgent;
+    }
 
-        // Send pack data
-        write_packet_data(req.pack_data);
+    // Commands, a flush, then the one pack they all share
+    std::string body;
+    const std::vector<uint8_t>* pack = nullptr;
+    for (size_t i = 0; i < requests.size(); ++i) {
+        const auto& req = requests[i];
+        std::string line = req.old_commit_id + " " + req.new_commit_id + " " + req.dst_ref;
+        if (i == 0) {
+            line += '\0' + capabilities;
+        }
+        pkt_line::append(body, line + "\n");
+        if (!req.pack_data.empty()) {
+            if (pack) {
+                throw GitException("receive-pack takes a single pack");
+            }
+            pack = &req.pack_data;
+        }
+    }
+    pkt_line::append_flush(body);
+    if (pack) {
+        body.append(pack->begin(), pack->end());
     }
 
-    write_packet_line("");
+    // report-status: "unpack ok", then "ok <ref>" or "ng <ref> <reason>"
+    std::string response;
+    PktLineReader reader([&](PktLineReader::Kind kind, std::string_view payload) {
+        if (kind == PktLineReader::Kind::Data) {
+            response.append(payload.data(), payload.size());
+        }
+    });
+    transport_->rpc("receive-pack", body, [&](const uint8_t* data, size_t size) { reader.feed(data, size); });
+    return response;
+}
 
-    // Read response
-    std::string line = read_packet_line();
-    while (!line.empty()) {
-        response += line + "\n";
-        line = read_packet_line();
+// Remote implementation
+namespace {
+// Upper bound on "have" lines sent in one negotiation
+constexpr size_t kMaxHaves = 256;
+
+// Local commits, newest first, for the server to find a common base.
+// Parents and dates come from the commit-graph when there is one.
+std::vector<std::string> negotiation_haves(Repository& repo, size_t limit) {
+    using Entry = std::pair<int64_t, ObjectId>;
+    std::priority_queue<Entry> queue;
+    std::unordered_map<ObjectId, std::vector<ObjectId>, ObjectIdHash> parents;
+    auto enqueue = [&](const ObjectId& id) {
+        if (!parents.count(id)) {
+            CommitInfo info = read_commit_info(repo.objects(), id);
+            parents[id] = std::move(info.parents);
+            queue.emplace(info.commit_time, id);
+        }
+    };
+    for (const auto& tip : repo.commit_tips()) {
+        enqueue(tip);
     }
 
-    transport_->disconnect();
-    return response;
+    std::vector<std::string> haves;
+    while (!queue.empty() && haves.size() < limit) {
+        ObjectId id = queue.top().second;
+        queue.pop();
+        haves.push_back(id.hex());
+        // Copied: enqueue may rehash the map
+        for (const auto& parent : std::vector<ObjectId>(parents[id])) {
+            enqueue(parent);
+        }
+    }
+    return haves;
 }
 
-std::string GitProtocol::read_packet_line() {
-    // Simplified packet line reading
-    return transport_->send_command("");
+// ID an advertisement gives for `ref`, from its "<id> <ref>" lines
+std::optional<ObjectId> advertised_id(const std::vector<std::string>& refs, const std::string& ref) {
+    for (const auto& line : refs) {
+        if (line.size() == ObjectId::kHexSize + 1 + ref.size() &&
+            line.compare(ObjectId::kHexSize + 1, std::string::npos, ref) == 0) {
+            return ObjectId::from_hex(line.substr(0, ObjectId::kHexSize));
+        }
+    }
+    return std::nullopt;
 }
 
-void GitProtocol::write_packet_line(const std::string& line) {
-    transport_->send_command(line);
+void set_ref(Repository& repo, const std::string& name, const ObjectId& id) {
+    if (repo.refs().read_ref(name)) {
+        repo.refs().update_ref(name, id);
+    } else {
+        repo.refs().create_ref(name, id);
+    }
 }
 
-std::vector<uint8_t> GitProtocol::read_packet_data() {
-    return transport_->read_data(1024); // Simplified
+// index-pack settings shared with git: pack.threads and pack.writeReverseIndex
+void configure_indexer(PackIndexer& indexer, Repository& repo) {
+    indexer.set_threads(static_cast<size_t>(repo.config().get_int("pack", "threads", 0)));
+    indexer.set_write_reverse_index(repo.config().get_bool("pack", "writeReverseIndex", false));
 }
 
-void GitProtocol::write_packet_data(const std::vector<uint8_t>& data) {
-    transport_->write_data(data);
+// pack-<sha>.promisor tells git, and repack, that objects the pack refers
+// to may be missing on purpose
+void mark_promisor_pack(const std::string& pack_path) {
+    std::filesystem::path marker = pack_path;
+    marker.replace_extension(".promisor");
+    std::ofstream file(marker);
+    if (!file) {
+        throw GitException("Cannot write " + marker.string());
+    }
+}
 }
 
-// Remote implementation
 Remote::Remote(Repository& repo, const std::string& name)
     : repo_(repo), name_(name) {
     config_.url = "";
@@ -270,45 +1104,131 @@ void Remote::add_push_spec(const std::string& spec) {
     config_.push_specs.push_back(spec);
 }
 
+void Remote::set_filter(const std::string& spec) {
+    config_.filter = spec;
+}
+
+std::string Remote::get_filter() const {
+    // A partial clone keeps filtering later fetches the same way
+    if (!config_.filter.empty()) {
+        return config_.filter;
+    }
+    return repo_.config().get_string("remote", name_ + ".partialclonefilter", "");
+}
+
 bool Remote::fetch(const std::string& branch) {
     if (!connect()) {
         return false;
     }
 
-    GitProtocol::PackRequest request;
-    request.wants = {"refs/heads/" + branch};
-    request.haves = {}; // Get all objects
-
-    auto [response, pack_data] = protocol_->upload_pack(request);
+    // ref-prefix also matches longer names, so the match is checked here
+    std::string ref = "refs/heads/" + branch;
+    std::optional<ObjectId> wanted;
+    for (const auto& remote_ref : protocol_->list_refs({ref})) {
+        if (remote_ref.name == ref) {
+            wanted = remote_ref.id;
+        }
+    }
+    if (!wanted) {
+        throw GitException("Couldn't find remote ref " + ref);
+    }
 
-    // Process the received packfile
-    // In a real implementation, this would parse and store the objects
+    // The pack is indexed while it arrives instead of being held in memory
+    if (!repo_.objects().exists(*wanted)) {
+        GitProtocol::PackRequest request;
+        request.wants = {wanted->hex()};
+        request.haves = negotiation_haves(repo_, kMaxHaves);
+        request.filter = get_filter();
+        request.progress = [](const std::string& line) { std::cerr << "remote: " << line << "\n"; };
+
+        PackIndexer indexer(repo_.git_dir() + "/objects/pack");
+        configure_indexer(indexer, repo_);
+        protocol_->upload_pack(request, [&](const uint8_t* data, size_t size) { indexer.write(data, size); });
+        std::string pack_path = indexer.finish();
+
+        // Filtered out objects are fetched from this remote when needed
+        if (!request.filter.empty()) {
+            mark_promisor_pack(pack_path);
+            if (repo_.config().get_string("extensions", "partialClone", "") != name_) {
+                repo_.config().set_value("extensions", "partialClone", name_);
+                repo_.config().set_value("remote", name_ + ".promisor", "true");
+                repo_.config().set_value("remote", name_ + ".partialclonefilter", request.filter);
+                repo_.config().save();
+                repo_.set_promisor_remote(name_);
+            }
+        }
+        repo_.objects().reload_packs();
+    }
+    set_ref(repo_, "refs/remotes/" + name_ + "/" + branch, *wanted);
 
     disconnect();
     return true;
 }
 
+void Remote::fetch_objects(const std::vector<ObjectId>& ids) {
+    if (ids.empty()) {
+        return;
+    }
+    if (!connect()) {
+        throw GitException("Cannot connect to remote " + name_);
+    }
+
+    // Wanted by ID with no haves: the server sends these objects and
+    // whatever the filter lets through below them, nothing else
+    GitProtocol::PackRequest request;
+    for (const auto& id : ids) {
+        request.wants.push_back(id.hex());
+    }
+    request.filter = get_filter();
+
+    PackIndexer indexer(repo_.git_dir() + "/objects/pack");
+    configure_indexer(indexer, repo_);
+    protocol_->upload_pack(request, [&](const uint8_t* data, size_t size) { indexer.write(data, size); });
+    mark_promisor_pack(indexer.finish());
+    repo_.objects().reload_packs();
+
+    disconnect();
+}
+
 bool Remote::push(const std::string& branch, bool force) {
     if (!connect()) {
         return false;
     }
 
     // Get the current commit
-    std::string head_id = repo_.refs().get_head();
+    ObjectId head_id = repo_.refs().get_head();
+
+    // The remote's current value is the old side of the update, and along
+    // with our tracking ref, something it already has
+    std::string ref = "refs/heads/" + branch;
+    std::string tracking = "refs/remotes/" + name_ + "/" + branch;
+    ObjectId old_id = advertised_id(protocol_->get_service_refs("receive-pack"), ref).value_or(ObjectId());
+    std::vector<ObjectId> haves;
+    if (!old_id.is_null()) {
+        haves.push_back(old_id);
+    }
+    if (auto tracked = repo_.refs().read_ref(tracking)) {
+        haves.push_back(*tracked);
+    }
 
     GitProtocol::PushRequest request;
-    request.src_ref = "refs/heads/" + branch;
-    request.dst_ref = "refs/heads/" + branch;
-    request.old_commit_id = "0000000000000000000000000000000000000000";
-    request.new_commit_id = head_id;
+    request.src_ref = ref;
+    request.dst_ref = ref;
+    request.old_commit_id = old_id.hex();
+    request.new_commit_id = head_id.hex();
 
     // Create packfile with objects to push
-    request.pack_data = network::create_packfile({head_id});
+    request.pack_data = network::create_packfile(repo_, {head_id}, haves);
 
     auto response = protocol_->receive_pack({request});
+    bool accepted = response.find("unpack ok\n") != std::string::npos &&
+                    response.find("ok " + ref + "\n") != std::string::npos;
+    if (accepted) {
+        set_ref(repo_, tracking, head_id);
+    }
 
     disconnect();
-    return !response.empty();
+    return accepted;
 }
 
 std::vector<std::string> Remote::get_remote_refs() {
@@ -322,13 +1242,19 @@ std::vector<std::string> Remote::get_remote_refs() {
 }
 
 std::string Remote::resolve_remote_ref(const std::string& ref) {
-    auto refs = get_remote_refs();
-    for (const auto& r : refs) {
-        if (r.find(ref) != std::string::npos) {
-            // Extract SHA-1 from ref line
-            auto pos = r.find(' ');
-            if (pos != std::string::npos) {
-                return r.substr(0, pos);
+    if (!connect()) {
+        return "";
+    }
+
+    // Same order as git's rev-parse rules; only these names are listed
+    std::vector<std::string> candidates = {ref, "refs/" + ref, "refs/tags/" + ref, "refs/heads/" + ref,
+                                           "refs/remotes/" + ref, "refs/remotes/" + ref + "/HEAD"};
+    auto refs = protocol_->list_refs(candidates);
+    disconnect();
+    for (const auto& candidate : candidates) {
+        for (const auto& remote_ref : refs) {
+            if (remote_ref.name == candidate) {
+                return remote_ref.id.hex();
             }
         }
     }
@@ -347,7 +1273,8 @@ bool Remote::connect() {
         return false;
     }
 
-    protocol_ = std::make_unique<GitProtocol>(std::move(transport));
+    protocol_ = std::make_unique<GitProtocol>(std::move(transport), config_.url);
+    protocol_->set_protocol_version(repo_.config().get_int("protocol", "version", 2));
     return true;
 }
 
@@ -361,6 +1288,9 @@ TransportType Remote::detect_transport_type(const std::string& url) {
     if (url.substr(0, 4) == "git@") return TransportType::SSH;
     if (url.substr(0, 7) == "ssh://") return TransportType::SSH;
     if (url.substr(0, 7) == "git://") return TransportType::GitProtocol;
+    // scp-like [user@]host:path, as long as the colon comes before any slash
+    size_t colon = url.find(':');
+    if (colon != std::string::npos && colon > 0 && url.find('/') > colon) return TransportType::SSH;
     return TransportType::Local;
 }
 
@@ -422,15 +1352,76 @@ std::string get_credentials(const std::string& url) {
     return "";
 }
 
-std::vector<uint8_t> create_packfile(const std::vector<std::string>& object_ids) {
-    // Simplified packfile creation
-    // In a real implementation, this would create a proper Git packfile
-    return std::vector<uint8_t>(1024, 0); // Placeholder
+std::vector<uint8_t> create_packfile(Repository& repo, const std::vector<ObjectId>& wants,
+                                     const std::vector<ObjectId>& haves) {
+    std::vector<ObjectId> objects = find_objects_to_send(repo.objects(), wants, haves);
+
+    // Written next to the repository's packs so a failed send leaves
+    // nothing outside it
+    std::filesystem::path pack_dir = std::filesystem::path(repo.git_dir()) / "objects" / "pack";
+    std::filesystem::create_directories(pack_dir);
+    std::string base = (pack_dir / ("tmp_send_" + std::to_string(::getpid()))).string();
+    std::string pack_path = base + ".pack";
+    std::string index_path = base + ".idx";
+
+    std::vector<uint8_t> data;
+    bool written = packfile::create_packfile(repo, pack_path, index_path, objects);
+    if (written) {
+        std::ifstream file(pack_path, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    std::filesystem::remove(pack_path);
+    std::filesystem::remove(index_path);
+    if (!written) {
+        throw GitException("Cannot create packfile to send");
+    }
+    return data;
+}
+
+std::vector<uint8_t> serve_upload_pack(Repository& repo, const GitProtocol::PackRequest& request) {
+    // Wants and haves come as hex IDs or, from fetch, as ref names
+    auto resolve = [&](const std::string& name) -> std::optional<ObjectId> {
+        if (name.size() == ObjectId::kHexSize && name.find_first_not_of("0123456789abcdef") == std::string::npos) {
+            return ObjectId::from_hex(name);
+        }
+        if (name.compare(0, 5, "refs/") == 0) {
+            return repo.refs().read_ref(name);
+        }
+        return std::nullopt;
+    };
+
+    std::vector<ObjectId> wants;
+    for (const auto& name : request.wants) {
+        auto id = resolve(name);
+        if (!id || !repo.objects().exists(*id)) {
+            throw GitException("upload-pack: not our ref " + name);
+        }
+        wants.push_back(*id);
+    }
+    std::vector<ObjectId> haves;
+    for (const auto& name : request.haves) {
+        if (auto id = resolve(name)) {
+            haves.push_back(*id);
+        }
+    }
+    return create_packfile(repo, wants, haves);
 }
 
 bool verify_packfile(const std::vector<uint8_t>& pack_data) {
-    // Simplified verification
-    return !pack_data.empty();
+    // Header and trailing checksum only; PackIndexer checks every entry
+    constexpr size_t kHeaderSize = 12;
+    if (pack_data.size() < kHeaderSize + ObjectId::kRawSize ||
+        std::memcmp(pack_data.data(), packfile_format::PACK_SIGNATURE, 4) != 0) {
+        return false;
+    }
+    uint32_t version = (uint32_t(pack_data[4]) << 24) | (uint32_t(pack_data[5]) << 16) |
+                       (uint32_t(pack_data[6]) << 8) | uint32_t(pack_data[7]);
+    if (version != 2 && version != 3) {
+        return false;
+    }
+    size_t body = pack_data.size() - ObjectId::kRawSize;
+    auto digest = SHA1::hash_raw(pack_data.data(), body);
+    return std::memcmp(digest.data(), pack_data.data() + body, digest.size()) == 0;
 }
 
 } // namespace network
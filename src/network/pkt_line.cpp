@@ -0,0 +1,172 @@
+#include "dgit/pkt_line.hpp"
+#include "dgit/sha1.hpp"
+#include <algorithm>
+
+namespace dgit {
+
+namespace {
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+}
+
+namespace pkt_line {
+
+void append(std::string& out, std::string_view payload) {
+    if (payload.size() > kMaxPayload) {
+        throw GitException("pkt-line payload too long: " + std::to_string(payload.size()));
+    }
+    static const char kDigits[] = "0123456789abcdef";
+    size_t length = payload.size() + 4;
+    for (int shift = 12; shift >= 0; shift -= 4) {
+        out.push_back(kDigits[(length >> shift) & 0xF]);
+    }
+    out.append(payload.data(), payload.size());
+}
+
+void append_flush(std::string& out) {
+    out.append("0000", 4);
+}
+
+void append_delim(std::string& out) {
+    out.append("0001", 4);
+}
+
+} // namespace pkt_line
+
+size_t PktLineReader::packet_length(const char* data, size_t size) const {
+    if (size < 4) {
+        return 0;
+    }
+    size_t length = 0;
+    for (int i = 0; i < 4; ++i) {
+        int digit = hex_value(data[i]);
+        if (digit < 0) {
+            throw GitException("Invalid pkt-line length: " + std::string(data, 4));
+        }
+        length = (length << 4) | static_cast<size_t>(digit);
+    }
+    // 0000-0002 are special packets; 0003 cannot be a packet at all
+    if (length == 3 || length > pkt_line::kMaxPacket) {
+        throw GitException("Invalid pkt-line length: " + std::string(data, 4));
+    }
+    return length < 4 ? 4 : length;
+}
+
+void PktLineReader::dispatch(const char* packet, size_t length) {
+    std::string_view prefix(packet, 4);
+    if (prefix == "0000") {
+        handler_(Kind::Flush, {});
+    } else if (prefix == "0001") {
+        handler_(Kind::Delim, {});
+    } else if (prefix == "0002") {
+        handler_(Kind::ResponseEnd, {});
+    } else {
+        handler_(Kind::Data, std::string_view(packet + 4, length - 4));
+    }
+}
+
+void PktLineReader::feed(const uint8_t* bytes, size_t size) {
+    const char* data = reinterpret_cast<const char*>(bytes);
+
+    // Complete a packet left over from the previous chunk first
+    if (!partial_.empty()) {
+        if (partial_.size() < 4) {
+            size_t take = std::min(size, 4 - partial_.size());
+            partial_.append(data, take);
+            data += take;
+            size -= take;
+        }
+        size_t length = packet_length(partial_.data(), partial_.size());
+        if (length == 0) {
+            return;
+        }
+        size_t take = std::min(size, length - partial_.size());
+        partial_.append(data, take);
+        data += take;
+        size -= take;
+        if (partial_.size() < length) {
+            return;
+        }
+        std::string packet = std::move(partial_);
+        partial_.clear();
+        dispatch(packet.data(), packet.size());
+    }
+
+    while (size > 0) {
+        size_t length = packet_length(data, size);
+        if (length == 0 || length > size) {
+            partial_.assign(data, size);
+            return;
+        }
+        dispatch(data, length);
+        data += length;
+        size -= length;
+    }
+}
+
+size_t FlushScanner::feed(const uint8_t* data, size_t size) {
+    size_t pos = 0;
+    while (pos < size && !done_) {
+        if (remaining_ > 0) {
+            size_t take = std::min(remaining_, size - pos);
+            remaining_ -= take;
+            pos += take;
+            continue;
+        }
+        header_.push_back(static_cast<char>(data[pos++]));
+        if (header_.size() < 4) {
+            continue;
+        }
+        size_t length = 0;
+        for (char c : header_) {
+            int digit = hex_value(c);
+            if (digit < 0) {
+                throw GitException("Invalid pkt-line length: " + header_);
+            }
+            length = (length << 4) | static_cast<size_t>(digit);
+        }
+        header_.clear();
+        // 0001 and 0002 carry no payload
+        if (length == 0) {
+            done_ = true;
+        } else if (length > 4) {
+            remaining_ = length - 4;
+        }
+    }
+    return pos;
+}
+
+void SidebandDemuxer::packet(std::string_view payload) {
+    if (payload.empty()) {
+        throw GitException("Empty side-band packet");
+    }
+    std::string_view body = payload.substr(1);
+    switch (payload[0]) {
+        case 1:
+            pack_(reinterpret_cast<const uint8_t*>(body.data()), body.size());
+            return;
+        case 2:
+            // Counters update in place with \r; each complete line is reported
+            for (char c : body) {
+                if (c == '\r' || c == '\n') {
+                    if (!progress_line_.empty() && progress_) {
+                        progress_(progress_line_);
+                    }
+                    progress_line_.clear();
+                } else {
+                    progress_line_.push_back(c);
+                }
+            }
+            return;
+        case 3:
+            throw GitException("remote error: " + std::string(body));
+        default:
+            throw GitException("Unknown side-band channel " + std::to_string(static_cast<int>(payload[0])));
+    }
+}
+
+} // namespace dgit
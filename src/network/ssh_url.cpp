@@ -0,0 +1,87 @@
+#include "dgit/ssh_url.hpp"
+#include "dgit/sha1.hpp"
+#include <charconv>
+
+namespace dgit {
+
+namespace {
+int parse_port(const std::string& text, const std::string& url) {
+    int port = 0;
+    const char* end = text.data() + text.size();
+    auto [stop, error] = std::from_chars(text.data(), end, port);
+    if (error != std::errc() || stop != end || port < 1 || port > 65535) {
+        throw GitException("Invalid port in SSH URL: " + url);
+    }
+    return port;
+}
+}
+
+std::optional<SshUrl> parse_ssh_url(const std::string& url) {
+    SshUrl parsed;
+    std::string authority;
+    if (url.compare(0, 6, "ssh://") == 0) {
+        size_t slash = url.find('/', 6);
+        if (slash == std::string::npos) {
+            return std::nullopt;
+        }
+        authority = url.substr(6, slash - 6);
+        parsed.path = url.substr(slash);
+        // "/~user/repo" is relative to a home directory
+        if (parsed.path.compare(0, 2, "/~") == 0) {
+            parsed.path.erase(0, 1);
+        }
+    } else {
+        if (url.find("://") != std::string::npos) {
+            return std::nullopt;
+        }
+        // The path starts after the first colon outside an [IPv6] host
+        size_t search = 0;
+        size_t open = url.find('[');
+        if (open != std::string::npos && open < url.find(':')) {
+            search = url.find(']', open);
+            if (search == std::string::npos) {
+                return std::nullopt;
+            }
+        }
+        size_t colon = url.find(':', search);
+        if (colon == std::string::npos) {
+            return std::nullopt;
+        }
+        authority = url.substr(0, colon);
+        parsed.path = url.substr(colon + 1);
+    }
+
+    size_t at = authority.rfind('@');
+    if (at != std::string::npos) {
+        parsed.user = authority.substr(0, at);
+        authority.erase(0, at + 1);
+    }
+    if (!authority.empty() && authority.front() == '[') {
+        size_t close = authority.find(']');
+        if (close == std::string::npos) {
+            return std::nullopt;
+        }
+        parsed.host = authority.substr(1, close - 1);
+        if (close + 1 < authority.size()) {
+            if (authority[close + 1] != ':') {
+                throw GitException("Invalid host in SSH URL: " + url);
+            }
+            parsed.port = parse_port(authority.substr(close + 2), url);
+        }
+    } else {
+        size_t colon = authority.rfind(':');
+        parsed.host = authority.substr(0, colon);
+        if (colon != std::string::npos) {
+            parsed.port = parse_port(authority.substr(colon + 1), url);
+        }
+    }
+    if (parsed.host.empty()) {
+        throw GitException("No host in SSH URL: " + url);
+    }
+    if (parsed.path.empty()) {
+        return std::nullopt;
+    }
+    return parsed;
+}
+
+} // namespace dgit
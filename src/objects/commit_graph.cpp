@@ -0,0 +1,545 @@
+#include "dgit/commit_graph.hpp"
+#include "dgit/object_database.hpp"
+#include "dgit/object_view.hpp"
+#include "dgit/sha1.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+namespace dgit {
+
+namespace {
+constexpr char kSignature[] = "CGPH";
+constexpr uint8_t kVersion = 1;
+constexpr uint8_t kHashVersion = 1;   // SHA-1
+constexpr size_t kHeaderSize = 8;
+constexpr size_t kChunkEntrySize = 12;
+constexpr size_t kFanoutSize = 256 * 4;
+constexpr size_t kRecordSize = ObjectId::kRawSize + 16;
+
+constexpr uint32_t kChunkFanout = 0x4f494446;   // "OIDF"
+constexpr uint32_t kChunkIds = 0x4f49444c;      // "OIDL"
+constexpr uint32_t kChunkData = 0x43444154;     // "CDAT"
+constexpr uint32_t kChunkEdges = 0x45444745;    // "EDGE"
+constexpr uint32_t kChunkBase = 0x42415345;     // "BASE"
+
+constexpr uint32_t kParentNone = 0x70000000;
+constexpr uint32_t kParentEdgeFlag = 0x80000000;   // second parent word indexes EDGE
+constexpr uint32_t kEdgeLastFlag = 0x80000000;
+constexpr uint64_t kMaxCommitTime = (uint64_t(1) << 34) - 1;
+
+std::string info_dir(const std::string& objects_dir) {
+    return objects_dir + "/info";
+}
+
+std::string chain_dir(const std::string& objects_dir) {
+    return objects_dir + "/info/commit-graphs";
+}
+
+std::string chain_layer_path(const std::string& objects_dir, const std::string& hex) {
+    return chain_dir(objects_dir) + "/graph-" + hex + ".graph";
+}
+
+struct PendingCommit {
+    CommitInfo info;
+    uint32_t generation = 0;   // 0 until computed
+};
+}
+
+// CommitGraph implementation
+std::unique_ptr<CommitGraph> CommitGraph::open(const std::string& objects_dir) {
+    auto graph = std::unique_ptr<CommitGraph>(new CommitGraph());
+
+    // A single file wins over a chain, as in git
+    std::string single = info_dir(objects_dir) + "/commit-graph";
+    std::string chain = chain_dir(objects_dir) + "/commit-graph-chain";
+    if (fs::exists(single)) {
+        graph->layers_.push_back(load_layer(single, 0, 0));
+    } else if (fs::exists(chain)) {
+        std::ifstream file(chain);
+        std::string line;
+        while (std::getline(file, line)) {
+            auto checksum = ObjectId::parse_hex(line);
+            if (!checksum) {
+                throw GitException("Corrupt commit-graph chain: " + chain);
+            }
+            Layer layer = load_layer(chain_layer_path(objects_dir, line), static_cast<uint32_t>(graph->size_),
+                                     graph->layers_.size());
+            if (layer.checksum != *checksum) {
+                throw GitException("Commit-graph layer does not match its name: " + line);
+            }
+            // Each layer names the ones below it; they must be this chain's
+            for (size_t i = 0; i < graph->layers_.size(); ++i) {
+                if (std::memcmp(layer.bases + i * ObjectId::kRawSize, graph->layers_[i].checksum.data(),
+                                ObjectId::kRawSize) != 0) {
+                    throw GitException("Commit-graph chain is inconsistent at layer " + line);
+                }
+            }
+            graph->size_ += layer.count;
+            graph->layers_.push_back(std::move(layer));
+        }
+    }
+
+    if (graph->layers_.empty()) {
+        return nullptr;
+    }
+    graph->size_ = graph->layers_.back().base_count + graph->layers_.back().count;
+    return graph;
+}
+
+CommitGraph::Layer CommitGraph::load_layer(const std::string& path, uint32_t base_count, size_t base_layers) {
+    Layer layer;
+    layer.file = MappedFile(path);
+    layer.base_count = base_count;
+    const uint8_t* data = layer.file.data();
+    size_t size = layer.file.size();
+
+    if (size < kHeaderSize + kChunkEntrySize + ObjectId::kRawSize || std::memcmp(data, kSignature, 4) != 0) {
+        throw GitException("Invalid commit-graph file: " + path);
+    }
+    if (data[4] != kVersion || data[5] != kHashVersion) {
+        throw GitException("Unsupported commit-graph version: " + path);
+    }
+    size_t chunk_count = data[6];
+    size_t file_base_layers = data[7];
+    if (file_base_layers != base_layers) {
+        throw GitException("Commit-graph layer has the wrong number of bases: " + path);
+    }
+
+    size_t table_end = kHeaderSize + (chunk_count + 1) * kChunkEntrySize;
+    size_t content_end = size - ObjectId::kRawSize;
+    if (table_end > content_end) {
+        throw GitException("Corrupt commit-graph (chunk table): " + path);
+    }
+    layer.checksum = ObjectId::from_raw(data + content_end);
+
+    size_t data_size = 0;
+    size_t base_size = 0;
+    for (size_t i = 0; i < chunk_count; ++i) {
+        const uint8_t* entry = data + kHeaderSize + i * kChunkEntrySize;
+        uint32_t id = load_be32(entry);
+        uint64_t offset = load_be64(entry + 4);
+        uint64_t next = load_be64(entry + 4 + kChunkEntrySize);
+        if (offset < table_end || next < offset || next > content_end) {
+            throw GitException("Corrupt commit-graph (chunk offsets): " + path);
+        }
+        const uint8_t* chunk = data + offset;
+        size_t chunk_size = static_cast<size_t>(next - offset);
+
+        switch (id) {
+            case kChunkFanout:
+                if (chunk_size != kFanoutSize) {
+                    throw GitException("Corrupt commit-graph (fanout): " + path);
+                }
+                layer.fanout = chunk;
+                break;
+            case kChunkIds:
+                layer.ids = chunk;
+                layer.count = static_cast<uint32_t>(chunk_size / ObjectId::kRawSize);
+                break;
+            case kChunkData:
+                layer.data = chunk;
+                data_size = chunk_size;
+                break;
+            case kChunkEdges:
+                layer.edges = chunk;
+                layer.edge_count = chunk_size / 4;
+                break;
+            case kChunkBase:
+                layer.bases = chunk;
+                base_size = chunk_size;
+                break;
+            default:
+                break;   // chunks we do not use, such as bloom filters
+        }
+    }
+
+    if (!layer.fanout || !layer.ids || !layer.data) {
+        throw GitException("Commit-graph is missing a required chunk: " + path);
+    }
+    uint32_t previous = 0;
+    for (size_t i = 0; i < 256; ++i) {
+        uint32_t count = load_be32(layer.fanout + i * 4);
+        if (count < previous) {
+            throw GitException("Corrupt commit-graph (fanout not monotonic): " + path);
+        }
+        previous = count;
+    }
+    if (previous != layer.count || data_size != static_cast<size_t>(layer.count) * kRecordSize) {
+        throw GitException("Corrupt commit-graph (table sizes): " + path);
+    }
+    if (base_size != base_layers * ObjectId::kRawSize || (base_layers && !layer.bases)) {
+        throw GitException("Corrupt commit-graph (base list): " + path);
+    }
+
+    layer.file.advise_random();
+    return layer;
+}
+
+const CommitGraph::Layer& CommitGraph::layer_for(uint32_t pos) const {
+    if (pos >= size_) {
+        throw GitException("Commit-graph position out of range: " + std::to_string(pos));
+    }
+    // Few layers, and lookups mostly hit the top one
+    for (size_t i = layers_.size(); i-- > 0;) {
+        if (pos >= layers_[i].base_count) {
+            return layers_[i];
+        }
+    }
+    return layers_.front();
+}
+
+const uint8_t* CommitGraph::record(uint32_t pos) const {
+    const Layer& layer = layer_for(pos);
+    return layer.data + static_cast<size_t>(pos - layer.base_count) * kRecordSize;
+}
+
+std::optional<uint32_t> CommitGraph::find(const ObjectId& id) const {
+    uint8_t first = id.first_byte();
+    for (size_t i = layers_.size(); i-- > 0;) {
+        const Layer& layer = layers_[i];
+        size_t lo = first == 0 ? 0 : load_be32(layer.fanout + (first - 1) * 4);
+        size_t hi = load_be32(layer.fanout + first * 4);
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            int cmp = std::memcmp(layer.ids + mid * ObjectId::kRawSize, id.data(), ObjectId::kRawSize);
+            if (cmp == 0) {
+                return layer.base_count + static_cast<uint32_t>(mid);
+            }
+            if (cmp < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+ObjectId CommitGraph::id(uint32_t pos) const {
+    const Layer& layer = layer_for(pos);
+    return ObjectId::from_raw(layer.ids + static_cast<size_t>(pos - layer.base_count) * ObjectId::kRawSize);
+}
+
+ObjectId CommitGraph::tree_id(uint32_t pos) const {
+    return ObjectId::from_raw(record(pos));
+}
+
+uint32_t CommitGraph::generation(uint32_t pos) const {
+    return load_be32(record(pos) + ObjectId::kRawSize + 8) >> 2;
+}
+
+int64_t CommitGraph::commit_time(uint32_t pos) const {
+    const uint8_t* p = record(pos) + ObjectId::kRawSize + 8;
+    uint64_t high = load_be32(p) & 3;
+    return static_cast<int64_t>((high << 32) | load_be32(p + 4));
+}
+
+void CommitGraph::parents(uint32_t pos, std::vector<uint32_t>& out) const {
+    const Layer& layer = layer_for(pos);
+    const uint8_t* p = layer.data + static_cast<size_t>(pos - layer.base_count) * kRecordSize + ObjectId::kRawSize;
+    uint32_t first = load_be32(p);
+    uint32_t second = load_be32(p + 4);
+    if (first == kParentNone) {
+        return;
+    }
+    out.push_back(first);
+    if (second == kParentNone) {
+        return;
+    }
+    if (!(second & kParentEdgeFlag)) {
+        out.push_back(second);
+        return;
+    }
+
+    // Octopus merges: the rest of the parents are a run in the EDGE chunk
+    for (size_t edge = second & ~kParentEdgeFlag;; ++edge) {
+        if (edge >= layer.edge_count) {
+            throw GitException("Corrupt commit-graph (edge list): " + layer.file.path());
+        }
+        uint32_t value = load_be32(layer.edges + edge * 4);
+        out.push_back(value & ~kEdgeLastFlag);
+        if (value & kEdgeLastFlag) {
+            break;
+        }
+    }
+}
+
+// Writing
+namespace {
+// Serializes one layer. `position_of` maps a parent to its global position.
+std::string serialize_layer(const std::vector<ObjectId>& ids,
+                            const std::unordered_map<ObjectId, PendingCommit, ObjectIdHash>& commits,
+                            const std::function<uint32_t(const ObjectId&)>& position_of,
+                            const std::vector<ObjectId>& base_checksums) {
+    std::string fanout;
+    std::string id_table;
+    std::string data_table;
+    std::string edges;
+    fanout.reserve(kFanoutSize);
+    id_table.reserve(ids.size() * ObjectId::kRawSize);
+    data_table.reserve(ids.size() * kRecordSize);
+
+    size_t next = 0;
+    for (size_t byte = 0; byte < 256; ++byte) {
+        while (next < ids.size() && ids[next].first_byte() == byte) {
+            ++next;
+        }
+        store_be32(fanout, static_cast<uint32_t>(next));
+    }
+
+    for (const auto& id : ids) {
+        id_table.append(reinterpret_cast<const char*>(id.data()), ObjectId::kRawSize);
+
+        const PendingCommit& commit = commits.at(id);
+        const auto& parents = commit.info.parents;
+        data_table.append(reinterpret_cast<const char*>(commit.info.tree.data()), ObjectId::kRawSize);
+        store_be32(data_table, parents.empty() ? kParentNone : position_of(parents[0]));
+        if (parents.size() < 2) {
+            store_be32(data_table, kParentNone);
+        } else if (parents.size() == 2) {
+            store_be32(data_table, position_of(parents[1]));
+        } else {
+            store_be32(data_table, kParentEdgeFlag | static_cast<uint32_t>(edges.size() / 4));
+            for (size_t i = 1; i < parents.size(); ++i) {
+                uint32_t value = position_of(parents[i]);
+                store_be32(edges, i + 1 == parents.size() ? value | kEdgeLastFlag : value);
+            }
+        }
+
+        uint64_t time = static_cast<uint64_t>(std::max<int64_t>(commit.info.commit_time, 0));
+        time = std::min(time, kMaxCommitTime);
+        store_be32(data_table, (commit.generation << 2) | static_cast<uint32_t>(time >> 32));
+        store_be32(data_table, static_cast<uint32_t>(time));
+    }
+
+    std::string base;
+    for (const auto& checksum : base_checksums) {
+        base.append(reinterpret_cast<const char*>(checksum.data()), ObjectId::kRawSize);
+    }
+
+    std::vector<std::pair<uint32_t, const std::string*>> chunks = {
+        {kChunkFanout, &fanout}, {kChunkIds, &id_table}, {kChunkData, &data_table}};
+    if (!edges.empty()) {
+        chunks.emplace_back(kChunkEdges, &edges);
+    }
+    if (!base.empty()) {
+        chunks.emplace_back(kChunkBase, &base);
+    }
+
+    std::string out;
+    out.append(kSignature, 4);
+    out.push_back(static_cast<char>(kVersion));
+    out.push_back(static_cast<char>(kHashVersion));
+    out.push_back(static_cast<char>(chunks.size()));
+    out.push_back(static_cast<char>(base_checksums.size()));
+
+    uint64_t offset = kHeaderSize + (chunks.size() + 1) * kChunkEntrySize;
+    for (const auto& chunk : chunks) {
+        store_be32(out, chunk.first);
+        store_be64(out, offset);
+        offset += chunk.second->size();
+    }
+    store_be32(out, 0);
+    store_be64(out, offset);
+    for (const auto& chunk : chunks) {
+        out += *chunk.second;
+    }
+
+    auto checksum = SHA1::hash_raw(reinterpret_cast<const uint8_t*>(out.data()), out.size());
+    out.append(reinterpret_cast<const char*>(checksum.data()), checksum.size());
+    return out;
+}
+}
+
+CommitGraphWriteResult write_commit_graph(ObjectDatabase& objects, const std::vector<ObjectId>& tips,
+                                          const CommitGraphWriteOptions& options) {
+    const std::string& objects_dir = objects.objects_dir();
+    std::unique_ptr<CommitGraph> existing = CommitGraph::open(objects_dir);
+
+    // In split mode commits of the layers kept below are not rewritten
+    size_t kept_layers = options.split && existing ? existing->layer_count() : 0;
+    auto kept_size = [&]() -> uint32_t {
+        return kept_layers ? existing->layer_start(kept_layers - 1) + existing->layer_size(kept_layers - 1) : 0;
+    };
+    auto kept_position = [&](const ObjectId& id) -> std::optional<uint32_t> {
+        if (!kept_layers) {
+            return std::nullopt;
+        }
+        auto pos = existing->find(id);
+        return pos && *pos < kept_size() ? pos : std::nullopt;
+    };
+
+    // Commits already in the current graph are read from it, not inflated
+    std::unordered_map<ObjectId, PendingCommit, ObjectIdHash> commits;
+    std::vector<ObjectId> stack(tips.begin(), tips.end());
+    while (!stack.empty()) {
+        ObjectId id = stack.back();
+        stack.pop_back();
+        if (commits.count(id) || kept_position(id)) {
+            continue;
+        }
+        PendingCommit& commit = commits[id];
+        commit.info = read_commit_info(objects, id);
+        stack.insert(stack.end(), commit.info.parents.begin(), commit.info.parents.end());
+    }
+
+    if (options.split && commits.empty()) {
+        return {0, existing ? existing->layer_count() : 0};
+    }
+
+    // Fold in layers that are not much bigger than what is being added, so
+    // the chain stays logarithmic in length
+    while (kept_layers > 0 &&
+           existing->layer_size(kept_layers - 1) <= options.size_multiple * commits.size()) {
+        size_t layer = --kept_layers;
+        uint32_t start = existing->layer_start(layer);
+        for (uint32_t pos = start; pos < start + existing->layer_size(layer); ++pos) {
+            PendingCommit& commit = commits[existing->id(pos)];
+            std::vector<uint32_t> parents;
+            existing->parents(pos, parents);
+            commit.info.tree = existing->tree_id(pos);
+            commit.info.commit_time = existing->commit_time(pos);
+            for (uint32_t parent : parents) {
+                commit.info.parents.push_back(existing->id(parent));
+            }
+        }
+    }
+
+    // Generation: one more than the highest parent, roots being 1
+    auto generation_of = [&](const ObjectId& id) -> uint32_t {
+        auto it = commits.find(id);
+        if (it != commits.end()) {
+            return it->second.generation;
+        }
+        return existing->generation(*kept_position(id));
+    };
+    for (auto& entry : commits) {
+        stack.assign(1, entry.first);
+        while (!stack.empty()) {
+            PendingCommit& commit = commits.at(stack.back());
+            if (commit.generation) {
+                stack.pop_back();
+                continue;
+            }
+            bool ready = true;
+            for (const auto& parent : commit.info.parents) {
+                auto it = commits.find(parent);
+                if (it != commits.end() && !it->second.generation) {
+                    stack.push_back(parent);
+                    ready = false;
+                }
+            }
+            if (!ready) {
+                continue;
+            }
+            uint32_t generation = 0;
+            for (const auto& parent : commit.info.parents) {
+                generation = std::max(generation, generation_of(parent));
+            }
+            commit.generation = std::min(generation + 1, CommitGraph::kGenerationMax);
+            stack.pop_back();
+        }
+    }
+
+    std::vector<ObjectId> ids;
+    ids.reserve(commits.size());
+    for (const auto& entry : commits) {
+        ids.push_back(entry.first);
+    }
+    std::sort(ids.begin(), ids.end());
+
+    uint32_t base_count = kept_size();
+    auto position_of = [&](const ObjectId& id) -> uint32_t {
+        auto it = std::lower_bound(ids.begin(), ids.end(), id);
+        if (it != ids.end() && *it == id) {
+            return base_count + static_cast<uint32_t>(it - ids.begin());
+        }
+        return *kept_position(id);
+    };
+
+    std::vector<ObjectId> base_checksums;
+    for (size_t i = 0; i < kept_layers; ++i) {
+        base_checksums.push_back(existing->layer_checksum(i));
+    }
+    std::string contents = serialize_layer(ids, commits, position_of, base_checksums);
+    ObjectId checksum = ObjectId::from_raw(
+        reinterpret_cast<const uint8_t*>(contents.data() + contents.size() - ObjectId::kRawSize));
+
+    std::string single = info_dir(objects_dir) + "/commit-graph";
+    std::string chain_path = chain_dir(objects_dir) + "/commit-graph-chain";
+    CommitGraphWriteResult result;
+    result.commits = ids.size();
+    std::error_code ec;
+
+    if (!options.split) {
+        write_file_atomically(single, contents, "commit-graph");
+        fs::remove_all(chain_dir(objects_dir), ec);
+        result.layers = 1;
+    } else {
+        fs::create_directories(chain_dir(objects_dir));
+        // A kept single-file graph becomes the chain's base layer
+        if (kept_layers == 1 && existing->layer_path(0) == single) {
+            fs::rename(single, chain_layer_path(objects_dir, base_checksums[0].hex()));
+        }
+        write_file_atomically(chain_layer_path(objects_dir, checksum.hex()), contents, "commit-graph");
+
+        std::string chain;
+        std::unordered_set<std::string> live;
+        base_checksums.push_back(checksum);
+        for (const auto& layer : base_checksums) {
+            chain += layer.hex() + "\n";
+            live.insert("graph-" + layer.hex() + ".graph");
+        }
+        write_file_atomically(chain_path, chain, "commit-graph");
+        fs::remove(single, ec);
+
+        // Layers merged away are no longer referenced
+        for (const auto& entry : fs::directory_iterator(chain_dir(objects_dir), ec)) {
+            std::string name = entry.path().filename().string();
+            if (name.compare(0, 6, "graph-") == 0 && !live.count(name)) {
+                fs::remove(entry.path(), ec);
+            }
+        }
+        result.layers = base_checksums.size();
+    }
+
+    objects.reload_commit_graph();
+    return result;
+}
+
+CommitInfo read_commit_info(ObjectDatabase& objects, const ObjectId& id) {
+    CommitInfo info;
+    if (const CommitGraph* graph = objects.commit_graph()) {
+        if (auto pos = graph->find(id)) {
+            std::vector<uint32_t> parents;
+            graph->parents(*pos, parents);
+            info.tree = graph->tree_id(*pos);
+            info.generation = graph->generation(*pos);
+            info.commit_time = graph->commit_time(*pos);
+            info.parents.reserve(parents.size());
+            for (uint32_t parent : parents) {
+                info.parents.push_back(graph->id(parent));
+            }
+            return info;
+        }
+    }
+
+    auto raw = objects.read_raw(id);
+    if (!raw || raw->type != ObjectType::Commit) {
+        throw GitException("Not a commit: " + id.hex());
+    }
+    CommitView view(raw->data);
+    info.tree = view.tree_id();
+    info.parents = view.parents();
+    info.commit_time = std::chrono::duration_cast<std::chrono::seconds>(
+        parse_person(view.committer()).when.time_since_epoch()).count();
+    return info;
+}
+
+} // namespace dgit
@@ -1,5 +1,8 @@
 #include "dgit/object.hpp"
+#include "dgit/object_view.hpp"
 #include "dgit/sha1.hpp"
+#include "dgit/tree_builder.hpp"
+#include "dgit/tree_iterator.hpp"
 #include <sstream>
 #include <iostream>
 #include <algorithm>
@@ -7,8 +10,8 @@
 namespace dgit {
 
 // Base Object implementation
-Object::Object(ObjectType type, const std::string& data)
-    : type_(type), data_(data) {
+Object::Object(ObjectType type, std::string data)
+    : type_(type), data_(std::move(data)) {
     compute_id();
 }
 
@@ -29,56 +32,45 @@ void Object::compute_id() {
             break;
     }
 
-    std::ostringstream oss;
-    oss << header << " " << data_.size() << "\0" << data_;
-    id_ = SHA1::hash(oss.str());
+    header += ' ';
+    header += std::to_string(data_.size());
+
+    // Hash the header and body in place instead of concatenating them
+    SHA1 sha;
+    sha.update(reinterpret_cast<const uint8_t*>(header.c_str()), header.size() + 1);
+    sha.update(reinterpret_cast<const uint8_t*>(data_.data()), data_.size());
+    id_ = ObjectId::from_raw(sha.digest().data());
 }
 
+
 std::string Object::serialize() const {
     return data_;
 }
 
-std::unique_ptr<Object> Object::deserialize(const std::string& raw_data) {
-    // Find null terminator
-    size_t null_pos = raw_data.find('\0');
-    if (null_pos == std::string::npos) {
-        throw GitException("Invalid object data: no null terminator");
-    }
-
-    std::string header = raw_data.substr(0, null_pos);
-    std::string content = raw_data.substr(null_pos + 1);
+std::unique_ptr<Object> Object::deserialize(std::string raw_data) {
+    ObjectHeader header = parse_object_header(raw_data);
 
-    // Parse header
-    size_t space_pos = header.find(' ');
-    if (space_pos == std::string::npos) {
-        throw GitException("Invalid object header: no space");
-    }
-
-    std::string type_str = header.substr(0, space_pos);
-    ObjectType type;
-
-    if (type_str == "blob") {
-        type = ObjectType::Blob;
-    } else if (type_str == "tree") {
-        type = ObjectType::Tree;
-    } else if (type_str == "commit") {
-        type = ObjectType::Commit;
-    } else if (type_str == "tag") {
-        type = ObjectType::Tag;
-    } else {
-        throw GitException("Unknown object type: " + type_str);
-    }
+    // Drop the header in place rather than copying the body out
+    raw_data.erase(0, header.body_offset);
+    return parse(header.type, std::move(raw_data));
+}
 
-    // Create object based on type
+std::unique_ptr<Object> Object::parse(ObjectType type, std::string data) {
     switch (type) {
         case ObjectType::Blob:
-            return std::make_unique<Blob>(content);
-        case ObjectType::Tree:
-            return std::make_unique<Tree>();
+            return std::make_unique<Blob>(std::move(data));
+        case ObjectType::Tree: {
+            // Entries are read straight out of the raw bytes
+            std::vector<TreeEntry> entries;
+            for (const auto& entry : TreeView(data)) {
+                entries.emplace_back(entry.mode, entry.id(), std::string(entry.name));
+            }
+            return std::make_unique<Tree>(std::move(entries), std::move(data));
+        }
         case ObjectType::Commit:
-            return std::make_unique<Commit>();
+            return std::make_unique<Commit>(std::move(data));
         case ObjectType::Tag:
-            return std::make_unique<Tag>("", ObjectType::Blob, "", Person("", "", {}), "");
+            return std::make_unique<Tag>(std::move(data));
         default:
             throw GitException("Unsupported object type for deserialization");
     }
@@ -89,24 +81,26 @@ Tree::Tree() : Object(ObjectType::Tree, "") {
     // Tree data will be built from entries
 }
 
-void Tree::add_entry(FileMode mode, const ObjectId& id, const std::string& name) {
-    entries_.emplace_back(mode, id, name);
-
-    // Sort entries for consistent ordering
-    std::sort(entries_.begin(), entries_.end(),
-              [](const TreeEntry& a, const TreeEntry& b) {
-                  return a.name < b.name;
-              });
+Tree::Tree(std::vector<TreeEntry> entries, std::string data)
+    : Object(ObjectType::Tree, std::move(data)), entries_(std::move(entries)) {
+}
 
-    // Rebuild tree data
+void Tree::add_entry(FileMode mode, const ObjectId& id, const std::string& name) {
+    // Git's order: a directory sorts as if its name ended in '/', so
+    // "a.txt" comes before the directory "a"
+    bool is_dir = mode == FileMode::Directory;
+    auto pos = std::upper_bound(entries_.begin(), entries_.end(), name,
+                                [is_dir](const std::string& key, const TreeEntry& entry) {
+                                    return tree_entry_less(key, is_dir, entry.name,
+                                                           entry.mode == FileMode::Directory);
+                                });
+    entries_.emplace(pos, mode, id, name);
+
+    // Rebuild tree data; TreeBuilder avoids this for whole directories
     std::ostringstream oss;
     for (const auto& entry : entries_) {
-        oss << static_cast<int>(entry.mode) << " " << entry.name << "\0";
-        // write binary 20-byte id from hex
-        for (size_t i = 0; i < 20; ++i) {
-            uint8_t byte = std::stoi(entry.id.substr(i * 2, 2), nullptr, 16);
-            oss.put(static_cast<char>(byte));
-        }
+        oss << std::oct << static_cast<uint32_t>(entry.mode) << std::dec << " " << entry.name << '\0';
+        oss.write(reinterpret_cast<const char*>(entry.id.data()), ObjectId::kRawSize);
     }
     data_ = oss.str();
     recompute_id();
@@ -115,11 +109,24 @@ void Tree::add_entry(FileMode mode, const ObjectId& id, const std::string& name)
 // Commit implementation
 Commit::Commit()
     : Object(ObjectType::Commit, ""),
-      tree_id_(""), parent_ids_({}), author_(Person("", "", {})),
+      tree_id_(), parent_ids_({}), author_(Person("", "", {})),
       committer_(Person("", "", {})), message_("") {
 }
 
-Commit::Commit(const std::string& tree_id, const std::vector<std::string>& parent_ids,
+Commit::Commit(std::string data)
+    : Object(ObjectType::Commit, std::move(data)),
+      author_(Person("", "", {})), committer_(Person("", "", {})) {
+
+    // The bytes are kept as read, so the ID matches whatever wrote them
+    CommitView view(data_);
+    tree_id_ = view.tree_id();
+    parent_ids_ = view.parents();
+    author_ = parse_person(view.author());
+    committer_ = parse_person(view.committer());
+    message_ = std::string(view.message());
+}
+
+Commit::Commit(const ObjectId& tree_id, const std::vector<ObjectId>& parent_ids,
                const Person& author, const Person& committer, const std::string& message)
     : Object(ObjectType::Commit, ""),
       tree_id_(tree_id), parent_ids_(parent_ids), author_(author),
@@ -147,7 +154,7 @@ Commit::Commit(const std::string& tree_id, const std::vector<std::string>& paren
 }
 
 // Tag implementation
-Tag::Tag(const std::string& object_id, ObjectType object_type, const std::string& tag_name,
+Tag::Tag(const ObjectId& object_id, ObjectType object_type, const std::string& tag_name,
          const Person& tagger, const std::string& message)
     : Object(ObjectType::Tag, ""),
       object_id_(object_id), object_type_(object_type), tag_name_(tag_name),
@@ -185,6 +192,18 @@ Tag::Tag(const std::string& object_id, ObjectType object_type, const std::string
     recompute_id();
 }
 
+Tag::Tag(std::string data)
+    : Object(ObjectType::Tag, std::move(data)),
+      object_type_(ObjectType::Commit), tagger_(Person("", "", {})) {
+
+    TagView view(data_);
+    object_id_ = view.object_id();
+    object_type_ = view.object_type();
+    tag_name_ = std::string(view.tag_name());
+    tagger_ = parse_person(view.tagger());
+    message_ = std::string(view.message());
+}
+
 // Object methods
 void Object::recompute_id() {
     compute_id();
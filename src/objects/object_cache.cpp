@@ -0,0 +1,93 @@
+#include "dgit/object_cache.hpp"
+
+namespace dgit {
+
+std::shared_ptr<const Object> ObjectCache::get(const ObjectId& id) {
+    auto it = entries_.find(id);
+    if (it == entries_.end()) {
+        stats_.misses++;
+        return nullptr;
+    }
+
+    stats_.hits++;
+    lru_.splice(lru_.begin(), lru_, it->second);
+    return it->second->object;
+}
+
+void ObjectCache::put(std::shared_ptr<const Object> object) {
+    size_t size = approximate_size(*object);
+    if (size > limit_) {
+        return;
+    }
+
+    ObjectId id = object->id();
+    erase(id);
+
+    lru_.push_front(Entry{std::move(object), size});
+    entries_.emplace(id, lru_.begin());
+    stats_.bytes += size;
+    stats_.entries = entries_.size();
+    trim();
+}
+
+void ObjectCache::erase(const ObjectId& id) {
+    auto it = entries_.find(id);
+    if (it == entries_.end()) {
+        return;
+    }
+
+    stats_.bytes -= it->second->size;
+    lru_.erase(it->second);
+    entries_.erase(it);
+    stats_.entries = entries_.size();
+}
+
+void ObjectCache::clear() {
+    lru_.clear();
+    entries_.clear();
+    stats_.bytes = 0;
+    stats_.entries = 0;
+}
+
+void ObjectCache::set_limit(size_t bytes) {
+    limit_ = bytes;
+    trim();
+}
+
+size_t ObjectCache::approximate_size(const Object& object) {
+    size_t size = sizeof(Object) + object.data().capacity();
+
+    switch (object.type()) {
+        case ObjectType::Tree:
+            for (const auto& entry : static_cast<const Tree&>(object).entries()) {
+                size += sizeof(TreeEntry) + entry.name.capacity();
+            }
+            break;
+        case ObjectType::Commit: {
+            const auto& commit = static_cast<const Commit&>(object);
+            size += sizeof(Commit) - sizeof(Object) + commit.message().capacity() +
+                    commit.parent_ids().capacity() * sizeof(ObjectId);
+            break;
+        }
+        case ObjectType::Tag:
+            size += sizeof(Tag) - sizeof(Object) + static_cast<const Tag&>(object).message().capacity();
+            break;
+        case ObjectType::Blob:
+            break;
+    }
+
+    return size;
+}
+
+void ObjectCache::trim() {
+    while (stats_.bytes > limit_ && !lru_.empty()) {
+        const Entry& victim = lru_.back();
+        stats_.bytes -= victim.size;
+        entries_.erase(victim.object->id());
+        lru_.pop_back();
+        stats_.evictions++;
+    }
+    stats_.entries = entries_.size();
+}
+
+} // namespace dgit
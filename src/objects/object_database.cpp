@@ -1,14 +1,121 @@
 #include "dgit/object_database.hpp"
+#include "dgit/commit_graph.hpp"
+#include "dgit/compression.hpp"
+#include "dgit/object_view.hpp"
+#include "dgit/pack_bitmap.hpp"
+#include "dgit/packfile.hpp"
 #include "dgit/sha1.hpp"
+#include "dgit/trace.hpp"
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <zlib.h>
 #include <cstring>
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace fs = std::filesystem;
 namespace dgit {
 
+namespace {
+constexpr size_t kStreamChunk = 64 * 1024;
+
+// Deflates a loose object into a temp file under objects/ while hashing the
+// uncompressed bytes, then renames it into place. Memory use is a fixed
+// pair of chunk buffers regardless of object size.
+class LooseObjectWriter {
+public:
+    LooseObjectWriter(const std::string& objects_dir, int level) : zs_(Deflater::for_thread(level).begin()) {
+        std::string pattern = objects_dir + "/tmp_obj_XXXXXX";
+        temp_path_.assign(pattern.begin(), pattern.end());
+        temp_path_.push_back('\0');
+        fd_ = ::mkstemp(temp_path_.data());
+        if (fd_ < 0) {
+            throw GitException("Cannot create temporary object file in " + objects_dir);
+        }
+    }
+
+    ~LooseObjectWriter() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        if (!committed_) {
+            ::unlink(temp_path_.data());
+        }
+    }
+
+    LooseObjectWriter(const LooseObjectWriter&) = delete;
+    LooseObjectWriter& operator=(const LooseObjectWriter&) = delete;
+
+    void write(const void* data, size_t size) {
+        Trace2::count(TraceCounter::BytesDeflated, size);
+        hash_.update(static_cast<const uint8_t*>(data), size);
+        zs_.next_in = reinterpret_cast<Bytef*>(const_cast<void*>(data));
+        zs_.avail_in = static_cast<uInt>(size);
+        deflate_pending(Z_NO_FLUSH);
+    }
+
+    // Flushes the deflate stream and returns the object id
+    ObjectId finish() {
+        deflate_pending(Z_FINISH);
+        // Loose objects are immutable; match git's read-only permissions
+        ::fchmod(fd_, 0444);
+        if (::close(fd_) != 0) {
+            fd_ = -1;
+            throw GitException("Failed to write object file");
+        }
+        fd_ = -1;
+        return ObjectId::from_raw(hash_.digest().data());
+    }
+
+    void commit(const std::string& path) {
+        fs::create_directories(fs::path(path).parent_path());
+        if (::rename(temp_path_.data(), path.c_str()) != 0) {
+            throw GitException("Cannot write object: " + path);
+        }
+        committed_ = true;
+    }
+
+private:
+    void deflate_pending(int flush) {
+        int ret;
+        do {
+            zs_.next_out = reinterpret_cast<Bytef*>(out_);
+            zs_.avail_out = sizeof(out_);
+            ret = deflate(&zs_, flush);
+            if (ret == Z_STREAM_ERROR) {
+                throw GitException("Failed to compress data");
+            }
+            write_all(out_, sizeof(out_) - zs_.avail_out);
+        } while (zs_.avail_out == 0 || (flush == Z_FINISH && ret != Z_STREAM_END));
+    }
+
+    void write_all(const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd_, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw GitException("Failed to write object file");
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    std::vector<char> temp_path_;
+    int fd_ = -1;
+    z_stream& zs_;  // the thread's reusable deflate context
+    SHA1 hash_;
+    char out_[kStreamChunk];
+    bool committed_ = false;
+};
+}
+
 ObjectDatabase::ObjectDatabase(const std::string& git_dir)
     : git_dir_(git_dir), objects_dir_(git_dir + "/objects") {
 
@@ -17,6 +124,15 @@ ObjectDatabase::ObjectDatabase(const std::string& git_dir)
     fs::create_directories(objects_dir_ + "/pack");
 }
 
+ObjectDatabase::~ObjectDatabase() = default;
+
+void ObjectDatabase::set_compression_level(int level) {
+    if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+        throw GitException("Bad zlib compression level " + std::to_string(level));
+    }
+    compression_level_ = level;
+}
+
 void ObjectDatabase::store(std::unique_ptr<Object>&& object) {
     const ObjectId& id = object->id();
 
@@ -25,171 +141,372 @@ void ObjectDatabase::store(std::unique_ptr<Object>&& object) {
     }
 
     std::string data = object->serialize();
-    std::string header;
-    switch (object->type()) {
-        case ObjectType::Blob:
-            header = "blob";
-            break;
-        case ObjectType::Tree:
-            header = "tree";
-            break;
-        case ObjectType::Commit:
-            header = "commit";
-            break;
-        case ObjectType::Tag:
-            header = "tag";
-            break;
+    std::string header = std::string(object_type_name(object->type())) + " " + std::to_string(data.size());
+
+    // Header and body are deflated straight into the temp file; no
+    // concatenated copy of the object is built
+    LooseObjectWriter writer(objects_dir_, compression_level_);
+    writer.write(header.c_str(), header.size() + 1);
+    writer.write(data.data(), data.size());
+    writer.finish();
+    writer.commit(get_object_path(id));
+    missing_.erase(id);
+
+    // The database owns the stored object from here on; no copy needed
+    cache_.put(std::shared_ptr<const Object>(std::move(object)));
+}
+
+ObjectId ObjectDatabase::store_blob_file(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw GitException("Cannot read file: " + path);
     }
 
-    std::ostringstream oss;
-    oss << header << " " << data.size() << "\0" << data;
-    std::string full_data = oss.str();
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw GitException("Cannot stat file: " + path);
+    }
 
-    // Compress the data
-    std::string compressed = compress_data(full_data);
+    // The header needs the size up front, so the file must not change while
+    // it is streamed through the hash and deflate
+    size_t expected = static_cast<size_t>(st.st_size);
+    std::string header = "blob " + std::to_string(expected);
+
+    ObjectId id;
+    try {
+        LooseObjectWriter writer(objects_dir_, compression_level_);
+        writer.write(header.c_str(), header.size() + 1);
+
+        std::vector<char> buffer(kStreamChunk);
+        size_t total = 0;
+        while (true) {
+            ssize_t got = ::read(fd, buffer.data(), buffer.size());
+            if (got < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw GitException("Cannot read file: " + path);
+            }
+            if (got == 0) {
+                break;
+            }
+            total += static_cast<size_t>(got);
+            if (total > expected) {
+                break;
+            }
+            writer.write(buffer.data(), static_cast<size_t>(got));
+        }
+        if (total != expected) {
+            throw GitException("File changed while reading: " + path);
+        }
 
-    write_object(id, compressed);
+        id = writer.finish();
+        if (!exists(id)) {
+            writer.commit(get_object_path(id));
+            missing_.erase(id);
+        }
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
 
-    // Cache the object
-    cache_[id] = object->clone();
+    ::close(fd);
+    return id;
 }
 
-std::unique_ptr<Object> ObjectDatabase::load(const ObjectId& id) {
+std::shared_ptr<const Object> ObjectDatabase::load(const ObjectId& id) {
+    Trace2::count(TraceCounter::ObjectLoads);
     // Check cache first
-    auto it = cache_.find(id);
-    if (it != cache_.end()) {
-        return it->second->clone();
+    if (auto cached = cache_.get(id)) {
+        Trace2::count(TraceCounter::ObjectCacheHits);
+        return cached;
     }
 
-    if (!exists(id)) {
-        throw GitException("Object not found: " + id);
+    if (!exists(id) && !(fetch_from_promisor({id}) && exists(id))) {
+        throw GitException("Object not found: " + id.hex());
     }
 
-    std::string compressed_data = read_object(id);
-    std::string decompressed_data = decompress_data(compressed_data);
-
-    auto object = Object::deserialize(decompressed_data);
-
-    // Cache the object
-    cache_[id] = object->clone();
+    // Packs first, then the loose object
+    std::shared_ptr<const Object> object;
+    if (PackReader* pack = find_pack(id)) {
+        object = pack->get_object(id);
+    } else {
+        object = Object::deserialize(decompress_data(read_object(id)));
+    }
 
+    cache_.put(object);
     return object;
 }
 
 bool ObjectDatabase::exists(const ObjectId& id) {
-    return fs::exists(get_object_path(id));
-}
-
-std::string ObjectDatabase::get_object_path(const ObjectId& id) const {
-    if (id.length() < 2) {
-        throw GitException("Invalid object ID: " + id);
+    if (cache_.contains(id) || find_pack(id)) {
+        return true;
+    }
+    if (missing_.count(id)) {
+        return false;
+    }
+    if (fs::exists(get_object_path(id))) {
+        return true;
     }
 
-    std::string dir1 = id.substr(0, 2);
-    std::string dir2 = id.substr(2);
+    // Another process may have written a pack since we last looked
+    if (pack_dir_changed()) {
+        reload_packs();
+        if (find_pack(id)) {
+            return true;
+        }
+    }
 
-    return objects_dir_ + "/" + dir1 + "/" + dir2;
+    // Plain set rather than a bloom filter: a false positive here would hide
+    // an existing object. Clearing it when full keeps memory bounded.
+    if (missing_.size() >= kMissingCacheLimit) {
+        missing_.clear();
+    }
+    missing_.insert(id);
+    return false;
 }
 
-void ObjectDatabase::write_object(const ObjectId& id, const std::string& data) {
-    std::string path = get_object_path(id);
-    fs::create_directories(fs::path(path).parent_path());
+void ObjectDatabase::set_promisor(PromisorFetch fetch) {
+    promisor_ = std::move(fetch);
+}
 
-    std::ofstream file(path, std::ios::binary);
-    if (!file) {
-        throw GitException("Cannot write object: " + path);
+void ObjectDatabase::prefetch(const std::vector<ObjectId>& ids) {
+    if (!promisor_) {
+        return;
     }
-
-    file.write(data.c_str(), data.size());
+    std::vector<ObjectId> missing;
+    std::unordered_set<ObjectId, ObjectIdHash> seen;
+    for (const auto& id : ids) {
+        if (seen.insert(id).second && !exists(id)) {
+            missing.push_back(id);
+        }
+    }
+    fetch_from_promisor(missing);
 }
 
-std::string ObjectDatabase::read_object(const ObjectId& id) {
-    std::string path = get_object_path(id);
-    std::ifstream file(path, std::ios::binary | std::ios::ate);
-
-    if (!file) {
-        throw GitException("Cannot read object: " + path);
+bool ObjectDatabase::fetch_from_promisor(const std::vector<ObjectId>& ids) {
+    // The fetch reads local objects itself; a miss there is a real miss
+    if (!promisor_ || fetching_ || ids.empty()) {
+        return false;
     }
+    fetching_ = true;
+    try {
+        promisor_(ids);
+    } catch (...) {
+        fetching_ = false;
+        throw;
+    }
+    fetching_ = false;
+    reload_packs();
+    return true;
+}
 
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
-
-    std::string data(size, '\0');
-    if (!file.read(&data[0], size)) {
-        throw GitException("Failed to read object data");
+void ObjectDatabase::reload_packs() {
+    packs_.clear();
+    missing_.clear();
+    pack_bitmap_.reset();
+    pack_bitmap_loaded_ = false;
+
+    std::string pack_dir = objects_dir_ + "/pack";
+    std::error_code ec;
+    pack_dir_mtime_ = fs::last_write_time(pack_dir, ec);
+    packs_loaded_ = true;
+
+    std::vector<std::pair<fs::file_time_type, fs::path>> found;
+    for (const auto& entry : fs::directory_iterator(pack_dir, ec)) {
+        fs::path index_path = entry.path();
+        index_path.replace_extension(".idx");
+        if (entry.path().extension() == ".pack" && fs::exists(index_path)) {
+            found.emplace_back(entry.last_write_time(), entry.path());
+        }
     }
 
-    return data;
+    // Newest packs first: recent objects are the ones most often asked for
+    std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    for (const auto& pack : found) {
+        fs::path index_path = pack.second;
+        index_path.replace_extension(".idx");
+        try {
+            packs_.push_back(std::make_unique<PackReader>(pack.second.string(), index_path.string()));
+            packs_.back()->set_delta_base_cache_limit(delta_base_cache_limit_);
+        } catch (const GitException& e) {
+            std::cerr << "warning: ignoring pack " << pack.second.string() << ": " << e.what() << "\n";
+        }
+    }
 }
 
-// Compression utilities
-std::string compress_data(const std::string& data) {
-    z_stream zs;
-    std::memset(&zs, 0, sizeof(zs));
+void ObjectDatabase::set_cache_limit(size_t bytes) {
+    cache_.set_limit(bytes);
+}
 
-    if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
-        throw GitException("Failed to initialize zlib compression");
+void ObjectDatabase::set_delta_base_cache_limit(size_t bytes) {
+    delta_base_cache_limit_ = bytes;
+    for (auto& pack : packs_) {
+        pack->set_delta_base_cache_limit(bytes);
     }
+}
 
-    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.c_str()));
-    zs.avail_in = data.size();
+size_t ObjectDatabase::pack_count() {
+    if (!packs_loaded_) {
+        reload_packs();
+    }
+    return packs_.size();
+}
 
-    std::string compressed;
-    int ret;
-    char outbuffer[32768];
+PackReader* ObjectDatabase::find_pack(const ObjectId& id) {
+    if (!packs_loaded_) {
+        reload_packs();
+    }
+    Trace2::count(TraceCounter::PackLookups);
+
+    for (size_t i = 0; i < packs_.size(); ++i) {
+        if (packs_[i]->has_object(id)) {
+            // Keep the pack that answered in front for the next lookup
+            if (i != 0) {
+                std::rotate(packs_.begin(), packs_.begin() + i, packs_.begin() + i + 1);
+            }
+            return packs_.front().get();
+        }
+    }
+    return nullptr;
+}
 
-    do {
-        zs.next_out = reinterpret_cast<Bytef*>(outbuffer);
-        zs.avail_out = sizeof(outbuffer);
+const CommitGraph* ObjectDatabase::commit_graph() {
+    if (!commit_graph_loaded_) {
+        commit_graph_loaded_ = true;
+        try {
+            commit_graph_ = CommitGraph::open(objects_dir_);
+        } catch (const GitException& e) {
+            // Only an accelerator: walks fall back to parsing commits
+            std::cerr << "warning: ignoring commit-graph: " << e.what() << "\n";
+            commit_graph_.reset();
+        }
+    }
+    return commit_graph_.get();
+}
 
-        ret = deflate(&zs, Z_FINISH);
+void ObjectDatabase::reload_commit_graph() {
+    commit_graph_.reset();
+    commit_graph_loaded_ = false;
+}
 
-        if (compressed.size() < zs.total_out) {
-            compressed.append(outbuffer, zs.total_out - compressed.size());
+const PackBitmapIndex* ObjectDatabase::pack_bitmap() {
+    if (!packs_loaded_) {
+        reload_packs();
+    }
+    if (pack_bitmap_loaded_) {
+        return pack_bitmap_.get();
+    }
+    pack_bitmap_loaded_ = true;
+
+    // Like git, only one bitmapped pack is used; a repack leaves just one
+    std::error_code ec;
+    std::vector<fs::path> bitmaps;
+    for (const auto& entry : fs::directory_iterator(objects_dir_ + "/pack", ec)) {
+        if (entry.path().extension() == ".bitmap") {
+            bitmaps.push_back(entry.path());
+        }
+    }
+    std::sort(bitmaps.begin(), bitmaps.end());
+    for (fs::path path : bitmaps) {
+        path.replace_extension(".pack");
+        if (!fs::exists(path)) {
+            continue;
+        }
+        try {
+            pack_bitmap_ = PackBitmapIndex::open(path.string());
+            break;
+        } catch (const GitException& e) {
+            // Only an accelerator: reachability falls back to walking
+            std::cerr << "warning: ignoring bitmap for " << path.string() << ": " << e.what() << "\n";
         }
-    } while (ret == Z_OK);
+    }
+    return pack_bitmap_.get();
+}
 
-    deflateEnd(&zs);
+bool ObjectDatabase::pack_dir_changed() const {
+    std::error_code ec;
+    auto mtime = fs::last_write_time(objects_dir_ + "/pack", ec);
+    return !ec && mtime != pack_dir_mtime_;
+}
 
-    if (ret != Z_STREAM_END) {
-        throw GitException("Failed to compress data");
+std::optional<RawObject> ObjectDatabase::read_raw(const ObjectId& id) {
+    Trace2::count(TraceCounter::ObjectLoads);
+    if (!exists(id) && !(fetch_from_promisor({id}) && exists(id))) {
+        return std::nullopt;
+    }
+    if (PackReader* pack = find_pack(id)) {
+        return pack->read_raw(id);
     }
 
-    return compressed;
-}
+    std::string decompressed = decompress_data(read_object(id));
+    ObjectHeader header = parse_object_header(decompressed);
 
-std::string decompress_data(const std::string& compressed_data) {
-    z_stream zs;
-    std::memset(&zs, 0, sizeof(zs));
+    // Drop the header in place rather than copying the body out
+    RawObject raw;
+    raw.type = header.type;
+    decompressed.erase(0, header.body_offset);
+    raw.data = std::move(decompressed);
+    return raw;
+}
 
-    if (inflateInit(&zs) != Z_OK) {
-        throw GitException("Failed to initialize zlib decompression");
+std::vector<ObjectId> ObjectDatabase::list_loose_objects() const {
+    std::vector<ObjectId> ids;
+    for (const auto& dir : fs::directory_iterator(objects_dir_)) {
+        std::string prefix = dir.path().filename().string();
+        if (!dir.is_directory() || prefix.size() != 2) {
+            continue;
+        }
+        for (const auto& file : fs::directory_iterator(dir.path())) {
+            auto id = ObjectId::parse_hex(prefix + file.path().filename().string());
+            if (id) {
+                ids.push_back(*id);
+            }
+        }
     }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
 
-    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed_data.c_str()));
-    zs.avail_in = compressed_data.size();
-
-    std::string decompressed;
-    int ret;
-    char outbuffer[32768];
+std::string ObjectDatabase::get_object_path(const ObjectId& id) const {
+    std::string hex = id.hex();
+    std::string dir1 = hex.substr(0, 2);
+    std::string dir2 = hex.substr(2);
 
-    do {
-        zs.next_out = reinterpret_cast<Bytef*>(outbuffer);
-        zs.avail_out = sizeof(outbuffer);
+    return objects_dir_ + "/" + dir1 + "/" + dir2;
+}
 
-        ret = inflate(&zs, 0);
+std::string ObjectDatabase::read_object(const ObjectId& id) {
+    std::string path = get_object_path(id);
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
 
-        if (decompressed.size() < zs.total_out) {
-            decompressed.append(outbuffer, zs.total_out - decompressed.size());
-        }
-    } while (ret == Z_OK);
+    if (!file) {
+        throw GitException("Cannot read object: " + path);
+    }
 
-    inflateEnd(&zs);
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
 
-    if (ret != Z_STREAM_END) {
-        throw GitException("Failed to decompress data");
+    std::string data(size, '\0');
+    if (!file.read(&data[0], size)) {
+        throw GitException("Failed to read object data");
     }
 
+    return data;
+}
+
+// Compression utilities
+std::string compress_data(const std::string& data, int level) {
+    std::string compressed;
+    Deflater::for_thread(level).compress(data.data(), data.size(), compressed);
+    return compressed;
+}
+
+std::string decompress_data(const std::string& compressed_data) {
+    std::string decompressed;
+    Inflater::for_thread().decompress(compressed_data.data(), compressed_data.size(), decompressed);
     return decompressed;
 }
 
@@ -0,0 +1,172 @@
+#include "dgit/object_view.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace dgit {
+
+namespace {
+// Value of the first "<key> <value>\n" header before the blank line.
+// Continuation lines (a leading space, as in gpgsig) are skipped.
+std::string_view find_header(std::string_view data, std::string_view key) {
+    size_t pos = 0;
+    while (pos < data.size() && data[pos] != '\n') {
+        size_t eol = data.find('\n', pos);
+        if (eol == std::string_view::npos) {
+            eol = data.size();
+        }
+        std::string_view line = data.substr(pos, eol - pos);
+        if (line.size() > key.size() && line[key.size()] == ' ' && line.compare(0, key.size(), key) == 0) {
+            return line.substr(key.size() + 1);
+        }
+        pos = eol + 1;
+    }
+    return {};
+}
+
+std::string_view find_message(std::string_view data) {
+    size_t pos = data.find("\n\n");
+    return pos == std::string_view::npos ? std::string_view() : data.substr(pos + 2);
+}
+
+bool has_id_line(std::string_view data, size_t pos, std::string_view key) {
+    size_t size = key.size() + 1 + ObjectId::kHexSize + 1;
+    return data.size() >= pos + size && data.compare(pos, key.size(), key) == 0 && data[pos + key.size()] == ' ' &&
+           data[pos + size - 1] == '\n';
+}
+}
+
+const char* object_type_name(ObjectType type) {
+    switch (type) {
+        case ObjectType::Blob: return "blob";
+        case ObjectType::Tree: return "tree";
+        case ObjectType::Commit: return "commit";
+        case ObjectType::Tag: return "tag";
+    }
+    return "blob";
+}
+
+ObjectType parse_object_type(std::string_view name) {
+    if (name == "blob") {
+        return ObjectType::Blob;
+    } else if (name == "tree") {
+        return ObjectType::Tree;
+    } else if (name == "commit") {
+        return ObjectType::Commit;
+    } else if (name == "tag") {
+        return ObjectType::Tag;
+    }
+    throw GitException("Unknown object type: " + std::string(name));
+}
+
+ObjectHeader parse_object_header(std::string_view raw) {
+    size_t null_pos = raw.find('\0');
+    if (null_pos == std::string_view::npos) {
+        throw GitException("Invalid object data: no null terminator");
+    }
+    size_t space_pos = raw.find(' ');
+    if (space_pos == std::string_view::npos || space_pos > null_pos) {
+        throw GitException("Invalid object header: no space");
+    }
+
+    ObjectHeader header;
+    header.type = parse_object_type(raw.substr(0, space_pos));
+    header.body_offset = null_pos + 1;
+
+    std::string_view digits = raw.substr(space_pos + 1, null_pos - space_pos - 1);
+    size_t size = 0;
+    for (char c : digits) {
+        if (c < '0' || c > '9' || size > (SIZE_MAX - 9) / 10) {
+            throw GitException("Invalid object header: bad size");
+        }
+        size = size * 10 + static_cast<size_t>(c - '0');
+    }
+    if (digits.empty() || size != raw.size() - header.body_offset) {
+        throw GitException("Invalid object header: size mismatch");
+    }
+    header.size = size;
+    return header;
+}
+
+Person parse_person(std::string_view line) {
+    size_t lt = line.find('<');
+    size_t gt = line.find('>', lt);
+    if (lt == std::string_view::npos || gt == std::string_view::npos) {
+        return Person(std::string(line), "", {});
+    }
+
+    std::string_view name = line.substr(0, lt);
+    while (!name.empty() && name.back() == ' ') {
+        name.remove_suffix(1);
+    }
+    std::string when(line.substr(gt + 1));
+    long long seconds = std::strtoll(when.c_str(), nullptr, 10);
+    return Person(std::string(name), std::string(line.substr(lt + 1, gt - lt - 1)),
+                  std::chrono::system_clock::time_point(std::chrono::seconds(seconds)));
+}
+
+// CommitView implementation
+CommitView::CommitView(std::string_view data) : data_(data) {
+    if (!has_id_line(data_, 0, "tree")) {
+        throw GitException("Invalid commit: no tree line");
+    }
+}
+
+ObjectId CommitView::tree_id() const {
+    return ObjectId::from_hex(data_.substr(5, ObjectId::kHexSize));
+}
+
+bool CommitView::is_parent_line(size_t pos) const {
+    return has_id_line(data_, pos, "parent");
+}
+
+ObjectId CommitView::parent_at(size_t pos) const {
+    return ObjectId::from_hex(data_.substr(pos + 7, ObjectId::kHexSize));
+}
+
+std::vector<ObjectId> CommitView::parents() const {
+    std::vector<ObjectId> parents;
+    for_each_parent([&parents](const ObjectId& id) { parents.push_back(id); });
+    return parents;
+}
+
+size_t CommitView::parent_count() const {
+    size_t count = 0;
+    for (size_t pos = kParentsOffset; is_parent_line(pos); pos += kParentLineSize) {
+        ++count;
+    }
+    return count;
+}
+
+std::string_view CommitView::header(std::string_view key) const {
+    return find_header(data_, key);
+}
+
+std::string_view CommitView::message() const {
+    return find_message(data_);
+}
+
+// TagView implementation
+TagView::TagView(std::string_view data) : data_(data) {
+    if (!has_id_line(data_, 0, "object")) {
+        throw GitException("Invalid tag: no object line");
+    }
+}
+
+ObjectId TagView::object_id() const {
+    return ObjectId::from_hex(data_.substr(7, ObjectId::kHexSize));
+}
+
+ObjectType TagView::object_type() const {
+    return parse_object_type(header("type"));
+}
+
+std::string_view TagView::header(std::string_view key) const {
+    return find_header(data_, key);
+}
+
+std::string_view TagView::message() const {
+    return find_message(data_);
+}
+
+} // namespace dgit
@@ -0,0 +1,73 @@
+#include "dgit/tree_builder.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace dgit {
+
+namespace {
+bool is_dir(const TreeEntry& entry) {
+    return entry.mode == FileMode::Directory;
+}
+
+// Octal digits of the mode, written backwards from `end`
+char* write_mode(uint32_t mode, char* end) {
+    do {
+        *--end = static_cast<char>('0' + (mode & 7));
+        mode >>= 3;
+    } while (mode);
+    return end;
+}
+}
+
+bool tree_entry_less(std::string_view a, bool a_is_dir, std::string_view b, bool b_is_dir) {
+    size_t common = std::min(a.size(), b.size());
+    int cmp = std::memcmp(a.data(), b.data(), common);
+    if (cmp != 0) {
+        return cmp < 0;
+    }
+    unsigned char a_next = a.size() > common ? static_cast<unsigned char>(a[common]) : (a_is_dir ? '/' : '\0');
+    unsigned char b_next = b.size() > common ? static_cast<unsigned char>(b[common]) : (b_is_dir ? '/' : '\0');
+    return a_next < b_next;
+}
+
+void TreeBuilder::add(FileMode mode, const ObjectId& id, std::string name) {
+    entries_.emplace_back(mode, id, std::move(name));
+}
+
+std::unique_ptr<Tree> TreeBuilder::build() {
+    std::vector<TreeEntry> entries = std::move(entries_);
+    entries_.clear();
+
+    // Callers such as the cache-tree add in index order, which is almost
+    // git order already
+    auto less = [](const TreeEntry& a, const TreeEntry& b) {
+        return tree_entry_less(a.name, is_dir(a), b.name, is_dir(b));
+    };
+    if (!std::is_sorted(entries.begin(), entries.end(), less)) {
+        std::sort(entries.begin(), entries.end(), less);
+    }
+
+    size_t size = 0;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (i > 0 && entries[i].name == entries[i - 1].name) {
+            throw GitException("Duplicate tree entry: " + entries[i].name);
+        }
+        size += 6 + 1 + entries[i].name.size() + 1 + ObjectId::kRawSize;
+    }
+
+    std::string data;
+    data.reserve(size);
+    char mode[6];
+    for (const auto& entry : entries) {
+        const char* digits = write_mode(static_cast<uint32_t>(entry.mode), mode + sizeof(mode));
+        data.append(digits, mode + sizeof(mode) - digits);
+        data.push_back(' ');
+        data += entry.name;
+        data.push_back('\0');
+        data.append(reinterpret_cast<const char*>(entry.id.data()), ObjectId::kRawSize);
+    }
+
+    return std::make_unique<Tree>(std::move(entries), std::move(data));
+}
+
+} // namespace dgit
@@ -0,0 +1,47 @@
+#include "dgit/tree_iterator.hpp"
+#include <cstring>
+
+namespace dgit {
+
+TreeIterator::TreeIterator(const char* data, const char* end) : pos_(data), next_(data), end_(end) {
+    parse();
+}
+
+TreeIterator& TreeIterator::operator++() {
+    pos_ = next_;
+    parse();
+    return *this;
+}
+
+void TreeIterator::parse() {
+    if (pos_ == end_) {
+        return;
+    }
+
+    // Modes are octal without leading zeros; six digits is the longest
+    uint32_t mode = 0;
+    const char* p = pos_;
+    while (p < end_ && *p != ' ') {
+        if (*p < '0' || *p > '7' || p - pos_ >= 6) {
+            throw GitException("Corrupt tree entry: bad mode");
+        }
+        mode = (mode << 3) | static_cast<uint32_t>(*p - '0');
+        ++p;
+    }
+    if (p == pos_ || p == end_) {
+        throw GitException("Corrupt tree entry: bad mode");
+    }
+
+    const char* name = p + 1;
+    const char* nul = static_cast<const char*>(std::memchr(name, '\0', end_ - name));
+    if (!nul || nul == name || static_cast<size_t>(end_ - nul - 1) < ObjectId::kRawSize) {
+        throw GitException("Corrupt tree entry: truncated");
+    }
+
+    entry_.mode = static_cast<FileMode>(mode);
+    entry_.name = std::string_view(name, nul - name);
+    entry_.raw_id = reinterpret_cast<const uint8_t*>(nul + 1);
+    next_ = nul + 1 + ObjectId::kRawSize;
+}
+
+} // namespace dgit
@@ -0,0 +1,173 @@
+#include "dgit/ewah_bitmap.hpp"
+#include "dgit/mapped_file.hpp"
+#include "dgit/sha1.hpp"
+#include <algorithm>
+
+namespace dgit {
+
+namespace {
+bool clean(uint64_t word) {
+    return word == 0 || word == ~uint64_t{0};
+}
+}
+
+void Bitmap::or_with(const Bitmap& other) {
+    if (other.words_.size() > words_.size()) {
+        words_.resize(other.words_.size());
+    }
+    for (size_t i = 0; i < other.words_.size(); ++i) {
+        words_[i] |= other.words_[i];
+    }
+}
+
+void Bitmap::and_not(const Bitmap& other) {
+    size_t common = std::min(words_.size(), other.words_.size());
+    for (size_t i = 0; i < common; ++i) {
+        words_[i] &= ~other.words_[i];
+    }
+}
+
+void Bitmap::xor_with(const Bitmap& other) {
+    if (other.words_.size() > words_.size()) {
+        words_.resize(other.words_.size());
+    }
+    for (size_t i = 0; i < other.words_.size(); ++i) {
+        words_[i] ^= other.words_[i];
+    }
+}
+
+void Bitmap::or_ewah(const EwahBitmap& other) {
+    other.for_each(
+        [&](size_t first, size_t count, bool fill) {
+            if (!fill) {
+                return;
+            }
+            if (first + count > words_.size()) {
+                words_.resize(first + count);
+            }
+            std::fill(words_.begin() + first, words_.begin() + first + count, ~uint64_t{0});
+        },
+        [&](size_t index, uint64_t literal) {
+            if (index >= words_.size()) {
+                words_.resize(index + 1);
+            }
+            words_[index] |= literal;
+        });
+}
+
+size_t Bitmap::count() const {
+    size_t total = 0;
+    for (uint64_t word : words_) {
+        total += static_cast<size_t>(__builtin_popcountll(word));
+    }
+    return total;
+}
+
+bool Bitmap::empty() const {
+    return std::all_of(words_.begin(), words_.end(), [](uint64_t word) { return word == 0; });
+}
+
+bool Bitmap::operator==(const Bitmap& other) const {
+    // Trailing zero words do not count
+    const auto& longer = words_.size() >= other.words_.size() ? words_ : other.words_;
+    size_t common = std::min(words_.size(), other.words_.size());
+    return std::equal(words_.begin(), words_.begin() + common, other.words_.begin()) &&
+           std::all_of(longer.begin() + common, longer.end(), [](uint64_t word) { return word == 0; });
+}
+
+EwahBitmap::EwahBitmap() : buffer_(1, 0) {}
+
+EwahBitmap EwahBitmap::compress(const Bitmap& bitmap) {
+    const auto& words = bitmap.words_;
+    size_t count = words.size();
+    while (count > 0 && words[count - 1] == 0) {
+        --count;
+    }
+
+    EwahBitmap ewah;
+    ewah.buffer_.clear();
+    ewah.bit_size_ = static_cast<uint32_t>(count * 64);
+    size_t i = 0;
+    do {
+        size_t marker = ewah.buffer_.size();
+        ewah.buffer_.push_back(0);
+
+        uint64_t fill = 0;
+        uint64_t run = 0;
+        if (i < count && clean(words[i])) {
+            uint64_t word = words[i];
+            fill = word ? 1 : 0;
+            while (i < count && words[i] == word && run < kMaxRun) {
+                ++run;
+                ++i;
+            }
+        }
+        uint64_t literals = 0;
+        while (i < count && !clean(words[i]) && literals < kMaxLiterals) {
+            ewah.buffer_.push_back(words[i++]);
+            ++literals;
+        }
+
+        ewah.buffer_[marker] = fill | (run << 1) | (literals << 33);
+        ewah.last_marker_ = static_cast<uint32_t>(marker);
+    } while (i < count);
+    return ewah;
+}
+
+Bitmap EwahBitmap::decompress() const {
+    Bitmap bitmap;
+    bitmap.or_ewah(*this);
+    return bitmap;
+}
+
+void EwahBitmap::serialize(std::string& out) const {
+    store_be32(out, bit_size_);
+    store_be32(out, static_cast<uint32_t>(buffer_.size()));
+    for (uint64_t word : buffer_) {
+        store_be64(out, word);
+    }
+    store_be32(out, last_marker_);
+}
+
+EwahBitmap EwahBitmap::parse(const uint8_t*& data, const uint8_t* end) {
+    if (end - data < 8) {
+        throw GitException("Truncated EWAH bitmap");
+    }
+    uint32_t bit_size = load_be32(data);
+    uint32_t word_count = load_be32(data + 4);
+    data += 8;
+    size_t available = static_cast<size_t>(end - data);
+    if (available / 8 < word_count || available - word_count * size_t{8} < 4) {
+        throw GitException("Truncated EWAH bitmap");
+    }
+
+    EwahBitmap ewah;
+    ewah.bit_size_ = bit_size;
+    ewah.buffer_.resize(word_count);
+    for (uint32_t i = 0; i < word_count; ++i) {
+        ewah.buffer_[i] = load_be64(data + i * size_t{8});
+    }
+    data += word_count * size_t{8};
+    ewah.last_marker_ = load_be32(data);
+    data += 4;
+
+    // Literal counts must stay inside the buffer and runs inside the bit
+    // count, so iteration and decompression need no further checks
+    size_t limit = (static_cast<size_t>(bit_size) + 63) / 64;
+    size_t expanded = 0;
+    for (size_t pos = 0; pos < ewah.buffer_.size();) {
+        uint64_t marker = ewah.buffer_[pos++];
+        size_t literals = static_cast<size_t>(marker >> 33);
+        expanded += static_cast<size_t>((marker >> 1) & kMaxRun) + literals;
+        if (literals > ewah.buffer_.size() - pos || expanded > limit) {
+            throw GitException("Corrupt EWAH bitmap");
+        }
+        pos += literals;
+    }
+    if (word_count && ewah.last_marker_ >= word_count) {
+        throw GitException("Corrupt EWAH bitmap");
+    }
+    return ewah;
+}
+
+} // namespace dgit
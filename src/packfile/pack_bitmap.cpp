@@ -0,0 +1,390 @@
+#include "dgit/pack_bitmap.hpp"
+#include "dgit/commit_graph.hpp"
+#include "dgit/mapped_file.hpp"
+#include "dgit/object_database.hpp"
+#include "dgit/object_view.hpp"
+#include "dgit/packfile.hpp"
+#include "dgit/tree_iterator.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+namespace dgit {
+
+// .bitmap layout (integers big-endian):
+//   "BITM", be16 version 1, be16 options, be32 entry count, pack checksum,
+//   EWAH bitmaps of the commits, trees, blobs and tags,
+//   per entry: be32 index position of the commit, u8 XOR offset (to an
+//   earlier entry), u8 flags, EWAH bitmap;
+//   optional name-hash cache and lookup table, SHA-1 of everything before.
+namespace {
+constexpr char kBitmapSignature[] = "BITM";
+constexpr uint16_t kBitmapVersion = 1;
+constexpr uint16_t kOptionFullDag = 0x1;   // closed under reachability; git requires it
+constexpr size_t kHeaderSize = 12 + ObjectId::kRawSize;
+constexpr size_t kTrailerSize = ObjectId::kRawSize;
+
+// Commits in the newest kRecentCommits get a bitmap every kRecentSpacing,
+// older ones every kOldSpacing
+constexpr size_t kRecentCommits = 10000;
+constexpr size_t kRecentSpacing = 100;
+constexpr size_t kOldSpacing = 1000;
+
+size_t type_slot(ObjectType type) {
+    switch (type) {
+        case ObjectType::Commit: return 0;
+        case ObjectType::Tree: return 1;
+        case ObjectType::Blob: return 2;
+        case ObjectType::Tag: return 3;
+    }
+    return 2;
+}
+
+std::string replace_extension(const std::string& pack_path, const char* extension) {
+    fs::path path(pack_path);
+    path.replace_extension(extension);
+    return path.string();
+}
+
+// Everything reachable from the roots given to add(): objects of the
+// bitmapped pack as bits, others by ID. Commits with a stored bitmap are
+// not walked; neither is anything `exclude` already holds, since what it
+// holds is closed under reachability.
+class ReachableSet {
+public:
+    ReachableSet(ObjectDatabase& objects, const PackBitmapIndex* bitmaps, const ReachableSet* exclude = nullptr)
+        : objects_(objects), bitmaps_(bitmaps), exclude_(exclude) {
+        if (bitmaps_) {
+            bits = Bitmap(bitmaps_->object_count());
+        }
+    }
+
+    // Throws GitException if `root` or anything below it is missing
+    void add(const ObjectId& root) {
+        auto raw = objects_.read_raw(root);
+        if (!raw) {
+            throw GitException("Object not found: " + root.hex());
+        }
+        pending_.emplace_back(root, raw->type);
+        while (!pending_.empty()) {
+            auto [id, type] = pending_.back();
+            pending_.pop_back();
+            visit(id, type);
+        }
+    }
+
+    bool contains(const ObjectId& id) const {
+        if (bitmaps_) {
+            if (auto pos = bitmaps_->position(id)) {
+                return bits.get(*pos);
+            }
+        }
+        return outside.count(id) > 0;
+    }
+
+    Bitmap bits;
+    std::unordered_set<ObjectId, ObjectIdHash> outside;
+
+private:
+    void visit(const ObjectId& id, ObjectType type) {
+        if (exclude_ && exclude_->contains(id)) {
+            return;
+        }
+        std::optional<uint32_t> pos = bitmaps_ ? bitmaps_->position(id) : std::nullopt;
+        if (pos) {
+            if (bits.get(*pos) || (type == ObjectType::Commit && bitmaps_->or_commit_bitmap(*pos, bits))) {
+                return;
+            }
+            bits.set(*pos);
+        } else if (!outside.insert(id).second) {
+            return;
+        }
+
+        switch (type) {
+            case ObjectType::Blob:
+                break;
+            case ObjectType::Commit: {
+                CommitInfo info = read_commit_info(objects_, id);
+                pending_.emplace_back(info.tree, ObjectType::Tree);
+                for (const auto& parent : info.parents) {
+                    pending_.emplace_back(parent, ObjectType::Commit);
+                }
+                break;
+            }
+            case ObjectType::Tree: {
+                auto raw = read(id);
+                for (const auto& entry : TreeView(raw.data)) {
+                    if (entry.mode == FileMode::Gitlink) {
+                        continue;   // commits of another repository
+                    }
+                    pending_.emplace_back(entry.id(), entry.is_directory() ? ObjectType::Tree : ObjectType::Blob);
+                }
+                break;
+            }
+            case ObjectType::Tag: {
+                auto raw = read(id);
+                TagView tag(raw.data);
+                pending_.emplace_back(tag.object_id(), tag.object_type());
+                break;
+            }
+        }
+    }
+
+    RawObject read(const ObjectId& id) {
+        auto raw = objects_.read_raw(id);
+        if (!raw) {
+            throw GitException("Object not found: " + id.hex());
+        }
+        return std::move(*raw);
+    }
+
+    ObjectDatabase& objects_;
+    const PackBitmapIndex* bitmaps_;
+    const ReachableSet* exclude_;
+    std::vector<std::pair<ObjectId, ObjectType>> pending_;
+};
+}
+
+PackBitmapIndex::PackBitmapIndex(const std::string& pack_path)
+    : pack_path_(pack_path), index_(std::make_unique<PackIndex>(replace_extension(pack_path, ".idx"))) {
+    // Bits follow pack order, the index is sorted by name
+    size_t count = index_->get_object_count();
+    std::vector<std::pair<size_t, uint32_t>> offsets(count);
+    for (size_t i = 0; i < count; ++i) {
+        offsets[i] = {index_->offset_at(i), static_cast<uint32_t>(i)};
+    }
+    std::sort(offsets.begin(), offsets.end());
+    pack_order_.resize(count);
+    positions_.resize(count);
+    for (size_t pos = 0; pos < count; ++pos) {
+        pack_order_[pos] = offsets[pos].second;
+        positions_[offsets[pos].second] = static_cast<uint32_t>(pos);
+    }
+}
+
+PackBitmapIndex::~PackBitmapIndex() = default;
+
+std::unique_ptr<PackBitmapIndex> PackBitmapIndex::open(const std::string& pack_path) {
+    std::string bitmap_path = replace_extension(pack_path, ".bitmap");
+    if (!fs::exists(bitmap_path)) {
+        return nullptr;
+    }
+    std::unique_ptr<PackBitmapIndex> bitmaps(new PackBitmapIndex(pack_path));
+    bitmaps->load(bitmap_path);
+    return bitmaps;
+}
+
+void PackBitmapIndex::load(const std::string& bitmap_path) {
+    MappedFile file(bitmap_path);
+    const uint8_t* data = file.data();
+    const uint8_t* end = data + file.size();
+    if (file.size() < kHeaderSize + kTrailerSize || std::memcmp(data, kBitmapSignature, 4) != 0) {
+        throw GitException("Invalid bitmap file: " + bitmap_path);
+    }
+    uint16_t version = static_cast<uint16_t>((data[4] << 8) | data[5]);
+    uint16_t options = static_cast<uint16_t>((data[6] << 8) | data[7]);
+    if (version != kBitmapVersion || !(options & kOptionFullDag)) {
+        throw GitException("Unsupported bitmap file: " + bitmap_path);
+    }
+    if (std::memcmp(data + 12, index_->pack_checksum(), ObjectId::kRawSize) != 0) {
+        throw GitException("Bitmap does not belong to pack: " + bitmap_path);
+    }
+    uint32_t entry_count = load_be32(data + 8);
+
+    const uint8_t* p = data + kHeaderSize;
+    end -= kTrailerSize;
+    for (auto& type : types_) {
+        type = EwahBitmap::parse(p, end).decompress();
+    }
+
+    entries_.reserve(entry_count);
+    for (uint32_t i = 0; i < entry_count; ++i) {
+        if (end - p < 6) {
+            throw GitException("Truncated bitmap file: " + bitmap_path);
+        }
+        uint32_t index_pos = load_be32(p);
+        uint8_t xor_offset = p[4];
+        p += 6;
+        if (index_pos >= positions_.size() || xor_offset > i) {
+            throw GitException("Corrupt bitmap entry in " + bitmap_path);
+        }
+
+        Entry entry;
+        entry.position = positions_[index_pos];
+        entry.xor_with = xor_offset ? i - xor_offset : kNoXor;
+        entry.bitmap = EwahBitmap::parse(p, end);
+        by_position_.emplace(entry.position, i);
+        entries_.push_back(std::move(entry));
+    }
+}
+
+std::optional<uint32_t> PackBitmapIndex::position(const ObjectId& id) const {
+    auto index_pos = index_->find_position(id);
+    if (!index_pos) {
+        return std::nullopt;
+    }
+    return positions_[*index_pos];
+}
+
+ObjectId PackBitmapIndex::object_id(uint32_t position) const {
+    return index_->object_id_at(pack_order_[position]);
+}
+
+ObjectType PackBitmapIndex::object_type(uint32_t position) const {
+    static const ObjectType kTypes[] = {ObjectType::Commit, ObjectType::Tree, ObjectType::Blob, ObjectType::Tag};
+    for (size_t i = 0; i < 4; ++i) {
+        if (types_[i].get(position)) {
+            return kTypes[i];
+        }
+    }
+    throw GitException("Object missing from bitmap type index: " + object_id(position).hex());
+}
+
+bool PackBitmapIndex::or_commit_bitmap(uint32_t position, Bitmap& into) const {
+    auto it = by_position_.find(position);
+    if (it == by_position_.end()) {
+        return false;
+    }
+    const Entry* entry = &entries_[it->second];
+    if (entry->xor_with == kNoXor) {
+        into.or_ewah(entry->bitmap);
+        return true;
+    }
+
+    // Stored as the XOR against an earlier entry, itself maybe XORed
+    Bitmap value = entry->bitmap.decompress();
+    while (entry->xor_with != kNoXor) {
+        entry = &entries_[entry->xor_with];
+        value.xor_with(entry->bitmap.decompress());
+    }
+    into.or_with(value);
+    return true;
+}
+
+size_t write_pack_bitmap(ObjectDatabase& objects, const std::string& pack_path, const std::vector<ObjectId>& tips) {
+    PackBitmapIndex bitmaps(pack_path);
+    size_t count = bitmaps.object_count();
+
+    // Types come from entry headers; deltas take their base's
+    PackReader reader(pack_path, replace_extension(pack_path, ".idx"));
+    for (uint32_t pos = 0; pos < count; ++pos) {
+        ObjectType type = reader.object_type_at(bitmaps.index_->offset_at(bitmaps.pack_order_[pos]));
+        bitmaps.types_[type_slot(type)].set(pos);
+    }
+
+    // Commits to select from, newest first. Tags are peeled; tips that are
+    // not commits get no bitmap of their own.
+    std::vector<ObjectId> selected;
+    std::vector<std::pair<int64_t, ObjectId>> history;
+    std::unordered_set<ObjectId, ObjectIdHash> seen;
+    std::vector<ObjectId> stack;
+    for (ObjectId tip : tips) {
+        auto raw = objects.read_raw(tip);
+        while (raw && raw->type == ObjectType::Tag) {
+            tip = TagView(raw->data).object_id();
+            raw = objects.read_raw(tip);
+        }
+        if (raw && raw->type == ObjectType::Commit) {
+            selected.push_back(tip);
+            stack.push_back(tip);
+        }
+    }
+    while (!stack.empty()) {
+        ObjectId id = stack.back();
+        stack.pop_back();
+        if (!seen.insert(id).second) {
+            continue;
+        }
+        CommitInfo info = read_commit_info(objects, id);
+        history.emplace_back(info.commit_time, id);
+        stack.insert(stack.end(), info.parents.begin(), info.parents.end());
+    }
+    std::sort(history.begin(), history.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    for (size_t i = 0; i < history.size(); ++i) {
+        if (i % (i < kRecentCommits ? kRecentSpacing : kOldSpacing) == 0) {
+            selected.push_back(history[i].second);
+        }
+    }
+    std::sort(selected.begin(), selected.end());
+    selected.erase(std::unique(selected.begin(), selected.end()), selected.end());
+
+    // Oldest first, so each walk stops at the bitmaps of older selections
+    std::unordered_map<ObjectId, int64_t, ObjectIdHash> times;
+    for (const auto& entry : history) {
+        times[entry.second] = entry.first;
+    }
+    std::sort(selected.begin(), selected.end(), [&](const ObjectId& a, const ObjectId& b) {
+        return times[a] != times[b] ? times[a] < times[b] : a < b;
+    });
+
+    for (const auto& commit : selected) {
+        ReachableSet reachable(objects, &bitmaps);
+        reachable.add(commit);
+        if (!reachable.outside.empty()) {
+            throw GitException("Cannot write bitmap: " + reachable.outside.begin()->hex() +
+                               " is reachable but not in " + pack_path);
+        }
+        PackBitmapIndex::Entry entry;
+        entry.position = *bitmaps.position(commit);
+        entry.bitmap = EwahBitmap::compress(reachable.bits);
+        bitmaps.by_position_.emplace(entry.position, static_cast<uint32_t>(bitmaps.entries_.size()));
+        bitmaps.entries_.push_back(std::move(entry));
+    }
+
+    std::string out(kBitmapSignature, 4);
+    out.push_back(static_cast<char>(kBitmapVersion >> 8));
+    out.push_back(static_cast<char>(kBitmapVersion & 0xFF));
+    out.push_back(static_cast<char>(kOptionFullDag >> 8));
+    out.push_back(static_cast<char>(kOptionFullDag & 0xFF));
+    store_be32(out, static_cast<uint32_t>(bitmaps.entries_.size()));
+    out.append(reinterpret_cast<const char*>(bitmaps.index_->pack_checksum()), ObjectId::kRawSize);
+    for (const auto& type : bitmaps.types_) {
+        EwahBitmap::compress(type).serialize(out);
+    }
+    for (const auto& entry : bitmaps.entries_) {
+        store_be32(out, bitmaps.pack_order_[entry.position]);
+        out.push_back(0);   // no XOR
+        out.push_back(0);   // flags
+        entry.bitmap.serialize(out);
+    }
+    auto checksum = SHA1::hash_raw(reinterpret_cast<const uint8_t*>(out.data()), out.size());
+    out.append(reinterpret_cast<const char*>(checksum.data()), checksum.size());
+
+    write_file_atomically(replace_extension(pack_path, ".bitmap"), out, "bitmap");
+    return bitmaps.entries_.size();
+}
+
+std::vector<ObjectId> find_objects_to_send(ObjectDatabase& objects, const std::vector<ObjectId>& wants,
+                                           const std::vector<ObjectId>& haves) {
+    // exists() may rescan the packs, which drops the loaded bitmaps, so
+    // the haves are checked before taking a pointer to them
+    std::vector<ObjectId> known_haves;
+    for (const auto& id : haves) {
+        if (objects.exists(id)) {
+            known_haves.push_back(id);
+        }
+    }
+    const PackBitmapIndex* bitmaps = objects.pack_bitmap();
+
+    ReachableSet have(objects, bitmaps);
+    for (const auto& id : known_haves) {
+        have.add(id);
+    }
+    ReachableSet want(objects, bitmaps, &have);
+    for (const auto& id : wants) {
+        want.add(id);
+    }
+
+    // Stored bitmaps can bring in objects the other side has
+    want.bits.and_not(have.bits);
+    std::vector<ObjectId> result;
+    result.reserve(want.bits.count() + want.outside.size());
+    want.bits.for_each([&](size_t pos) { result.push_back(bitmaps->object_id(static_cast<uint32_t>(pos))); });
+    result.insert(result.end(), want.outside.begin(), want.outside.end());
+    return result;
+}
+
+} // namespace dgit
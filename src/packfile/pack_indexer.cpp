@@ -0,0 +1,464 @@
+#include "dgit/pack_indexer.hpp"
+#include "dgit/mapped_file.hpp"
+#include "dgit/object_view.hpp"
+#include "dgit/thread_pool.hpp"
+#include "dgit/trace.hpp"
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unistd.h>
+#include <unordered_map>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+namespace dgit {
+
+namespace {
+constexpr size_t kPackHeaderSize = 12;
+// Type and size take at most 10 bytes, a REF_DELTA base 20 more
+constexpr size_t kMaxEntryHeader = 10 + ObjectId::kRawSize;
+constexpr size_t kInflateChunk = 64 * 1024;
+
+std::atomic<unsigned> tmp_counter{0};
+
+bool whole_object_type(PackObjectType pack_type, ObjectType& type) {
+    switch (pack_type) {
+        case PackObjectType::Commit: type = ObjectType::Commit; return true;
+        case PackObjectType::Tree: type = ObjectType::Tree; return true;
+        case PackObjectType::Blob: type = ObjectType::Blob; return true;
+        case PackObjectType::Tag: type = ObjectType::Tag; return true;
+        default: return false;
+    }
+}
+
+void hash_object_header(SHA1& sha, ObjectType type, size_t size) {
+    std::string header = std::string(object_type_name(type)) + " " + std::to_string(size);
+    sha.update(reinterpret_cast<const uint8_t*>(header.c_str()), header.size() + 1);
+}
+
+ObjectId hash_object(ObjectType type, const std::string& data) {
+    SHA1 sha;
+    hash_object_header(sha, type, data.size());
+    sha.update(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+    return ObjectId::from_raw(sha.digest().data());
+}
+}
+
+PackIndexer::PackIndexer(const std::string& pack_dir) : pack_dir_(pack_dir) {
+    fs::create_directories(pack_dir_);
+    tmp_path_ = (fs::path(pack_dir_) / ("tmp_pack_" + std::to_string(::getpid()) + "_" +
+                                        std::to_string(tmp_counter++))).string();
+    file_.open(tmp_path_, std::ios::binary | std::ios::trunc);
+    if (!file_) {
+        throw GitException("Cannot create temporary pack in " + pack_dir_);
+    }
+    scratch_.resize(kInflateChunk);
+}
+
+PackIndexer::~PackIndexer() {
+    if (!installed_) {
+        file_.close();
+        std::error_code ec;
+        fs::remove(tmp_path_, ec);
+    }
+}
+
+void PackIndexer::write(const uint8_t* data, size_t size) {
+    while (size > 0) {
+        size_t used = 0;
+        switch (state_) {
+            case State::Header: used = consume_header(data, size); break;
+            case State::EntryHeader: used = consume_entry_header(data, size); break;
+            case State::EntryData: used = consume_entry_data(data, size); break;
+            case State::Trailer: used = consume_trailer(data, size); break;
+        }
+        data += used;
+        size -= used;
+    }
+}
+
+void PackIndexer::append(const uint8_t* data, size_t size) {
+    file_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+    pack_hash_.update(data, size);
+    offset_ += size;
+}
+
+size_t PackIndexer::consume_header(const uint8_t* data, size_t size) {
+    size_t take = std::min(size, kPackHeaderSize - pending_.size());
+    pending_.append(reinterpret_cast<const char*>(data), take);
+    if (pending_.size() < kPackHeaderSize) {
+        return take;
+    }
+
+    const auto* header = reinterpret_cast<const uint8_t*>(pending_.data());
+    uint32_t version = load_be32(header + 4);
+    if (std::memcmp(header, packfile_format::PACK_SIGNATURE, 4) != 0 ||
+        (version != static_cast<uint32_t>(PackVersion::V2) && version != static_cast<uint32_t>(PackVersion::V3))) {
+        throw GitException("Not a packfile, or unsupported pack version");
+    }
+    object_count_ = load_be32(header + 8);
+    append(header, kPackHeaderSize);
+    pending_.clear();
+
+    // The count comes from the sender; do not let it size memory up front
+    entries_.reserve(std::min<uint32_t>(object_count_, 1u << 20));
+    state_ = object_count_ ? State::EntryHeader : State::Trailer;
+    return take;
+}
+
+size_t PackIndexer::consume_entry_header(const uint8_t* data, size_t size) {
+    size_t before = pending_.size();
+    size_t take = std::min(size, kMaxEntryHeader - before);
+    pending_.append(reinterpret_cast<const char*>(data), take);
+
+    const auto* p = reinterpret_cast<const uint8_t*>(pending_.data());
+    size_t available = pending_.size();
+    auto corrupt = [&]() { return GitException("Corrupt pack entry header at offset " + std::to_string(offset_)); };
+
+    Entry entry;
+    entry.offset = offset_;
+    size_t pos = 0;
+    uint8_t byte = p[pos++];
+    entry.pack_type = static_cast<PackObjectType>((byte >> 4) & 0x07);
+    entry.size = byte & 0x0F;
+    int shift = 4;
+    while (byte & 0x80) {
+        if (pos >= available) {
+            return take;
+        }
+        if (shift > 57) {
+            throw corrupt();
+        }
+        byte = p[pos++];
+        entry.size |= static_cast<size_t>(byte & 0x7F) << shift;
+        shift += 7;
+    }
+
+    if (entry.pack_type == PackObjectType::OfsDelta) {
+        if (pos >= available) {
+            return take;
+        }
+        byte = p[pos++];
+        size_t distance = byte & 0x7F;
+        while (byte & 0x80) {
+            if (pos >= available) {
+                return take;
+            }
+            if (distance > (SIZE_MAX >> 7)) {
+                throw corrupt();
+            }
+            byte = p[pos++];
+            distance = ((distance + 1) << 7) | (byte & 0x7F);
+        }
+        if (distance == 0 || distance > entry.offset) {
+            throw GitException("OFS_DELTA base out of range at offset " + std::to_string(entry.offset));
+        }
+        entry.base_offset = entry.offset - distance;
+    } else if (entry.pack_type == PackObjectType::RefDelta) {
+        if (available - pos < ObjectId::kRawSize) {
+            return take;
+        }
+        entry.base_id = ObjectId::from_raw(p + pos);
+        pos += ObjectId::kRawSize;
+    } else if (whole_object_type(entry.pack_type, entry.type)) {
+        entry.resolved = true;
+    } else {
+        throw GitException("Unknown pack object type at offset " + std::to_string(entry.offset));
+    }
+
+    entry.crc32 = static_cast<uint32_t>(crc32(0L, p, static_cast<uInt>(pos)));
+    append(p, pos);
+    entry.data_offset = offset_;
+    current_ = entry;
+    pending_.clear();
+
+    // Whole objects get their name on the way through; deltas once resolved
+    stream_ = &inflater_.begin();
+    inflated_ = 0;
+    if (current_.resolved) {
+        object_hash_ = SHA1();
+        hash_object_header(object_hash_, current_.type, current_.size);
+    }
+    state_ = State::EntryData;
+    return pos - before;
+}
+
+size_t PackIndexer::consume_entry_data(const uint8_t* data, size_t size) {
+    z_stream& zs = *stream_;
+    size_t chunk = std::min<size_t>(size, UINT_MAX);
+    zs.next_in = const_cast<Bytef*>(data);
+    zs.avail_in = static_cast<uInt>(chunk);
+
+    bool done = false;
+    while (true) {
+        zs.next_out = reinterpret_cast<Bytef*>(&scratch_[0]);
+        zs.avail_out = static_cast<uInt>(kInflateChunk);
+        int ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            throw GitException("Corrupt zlib data in pack entry at offset " + std::to_string(current_.offset));
+        }
+        size_t produced = kInflateChunk - zs.avail_out;
+        inflated_ += produced;
+        Trace2::count(TraceCounter::BytesInflated, produced);
+        if (inflated_ > current_.size) {
+            throw GitException("Pack entry at offset " + std::to_string(current_.offset) + " exceeds its size");
+        }
+        if (current_.resolved) {
+            object_hash_.update(reinterpret_cast<const uint8_t*>(scratch_.data()), produced);
+        }
+        if (ret == Z_STREAM_END) {
+            done = true;
+            break;
+        }
+        // Out of input, or no progress possible until more arrives
+        if ((zs.avail_in == 0 && zs.avail_out != 0) || ret == Z_BUF_ERROR) {
+            break;
+        }
+    }
+
+    size_t consumed = chunk - zs.avail_in;
+    current_.crc32 = static_cast<uint32_t>(crc32(current_.crc32, data, static_cast<uInt>(consumed)));
+    append(data, consumed);
+    if (done) {
+        if (inflated_ != current_.size) {
+            throw GitException("Pack entry at offset " + std::to_string(current_.offset) + " is shorter than its size");
+        }
+        if (current_.resolved) {
+            current_.id = ObjectId::from_raw(object_hash_.digest().data());
+        }
+        entries_.push_back(current_);
+        state_ = entries_.size() == object_count_ ? State::Trailer : State::EntryHeader;
+    }
+    return consumed;
+}
+
+size_t PackIndexer::consume_trailer(const uint8_t* data, size_t size) {
+    if (trailer_.size() == ObjectId::kRawSize) {
+        throw GitException("Unexpected data after pack trailer");
+    }
+    size_t take = std::min(size, ObjectId::kRawSize - trailer_.size());
+    trailer_.append(reinterpret_cast<const char*>(data), take);
+    file_.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(take));
+    return take;
+}
+
+std::string PackIndexer::finish() {
+    if (state_ != State::Trailer || trailer_.size() != ObjectId::kRawSize) {
+        throw GitException("Pack is truncated: received " + std::to_string(entries_.size()) + " of " +
+                           std::to_string(object_count_) + " objects");
+    }
+    SHA1::Digest digest = pack_hash_.digest();
+    if (std::memcmp(digest.data(), trailer_.data(), digest.size()) != 0) {
+        throw GitException("Pack checksum mismatch");
+    }
+    file_.close();
+    if (!file_) {
+        throw GitException("Failed to write temporary pack: " + tmp_path_);
+    }
+
+    resolve_deltas();
+
+    ObjectId checksum = ObjectId::from_raw(digest.data());
+    std::vector<PackIndexEntry> index;
+    index.reserve(entries_.size());
+    for (const auto& entry : entries_) {
+        PackIndexEntry item;
+        item.sha1 = entry.id;
+        item.crc32 = entry.crc32;
+        item.offset = entry.offset;
+        index.push_back(item);
+    }
+    std::string rev;
+    if (write_reverse_index_) {
+        rev = packfile::encode_reverse_index(index, checksum);
+    }
+    std::string idx = packfile::encode_pack_index(std::move(index), checksum);
+
+    auto write_file = [](const std::string& path, const std::string& data) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!out) {
+            fs::remove(path);
+            throw GitException("Cannot write pack index: " + path);
+        }
+    };
+
+    // The .idx goes in last: readers find packs through their index
+    std::string base = (fs::path(pack_dir_) / ("pack-" + checksum.hex())).string();
+    std::string idx_tmp = tmp_path_ + ".idx";
+    write_file(idx_tmp, idx);
+    if (write_reverse_index_) {
+        std::string rev_tmp = tmp_path_ + ".rev";
+        try {
+            write_file(rev_tmp, rev);
+        } catch (...) {
+            fs::remove(idx_tmp);
+            throw;
+        }
+        fs::rename(rev_tmp, base + ".rev");
+    }
+    fs::rename(tmp_path_, base + ".pack");
+    fs::rename(idx_tmp, base + ".idx");
+    installed_ = true;
+    return base + ".pack";
+}
+
+void PackIndexer::resolve_deltas() {
+    size_t unresolved = std::count_if(entries_.begin(), entries_.end(), [](const Entry& e) { return !e.resolved; });
+    if (unresolved == 0) {
+        return;
+    }
+
+    MappedFile map(tmp_path_);
+    const uint8_t* pack = map.data();
+    size_t end = map.size() - ObjectId::kRawSize;
+
+    // Children of each base: OFS_DELTA by the base's offset, REF_DELTA by its name
+    std::unordered_map<size_t, std::vector<uint32_t>> by_offset;
+    std::unordered_map<ObjectId, std::vector<uint32_t>, ObjectIdHash> by_id;
+    for (uint32_t i = 0; i < entries_.size(); ++i) {
+        if (entries_[i].pack_type == PackObjectType::OfsDelta) {
+            by_offset[entries_[i].base_offset].push_back(i);
+        } else if (entries_[i].pack_type == PackObjectType::RefDelta) {
+            by_id[entries_[i].base_id].push_back(i);
+        }
+    }
+
+    auto inflate_entry = [&](const Entry& entry, std::string& out) {
+        try {
+            Inflater::for_thread().decompress(pack + entry.data_offset, end - entry.data_offset, out, entry.size);
+        } catch (const GitException&) {
+            throw GitException("Corrupt zlib data in pack entry at offset " + std::to_string(entry.offset));
+        }
+    };
+
+    // A pack may hold the same base twice, so a REF_DELTA can be reached
+    // from two roots; whoever claims it first resolves it
+    std::unique_ptr<std::atomic<bool>[]> claimed(new std::atomic<bool>[entries_.size()]);
+    for (size_t i = 0; i < entries_.size(); ++i) {
+        claimed[i].store(entries_[i].resolved, std::memory_order_relaxed);
+    }
+
+    // Work items are a delta and its base's data, or a whole object with
+    // children (no base). Each worker goes depth-first, so a base is
+    // inflated once and dropped after its last child. Roots start on the
+    // shared list; a worker gives the older half of its own stack back
+    // whenever another one is waiting, so one deep tree of deltas still
+    // spreads across the threads.
+    struct Pending {
+        uint32_t entry;
+        ObjectType type;
+        std::shared_ptr<const std::string> base;
+    };
+    std::vector<Pending> shared;
+    for (uint32_t i = 0; i < entries_.size(); ++i) {
+        const Entry& root = entries_[i];
+        if (root.pack_type != PackObjectType::OfsDelta && root.pack_type != PackObjectType::RefDelta &&
+            (by_offset.count(root.offset) || by_id.count(root.id))) {
+            shared.push_back({i, root.type, nullptr});
+        }
+    }
+    std::mutex mutex;
+    std::condition_variable ready;
+    size_t active = 0;
+    std::atomic<size_t> waiting{0};
+    bool failed = false;
+
+    // False once nothing is queued and nobody is left to queue more
+    auto take = [&](std::vector<Pending>& stack) {
+        std::unique_lock<std::mutex> lock(mutex);
+        waiting++;
+        ready.wait(lock, [&] { return failed || !shared.empty() || active == 0; });
+        waiting--;
+        if (failed || shared.empty()) {
+            return false;
+        }
+        stack.push_back(std::move(shared.back()));
+        shared.pop_back();
+        active++;
+        return true;
+    };
+
+    auto push_children = [&](std::vector<Pending>& stack, const Entry& base,
+                             const std::shared_ptr<const std::string>& data) {
+        auto offset_children = by_offset.find(base.offset);
+        auto id_children = by_id.find(base.id);
+        for (const std::vector<uint32_t>* children :
+             {offset_children != by_offset.end() ? &offset_children->second : nullptr,
+              id_children != by_id.end() ? &id_children->second : nullptr}) {
+            if (!children) {
+                continue;
+            }
+            for (uint32_t child : *children) {
+                if (!claimed[child].load(std::memory_order_relaxed)) {
+                    stack.push_back({child, base.type, data});
+                }
+            }
+        }
+    };
+
+    auto worker = [&](size_t) {
+        std::vector<Pending> stack;
+        std::string delta;
+        try {
+            while (take(stack)) {
+                while (!stack.empty()) {
+                    Pending next = std::move(stack.back());
+                    stack.pop_back();
+                    Entry& entry = entries_[next.entry];
+                    std::shared_ptr<const std::string> data;
+                    if (!next.base) {
+                        auto whole = std::make_shared<std::string>();
+                        inflate_entry(entry, *whole);
+                        data = std::move(whole);
+                    } else {
+                        if (claimed[next.entry].exchange(true)) {
+                            continue;
+                        }
+                        inflate_entry(entry, delta);
+                        data = std::make_shared<const std::string>(Delta::decode(*next.base, delta));
+                        entry.type = next.type;
+                        entry.id = hash_object(entry.type, *data);
+                        entry.resolved = true;
+                    }
+                    push_children(stack, entry, data);
+
+                    if (stack.size() > 1 && waiting.load(std::memory_order_relaxed) > 0) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        auto half = stack.begin() + static_cast<std::ptrdiff_t>(stack.size() / 2);
+                        shared.insert(shared.end(), std::make_move_iterator(stack.begin()),
+                                      std::make_move_iterator(half));
+                        stack.erase(stack.begin(), half);
+                        ready.notify_all();
+                    }
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--active == 0 && shared.empty()) {
+                    ready.notify_all();
+                }
+            }
+        } catch (...) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                failed = true;
+            }
+            ready.notify_all();
+            throw;
+        }
+    };
+    size_t threads = threads_ ? threads_ : default_threads();
+    parallel_for(threads, threads, worker);
+
+    unresolved = std::count_if(entries_.begin(), entries_.end(), [](const Entry& e) { return !e.resolved; });
+    if (unresolved > 0) {
+        throw GitException("Pack has " + std::to_string(unresolved) + " deltas against bases it does not contain");
+    }
+}
+
+} // namespace dgit
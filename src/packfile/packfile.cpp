@@ -1,28 +1,62 @@
 #include "dgit/packfile.hpp"
 #include "dgit/object.hpp"
-#include <arpa/inet.h>
+#include "dgit/compression.hpp"
+#include "dgit/mapped_file.hpp"
+#include "dgit/object_database.hpp"
+#include "dgit/pack_bitmap.hpp"
+#include "dgit/thread_pool.hpp"
+#include "dgit/trace.hpp"
 #include <algorithm>
+#include <cctype>
+#include <deque>
 #include <sstream>
 #include <fstream>
 #include <cstring>
 #include <zlib.h>
+#include <filesystem>
+#include <unistd.h>
+#include <unordered_map>
 
+namespace fs = std::filesystem;
 namespace dgit {
-// Provide 64-bit host-to-network conversion if not available
-#ifndef htonll
-static inline uint64_t htonll(uint64_t value) {
-#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
-    return (static_cast<uint64_t>(htonl(static_cast<uint32_t>(value & 0xFFFFFFFFULL))) << 32) |
-           htonl(static_cast<uint32_t>(value >> 32));
-#else
-    return value;
-#endif
-}
-#endif
-
 // PackWriter implementation
-PackWriter::PackWriter(const std::string& packfile_path, const std::string& index_path)
-    : packfile_path_(packfile_path), index_path_(index_path) {
+//
+// Objects are queued by add_object()/add_delta() and written by finalize():
+//   1. sort by type, path-name hash and size (largest first)
+//   2. sliding-window delta search, one contiguous segment per thread
+//   3. deflate every entry in parallel
+//   4. write entries in sorted order so OFS_DELTA bases always come first,
+//      then the SHA-1 trailer and a sorted v2 .idx
+namespace {
+constexpr size_t kNoBase = static_cast<size_t>(-1);
+
+PackObjectType object_type_to_pack_type(ObjectType type) {
+    switch (type) {
+        case ObjectType::Commit: return PackObjectType::Commit;
+        case ObjectType::Tree: return PackObjectType::Tree;
+        case ObjectType::Blob: return PackObjectType::Blob;
+        case ObjectType::Tag: return PackObjectType::Tag;
+    }
+    return PackObjectType::Blob;
+}
+
+// git's pack name hash: the last characters weigh most, so files with the
+// same name (or extension) sort next to each other
+uint32_t pack_name_hash(const std::string& name) {
+    uint32_t hash = 0;
+    for (unsigned char c : name) {
+        if (std::isspace(c)) {
+            continue;
+        }
+        hash = (hash >> 2) + (static_cast<uint32_t>(c) << 24);
+    }
+    return hash;
+}
+}
+
+PackWriter::PackWriter(const std::string& packfile_path, const std::string& index_path,
+                       const PackWriteOptions& options)
+    : packfile_path_(packfile_path), index_path_(index_path), options_(options) {
 
     pack_file_.open(packfile_path, std::ios::binary);
     if (!pack_file_) {
@@ -36,196 +70,294 @@ PackWriter::PackWriter(const std::string& packfile_path, const std::string& inde
 }
 
 PackWriter::~PackWriter() {
-    if (pack_file_.is_open()) {
-        finalize();
+    if (!finalized_) {
+        try {
+            finalize();
+        } catch (const std::exception&) {
+            // Nothing sensible to do in a destructor
+        }
     }
 }
 
 bool PackWriter::add_object(const ObjectId& sha1, std::unique_ptr<Object> object) {
-    PackObjectEntry entry;
-    entry.sha1 = sha1;
-    entry.offset = pack_file_.tellp();
-
-    // Determine object type
-    switch (object->type()) {
-        case ObjectType::Commit:
-            entry.type = PackObjectType::Commit;
-            break;
-        case ObjectType::Tree:
-            entry.type = PackObjectType::Tree;
-            break;
-        case ObjectType::Blob:
-            entry.type = PackObjectType::Blob;
-            break;
-        case ObjectType::Tag:
-            entry.type = PackObjectType::Tag;
-            break;
-        default:
-            return false;
-    }
-
-    // Serialize and compress object
-    std::string data = object->serialize();
-    std::string compressed = compress_data(data);
-    entry.size = data.size();
+    return add_object(sha1, object->type(), object->serialize());
+}
 
-    // Write object to packfile
-    if (write_object(entry, compressed) == 0) {
+bool PackWriter::add_object(const ObjectId& sha1, ObjectType type, std::string data, const std::string& name_hint) {
+    if (finalized_ || !pending_ids_.insert(sha1).second) {
         return false;
     }
 
-    objects_.push_back(entry);
+    PendingObject pending;
+    pending.sha1 = sha1;
+    pending.type = object_type_to_pack_type(type);
+    pending.data = std::move(data);
+    pending.name_hash = pack_name_hash(name_hint);
+    pending_.push_back(std::move(pending));
     return true;
 }
 
 bool PackWriter::add_delta(const ObjectId& sha1, const ObjectId& base_sha1,
                           const std::string& delta_data) {
-    PackObjectEntry entry;
-    entry.sha1 = sha1;
-    entry.base_sha1 = base_sha1;
-    entry.offset = pack_file_.tellp();
-
-    // This is a simplified implementation
-    // In a real Git implementation, delta objects would be properly handled
+    if (finalized_ || !pending_ids_.insert(sha1).second) {
+        return false;
+    }
 
-    return false;
+    // Precomputed deltas are written as REF_DELTA against base_sha1, which
+    // must also be part of this pack
+    PendingObject pending;
+    pending.sha1 = sha1;
+    pending.type = PackObjectType::RefDelta;
+    pending.ref_base = base_sha1;
+    pending.delta = delta_data;
+    pending_.push_back(std::move(pending));
+    return true;
 }
 
 bool PackWriter::finalize() {
-    if (pack_file_.is_open()) {
-        write_trailer();
-        pack_file_.close();
+    if (finalized_) {
+        return true;
     }
+    finalized_ = true;
 
-    if (index_file_.is_open()) {
-        write_index();
-        index_file_.close();
+    for (const auto& pending : pending_) {
+        if (pending.type == PackObjectType::RefDelta && !pending_ids_.count(pending.ref_base)) {
+            throw GitException("Delta base missing from pack: " + pending.ref_base.hex());
+        }
     }
 
-    return true;
-}
+    // Precomputed deltas sort last; they never serve as window bases
+    std::stable_sort(pending_.begin(), pending_.end(), [](const PendingObject& a, const PendingObject& b) {
+        if (a.type != b.type) {
+            return a.type < b.type;
+        }
+        if (a.name_hash != b.name_hash) {
+            return a.name_hash < b.name_hash;
+        }
+        return a.data.size() > b.data.size();
+    });
 
-uint32_t PackWriter::write_object(const PackObjectEntry& entry, const std::string& data) {
-    // Write object header
-    uint8_t byte = (static_cast<uint8_t>(entry.type) << 4) | (entry.size & 0x0F);
-    pack_file_.put(static_cast<char>(byte));
+    size_t threads = options_.threads ? options_.threads : default_threads();
+    if (options_.window > 0 && options_.depth > 0) {
+        find_deltas(threads);
+    }
 
-    size_t size = entry.size;
-    while (size >= 0x80) {
-        byte = (size & 0x7F) | 0x80;
-        pack_file_.put(static_cast<char>(byte));
-        size >>= 7;
+    parallel_for(pending_.size(), threads, [this](size_t i) {
+        PendingObject& pending = pending_[i];
+        bool is_delta = pending.delta_base != kNoBase || pending.type == PackObjectType::RefDelta;
+        const std::string& body = is_delta ? pending.delta : pending.data;
+        Deflater::for_thread(options_.compression_level).compress(body.data(), body.size(), pending.compressed);
+    });
+
+    write_header();
+    std::vector<size_t> offsets(pending_.size());
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        offsets[i] = pack_offset_;
+        write_object(pending_[i], offsets);
+    }
+    write_trailer();
+    pack_file_.close();
+    if (!pack_file_) {
+        throw GitException("Failed to write packfile: " + packfile_path_);
     }
-    pack_file_.put(static_cast<char>(size));
 
-    // Write compressed data
-    pack_file_.write(data.c_str(), data.size());
+    write_index();
+    index_file_.close();
+    if (!index_file_) {
+        throw GitException("Failed to write index file: " + index_path_);
+    }
 
-    return static_cast<uint32_t>(pack_file_.tellp());
+    pending_.clear();
+    return true;
 }
 
-void PackWriter::write_header() {
-    // Write packfile header
-    pack_file_.write(packfile_format::PACK_SIGNATURE, 4);
-    uint32_t version = htonl(static_cast<uint32_t>(PackVersion::V2));
-    pack_file_.write(reinterpret_cast<char*>(&version), 4);
-    uint32_t count = htonl(static_cast<uint32_t>(objects_.size()));
-    pack_file_.write(reinterpret_cast<char*>(&count), 4);
+void PackWriter::find_deltas(size_t threads) {
+    // Only whole objects take part; precomputed deltas sit at the end
+    size_t count = 0;
+    while (count < pending_.size() && pending_[count].type != PackObjectType::RefDelta) {
+        ++count;
+    }
+
+    // Contiguous segments keep similar objects together; deltas never cross
+    // a segment boundary, so each segment is searched independently
+    size_t segments = std::max<size_t>(1, std::min(threads, count / (options_.window * 4 + 1)));
+    size_t per_segment = (count + segments - 1) / std::max<size_t>(segments, 1);
+
+    parallel_for(segments, threads, [&](size_t segment) {
+        size_t begin = segment * per_segment;
+        size_t end = std::min(count, begin + per_segment);
+
+        struct WindowEntry {
+            size_t index;
+            std::unique_ptr<DeltaIndex> delta_index;
+        };
+        std::deque<WindowEntry> window;
+
+        for (size_t i = begin; i < end; ++i) {
+            PendingObject& target = pending_[i];
+
+            // Drop window entries of another type; sorting groups types
+            while (!window.empty() && pending_[window.front().index].type != target.type) {
+                window.pop_front();
+            }
+
+            // Same limit as git: a delta must save at least half the object
+            size_t max_size = target.data.size() / 2;
+            max_size = max_size > 20 ? max_size - 20 : 0;
+
+            for (auto it = window.rbegin(); it != window.rend() && max_size > 0; ++it) {
+                const PendingObject& base = pending_[it->index];
+                if (base.depth >= options_.depth || base.data.size() < target.data.size() / 32) {
+                    continue;
+                }
+                if (!it->delta_index) {
+                    it->delta_index = std::make_unique<DeltaIndex>(base.data);
+                }
+                std::string delta = it->delta_index->encode(target.data, max_size);
+                if (!delta.empty() && delta.size() < max_size) {
+                    max_size = delta.size();
+                    target.delta = std::move(delta);
+                    target.delta_base = it->index;
+                    target.depth = base.depth + 1;
+                }
+            }
+
+            window.push_back(WindowEntry{i, nullptr});
+            if (window.size() > options_.window) {
+                window.pop_front();
+            }
+        }
+    });
 }
 
-void PackWriter::write_trailer() {
-    // Calculate and write SHA-1 of the packfile
-    // This is a simplified implementation
-    std::string trailer = "0000000000000000000000000000000000000000";
-    pack_file_.write(trailer.c_str(), 20);
+void PackWriter::write_pack_bytes(const void* data, size_t size) {
+    pack_file_.write(static_cast<const char*>(data), size);
+    pack_hash_.update(static_cast<const uint8_t*>(data), size);
+    pack_offset_ += size;
 }
 
-void PackWriter::write_index() {
-    // Write index file header
-    index_file_.write(packfile_format::IDX_SIGNATURE, 4);
-    uint32_t version = htonl(2);  // Index version 2
-    index_file_.write(reinterpret_cast<char*>(&version), 4);
+void PackWriter::write_object(const PendingObject& pending, const std::vector<size_t>& offsets) {
+    PackObjectEntry entry;
+    entry.sha1 = pending.sha1;
+    entry.offset = pack_offset_;
 
-    // Write fanout table (simplified)
-    for (int i = 0; i < 256; ++i) {
-        uint32_t fanout = htonl(static_cast<uint32_t>(objects_.size()));
-        index_file_.write(reinterpret_cast<char*>(&fanout), 4);
+    std::string header;
+    PackObjectType type = pending.type;
+    if (pending.delta_base != kNoBase) {
+        type = PackObjectType::OfsDelta;
     }
+    entry.type = type;
+    entry.size = type == PackObjectType::OfsDelta || type == PackObjectType::RefDelta ? pending.delta.size()
+                                                                                      : pending.data.size();
 
-    // Write object entries
-    for (const auto& obj : objects_) {
-        // Write SHA-1
-        index_file_.write(obj.sha1.c_str(), 20);
-
-        // Write CRC32 (placeholder)
-        uint32_t crc32 = 0;
-        index_file_.write(reinterpret_cast<char*>(&crc32), 4);
-
-        // Write offset
-        uint64_t offset = htonll(static_cast<uint64_t>(obj.offset));
-        index_file_.write(reinterpret_cast<char*>(&offset), 8);
+    // Type and size: 4 size bits in the first byte, then 7 bits per byte
+    size_t size = entry.size;
+    uint8_t byte = static_cast<uint8_t>((static_cast<uint8_t>(type) << 4) | (size & 0x0F));
+    size >>= 4;
+    while (size) {
+        header.push_back(static_cast<char>(byte | 0x80));
+        byte = static_cast<uint8_t>(size & 0x7F);
+        size >>= 7;
     }
-
-    // Write packfile checksum and trailer
-    std::string checksum = "0000000000000000000000000000000000000000";
-    index_file_.write(checksum.c_str(), 20);
-    uint32_t trailer = htonl(objects_.size());
-    index_file_.write(reinterpret_cast<char*>(&trailer), 4);
-}
-
-std::string PackWriter::compress_data(const std::string& data) {
-    z_stream zs;
-    memset(&zs, 0, sizeof(zs));
-
-    if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
-        throw GitException("Failed to initialize compression");
+    header.push_back(static_cast<char>(byte));
+
+    if (type == PackObjectType::OfsDelta) {
+        // Big-endian base-128 distance with an implicit +1 per continuation
+        size_t distance = entry.offset - offsets[pending.delta_base];
+        uint8_t encoded[16];
+        size_t pos = sizeof(encoded) - 1;
+        encoded[pos] = static_cast<uint8_t>(distance & 0x7F);
+        while (distance >>= 7) {
+            encoded[--pos] = static_cast<uint8_t>(0x80 | (--distance & 0x7F));
+        }
+        header.append(reinterpret_cast<const char*>(encoded + pos), sizeof(encoded) - pos);
+        entry.base_sha1 = pending_[pending.delta_base].sha1;
+    } else if (type == PackObjectType::RefDelta) {
+        header.append(reinterpret_cast<const char*>(pending.ref_base.data()), ObjectId::kRawSize);
+        entry.base_sha1 = pending.ref_base;
     }
 
-    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.c_str()));
-    zs.avail_in = data.size();
-
-    std::string compressed;
-    int ret;
-    char outbuffer[32768];
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, reinterpret_cast<const Bytef*>(header.data()), static_cast<uInt>(header.size()));
+    crc = crc32_z(crc, reinterpret_cast<const Bytef*>(pending.compressed.data()), pending.compressed.size());
+    entry.crc32 = static_cast<uint32_t>(crc);
 
-    do {
-        zs.next_out = reinterpret_cast<Bytef*>(outbuffer);
-        zs.avail_out = sizeof(outbuffer);
+    write_pack_bytes(header.data(), header.size());
+    write_pack_bytes(pending.compressed.data(), pending.compressed.size());
 
-        ret = deflate(&zs, Z_FINISH);
+    objects_.push_back(entry);
+}
 
-        if (compressed.size() < zs.total_out) {
-            compressed.append(outbuffer, zs.total_out - compressed.size());
-        }
-    } while (ret == Z_OK);
+void PackWriter::write_header() {
+    // Write packfile header
+    std::string header(packfile_format::PACK_SIGNATURE, 4);
+    store_be32(header, static_cast<uint32_t>(PackVersion::V2));
+    store_be32(header, static_cast<uint32_t>(pending_.size()));
+    write_pack_bytes(header.data(), header.size());
+}
 
-    deflateEnd(&zs);
+void PackWriter::write_trailer() {
+    // SHA-1 over everything written so far
+    checksum_ = ObjectId::from_raw(pack_hash_.digest().data());
+    pack_file_.write(reinterpret_cast<const char*>(checksum_.data()), ObjectId::kRawSize);
+}
 
-    if (ret != Z_STREAM_END) {
-        throw GitException("Failed to compress data");
+void PackWriter::write_index() {
+    std::vector<PackIndexEntry> entries;
+    entries.reserve(objects_.size());
+    for (const auto& object : objects_) {
+        PackIndexEntry entry;
+        entry.sha1 = object.sha1;
+        entry.crc32 = object.crc32;
+        entry.offset = object.offset;
+        entries.push_back(entry);
     }
-
-    return compressed;
+    std::string idx = packfile::encode_pack_index(std::move(entries), checksum_);
+    index_file_.write(idx.data(), idx.size());
 }
 
 std::string PackWriter::create_delta(const std::string& base_data, const std::string& target_data) {
-    // Simplified delta creation
-    // In a real implementation, this would use proper delta compression
-    return "";
+    return Delta::encode(base_data, target_data);
 }
 
 // PackReader implementation
+namespace {
+constexpr size_t kPackHeaderSize = 12;
+constexpr size_t kPackTrailerSize = ObjectId::kRawSize;
+constexpr size_t kMaxDeltaChain = 10000;
+
+bool pack_type_to_object_type(PackObjectType pack_type, ObjectType& type) {
+    switch (pack_type) {
+        case PackObjectType::Commit: type = ObjectType::Commit; return true;
+        case PackObjectType::Tree: type = ObjectType::Tree; return true;
+        case PackObjectType::Blob: type = ObjectType::Blob; return true;
+        case PackObjectType::Tag: type = ObjectType::Tag; return true;
+        default: return false;
+    }
+}
+}
+
 PackReader::PackReader(const std::string& packfile_path, const std::string& index_path)
     : packfile_path_(packfile_path), index_path_(index_path) {
 
-    pack_file_.open(packfile_path, std::ios::binary);
-    if (!pack_file_) {
-        throw GitException("Cannot open packfile: " + packfile_path);
+    pack_map_ = MappedFile(packfile_path);
+    const uint8_t* data = pack_map_.data();
+    if (pack_map_.size() < kPackHeaderSize + kPackTrailerSize ||
+        std::memcmp(data, packfile_format::PACK_SIGNATURE, 4) != 0) {
+        throw GitException("Invalid packfile: " + packfile_path);
+    }
+
+    uint32_t version = load_be32(data + 4);
+    if (version != static_cast<uint32_t>(PackVersion::V2) && version != static_cast<uint32_t>(PackVersion::V3)) {
+        throw GitException("Unsupported packfile version: " + std::to_string(version));
     }
 
     index_ = std::make_unique<PackIndex>(index_path);
-    if (!index_) {
-        throw GitException("Cannot open index file: " + index_path);
+    if (load_be32(data + 8) != index_->get_object_count()) {
+        throw GitException("Packfile and index disagree on object count: " + packfile_path);
+    }
+    if (std::memcmp(data + pack_map_.size() - kPackTrailerSize, index_->pack_checksum(), kPackTrailerSize) != 0) {
+        throw GitException("Index does not belong to packfile: " + index_path);
     }
 }
 
@@ -240,70 +372,235 @@ std::unique_ptr<Object> PackReader::get_object(const ObjectId& sha1) {
     return read_object_at_offset(*offset);
 }
 
+std::optional<PackedObject> PackReader::read_raw(const ObjectId& sha1) {
+    auto offset = index_->find_offset(sha1);
+    if (!offset) {
+        return std::nullopt;
+    }
+
+    return read_raw_at_offset(*offset);
+}
+
 bool PackReader::has_object(const ObjectId& sha1) const {
     return index_->has_object(sha1);
 }
 
 std::vector<ObjectId> PackReader::get_all_objects() const {
     std::vector<ObjectId> objects;
-    auto entries = index_->get_entries();
-    for (const auto& entry : entries) {
-        objects.push_back(entry.sha1);
+    objects.reserve(index_->get_object_count());
+    for (size_t i = 0; i < index_->get_object_count(); ++i) {
+        objects.push_back(index_->object_id_at(i));
     }
     return objects;
 }
 
+void PackReader::set_delta_base_cache_limit(size_t bytes) {
+    delta_base_cache_limit_ = bytes;
+    trim_delta_base_cache();
+}
+
+PackStats PackReader::stats() const {
+    PackStats result = stats_;
+    result.object_count = index_->get_object_count();
+    result.packfile_size = pack_map_.size();
+    result.packfiles = {packfile_path_};
+    return result;
+}
+
 std::unique_ptr<Object> PackReader::read_object_at_offset(size_t offset) {
-    pack_file_.seekg(offset);
+    PackedObject object = read_raw_at_offset(offset);
 
-    // Read object header
-    uint8_t byte;
-    pack_file_.read(reinterpret_cast<char*>(&byte), 1);
+    // Same parser as loose objects, handed the inflated body without a copy
+    return Object::parse(object.type, std::move(object.data));
+}
 
-    PackObjectType type = static_cast<PackObjectType>(byte >> 4);
-    size_t size = byte & 0x0F;
+ObjectType PackReader::object_type_at(size_t offset) const {
+    // Entry headers alone: a delta has the type of the end of its chain
+    for (size_t depth = 0; depth <= kMaxDeltaChain; ++depth) {
+        EntryHeader header = read_entry_header(offset);
+        ObjectType type;
+        if (pack_type_to_object_type(header.type, type)) {
+            return type;
+        }
+        offset = header.base_offset;
+    }
+    throw GitException("Delta chain too long at offset " + std::to_string(offset));
+}
+
+PackReader::EntryHeader PackReader::read_entry_header(size_t offset) const {
+    const uint8_t* data = pack_map_.data();
+    size_t end = pack_map_.size() - kPackTrailerSize;
+    if (offset < kPackHeaderSize || offset >= end) {
+        throw GitException("Pack offset out of range: " + std::to_string(offset));
+    }
+
+    EntryHeader header;
+    size_t pos = offset;
+    uint8_t byte = data[pos++];
+    header.type = static_cast<PackObjectType>((byte >> 4) & 0x07);
+    header.size = byte & 0x0F;
 
-    // Read size continuation bytes
+    // Size continuation bytes, least significant group first
     int shift = 4;
     while (byte & 0x80) {
-        pack_file_.read(reinterpret_cast<char*>(&byte), 1);
-        size |= (byte & 0x7F) << shift;
+        if (pos >= end || shift > 57) {
+            throw GitException("Corrupt pack entry header at offset " + std::to_string(offset));
+        }
+        byte = data[pos++];
+        header.size |= static_cast<size_t>(byte & 0x7F) << shift;
         shift += 7;
     }
 
-    // Read compressed data
-    std::string compressed_data;
-    compressed_data.resize(1024); // Simplified
+    if (header.type == PackObjectType::OfsDelta) {
+        // Big-endian base-128 distance back to the base, with an implicit +1 per continuation byte
+        if (pos >= end) {
+            throw GitException("Corrupt OFS_DELTA at offset " + std::to_string(offset));
+        }
+        byte = data[pos++];
+        size_t distance = byte & 0x7F;
+        while (byte & 0x80) {
+            if (pos >= end || distance > (SIZE_MAX >> 7)) {
+                throw GitException("Corrupt OFS_DELTA at offset " + std::to_string(offset));
+            }
+            byte = data[pos++];
+            distance = ((distance + 1) << 7) | (byte & 0x7F);
+        }
+        if (distance == 0 || distance > offset) {
+            throw GitException("OFS_DELTA base out of range at offset " + std::to_string(offset));
+        }
+        header.base_offset = offset - distance;
+    } else if (header.type == PackObjectType::RefDelta) {
+        if (end - pos < ObjectId::kRawSize) {
+            throw GitException("Corrupt REF_DELTA at offset " + std::to_string(offset));
+        }
+        ObjectId base = ObjectId::from_raw(data + pos);
+        pos += ObjectId::kRawSize;
+        auto base_offset = index_->find_offset(base);
+        if (!base_offset) {
+            throw GitException("REF_DELTA base not in pack: " + base.hex());
+        }
+        header.base_offset = *base_offset;
+    } else {
+        ObjectType ignored;
+        if (!pack_type_to_object_type(header.type, ignored)) {
+            throw GitException("Unknown pack object type at offset " + std::to_string(offset));
+        }
+    }
+
+    header.data_offset = pos;
+    return header;
+}
 
-    // In a real implementation, this would read the actual compressed data
-    // and decompress it properly
+std::string PackReader::inflate_entry(const EntryHeader& header) {
+    const uint8_t* data = pack_map_.data();
+    size_t end = pack_map_.size() - kPackTrailerSize;
 
-    // Create object based on type
-    switch (type) {
-        case PackObjectType::Commit:
-            return std::make_unique<Blob>("");
-        case PackObjectType::Tree:
-            return std::make_unique<Tree>();
-        case PackObjectType::Blob:
-            return std::make_unique<Blob>("");
-        case PackObjectType::Tag:
-            return std::make_unique<Tag>("", ObjectType::Blob, "", Person("", "", {}), "");
-        default:
-            return nullptr;
+    // The header gives the exact inflated size, so inflate in one call
+    std::string out;
+    try {
+        Inflater::for_thread().decompress(data + header.data_offset, end - header.data_offset, out, header.size);
+    } catch (const GitException&) {
+        throw GitException("Corrupt zlib data in pack entry at offset " + std::to_string(header.data_offset));
+    }
+    size_t produced = out.size();
+
+    stats_.bytes_inflated += produced;
+    return out;
+}
+
+PackedObject PackReader::read_raw_at_offset(size_t offset) {
+    // Walk down the delta chain until we reach a full object or a cached base
+    std::vector<EntryHeader> chain;
+    std::shared_ptr<const std::string> base;
+    ObjectType base_type = ObjectType::Blob;
+    size_t current = offset;
+
+    while (true) {
+        if (chain.size() > kMaxDeltaChain) {
+            throw GitException("Delta chain too long at offset " + std::to_string(offset));
+        }
+
+        // Hot objects are often bases of other deltas, so the requested
+        // entry itself may already be cached
+        auto cached = delta_base_cache_.find(current);
+        if (cached != delta_base_cache_.end()) {
+            delta_base_lru_.splice(delta_base_lru_.begin(), delta_base_lru_, cached->second);
+            base = cached->second->data;
+            base_type = cached->second->type;
+            stats_.delta_cache_hits++;
+            break;
+        }
+        stats_.delta_cache_misses++;
+
+        EntryHeader header = read_entry_header(current);
+        if (header.type != PackObjectType::OfsDelta && header.type != PackObjectType::RefDelta) {
+            pack_type_to_object_type(header.type, base_type);
+            base = std::make_shared<const std::string>(inflate_entry(header));
+            if (!chain.empty()) {
+                cache_delta_base(current, base_type, base);
+            }
+            break;
+        }
+
+        chain.push_back(header);
+        current = header.base_offset;
     }
+
+    // Apply deltas from the innermost base outwards, caching each
+    // intermediate result since it is somebody's base
+    for (size_t i = chain.size(); i-- > 0;) {
+        std::string delta = inflate_entry(chain[i]);
+        auto result = std::make_shared<const std::string>(apply_delta(*base, delta));
+        if (i > 0) {
+            cache_delta_base(chain[i - 1].base_offset, base_type, result);
+        }
+        base = std::move(result);
+    }
+
+    stats_.objects_read++;
+    return PackedObject{base_type, *base};
 }
 
-std::string PackReader::decompress_data(const std::string& compressed_data) {
-    // Simplified decompression
-    return compressed_data;
+void PackReader::cache_delta_base(size_t offset, ObjectType type, std::shared_ptr<const std::string> data) {
+    if (data->size() > delta_base_cache_limit_ || delta_base_cache_.count(offset)) {
+        return;
+    }
+
+    delta_base_cache_bytes_ += data->size();
+    delta_base_lru_.push_front(DeltaBaseEntry{offset, type, std::move(data)});
+    delta_base_cache_[offset] = delta_base_lru_.begin();
+    trim_delta_base_cache();
+}
+
+void PackReader::trim_delta_base_cache() {
+    while (delta_base_cache_bytes_ > delta_base_cache_limit_ && !delta_base_lru_.empty()) {
+        const DeltaBaseEntry& victim = delta_base_lru_.back();
+        delta_base_cache_bytes_ -= victim.data->size();
+        delta_base_cache_.erase(victim.offset);
+        delta_base_lru_.pop_back();
+    }
 }
 
 std::string PackReader::apply_delta(const std::string& base_data, const std::string& delta_data) {
-    // Simplified delta application
-    return base_data;
+    return Delta::decode(base_data, delta_data);
 }
 
 // PackIndex implementation
+//
+// Version 2 .idx layout (all integers big-endian):
+//   magic, version, 256-entry cumulative fanout, N sorted object names,
+//   N CRC32s, N 31-bit offsets (MSB set = index into the 64-bit table),
+//   64-bit offsets, pack checksum, index checksum.
+// The file is mapped and only the header is validated at open time; every
+// table is read in place.
+namespace {
+constexpr size_t kIdxHeaderSize = 8;
+constexpr size_t kIdxFanoutSize = 256 * 4;
+constexpr size_t kIdxEntrySize = ObjectId::kRawSize + 4 + 4;
+constexpr size_t kIdxTrailerSize = 2 * ObjectId::kRawSize;
+constexpr uint32_t kIdxLargeOffsetFlag = 0x80000000u;
+}
+
 PackIndex::PackIndex(const std::string& index_path) : index_path_(index_path) {
     read_index_file();
 }
@@ -311,68 +608,116 @@ PackIndex::PackIndex(const std::string& index_path) : index_path_(index_path) {
 PackIndex::~PackIndex() = default;
 
 std::vector<PackIndexEntry> PackIndex::get_entries() const {
-    return entries_;
+    std::vector<PackIndexEntry> entries(object_count_);
+    for (size_t i = 0; i < object_count_; ++i) {
+        entries[i].sha1 = object_id_at(i);
+        entries[i].crc32 = crc32_at(i);
+        entries[i].offset = offset_at(i);
+    }
+    return entries;
 }
 
-std::optional<size_t> PackIndex::find_offset(const ObjectId& sha1) const {
-    for (const auto& entry : entries_) {
-        if (entry.sha1 == sha1) {
-            return entry.offset;
+std::optional<size_t> PackIndex::find_position(const ObjectId& sha1) const {
+    // The fanout narrows the search to names sharing the first byte
+    uint8_t first = sha1.first_byte();
+    size_t lo = first == 0 ? 0 : load_be32(fanout_ + (first - 1) * 4);
+    size_t hi = load_be32(fanout_ + first * 4);
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = std::memcmp(names_ + mid * ObjectId::kRawSize, sha1.data(), ObjectId::kRawSize);
+        if (cmp == 0) {
+            return mid;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
     return std::nullopt;
 }
 
+std::optional<size_t> PackIndex::find_offset(const ObjectId& sha1) const {
+    auto position = find_position(sha1);
+    if (!position) {
+        return std::nullopt;
+    }
+    return offset_at(*position);
+}
+
 bool PackIndex::has_object(const ObjectId& sha1) const {
-    return find_offset(sha1).has_value();
+    return find_position(sha1).has_value();
 }
 
-void PackIndex::read_index_file() {
-    std::ifstream file(index_path_, std::ios::binary);
-    if (!file) {
-        throw GitException("Cannot read index file: " + index_path_);
+ObjectId PackIndex::object_id_at(size_t position) const {
+    return ObjectId::from_raw(names_ + position * ObjectId::kRawSize);
+}
+
+uint32_t PackIndex::crc32_at(size_t position) const {
+    return load_be32(crcs_ + position * 4);
+}
+
+size_t PackIndex::offset_at(size_t position) const {
+    uint32_t offset = load_be32(offsets_ + position * 4);
+    if (!(offset & kIdxLargeOffsetFlag)) {
+        return offset;
     }
 
-    // Read and verify signature
-    char signature[4];
-    file.read(signature, 4);
+    size_t large = offset & ~kIdxLargeOffsetFlag;
+    if (large >= large_offset_count_) {
+        throw GitException("Corrupt pack index (bad large offset): " + index_path_);
+    }
+    return static_cast<size_t>(load_be64(large_offsets_ + large * 8));
+}
 
-    if (std::memcmp(signature, packfile_format::IDX_SIGNATURE, 4) != 0) {
-        throw GitException("Invalid index file signature");
+const uint8_t* PackIndex::pack_checksum() const {
+    return map_.data() + map_.size() - kIdxTrailerSize;
+}
+
+void PackIndex::read_index_file() {
+    map_ = MappedFile(index_path_);
+    const uint8_t* data = map_.data();
+    size_t size = map_.size();
+
+    if (size < kIdxHeaderSize + kIdxFanoutSize + kIdxTrailerSize) {
+        throw GitException("Index file too small: " + index_path_);
     }
 
-    // Read version
-    uint32_t version;
-    file.read(reinterpret_cast<char*>(&version), 4);
-    version = ntohl(version);
+    // Verify signature and version
+    if (std::memcmp(data, packfile_format::IDX_SIGNATURE, 4) != 0) {
+        throw GitException("Invalid index file signature");
+    }
 
+    uint32_t version = load_be32(data + 4);
     if (version != 2) {
         throw GitException("Unsupported index version: " + std::to_string(version));
     }
 
-    // Skip fanout table for now (simplified implementation)
-    file.seekg(256 * 4, std::ios::cur);
-
-    // Read object entries
-    while (file) {
-        PackIndexEntry entry;
-
-        // Read SHA-1
-        char sha1_bytes[20];
-        if (!file.read(sha1_bytes, 20)) break;
-
-        // Convert to hex string
-        for (int i = 0; i < 20; ++i) {
-            char buf[3];
-            sprintf(buf, "%02x", static_cast<unsigned char>(sha1_bytes[i]));
-            entry.sha1 += buf;
+    fanout_ = data + kIdxHeaderSize;
+    uint32_t previous = 0;
+    for (size_t i = 0; i < 256; ++i) {
+        uint32_t count = load_be32(fanout_ + i * 4);
+        if (count < previous) {
+            throw GitException("Corrupt pack index (fanout not monotonic): " + index_path_);
         }
+        previous = count;
+    }
+    object_count_ = previous;
 
-        // Skip CRC32 and offset for now (simplified)
-        file.seekg(12, std::ios::cur);
-
-        entries_.push_back(entry);
+    // Whatever follows the fixed-size tables is the 64-bit offset table
+    size_t fixed = kIdxHeaderSize + kIdxFanoutSize + object_count_ * kIdxEntrySize + kIdxTrailerSize;
+    if (size < fixed || (size - fixed) % 8 != 0) {
+        throw GitException("Corrupt pack index (bad size): " + index_path_);
     }
+
+    names_ = fanout_ + kIdxFanoutSize;
+    crcs_ = names_ + object_count_ * ObjectId::kRawSize;
+    offsets_ = crcs_ + object_count_ * 4;
+    large_offsets_ = offsets_ + object_count_ * 4;
+    large_offset_count_ = (size - fixed) / 8;
+
+    map_.advise_random();
 }
 
 // PackObject implementation
@@ -389,34 +734,436 @@ std::unique_ptr<PackObject> PackObject::deserialize(const std::string& data) {
 }
 
 // Delta implementation
+//
+// The base is indexed by a rolling hash of every aligned 16-byte block. The
+// encoder slides the same hash over the target one byte at a time; on a
+// verified block match it extends the match in both directions and emits a
+// copy, otherwise the byte joins the pending literal insert.
+namespace {
+constexpr size_t kDeltaBlock = 16;
+constexpr uint32_t kDeltaHashMul = 0x01000193;
+constexpr size_t kDeltaMaxChain = 64;
+constexpr size_t kDeltaMaxInsert = 0x7F;
+constexpr size_t kDeltaMaxCopy = 0x10000;
+
+uint32_t delta_block_hash(const uint8_t* data) {
+    uint32_t hash = 0;
+    for (size_t i = 0; i < kDeltaBlock; ++i) {
+        hash = hash * kDeltaHashMul + data[i];
+    }
+    return hash;
+}
+
+// kDeltaHashMul^(kDeltaBlock - 1), the weight of the byte leaving the window
+constexpr uint32_t delta_hash_out_weight() {
+    uint32_t weight = 1;
+    for (size_t i = 1; i < kDeltaBlock; ++i) {
+        weight *= kDeltaHashMul;
+    }
+    return weight;
+}
+
+void append_delta_size(std::string& out, size_t size) {
+    while (size >= 0x80) {
+        out.push_back(static_cast<char>((size & 0x7F) | 0x80));
+        size >>= 7;
+    }
+    out.push_back(static_cast<char>(size));
+}
+
+void flush_insert(std::string& out, std::string& literal) {
+    if (!literal.empty()) {
+        out.push_back(static_cast<char>(literal.size()));
+        out += literal;
+        literal.clear();
+    }
+}
+
+void append_copy(std::string& out, size_t offset, size_t size) {
+    while (size > 0) {
+        size_t chunk = std::min(size, kDeltaMaxCopy);
+        char cmd = static_cast<char>(0x80);
+        std::string args;
+        for (int i = 0; i < 4; ++i) {
+            uint8_t byte = static_cast<uint8_t>(offset >> (i * 8));
+            if (byte) {
+                cmd |= static_cast<char>(1 << i);
+                args.push_back(static_cast<char>(byte));
+            }
+        }
+        // A copy with no size bytes means 0x10000
+        if (chunk != kDeltaMaxCopy) {
+            for (int i = 0; i < 3; ++i) {
+                uint8_t byte = static_cast<uint8_t>(chunk >> (i * 8));
+                if (byte) {
+                    cmd |= static_cast<char>(0x10 << i);
+                    args.push_back(static_cast<char>(byte));
+                }
+            }
+        }
+        out.push_back(cmd);
+        out += args;
+        offset += chunk;
+        size -= chunk;
+    }
+}
+}
+
+DeltaIndex::DeltaIndex(const std::string& base) : base_(&base) {
+    size_t blocks = base.size() / kDeltaBlock;
+    size_t table_size = 16;
+    while (table_size < blocks) {
+        table_size <<= 1;
+    }
+    mask_ = static_cast<uint32_t>(table_size - 1);
+    heads_.assign(table_size, -1);
+    next_.assign(blocks, -1);
+
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(base.data());
+    for (size_t block = 0; block < blocks; ++block) {
+        uint32_t bucket = delta_block_hash(data + block * kDeltaBlock) & mask_;
+        next_[block] = heads_[bucket];
+        heads_[bucket] = static_cast<int32_t>(block);
+    }
+}
+
+std::string DeltaIndex::encode(const std::string& target_data, size_t max_size) const {
+    const std::string& base_data = *base_;
+    const uint8_t* base = reinterpret_cast<const uint8_t*>(base_data.data());
+    const uint8_t* target = reinterpret_cast<const uint8_t*>(target_data.data());
+    size_t base_size = base_data.size();
+    size_t target_size = target_data.size();
+    constexpr uint32_t out_weight = delta_hash_out_weight();
+
+    std::string out;
+    append_delta_size(out, base_size);
+    append_delta_size(out, target_size);
+    std::string literal;
+
+    size_t pos = 0;
+    uint32_t hash = target_size >= kDeltaBlock ? delta_block_hash(target) : 0;
+
+    while (pos + kDeltaBlock <= target_size) {
+        size_t best_offset = 0;
+        size_t best_length = 0;
+
+        size_t chain = 0;
+        for (int32_t block = heads_[hash & mask_]; block >= 0 && chain < kDeltaMaxChain;
+             block = next_[block], ++chain) {
+            size_t offset = static_cast<size_t>(block) * kDeltaBlock;
+            if (std::memcmp(base + offset, target + pos, kDeltaBlock) != 0) {
+                continue;
+            }
+            size_t length = kDeltaBlock;
+            while (offset + length < base_size && pos + length < target_size &&
+                   base[offset + length] == target[pos + length]) {
+                ++length;
+            }
+            if (length > best_length) {
+                best_offset = offset;
+                best_length = length;
+            }
+        }
+
+        if (best_length > 0) {
+            // Grow the match backwards over literal bytes that also match
+            while (!literal.empty() && best_offset > 0 &&
+                   base[best_offset - 1] == static_cast<uint8_t>(literal.back())) {
+                literal.pop_back();
+                --best_offset;
+                --pos;
+                ++best_length;
+            }
+            flush_insert(out, literal);
+            append_copy(out, best_offset, best_length);
+            pos += best_length;
+            if (pos + kDeltaBlock <= target_size) {
+                hash = delta_block_hash(target + pos);
+            }
+        } else {
+            literal.push_back(static_cast<char>(target[pos]));
+            if (literal.size() == kDeltaMaxInsert) {
+                flush_insert(out, literal);
+            }
+            if (pos + kDeltaBlock < target_size) {
+                hash = (hash - target[pos] * out_weight) * kDeltaHashMul + target[pos + kDeltaBlock];
+            }
+            ++pos;
+        }
+
+        if (out.size() + literal.size() > max_size) {
+            return "";
+        }
+    }
+
+    // Tail shorter than a block
+    for (; pos < target_size; ++pos) {
+        literal.push_back(static_cast<char>(target[pos]));
+        if (literal.size() == kDeltaMaxInsert) {
+            flush_insert(out, literal);
+        }
+    }
+    flush_insert(out, literal);
+
+    if (out.size() > max_size) {
+        return "";
+    }
+    return out;
+}
+
 std::string Delta::encode(const std::string& base_data, const std::string& target_data) {
-    // Simplified delta encoding
-    return target_data;
+    return DeltaIndex(base_data).encode(target_data);
+}
+
+namespace {
+// Little-endian base-128 size as used in delta headers
+size_t read_delta_size(const std::string& delta, size_t& pos) {
+    size_t size = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        if (pos >= delta.size() || shift > 63) {
+            throw GitException("Corrupt delta header");
+        }
+        byte = static_cast<uint8_t>(delta[pos++]);
+        size |= static_cast<size_t>(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return size;
+}
 }
 
 std::string Delta::decode(const std::string& base_data, const std::string& delta_data) {
-    // Simplified delta decoding
-    return base_data + delta_data;
+    size_t pos = 0;
+    size_t base_size = read_delta_size(delta_data, pos);
+    size_t result_size = read_delta_size(delta_data, pos);
+    if (base_size != base_data.size()) {
+        throw GitException("Delta base size mismatch");
+    }
+
+    std::string result;
+    result.reserve(result_size);
+
+    while (pos < delta_data.size()) {
+        uint8_t cmd = static_cast<uint8_t>(delta_data[pos++]);
+        if (cmd & 0x80) {
+            // Copy from base: bits 0-3 select offset bytes, bits 4-6 size bytes
+            size_t copy_offset = 0;
+            size_t copy_size = 0;
+            for (int i = 0; i < 4; ++i) {
+                if (cmd & (1 << i)) {
+                    if (pos >= delta_data.size()) {
+                        throw GitException("Corrupt delta copy instruction");
+                    }
+                    copy_offset |= static_cast<size_t>(static_cast<uint8_t>(delta_data[pos++])) << (i * 8);
+                }
+            }
+            for (int i = 0; i < 3; ++i) {
+                if (cmd & (0x10 << i)) {
+                    if (pos >= delta_data.size()) {
+                        throw GitException("Corrupt delta copy instruction");
+                    }
+                    copy_size |= static_cast<size_t>(static_cast<uint8_t>(delta_data[pos++])) << (i * 8);
+                }
+            }
+            if (copy_size == 0) {
+                copy_size = 0x10000;
+            }
+            if (copy_offset > base_data.size() || copy_size > base_data.size() - copy_offset ||
+                copy_size > result_size - result.size()) {
+                throw GitException("Delta copy out of range");
+            }
+            result.append(base_data, copy_offset, copy_size);
+        } else if (cmd != 0) {
+            // Insert the next `cmd` literal bytes
+            if (cmd > delta_data.size() - pos || cmd > result_size - result.size()) {
+                throw GitException("Delta insert out of range");
+            }
+            result.append(delta_data, pos, cmd);
+            pos += cmd;
+        } else {
+            throw GitException("Invalid delta opcode 0");
+        }
+    }
+
+    if (result.size() != result_size) {
+        throw GitException("Delta result size mismatch");
+    }
+    return result;
 }
 
 // Packfile utilities
 namespace packfile {
 
-bool create_packfile(const std::string& packfile_path,
+namespace {
+// Gives tree entries' names to the objects they point at, so the writer can
+// sort same-named files next to each other
+void collect_name_hints(const RawObject& tree, std::unordered_map<ObjectId, std::string>& names) {
+    const std::string& data = tree.data;
+    size_t pos = 0;
+    while (pos < data.size()) {
+        size_t space = data.find(' ', pos);
+        size_t nul = data.find('\0', space == std::string::npos ? pos : space);
+        if (space == std::string::npos || nul == std::string::npos || nul + 1 + ObjectId::kRawSize > data.size()) {
+            return;
+        }
+        ObjectId id = ObjectId::from_raw(reinterpret_cast<const uint8_t*>(data.data()) + nul + 1);
+        names.emplace(id, data.substr(space + 1, nul - space - 1));
+        pos = nul + 1 + ObjectId::kRawSize;
+    }
+}
+
+std::vector<fs::path> list_packfiles(const std::string& pack_dir) {
+    std::vector<fs::path> packs;
+    if (fs::exists(pack_dir)) {
+        for (const auto& entry : fs::directory_iterator(pack_dir)) {
+            fs::path index_path = entry.path();
+            index_path.replace_extension(".idx");
+            if (entry.path().extension() == ".pack" && fs::exists(index_path)) {
+                packs.push_back(entry.path());
+            }
+        }
+    }
+    std::sort(packs.begin(), packs.end());
+    return packs;
+}
+}
+
+std::string encode_pack_index(std::vector<PackIndexEntry> entries, const ObjectId& pack_checksum) {
+    std::sort(entries.begin(), entries.end(),
+              [](const PackIndexEntry& a, const PackIndexEntry& b) { return a.sha1 < b.sha1; });
+
+    std::string idx(packfile_format::IDX_SIGNATURE, 4);
+    store_be32(idx, 2);  // Index version 2
+
+    // Cumulative count of names whose first byte is <= i
+    uint32_t counts[256] = {};
+    for (const auto& entry : entries) {
+        counts[entry.sha1.first_byte()]++;
+    }
+    uint32_t running = 0;
+    for (uint32_t count : counts) {
+        running += count;
+        store_be32(idx, running);
+    }
+
+    for (const auto& entry : entries) {
+        idx.append(reinterpret_cast<const char*>(entry.sha1.data()), ObjectId::kRawSize);
+    }
+    for (const auto& entry : entries) {
+        store_be32(idx, entry.crc32);
+    }
+
+    // Offsets past 2^31 - 1 live in a trailing 64-bit table
+    std::string large_offsets;
+    uint32_t large_count = 0;
+    for (const auto& entry : entries) {
+        if (entry.offset < 0x80000000u) {
+            store_be32(idx, static_cast<uint32_t>(entry.offset));
+        } else {
+            store_be32(idx, 0x80000000u | large_count++);
+            store_be64(large_offsets, static_cast<uint64_t>(entry.offset));
+        }
+    }
+    idx += large_offsets;
+
+    idx.append(reinterpret_cast<const char*>(pack_checksum.data()), ObjectId::kRawSize);
+    auto idx_checksum = SHA1::hash_raw(reinterpret_cast<const uint8_t*>(idx.data()), idx.size());
+    idx.append(reinterpret_cast<const char*>(idx_checksum.data()), idx_checksum.size());
+
+    return idx;
+}
+
+std::string encode_reverse_index(const std::vector<PackIndexEntry>& entries, const ObjectId& pack_checksum) {
+    // Index positions are name order; the table lists them in pack order
+    std::vector<uint32_t> by_name(entries.size());
+    for (uint32_t i = 0; i < by_name.size(); ++i) {
+        by_name[i] = i;
+    }
+    std::sort(by_name.begin(), by_name.end(),
+              [&](uint32_t a, uint32_t b) { return entries[a].sha1 < entries[b].sha1; });
+    std::vector<std::pair<size_t, uint32_t>> by_offset;
+    by_offset.reserve(entries.size());
+    for (uint32_t position = 0; position < by_name.size(); ++position) {
+        by_offset.emplace_back(entries[by_name[position]].offset, position);
+    }
+    std::sort(by_offset.begin(), by_offset.end());
+
+    std::string rev = "RIDX";
+    store_be32(rev, 1);  // Format version
+    store_be32(rev, 1);  // SHA-1
+    for (const auto& entry : by_offset) {
+        store_be32(rev, entry.second);
+    }
+    rev.append(reinterpret_cast<const char*>(pack_checksum.data()), ObjectId::kRawSize);
+    auto rev_checksum = SHA1::hash_raw(reinterpret_cast<const uint8_t*>(rev.data()), rev.size());
+    rev.append(reinterpret_cast<const char*>(rev_checksum.data()), rev_checksum.size());
+    return rev;
+}
+
+bool create_packfile(Repository& repo,
+                    const std::string& packfile_path,
                     const std::string& index_path,
-                    const std::vector<std::string>& object_shas) {
+                    const std::vector<ObjectId>& object_shas,
+                    const PackWriteOptions& options) {
 
-    PackWriter writer(packfile_path, index_path);
+    std::vector<std::pair<ObjectId, RawObject>> objects;
+    objects.reserve(object_shas.size());
 
-    // This is a placeholder implementation
-    // In a real implementation, this would:
-    // 1. Load the objects from the object database
-    // 2. Compute deltas between similar objects
-    // 3. Write them to the packfile
+    for (const auto& id : object_shas) {
+        auto raw = repo.objects().read_raw(id);
+        if (!raw) {
+            throw GitException("Object not found: " + id.hex());
+        }
+        objects.emplace_back(id, std::move(*raw));
+    }
+
+    std::unordered_map<ObjectId, std::string> names;
+    for (const auto& object : objects) {
+        if (object.second.type == ObjectType::Tree) {
+            collect_name_hints(object.second, names);
+        }
+    }
+
+    PackWriter writer(packfile_path, index_path, options);
+    for (auto& object : objects) {
+        auto name = names.find(object.first);
+        writer.add_object(object.first, object.second.type, std::move(object.second.data),
+                          name != names.end() ? name->second : "");
+    }
 
     return writer.finalize();
 }
 
+std::string write_pack(Repository& repo, const std::vector<ObjectId>& object_shas,
+                       const PackWriteOptions& options) {
+    TraceRegion region("pack", "write");
+    std::string pack_dir = repo.git_dir() + "/objects/pack";
+    fs::create_directories(pack_dir);
+
+    // Write under a temporary name, then rename to the content-addressed one
+    std::string tmp_base = pack_dir + "/tmp_pack_" + std::to_string(::getpid());
+    std::string tmp_pack = tmp_base + ".pack";
+    std::string tmp_idx = tmp_base + ".idx";
+
+    ObjectId checksum;
+    try {
+        create_packfile(repo, tmp_pack, tmp_idx, object_shas, options);
+        PackIndex index(tmp_idx);
+        checksum = ObjectId::from_raw(index.pack_checksum());
+    } catch (...) {
+        fs::remove(tmp_pack);
+        fs::remove(tmp_idx);
+        throw;
+    }
+
+    std::string final_base = pack_dir + "/pack-" + checksum.hex();
+    fs::rename(tmp_pack, final_base + ".pack");
+    fs::rename(tmp_idx, final_base + ".idx");
+    repo.objects().reload_packs();
+    return final_base + ".pack";
+}
+
 bool verify_packfile(const std::string& packfile_path,
                     const std::string& index_path) {
     try {
@@ -439,29 +1186,82 @@ std::unique_ptr<Object> extract_object(const std::string& packfile_path,
 }
 
 bool garbage_collect(Repository& repo) {
-    // Simplified garbage collection
-    // In a real implementation, this would:
-    // 1. Find all reachable objects
-    // 2. Identify unreachable objects
-    // 3. Remove unreachable objects
-    return true;
+    // One pack with reachability bitmaps, so later counting and pack
+    // generation are bitmap operations. Unreachable objects are kept:
+    // nothing here knows how long they have been unreachable.
+    return repack_repository(repo, {}, true);
 }
 
-bool repack_repository(Repository& repo) {
-    // Simplified repack
-    // In a real implementation, this would:
-    // 1. Read all objects
-    // 2. Create new packfiles with better compression
-    // 3. Update references
+bool repack_repository(Repository& repo, const PackWriteOptions& options, bool write_bitmap) {
+    // Everything loose plus everything already packed goes into one pack.
+    // Loose objects are kept: the object database still reads them directly.
+    std::string pack_dir = repo.git_dir() + "/objects/pack";
+    auto old_packs = list_packfiles(pack_dir);
+
+    std::vector<ObjectId> ids = repo.objects().list_loose_objects();
+    bool promisor = false;
+    for (const auto& pack_path : old_packs) {
+        fs::path idx_path = pack_path;
+        promisor = promisor || fs::exists(idx_path.replace_extension(".promisor"));
+        idx_path.replace_extension(".idx");
+        PackIndex index(idx_path.string());
+        for (size_t i = 0; i < index.get_object_count(); ++i) {
+            ids.push_back(index.object_id_at(i));
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    if (ids.empty()) {
+        return true;
+    }
+
+    fs::path new_pack = write_pack(repo, ids, options);
+    // The pack holds every object, so it is closed under reachability,
+    // unless a partial clone's filter left some out. Then the new pack
+    // takes over the promise instead, and gets no bitmap.
+    if (promisor) {
+        fs::path marker = new_pack;
+        std::ofstream(marker.replace_extension(".promisor"));
+    } else if (write_bitmap) {
+        write_pack_bitmap(repo.objects(), new_pack.string(), repo.refs().commit_tips(repo.objects()));
+    }
+    for (const auto& pack_path : old_packs) {
+        if (pack_path != new_pack) {
+            fs::path path = pack_path;
+            fs::remove(path);
+            fs::remove(path.replace_extension(".idx"));
+            fs::remove(path.replace_extension(".bitmap"));
+            fs::remove(path.replace_extension(".rev"));
+            fs::remove(path.replace_extension(".promisor"));
+        }
+    }
+    repo.objects().reload_packs();
     return true;
 }
 
 PackStats get_packfile_stats(Repository& repo) {
     PackStats stats;
-    stats.object_count = 0;
-    stats.packfile_size = 0;
-    stats.index_size = 0;
-    stats.compression_ratio = 1.0;
+    std::string pack_dir = repo.git_dir() + "/objects/pack";
+    if (!fs::exists(pack_dir)) {
+        return stats;
+    }
+
+    for (const auto& entry : fs::directory_iterator(pack_dir)) {
+        if (entry.path().extension() != ".pack") {
+            continue;
+        }
+        fs::path index_path = entry.path();
+        index_path.replace_extension(".idx");
+        if (!fs::exists(index_path)) {
+            continue;
+        }
+
+        PackReader reader(entry.path().string(), index_path.string());
+        stats.object_count += reader.get_object_count();
+        stats.packfile_size += fs::file_size(entry.path());
+        stats.index_size += fs::file_size(index_path);
+        stats.packfiles.push_back(entry.path().string());
+    }
     return stats;
 }
 
@@ -0,0 +1,238 @@
+#include "dgit/packed_refs.hpp"
+#include "dgit/sha1.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace dgit {
+
+namespace {
+constexpr std::string_view kHeaderPrefix = "# pack-refs with:";
+constexpr size_t kRecordPrefix = ObjectId::kHexSize + 1;   // "<hex> "
+
+bool starts_with(std::string_view s, std::string_view prefix) {
+    return s.size() >= prefix.size() && s.compare(0, prefix.size(), prefix) == 0;
+}
+}
+
+PackedRefs::PackedRefs(const std::string& path) : path_(path) {
+    // Identity first: if the file is replaced before it is mapped, the next
+    // stale() check sees the change and the snapshot is read again
+    struct stat st;
+    if (::stat(path.c_str(), &st) != 0) {
+        return;
+    }
+    exists_ = true;
+    inode_ = static_cast<uint64_t>(st.st_ino);
+    size_ = static_cast<uint64_t>(st.st_size);
+    mtime_ns_ = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+
+    file_ = MappedFile(path);
+    file_.advise_random();
+    std::string_view data(reinterpret_cast<const char*>(file_.data()), file_.size());
+    if (!data.empty() && data[0] == '#') {
+        size_t end = line_end(0);
+        std::string_view header = data.substr(0, end);
+        if (!starts_with(header, kHeaderPrefix)) {
+            throw GitException("Malformed packed-refs header: " + path);
+        }
+        std::istringstream traits(std::string(header.substr(kHeaderPrefix.size())));
+        std::string trait;
+        while (traits >> trait) {
+            if (trait == "sorted") {
+                sorted_ = true;
+            } else if (trait == "fully-peeled") {
+                fully_peeled_ = true;
+            }
+        }
+        body_ = std::min(end + 1, data.size());
+    }
+
+    if (!sorted_) {
+        for (size_t pos = body_; pos < data.size(); pos = record_end(pos)) {
+            unsorted_.push_back(parse_record(pos));
+        }
+        std::sort(unsorted_.begin(), unsorted_.end(),
+                  [](const RefRecord& a, const RefRecord& b) { return a.name < b.name; });
+    }
+}
+
+size_t PackedRefs::line_end(size_t pos) const {
+    const auto* data = file_.data();
+    const void* newline = std::memchr(data + pos, '\n', file_.size() - pos);
+    return newline ? static_cast<size_t>(static_cast<const uint8_t*>(newline) - data) : file_.size();
+}
+
+size_t PackedRefs::record_start(size_t pos) const {
+    const auto* data = file_.data();
+    while (pos > body_ && data[pos - 1] != '\n') {
+        --pos;
+    }
+    // A peeled line belongs to the ref above it
+    if (data[pos] == '^' && pos > body_) {
+        --pos;
+        while (pos > body_ && data[pos - 1] != '\n') {
+            --pos;
+        }
+    }
+    return pos;
+}
+
+size_t PackedRefs::record_end(size_t pos) const {
+    size_t end = std::min(line_end(pos) + 1, file_.size());
+    if (end < file_.size() && file_.data()[end] == '^') {
+        end = std::min(line_end(end) + 1, file_.size());
+    }
+    return end;
+}
+
+std::string_view PackedRefs::record_name(size_t pos) const {
+    size_t end = line_end(pos);
+    const char* line = reinterpret_cast<const char*>(file_.data()) + pos;
+    if (end - pos <= kRecordPrefix || line[ObjectId::kHexSize] != ' ') {
+        throw GitException("Malformed packed-refs line in " + path_);
+    }
+    return std::string_view(line + kRecordPrefix, end - pos - kRecordPrefix);
+}
+
+RefRecord PackedRefs::parse_record(size_t pos) const {
+    const char* data = reinterpret_cast<const char*>(file_.data());
+    RefRecord record;
+    record.name = std::string(record_name(pos));
+    auto id = ObjectId::parse_hex(std::string_view(data + pos, ObjectId::kHexSize));
+    if (!id) {
+        throw GitException("Malformed packed-refs line in " + path_);
+    }
+    record.id = *id;
+
+    size_t next = line_end(pos) + 1;
+    if (next < file_.size() && data[next] == '^') {
+        auto peeled = ObjectId::parse_hex(std::string_view(data + next + 1, line_end(next) - next - 1));
+        if (!peeled) {
+            throw GitException("Malformed peeled line in " + path_);
+        }
+        record.peeled = *peeled;
+    }
+    return record;
+}
+
+size_t PackedRefs::lower_bound(std::string_view name) const {
+    // Records before `low` sort before `name`; those from `high` on do not
+    size_t low = body_;
+    size_t high = file_.size();
+    while (low < high) {
+        size_t mid = record_start(low + (high - low) / 2);
+        if (record_name(mid) < name) {
+            low = record_end(mid);
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+std::optional<RefRecord> PackedRefs::find(std::string_view name) const {
+    if (!sorted_) {
+        auto it = std::lower_bound(unsorted_.begin(), unsorted_.end(), name,
+                                   [](const RefRecord& record, std::string_view n) { return record.name < n; });
+        if (it != unsorted_.end() && it->name == name) {
+            return *it;
+        }
+        return std::nullopt;
+    }
+
+    size_t pos = lower_bound(name);
+    if (pos < file_.size() && record_name(pos) == name) {
+        return parse_record(pos);
+    }
+    return std::nullopt;
+}
+
+void PackedRefs::for_each(std::string_view prefix, const std::function<void(const RefRecord&)>& fn) const {
+    if (!sorted_) {
+        auto it = std::lower_bound(unsorted_.begin(), unsorted_.end(), prefix,
+                                   [](const RefRecord& record, std::string_view p) { return record.name < p; });
+        for (; it != unsorted_.end() && starts_with(it->name, prefix); ++it) {
+            fn(*it);
+        }
+        return;
+    }
+
+    for (size_t pos = lower_bound(prefix); pos < file_.size(); pos = record_end(pos)) {
+        if (!starts_with(record_name(pos), prefix)) {
+            break;
+        }
+        fn(parse_record(pos));
+    }
+}
+
+bool PackedRefs::stale() const {
+    struct stat st;
+    if (::stat(path_.c_str(), &st) != 0) {
+        return exists_;
+    }
+    int64_t mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return !exists_ || static_cast<uint64_t>(st.st_ino) != inode_ || static_cast<uint64_t>(st.st_size) != size_ ||
+           mtime_ns != mtime_ns_;
+}
+
+PackedRefsLock::PackedRefsLock(const std::string& path) : path_(path), lock_path_(path + ".lock") {
+    fd_ = ::open(lock_path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd_ < 0) {
+        if (errno == EEXIST) {
+            throw GitException("Unable to create '" + lock_path_ + "': File exists");
+        }
+        throw GitException("Cannot lock packed refs: " + lock_path_);
+    }
+}
+
+PackedRefsLock::~PackedRefsLock() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        ::unlink(lock_path_.c_str());
+    }
+}
+
+void PackedRefsLock::commit(std::vector<RefRecord> refs) {
+    std::sort(refs.begin(), refs.end(), [](const RefRecord& a, const RefRecord& b) { return a.name < b.name; });
+
+    std::string out = "# pack-refs with: peeled fully-peeled sorted \n";
+    char hex[ObjectId::kHexSize];
+    for (const auto& ref : refs) {
+        ref.id.write_hex(hex);
+        out.append(hex, sizeof(hex));
+        out.push_back(' ');
+        out += ref.name;
+        out.push_back('\n');
+        if (ref.peeled) {
+            ref.peeled->write_hex(hex);
+            out.push_back('^');
+            out.append(hex, sizeof(hex));
+            out.push_back('\n');
+        }
+    }
+
+    for (size_t written = 0; written < out.size();) {
+        ssize_t n = ::write(fd_, out.data() + written, out.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw GitException("Cannot write packed refs: " + lock_path_);
+        }
+        written += static_cast<size_t>(n);
+    }
+
+    int fd = fd_;
+    fd_ = -1;
+    if (::close(fd) != 0 || ::rename(lock_path_.c_str(), path_.c_str()) != 0) {
+        ::unlink(lock_path_.c_str());
+        throw GitException("Cannot write packed refs: " + path_);
+    }
+}
+
+} // namespace dgit
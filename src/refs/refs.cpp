@@ -1,66 +1,111 @@
 #include "dgit/refs.hpp"
+#include "dgit/object_database.hpp"
+#include "dgit/object_view.hpp"
+#include "dgit/packed_refs.hpp"
+#include "dgit/reftable.hpp"
+#include <algorithm>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
-#include <regex>
+#include <iterator>
+#include <map>
 
 namespace fs = std::filesystem;
 namespace dgit {
 
-Refs::Refs(const std::string& git_dir)
+namespace {
+bool starts_with(const std::string& s, const std::string& prefix) {
+    return s.compare(0, prefix.size(), prefix) == 0;
+}
+
+// Every loose ref file under `dir` ("refs/tags/"), by ref name
+void for_each_loose_file(const std::string& git_dir, const std::string& dir,
+                         const std::function<void(const RefName& name, const std::string& path)>& fn) {
+    std::error_code ec;
+    fs::path root = fs::path(git_dir) / dir;
+    for (fs::recursive_directory_iterator it(root, ec), end; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) {
+            continue;
+        }
+        std::string name = dir + it->path().lexically_relative(root).generic_string();
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".lock") == 0) {
+            continue;
+        }
+        fn(name, it->path().string());
+    }
+}
+
+// What an annotated tag, or a chain of them, finally points at
+std::optional<ObjectId> peel_tag(ObjectDatabase& objects, const ObjectId& id) {
+    std::optional<ObjectId> peeled;
+    auto raw = objects.read_raw(id);
+    while (raw && raw->type == ObjectType::Tag) {
+        peeled = TagView(raw->data).object_id();
+        raw = objects.read_raw(*peeled);
+    }
+    return peeled;
+}
+
+int64_t now_seconds() {
+    auto now = std::chrono::system_clock::now();
+    return std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+}
+}
+
+Refs::Refs(const std::string& git_dir, RefStorage storage)
     : git_dir_(git_dir), refs_dir_(git_dir + "/refs"),
       heads_dir_(refs_dir_ + "/heads"), tags_dir_(refs_dir_ + "/tags"),
-      remotes_dir_(refs_dir_ + "/remotes") {
+      remotes_dir_(refs_dir_ + "/remotes"), packed_refs_path_(git_dir + "/packed-refs") {
 
     // Create refs directory structure
     fs::create_directories(heads_dir_);
     fs::create_directories(tags_dir_);
     fs::create_directories(remotes_dir_);
 
+    // HEAD stays a file either way, so tools that only read HEAD still work
+    if (storage == RefStorage::Reftable) {
+        reftable_ = std::make_unique<ReftableStack>(git_dir + "/reftable");
+    }
+
     // Load reference cache
     load_ref_cache();
 }
 
-void Refs::create_ref(const RefName& name, const ObjectId& target, bool symbolic) {
-    std::string path = get_ref_path(name);
-
-    if (symbolic) {
-        // Create symbolic ref
-        std::string target_path = get_ref_path(target);
-        if (!fs::exists(target_path)) {
-            throw GitException("Symbolic ref target does not exist: " + target);
-        }
-
-        std::ofstream file(path);
-        if (!file) {
-            throw GitException("Cannot create ref: " + path);
-        }
-
-        file << "ref: " << target << "\n";
-    } else {
-        // Create direct ref
-        write_ref_file(path, target);
+void Refs::create_ref(const RefName& name, const ObjectId& target) {
+    if (reftable_ && full_name(name) != "HEAD") {
+        update_refs({RefUpdate{name, target, std::nullopt}});
+        return;
     }
 
+    std::string path = get_ref_path(name);
+    write_ref_file(path, target);
+
     // Update cache
     ref_cache_[name] = target;
 
     // Log the change
-    log_ref_change(name, "", target);
+    log_ref_change(name, ObjectId(), target);
 }
 
 void Refs::update_ref(const RefName& name, const ObjectId& target) {
     std::string path = get_ref_path(name);
 
-    if (!fs::exists(path)) {
+    // A packed ref is updated by a loose file that overrides it
+    if (!ref_exists(name)) {
         throw GitException("Ref does not exist: " + name);
     }
+    if (reftable_ && full_name(name) != "HEAD") {
+        update_refs({RefUpdate{name, target, std::nullopt}});
+        return;
+    }
 
     ObjectId old_target;
     try {
         old_target = resolve_ref(name);
     } catch (...) {
-        old_target = ""; // allow creating first commit when ref is empty/unresolved
+        old_target = ObjectId(); // allow creating first commit when ref is empty/unresolved
     }
     write_ref_file(path, target);
 
@@ -73,19 +118,113 @@ void Refs::update_ref(const RefName& name, const ObjectId& target) {
 
 void Refs::delete_ref(const RefName& name) {
     std::string path = get_ref_path(name);
+    RefName full = full_name(name);
+    if (reftable_ && full != "HEAD") {
+        if (!ref_exists(name)) {
+            throw GitException("Ref does not exist: " + name);
+        }
+        update_refs({RefUpdate{name, std::nullopt, std::nullopt}});
+        return;
+    }
+    bool loose = fs::exists(path);
+    bool packed = full != "HEAD" && packed_refs()->find(full).has_value();
 
-    if (!fs::exists(path)) {
+    if (!loose && !packed) {
         throw GitException("Ref does not exist: " + name);
     }
 
     ObjectId old_target = resolve_ref(name);
-    fs::remove(path);
+
+    // The packed entry goes first, so the old value never shows through
+    // once the loose file is gone
+    if (packed) {
+        PackedRefsLock lock(packed_refs_path_);
+        std::vector<RefRecord> kept;
+        PackedRefs(packed_refs_path_).for_each("", [&](const RefRecord& record) {
+            if (record.name != full) {
+                kept.push_back(record);
+            }
+        });
+        lock.commit(std::move(kept));
+        packed_.reset();
+    }
+    if (loose) {
+        fs::remove(path);
+    }
 
     // Remove from cache
     ref_cache_.erase(name);
 
     // Log the change
-    log_ref_change(name, old_target, "");
+    log_ref_change(name, old_target, ObjectId());
+}
+
+void Refs::update_refs(const std::vector<RefUpdate>& updates) {
+    if (!reftable_) {
+        // Loose files cannot change together; checking every expected value
+        // before writing any at least refuses a batch that is already stale
+        for (const auto& update : updates) {
+            if (update.old_id && lookup(update.name).value_or(ObjectId()) != *update.old_id) {
+                throw GitException("Ref changed since it was read: " + update.name);
+            }
+        }
+        for (const auto& update : updates) {
+            if (!update.new_id) {
+                delete_ref(update.name);
+            } else if (ref_exists(update.name)) {
+                update_ref(update.name, *update.new_id);
+            } else {
+                create_ref(update.name, *update.new_id);
+            }
+        }
+        return;
+    }
+
+    // One table holds every ref and its reflog entry, checked against the
+    // stack as it is while tables.list is locked
+    reftable_->transact([&](uint64_t update_index, std::vector<ReftableRef>& refs, std::vector<ReftableLog>& logs) {
+        int64_t timestamp = now_seconds();
+        for (const auto& update : updates) {
+            RefName full = full_name(update.name);
+            if (full == "HEAD") {
+                throw GitException("HEAD cannot be updated in a reftable transaction");
+            }
+            std::optional<ObjectId> current = lookup(full);
+            if (update.old_id && current.value_or(ObjectId()) != *update.old_id) {
+                throw GitException("Ref changed since it was read: " + update.name);
+            }
+
+            ReftableRef ref;
+            ref.name = full;
+            ref.update_index = update_index;
+            if (update.new_id) {
+                ref.type = ReftableRef::Type::Value;
+                ref.value = *update.new_id;
+            } else {
+                ref.type = ReftableRef::Type::Deletion;
+            }
+            refs.push_back(std::move(ref));
+
+            ReftableLog log;
+            log.name = full;
+            log.update_index = update_index;
+            log.old_id = current.value_or(ObjectId());
+            log.new_id = update.new_id.value_or(ObjectId());
+            log.committer_name = "user";
+            log.email = "user@example.com";
+            log.time = static_cast<uint64_t>(timestamp);
+            log.message = "ref update";
+            logs.push_back(std::move(log));
+        }
+    });
+
+    for (const auto& update : updates) {
+        if (update.new_id) {
+            ref_cache_[update.name] = *update.new_id;
+        } else {
+            ref_cache_.erase(update.name);
+        }
+    }
 }
 
 std::optional<ObjectId> Refs::read_ref(const RefName& name) {
@@ -94,17 +233,20 @@ std::optional<ObjectId> Refs::read_ref(const RefName& name) {
         return it->second;
     }
 
-    std::string path = get_ref_path(name);
-    if (!fs::exists(path)) {
-        return std::nullopt;
-    }
-
-    return read_ref_file(path);
+    return lookup(name);
 }
 
 bool Refs::ref_exists(const RefName& name) {
+    RefName full = full_name(name);
+    if (reftable_ && full != "HEAD") {
+        return reftable_->read(full).has_value();
+    }
+
     std::string path = get_ref_path(name);
-    return fs::exists(path);
+    if (fs::exists(path)) {
+        return true;
+    }
+    return full != "HEAD" && packed_refs()->find(full).has_value();
 }
 
 ObjectId Refs::get_head() {
@@ -122,7 +264,7 @@ ObjectId Refs::get_head() {
         RefName branch = line.substr(5);
         return resolve_ref(branch);
     } else {
-        return line; // Detached HEAD
+        return ObjectId::from_hex(line); // Detached HEAD
     }
 }
 
@@ -173,57 +315,195 @@ std::optional<RefName> Refs::get_head_branch() {
 
 std::vector<RefName> Refs::list_branches() {
     std::vector<RefName> branches;
-
-    if (fs::exists(heads_dir_)) {
-        for (const auto& entry : fs::directory_iterator(heads_dir_)) {
-            if (entry.is_regular_file()) {
-                branches.push_back("refs/heads/" + entry.path().filename().string());
-            }
-        }
+    for (const auto& record : list_refs("refs/heads/")) {
+        branches.push_back(record.name);
     }
-
     return branches;
 }
 
 std::vector<RefName> Refs::list_remote_branches() {
     std::vector<RefName> branches;
-
-    if (fs::exists(remotes_dir_)) {
-        for (const auto& remote_dir : fs::directory_iterator(remotes_dir_)) {
-            if (remote_dir.is_directory()) {
-                std::string remote_name = remote_dir.path().filename().string();
-                for (const auto& branch_file : fs::directory_iterator(remote_dir)) {
-                    if (branch_file.is_regular_file()) {
-                        std::string branch_name = branch_file.path().filename().string();
-                        branches.push_back("refs/remotes/" + remote_name + "/" + branch_name);
-                    }
-                }
-            }
-        }
+    for (const auto& record : list_refs("refs/remotes/")) {
+        branches.push_back(record.name);
     }
-
     return branches;
 }
 
 std::vector<RefName> Refs::list_tags() {
     std::vector<RefName> tags;
+    for (const auto& record : list_refs("refs/tags/")) {
+        tags.push_back(record.name);
+    }
+    return tags;
+}
 
-    if (fs::exists(tags_dir_)) {
-        for (const auto& entry : fs::directory_iterator(tags_dir_)) {
-            if (entry.is_regular_file()) {
-                tags.push_back("refs/tags/" + entry.path().filename().string());
+std::vector<RefRecord> Refs::list_refs(const std::string& prefix) {
+    if (reftable_) {
+        std::vector<RefRecord> refs;
+        for (auto& ref : reftable_->list(prefix)) {
+            RefRecord record{ref.name, ref.value, std::nullopt};
+            if (ref.type == ReftableRef::Type::Peeled) {
+                record.peeled = ref.peeled;
+            } else if (ref.type == ReftableRef::Type::Symref) {
+                record.id = lookup(ref.target).value_or(ObjectId());
             }
+            refs.push_back(std::move(record));
         }
+        return refs;
     }
 
-    return tags;
+    std::vector<RefRecord> packed;
+    packed_refs()->for_each(prefix, [&](const RefRecord& record) { packed.push_back(record); });
+
+    // Only the loose files under the prefix's directory are read; after
+    // pack-refs those are just the refs changed since
+    std::string dir = starts_with(prefix, "refs/") ? prefix.substr(0, prefix.rfind('/') + 1) : "refs/";
+    std::vector<RefRecord> loose;
+    for_each_loose_file(git_dir_, dir, [&](const RefName& name, const std::string& path) {
+        if (starts_with(name, prefix)) {
+            loose.push_back({name, read_ref_file(path).value_or(ObjectId()), std::nullopt});
+        }
+    });
+    std::sort(loose.begin(), loose.end(), [](const RefRecord& a, const RefRecord& b) { return a.name < b.name; });
+
+    // Both are sorted by name; a loose file overrides its packed entry
+    std::vector<RefRecord> refs;
+    refs.reserve(packed.size() + loose.size());
+    size_t p = 0;
+    for (auto& record : loose) {
+        while (p < packed.size() && packed[p].name < record.name) {
+            refs.push_back(std::move(packed[p++]));
+        }
+        if (p < packed.size() && packed[p].name == record.name) {
+            if (packed[p].id == record.id) {
+                record.peeled = packed[p].peeled;
+            }
+            ++p;
+        }
+        refs.push_back(std::move(record));
+    }
+    for (; p < packed.size(); ++p) {
+        refs.push_back(std::move(packed[p]));
+    }
+    return refs;
+}
+
+size_t Refs::pack_refs(ObjectDatabase& objects, bool all) {
+    // A reftable is packed already; the nearest thing is one table
+    if (reftable_) {
+        reftable_->compact_all();
+        return reftable_->list("").size();
+    }
+
+    // Held while the refs are read, so a concurrent pack-refs or packed
+    // delete cannot be lost
+    PackedRefsLock lock(packed_refs_path_);
+
+    PackedRefs current(packed_refs_path_);
+    std::map<RefName, RefRecord> refs;
+    current.for_each("", [&](const RefRecord& record) { refs[record.name] = record; });
+
+    // Tags by default, as git does; symbolic and unborn refs stay loose
+    std::vector<std::pair<std::string, RefRecord>> packed_loose;
+    for_each_loose_file(git_dir_, "refs/", [&](const RefName& name, const std::string& path) {
+        if (!all && !starts_with(name, "refs/tags/")) {
+            return;
+        }
+        std::ifstream file(path);
+        std::string line;
+        std::getline(file, line);
+        auto id = ObjectId::parse_hex(line);
+        if (!id) {
+            return;
+        }
+
+        RefRecord record{name, *id, std::nullopt};
+        auto it = refs.find(name);
+        if (it != refs.end() && it->second.id == *id && current.fully_peeled()) {
+            record.peeled = it->second.peeled;
+        } else {
+            record.peeled = peel_tag(objects, *id);
+        }
+        refs[name] = record;
+        packed_loose.emplace_back(path, std::move(record));
+    });
+
+    std::vector<RefRecord> records;
+    records.reserve(refs.size());
+    for (auto& entry : refs) {
+        records.push_back(std::move(entry.second));
+    }
+    lock.commit(std::move(records));
+    packed_.reset();
+
+    // The loose files now repeat packed values, unless one changed meanwhile
+    for (const auto& [path, record] : packed_loose) {
+        auto id = read_ref_file(path);
+        if (!id || *id != record.id) {
+            continue;
+        }
+        std::error_code ec;
+        fs::remove(path, ec);
+        // Empty namespace directories go too; refs/heads and friends stay
+        auto depth = [this](const fs::path& dir) {
+            fs::path relative = dir.lexically_relative(refs_dir_);
+            return std::distance(relative.begin(), relative.end());
+        };
+        fs::path dir = fs::path(path).parent_path();
+        while (depth(dir) > 1 && fs::is_empty(dir, ec)) {
+            fs::remove(dir, ec);
+            dir = dir.parent_path();
+        }
+    }
+    return packed_loose.size();
 }
 
 void Refs::create_symbolic_ref(const RefName& name, const RefName& target) {
-    create_ref(name, target, true);
+    std::string path = get_ref_path(name);
+    if (!ref_exists(target)) {
+        throw GitException("Symbolic ref target does not exist: " + target);
+    }
+
+    RefName full = full_name(name);
+    if (reftable_ && full != "HEAD") {
+        reftable_->transact([&](uint64_t update_index, std::vector<ReftableRef>& refs, std::vector<ReftableLog>&) {
+            ReftableRef ref;
+            ref.name = full;
+            ref.type = ReftableRef::Type::Symref;
+            ref.update_index = update_index;
+            ref.target = full_name(target);
+            refs.push_back(std::move(ref));
+        });
+        ref_cache_.erase(name);
+        return;
+    }
+
+    std::ofstream file(path);
+    if (!file) {
+        throw GitException("Cannot create ref: " + path);
+    }
+
+    file << "ref: " << target << "\n";
+
+    // Cache what the symbolic ref currently points at
+    auto resolved = lookup(target);
+    if (resolved) {
+        ref_cache_[name] = *resolved;
+    } else {
+        ref_cache_.erase(name);
+    }
 }
 
 std::optional<RefName> Refs::read_symbolic_ref(const RefName& name) {
+    RefName full = full_name(name);
+    if (reftable_ && full != "HEAD") {
+        auto ref = reftable_->read(full);
+        if (ref && ref->type == ReftableRef::Type::Symref) {
+            return ref->target;
+        }
+        return std::nullopt;
+    }
+
     std::string path = get_ref_path(name);
 
     if (!fs::exists(path)) {
@@ -245,18 +525,17 @@ std::optional<RefName> Refs::read_symbolic_ref(const RefName& name) {
     return std::nullopt;
 }
 
-std::string Refs::resolve_ref(const RefName& name) {
+ObjectId Refs::resolve_ref(const RefName& name) {
     auto cached = ref_cache_.find(name);
     if (cached != ref_cache_.end()) {
         return cached->second;
     }
 
-    std::string path = get_ref_path(name);
-    if (!fs::exists(path)) {
+    if (!ref_exists(name)) {
         throw GitException("Ref not found: " + name);
     }
 
-    auto target = read_ref_file(path);
+    auto target = lookup(name);
     if (!target) {
         throw GitException("Cannot resolve ref: " + name);
     }
@@ -284,13 +563,63 @@ std::string Refs::get_ref_path(const RefName& name) const {
     throw GitException("Invalid ref name: " + name);
 }
 
+RefName Refs::full_name(const RefName& name) const {
+    if (name == "HEAD" || name.substr(0, 5) == "refs/") {
+        return name;
+    }
+    if (name.find('/') == std::string::npos) {
+        return "refs/heads/" + name;
+    }
+    throw GitException("Invalid ref name: " + name);
+}
+
+std::optional<ObjectId> Refs::lookup(const RefName& name) {
+    RefName full = full_name(name);
+    if (reftable_ && full != "HEAD") {
+        auto ref = reftable_->read(full);
+        if (!ref) {
+            return std::nullopt;
+        }
+        if (ref->type == ReftableRef::Type::Symref) {
+            return lookup(ref->target);
+        }
+        return ref->value;
+    }
+
+    // A loose file overrides the packed value, even while it is unborn
+    std::string path = get_ref_path(name);
+    if (fs::exists(path)) {
+        return read_ref_file(path);
+    }
+    if (full == "HEAD") {
+        return std::nullopt;
+    }
+    auto record = packed_refs()->find(full);
+    return record ? std::optional<ObjectId>(record->id) : std::nullopt;
+}
+
+std::shared_ptr<const PackedRefs> Refs::packed_refs() {
+    // One stat per call keeps the snapshot in step with other processes;
+    // callers hold on to the old one while they iterate it
+    if (!packed_ || packed_->stale()) {
+        packed_ = std::make_shared<PackedRefs>(packed_refs_path_);
+    }
+    return packed_;
+}
+
 void Refs::write_ref_file(const std::string& path, const ObjectId& target) {
+    // Namespaced refs such as refs/remotes/origin/main need their directory
+    fs::create_directories(fs::path(path).parent_path());
     std::ofstream file(path);
     if (!file) {
         throw GitException("Cannot write ref file: " + path);
     }
 
-    file << target << "\n";
+    // A null target leaves an unborn branch with no commit yet
+    if (!target.is_null()) {
+        file << target;
+    }
+    file << "\n";
 }
 
 std::optional<ObjectId> Refs::read_ref_file(const std::string& path) {
@@ -305,48 +634,21 @@ std::optional<ObjectId> Refs::read_ref_file(const std::string& path) {
     // Handle symbolic refs
     if (line.substr(0, 5) == "ref: ") {
         RefName target = line.substr(5);
-        return read_ref_file(get_ref_path(target));
+        return lookup(target);
     }
 
-    // Validate SHA-1
-    if (line.empty()) {
-        return std::nullopt;
-    }
-    if (line.length() == 40 && std::regex_match(line, std::regex("^[0-9a-fA-F]+$"))) {
-        return line;
-    }
-
-    return std::nullopt;
+    return ObjectId::parse_hex(line);
 }
 
 void Refs::load_ref_cache() {
-    // Load HEAD
+    // Branches and tags are read on demand, from loose files or the mapped
+    // packed-refs, so startup costs the same with 100k tags as with none
     try {
         ObjectId head_target = get_head();
         ref_cache_["HEAD"] = head_target;
     } catch (...) {
         // HEAD might not exist yet
     }
-
-    // Load branches
-    for (const auto& branch : list_branches()) {
-        try {
-            ObjectId target = resolve_ref(branch);
-            ref_cache_[branch] = target;
-        } catch (...) {
-            // Skip invalid refs
-        }
-    }
-
-    // Load tags
-    for (const auto& tag : list_tags()) {
-        try {
-            ObjectId target = resolve_ref(tag);
-            ref_cache_[tag] = target;
-        } catch (...) {
-            // Skip invalid refs
-        }
-    }
 }
 
 void Refs::log_ref_change(const RefName& name, const ObjectId& old_id, const ObjectId& new_id) {
@@ -360,12 +662,49 @@ void Refs::log_ref_change(const RefName& name, const ObjectId& old_id, const Obj
         return; // Silently fail reflog writes
     }
 
-    auto now = std::chrono::system_clock::now();
-    auto timestamp = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
-
     file << new_id << " " << old_id << " " << "user"
-         << " <user@example.com> " << timestamp << " +0000"
+         << " <user@example.com> " << now_seconds() << " +0000"
          << "\tref update\n";
 }
 
+std::vector<ObjectId> Refs::commit_tips(ObjectDatabase& objects) {
+    std::vector<RefRecord> refs = list_refs("refs/heads/");
+    std::vector<RefRecord> remotes = list_refs("refs/remotes/");
+    std::vector<RefRecord> tags = list_refs("refs/tags/");
+    refs.insert(refs.end(), remotes.begin(), remotes.end());
+    refs.insert(refs.end(), tags.begin(), tags.end());
+
+    std::vector<ObjectId> tips;
+    try {
+        ObjectId head = get_head();
+        if (!head.is_null()) {
+            tips.push_back(head);
+        }
+    } catch (const GitException&) {
+        // Unborn branch
+    }
+    for (const auto& ref : refs) {
+        if (ref.id.is_null()) {
+            continue;
+        }
+        // Annotated tags are peeled to the commit they name; packed-refs
+        // already knows where a packed tag leads
+        std::optional<ObjectId> id = ref.peeled ? ref.peeled : std::optional<ObjectId>(ref.id);
+        while (id) {
+            auto raw = objects.read_raw(*id);
+            if (raw && raw->type == ObjectType::Commit) {
+                tips.push_back(*id);
+            }
+            if (!raw || raw->type != ObjectType::Tag) {
+                break;
+            }
+            id = TagView(raw->data).object_id();
+        }
+    }
+
+    std::sort(tips.begin(), tips.end());
+    tips.erase(std::unique(tips.begin(), tips.end()), tips.end());
+    return tips;
+}
+
 } // namespace dgit
@@ -0,0 +1,972 @@
+#include "dgit/reftable.hpp"
+#include "dgit/compression.hpp"
+#include "dgit/mapped_file.hpp"
+#include "dgit/sha1.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+namespace dgit {
+
+namespace {
+constexpr size_t kHeaderSize = 24;
+constexpr size_t kFooterSize = 68;
+constexpr size_t kBlockHeaderSize = 4;   // type and uint24 length
+constexpr size_t kRestartInterval = 16;
+constexpr size_t kMinBlocksForIndex = 4;
+constexpr uint8_t kVersion = 1;
+constexpr uint8_t kRefBlock = 'r';
+constexpr uint8_t kIndexBlock = 'i';
+constexpr uint8_t kLogBlock = 'g';
+constexpr uint8_t kLogDeletion = 0;
+constexpr uint8_t kLogUpdate = 1;
+// Reads of tables.list retried while compactions keep replacing it
+constexpr int kReloadAttempts = 8;
+
+bool starts_with(std::string_view s, std::string_view prefix) {
+    return s.size() >= prefix.size() && s.compare(0, prefix.size(), prefix) == 0;
+}
+
+void put_be(std::string& out, uint64_t value, int bytes) {
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+}
+
+uint64_t get_be(const uint8_t* p, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; ++i) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+// Reftable varints: seven bits a byte, most significant first, and each
+// continuation adds one so that every value has exactly one encoding
+void put_varint(std::string& out, uint64_t value) {
+    uint8_t buf[10];
+    size_t i = sizeof(buf) - 1;
+    buf[i] = value & 0x7F;
+    while (value >>= 7) {
+        buf[--i] = static_cast<uint8_t>(0x80 | (--value & 0x7F));
+    }
+    out.append(reinterpret_cast<const char*>(buf + i), sizeof(buf) - i);
+}
+
+void put_id(std::string& out, const ObjectId& id) {
+    out.append(reinterpret_cast<const char*>(id.data()), ObjectId::kRawSize);
+}
+
+// Log keys sort by name, then newest first
+std::string log_key(const std::string& name, uint64_t update_index) {
+    std::string key = name;
+    key.push_back('\0');
+    put_be(key, ~update_index, 8);
+    return key;
+}
+
+// Bounds-checked reader over one block's bytes
+class Cursor {
+public:
+    Cursor(const uint8_t* p, const uint8_t* end) : p_(p), end_(end) {}
+
+    const uint8_t* position() const { return p_; }
+
+    uint64_t varint() {
+        need(1);
+        uint8_t byte = *p_++;
+        uint64_t value = byte & 0x7F;
+        while (byte & 0x80) {
+            need(1);
+            byte = *p_++;
+            value = ((value + 1) << 7) | (byte & 0x7F);
+        }
+        return value;
+    }
+
+    std::string_view bytes(size_t n) {
+        need(n);
+        std::string_view view(reinterpret_cast<const char*>(p_), n);
+        p_ += n;
+        return view;
+    }
+
+    ObjectId id() {
+        need(ObjectId::kRawSize);
+        ObjectId id = ObjectId::from_raw(p_);
+        p_ += ObjectId::kRawSize;
+        return id;
+    }
+
+    uint64_t be(int n) {
+        need(static_cast<size_t>(n));
+        uint64_t value = get_be(p_, n);
+        p_ += n;
+        return value;
+    }
+
+    // A key prefix-compressed against `key`, which holds the previous one
+    uint8_t key(std::string& key) {
+        uint64_t prefix = varint();
+        uint64_t suffix_and_type = varint();
+        if (prefix > key.size()) {
+            throw GitException("Corrupt reftable: bad key prefix");
+        }
+        key.resize(prefix);
+        key += bytes(suffix_and_type >> 3);
+        return static_cast<uint8_t>(suffix_and_type & 0x7);
+    }
+
+private:
+    void need(size_t n) const {
+        if (static_cast<size_t>(end_ - p_) < n) {
+            throw GitException("Corrupt reftable: truncated record");
+        }
+    }
+
+    const uint8_t* p_;
+    const uint8_t* end_;
+};
+
+// Records of one block. Offsets are from the block's start, which for the
+// first block is the start of the file, header included.
+struct Block {
+    uint8_t type = 0;
+    size_t start = 0;
+    size_t next = 0;        // file offset of the following block
+    size_t records = 0;
+    size_t restarts = 0;
+    size_t restart_count = 0;
+    const uint8_t* mapped = nullptr;
+    std::string inflated;   // log blocks
+
+    const uint8_t* data() const {
+        return inflated.empty() ? mapped : reinterpret_cast<const uint8_t*>(inflated.data());
+    }
+    Cursor cursor(size_t offset) const { return Cursor(data() + offset, data() + restarts); }
+    size_t restart(size_t i) const { return static_cast<size_t>(get_be(data() + restarts + 3 * i, 3)); }
+
+    // Where to start scanning for the first key >= `target`: the last
+    // restart point whose key is below it
+    size_t seek(std::string_view target) const {
+        size_t low = 0;
+        size_t high = restart_count;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            std::string key;
+            Cursor c = cursor(restart(mid));
+            c.key(key);
+            if (key < target) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return low == 0 ? records : restart(low - 1);
+    }
+};
+
+ReftableRef parse_ref(Cursor& c, const std::string& key, uint8_t type, uint64_t min_update_index) {
+    ReftableRef ref;
+    ref.name = key;
+    ref.update_index = min_update_index + c.varint();
+    switch (type) {
+        case 0:
+            ref.type = ReftableRef::Type::Deletion;
+            break;
+        case 1:
+            ref.type = ReftableRef::Type::Value;
+            ref.value = c.id();
+            break;
+        case 2:
+            ref.type = ReftableRef::Type::Peeled;
+            ref.value = c.id();
+            ref.peeled = c.id();
+            break;
+        case 3:
+            ref.type = ReftableRef::Type::Symref;
+            ref.target = std::string(c.bytes(c.varint()));
+            break;
+        default:
+            throw GitException("Corrupt reftable: unknown ref value type " + std::to_string(type));
+    }
+    return ref;
+}
+
+ReftableLog parse_log(Cursor& c, const std::string& key, uint8_t type) {
+    if (key.size() < 9 || key[key.size() - 9] != '\0') {
+        throw GitException("Corrupt reftable: bad log key");
+    }
+    ReftableLog log;
+    log.name = key.substr(0, key.size() - 9);
+    log.update_index = ~get_be(reinterpret_cast<const uint8_t*>(key.data()) + key.size() - 8, 8);
+    if (type == kLogDeletion) {
+        return log;
+    }
+    if (type != kLogUpdate) {
+        throw GitException("Corrupt reftable: unknown log type " + std::to_string(type));
+    }
+    log.old_id = c.id();
+    log.new_id = c.id();
+    log.committer_name = std::string(c.bytes(c.varint()));
+    log.email = std::string(c.bytes(c.varint()));
+    log.time = c.varint();
+    log.tz_offset = static_cast<int16_t>(c.be(2));
+    log.message = std::string(c.bytes(c.varint()));
+    return log;
+}
+
+// Builds one block: prefix-compressed records with a restart point every
+// kRestartInterval records, then the restart table
+class BlockWriter {
+public:
+    BlockWriter(uint8_t type, size_t header_offset, size_t limit)
+        : type_(type), header_offset_(header_offset), limit_(limit) {}
+
+    bool empty() const { return count_ == 0; }
+    const std::string& last_key() const { return last_key_; }
+
+    // False if the record would overflow a block that already has some
+    bool add(std::string_view key, uint8_t value_type, const std::string& value) {
+        bool restart = count_ % kRestartInterval == 0;
+        size_t prefix = 0;
+        if (!restart) {
+            while (prefix < key.size() && prefix < last_key_.size() && key[prefix] == last_key_[prefix]) {
+                ++prefix;
+            }
+        }
+        std::string record;
+        put_varint(record, prefix);
+        put_varint(record, ((key.size() - prefix) << 3) | value_type);
+        record.append(key.substr(prefix));
+        record += value;
+
+        size_t restarts = restarts_.size() + (restart ? 1 : 0);
+        if (count_ > 0 && length(records_.size() + record.size(), restarts) > limit_) {
+            return false;
+        }
+        if (restart) {
+            restarts_.push_back(header_offset_ + kBlockHeaderSize + records_.size());
+        }
+        records_ += record;
+        last_key_ = std::string(key);
+        ++count_;
+        return true;
+    }
+
+    // The block header, records and restart table, uncompressed
+    std::string finish() const {
+        std::string out;
+        out.push_back(static_cast<char>(type_));
+        put_be(out, length(records_.size(), restarts_.size()), 3);
+        out += records_;
+        for (size_t offset : restarts_) {
+            put_be(out, offset, 3);
+        }
+        put_be(out, restarts_.size(), 2);
+        return out;
+    }
+
+private:
+    size_t length(size_t records, size_t restarts) const {
+        return header_offset_ + kBlockHeaderSize + records + 3 * restarts + 2;
+    }
+
+    uint8_t type_;
+    size_t header_offset_;
+    size_t limit_;
+    std::string records_;
+    std::vector<size_t> restarts_;
+    std::string last_key_;
+    size_t count_ = 0;
+};
+
+std::string encode_ref_value(const ReftableRef& ref, uint64_t min_update_index) {
+    std::string value;
+    put_varint(value, ref.update_index - min_update_index);
+    switch (ref.type) {
+        case ReftableRef::Type::Deletion:
+            break;
+        case ReftableRef::Type::Value:
+            put_id(value, ref.value);
+            break;
+        case ReftableRef::Type::Peeled:
+            put_id(value, ref.value);
+            put_id(value, ref.peeled);
+            break;
+        case ReftableRef::Type::Symref:
+            put_varint(value, ref.target.size());
+            value += ref.target;
+            break;
+    }
+    return value;
+}
+
+std::string encode_log_value(const ReftableLog& log) {
+    std::string value;
+    put_id(value, log.old_id);
+    put_id(value, log.new_id);
+    put_varint(value, log.committer_name.size());
+    value += log.committer_name;
+    put_varint(value, log.email.size());
+    value += log.email;
+    put_varint(value, log.time);
+    put_be(value, static_cast<uint16_t>(log.tz_offset), 2);
+    put_varint(value, log.message.size());
+    value += log.message;
+    return value;
+}
+
+std::string encode_header(uint32_t block_size, uint64_t min_index, uint64_t max_index) {
+    std::string header = "REFT";
+    header.push_back(static_cast<char>(kVersion));
+    put_be(header, block_size, 3);
+    put_be(header, min_index, 8);
+    put_be(header, max_index, 8);
+    return header;
+}
+
+// Refs sorted by name and logs by key
+std::string encode_table(uint32_t block_size, uint64_t min_index, uint64_t max_index,
+                         const std::vector<ReftableRef>& refs, const std::vector<ReftableLog>& logs) {
+    std::string out = encode_header(block_size, min_index, max_index);
+
+    // Ref blocks are padded to the block size so each starts on a boundary
+    std::vector<std::pair<std::string, uint64_t>> index;   // last key, block start
+    size_t block_start = 0;
+    BlockWriter block(kRefBlock, kHeaderSize, block_size);
+    auto flush_refs = [&] {
+        out += block.finish();
+        index.emplace_back(block.last_key(), block_start);
+    };
+    for (const auto& ref : refs) {
+        std::string value = encode_ref_value(ref, min_index);
+        if (!block.add(ref.name, static_cast<uint8_t>(ref.type), value)) {
+            flush_refs();
+            out.resize((out.size() + block_size - 1) / block_size * block_size, '\0');
+            block_start = out.size();
+            block = BlockWriter(kRefBlock, 0, block_size);
+            block.add(ref.name, static_cast<uint8_t>(ref.type), value);
+        }
+    }
+    if (!block.empty()) {
+        flush_refs();
+    }
+
+    // Enough blocks to be worth it get an index of each block's last key,
+    // in as many levels as it takes to fit the top one in a block
+    uint64_t ref_index_position = 0;
+    if (index.size() >= kMinBlocksForIndex) {
+        std::vector<std::pair<std::string, uint64_t>> level = std::move(index);
+        for (;;) {
+            std::vector<std::pair<std::string, uint64_t>> upper;
+            BlockWriter index_block(kIndexBlock, 0, block_size);
+            size_t start = out.size();
+            for (const auto& [key, position] : level) {
+                std::string value;
+                put_varint(value, position);
+                if (!index_block.add(key, 0, value)) {
+                    out += index_block.finish();
+                    upper.emplace_back(index_block.last_key(), start);
+                    index_block = BlockWriter(kIndexBlock, 0, block_size);
+                    start = out.size();
+                    index_block.add(key, 0, value);
+                }
+            }
+            out += index_block.finish();
+            upper.emplace_back(index_block.last_key(), start);
+            if (upper.size() == 1) {
+                ref_index_position = upper[0].second;
+                break;
+            }
+            level = std::move(upper);
+        }
+    }
+
+    // Log blocks are deflated after their four header bytes
+    uint64_t log_position = 0;
+    if (!logs.empty()) {
+        log_position = out.size();
+        BlockWriter log_block(kLogBlock, out.size() == kHeaderSize ? kHeaderSize : 0, block_size);
+        auto flush_logs = [&] {
+            std::string raw = log_block.finish();
+            std::string compressed;
+            Deflater::for_thread(kDefaultCompressionLevel)
+                .compress(raw.data() + kBlockHeaderSize, raw.size() - kBlockHeaderSize, compressed);
+            out.append(raw, 0, kBlockHeaderSize);
+            out += compressed;
+        };
+        for (const auto& log : logs) {
+            std::string key = log_key(log.name, log.update_index);
+            std::string value = encode_log_value(log);
+            if (!log_block.add(key, kLogUpdate, value)) {
+                flush_logs();
+                log_block = BlockWriter(kLogBlock, 0, block_size);
+                log_block.add(key, kLogUpdate, value);
+            }
+        }
+        flush_logs();
+    }
+
+    // Footer: the header again, section positions (no object index), CRC
+    std::string footer = encode_header(block_size, min_index, max_index);
+    put_be(footer, ref_index_position, 8);
+    put_be(footer, 0, 8);
+    put_be(footer, 0, 8);
+    put_be(footer, log_position, 8);
+    put_be(footer, 0, 8);
+    uint32_t crc = static_cast<uint32_t>(
+        ::crc32(0, reinterpret_cast<const Bytef*>(footer.data()), static_cast<uInt>(footer.size())));
+    put_be(footer, crc, 4);
+    return out + footer;
+}
+
+// tables.list.lock. commit() renames it over tables.list; otherwise the
+// destructor removes it.
+class ListLock {
+public:
+    // Throws GitException if someone else holds it, unless `try_only`
+    ListLock(const std::string& list_path, bool try_only)
+        : list_path_(list_path), lock_path_(list_path + ".lock") {
+        fd_ = ::open(lock_path_.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (fd_ < 0 && !try_only) {
+            if (errno == EEXIST) {
+                throw GitException("Unable to create '" + lock_path_ + "': File exists");
+            }
+            throw GitException("Cannot lock reftable stack: " + lock_path_);
+        }
+    }
+
+    ~ListLock() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            ::unlink(lock_path_.c_str());
+        }
+    }
+
+    bool held() const { return fd_ >= 0; }
+
+    void commit(const std::vector<std::string>& names) {
+        std::string content;
+        for (const auto& name : names) {
+            content += name + "\n";
+        }
+        bool ok = ::write(fd_, content.data(), content.size()) == static_cast<ssize_t>(content.size());
+        int fd = fd_;
+        fd_ = -1;
+        if (::close(fd) != 0 || !ok || ::rename(lock_path_.c_str(), list_path_.c_str()) != 0) {
+            ::unlink(lock_path_.c_str());
+            throw GitException("Cannot write " + list_path_);
+        }
+    }
+
+private:
+    std::string list_path_;
+    std::string lock_path_;
+    int fd_ = -1;
+};
+}
+
+// One immutable table, read through its mapping
+class ReftableTable {
+public:
+    explicit ReftableTable(const std::string& path) : file_(path) {
+        const uint8_t* data = file_.data();
+        if (file_.size() < kHeaderSize + kFooterSize || std::memcmp(data, "REFT", 4) != 0) {
+            throw GitException("Not a reftable: " + path);
+        }
+        if (data[4] != kVersion) {
+            throw GitException("Unsupported reftable version " + std::to_string(data[4]) + ": " + path);
+        }
+        block_size_ = static_cast<uint32_t>(get_be(data + 5, 3));
+        min_update_index_ = get_be(data + 8, 8);
+        max_update_index_ = get_be(data + 16, 8);
+
+        footer_ = file_.size() - kFooterSize;
+        const uint8_t* footer = data + footer_;
+        uint32_t crc = static_cast<uint32_t>(::crc32(0, footer, kFooterSize - 4));
+        if (std::memcmp(footer, data, kHeaderSize) != 0 || crc != get_be(footer + kFooterSize - 4, 4)) {
+            throw GitException("Corrupt reftable footer: " + path);
+        }
+        ref_index_ = get_be(footer + 24, 8);
+        log_position_ = get_be(footer + 48, 8);
+        has_refs_ = footer_ > kHeaderSize && data[kHeaderSize] == kRefBlock;
+    }
+
+    uint64_t min_update_index() const { return min_update_index_; }
+    uint64_t max_update_index() const { return max_update_index_; }
+    size_t size() const { return file_.size(); }
+
+    std::optional<ReftableRef> find(std::string_view name) const {
+        std::optional<ReftableRef> found;
+        for_each_ref(name, [&](ReftableRef&& ref) {
+            if (ref.name == name) {
+                found = std::move(ref);
+            }
+            return false;
+        });
+        return found;
+    }
+
+    // Records from the first name >= `from`, in order, until fn says stop
+    void for_each_ref(std::string_view from, const std::function<bool(ReftableRef&&)>& fn) const {
+        auto start = seek_ref_block(from);
+        if (!start) {
+            return;
+        }
+        for (size_t position = *start; position < footer_;) {
+            Block block = block_at(position);
+            if (block.type != kRefBlock) {
+                return;
+            }
+            std::string key;
+            Cursor c = block.cursor(block.seek(from));
+            while (c.position() < block.data() + block.restarts) {
+                uint8_t type = c.key(key);
+                ReftableRef ref = parse_ref(c, key, type, min_update_index_);
+                if (ref.name >= from && !fn(std::move(ref))) {
+                    return;
+                }
+            }
+            position = block.next;
+        }
+    }
+
+    void for_each_log(const std::function<void(ReftableLog&&)>& fn) const {
+        if (log_position_ == 0) {
+            return;
+        }
+        for (size_t position = log_position_; position < footer_;) {
+            Block block = block_at(position);
+            if (block.type != kLogBlock) {
+                return;
+            }
+            std::string key;
+            Cursor c = block.cursor(block.records);
+            while (c.position() < block.data() + block.restarts) {
+                uint8_t type = c.key(key);
+                fn(parse_log(c, key, type));
+            }
+            position = block.next;
+        }
+    }
+
+private:
+    // The block whose header is at `position`, or whose start is: the
+    // first block starts at 0 with its header after the file header
+    Block block_at(size_t position) const {
+        Block block;
+        block.start = position <= kHeaderSize ? 0 : position;
+        size_t header = block.start == 0 ? kHeaderSize : block.start;
+        if (header + kBlockHeaderSize > footer_) {
+            throw GitException("Corrupt reftable: block past the end");
+        }
+        const uint8_t* data = file_.data();
+        block.type = data[header];
+        size_t length = static_cast<size_t>(get_be(data + header + 1, 3));
+        size_t header_offset = header - block.start;
+        if (length < header_offset + kBlockHeaderSize + 2) {
+            throw GitException("Corrupt reftable: bad block length");
+        }
+
+        if (block.type == kLogBlock) {
+            std::string content;
+            size_t consumed = 0;
+            Inflater::for_thread().decompress(data + header + kBlockHeaderSize, footer_ - header - kBlockHeaderSize,
+                                              content, length - header_offset - kBlockHeaderSize, &consumed);
+            block.inflated.assign(header_offset + kBlockHeaderSize, '\0');
+            block.inflated += content;
+            block.next = header + kBlockHeaderSize + consumed;
+        } else {
+            if (block.start + length > footer_) {
+                throw GitException("Corrupt reftable: block past the end");
+            }
+            block.mapped = data + block.start;
+            block.next = block.start + length;
+            // Ref blocks are padded up to the next boundary
+            if (block_size_ > 0 && block.next < footer_ && data[block.next] == 0) {
+                block.next = (block.next + block_size_ - 1) / block_size_ * block_size_;
+            }
+        }
+
+        block.restart_count = static_cast<size_t>(get_be(block.data() + length - 2, 2));
+        if (3 * block.restart_count + 2 > length - header_offset - kBlockHeaderSize) {
+            throw GitException("Corrupt reftable: bad restart count");
+        }
+        block.restarts = length - 2 - 3 * block.restart_count;
+        block.records = header_offset + kBlockHeaderSize;
+        return block;
+    }
+
+    // The ref block where a scan for `name` starts, through the index when
+    // there is one; nullopt when every ref sorts before it
+    std::optional<size_t> seek_ref_block(std::string_view name) const {
+        if (!has_refs_) {
+            return std::nullopt;
+        }
+        if (ref_index_ == 0) {
+            return 0;
+        }
+        size_t position = ref_index_;
+        for (;;) {
+            Block block = block_at(position);
+            if (block.type == kRefBlock) {
+                return position;
+            }
+            if (block.type != kIndexBlock) {
+                throw GitException("Corrupt reftable: bad index block");
+            }
+            std::optional<size_t> child;
+            std::string key;
+            Cursor c = block.cursor(block.seek(name));
+            while (!child && c.position() < block.data() + block.restarts) {
+                c.key(key);
+                uint64_t block_position = c.varint();
+                if (key >= name) {
+                    child = static_cast<size_t>(block_position);
+                }
+            }
+            if (!child) {
+                return std::nullopt;
+            }
+            position = *child;
+        }
+    }
+
+    MappedFile file_;
+    uint32_t block_size_ = 0;
+    uint64_t min_update_index_ = 0;
+    uint64_t max_update_index_ = 0;
+    size_t footer_ = 0;
+    uint64_t ref_index_ = 0;
+    uint64_t log_position_ = 0;
+    bool has_refs_ = false;
+};
+
+ReftableStack::ReftableStack(const std::string& dir) : dir_(dir), list_path_(dir + "/tables.list") {
+    fs::create_directories(dir_);
+    if (!fs::exists(list_path_)) {
+        std::ofstream list(list_path_);
+        if (!list) {
+            throw GitException("Cannot create " + list_path_);
+        }
+    }
+    reload();
+}
+
+ReftableStack::~ReftableStack() = default;
+
+void ReftableStack::reload() {
+    // A compaction renames its tables.list into place and then unlinks the
+    // tables it merged, so a table named by the list just read can vanish
+    // before it is opened. The list has moved on by then: read it again,
+    // as git does. A missing table in an unchanged list is damage.
+    std::vector<std::string> previous;
+    for (int attempt = 1;; ++attempt) {
+        struct stat st;
+        if (::stat(list_path_.c_str(), &st) != 0) {
+            throw GitException("Cannot read " + list_path_);
+        }
+        std::vector<std::string> names;
+        std::ifstream list(list_path_);
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty()) {
+                names.push_back(line);
+            }
+        }
+        if (reload_hook_) {
+            reload_hook_();
+        }
+
+        // Tables never change, so the ones still listed are kept open
+        std::map<std::string, std::shared_ptr<ReftableTable>> open;
+        for (size_t i = 0; i < names_.size(); ++i) {
+            open[names_[i]] = tables_[i];
+        }
+        std::vector<std::shared_ptr<ReftableTable>> tables;
+        std::string missing;
+        for (const auto& name : names) {
+            auto it = open.find(name);
+            if (it != open.end()) {
+                tables.push_back(it->second);
+                continue;
+            }
+            std::string path = dir_ + "/" + name;
+            try {
+                tables.push_back(std::make_shared<ReftableTable>(path));
+            } catch (const GitException&) {
+                std::error_code ec;
+                if (fs::exists(path, ec) || ec) {
+                    throw;
+                }
+                missing = name;
+                break;
+            }
+        }
+
+        if (missing.empty()) {
+            list_inode_ = static_cast<uint64_t>(st.st_ino);
+            list_size_ = static_cast<uint64_t>(st.st_size);
+            list_mtime_ns_ = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+            names_ = std::move(names);
+            tables_ = std::move(tables);
+            return;
+        }
+        if (names == previous || attempt == kReloadAttempts) {
+            throw GitException("Reftable " + missing + " listed in " + list_path_ + " is missing");
+        }
+        previous = std::move(names);
+    }
+}
+
+void ReftableStack::reload_if_changed() {
+    struct stat st;
+    if (::stat(list_path_.c_str(), &st) != 0 || static_cast<uint64_t>(st.st_ino) != list_inode_ ||
+        static_cast<uint64_t>(st.st_size) != list_size_ ||
+        static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec != list_mtime_ns_) {
+        reload();
+    }
+}
+
+uint64_t ReftableStack::next_update_index() const {
+    return tables_.empty() ? 1 : tables_.back()->max_update_index() + 1;
+}
+
+size_t ReftableStack::table_count() {
+    reload_if_changed();
+    return tables_.size();
+}
+
+std::optional<ReftableRef> ReftableStack::read(std::string_view name) {
+    reload_if_changed();
+    for (auto it = tables_.rbegin(); it != tables_.rend(); ++it) {
+        if (auto ref = (*it)->find(name)) {
+            if (ref->type == ReftableRef::Type::Deletion) {
+                return std::nullopt;
+            }
+            return ref;
+        }
+    }
+    return std::nullopt;
+}
+
+std::vector<ReftableRef> ReftableStack::list(std::string_view prefix) {
+    reload_if_changed();
+    auto scan = [prefix](const ReftableTable& table, const std::function<void(ReftableRef&&)>& fn) {
+        table.for_each_ref(prefix, [&](ReftableRef&& ref) {
+            if (!starts_with(ref.name, prefix)) {
+                return false;
+            }
+            fn(std::move(ref));
+            return true;
+        });
+    };
+
+    std::vector<ReftableRef> refs;
+    if (tables_.size() == 1) {
+        scan(*tables_[0], [&](ReftableRef&& ref) {
+            if (ref.type != ReftableRef::Type::Deletion) {
+                refs.push_back(std::move(ref));
+            }
+        });
+        return refs;
+    }
+
+    // Newer tables override older ones name by name
+    std::map<std::string, ReftableRef> merged;
+    for (const auto& table : tables_) {
+        scan(*table, [&](ReftableRef&& ref) { merged[ref.name] = std::move(ref); });
+    }
+    for (auto& entry : merged) {
+        if (entry.second.type != ReftableRef::Type::Deletion) {
+            refs.push_back(std::move(entry.second));
+        }
+    }
+    return refs;
+}
+
+std::vector<ReftableLog> ReftableStack::logs(std::string_view name) {
+    reload_if_changed();
+    std::vector<ReftableLog> logs;
+    for (const auto& table : tables_) {
+        table->for_each_log([&](ReftableLog&& log) {
+            if (log.name == name) {
+                logs.push_back(std::move(log));
+            }
+        });
+    }
+    std::sort(logs.begin(), logs.end(),
+              [](const ReftableLog& a, const ReftableLog& b) { return a.update_index > b.update_index; });
+    return logs;
+}
+
+std::string ReftableStack::write_table(uint64_t min_index, uint64_t max_index, std::vector<ReftableRef> refs,
+                                       std::vector<ReftableLog> logs) {
+    // A later record for the same name wins
+    std::stable_sort(refs.begin(), refs.end(),
+                     [](const ReftableRef& a, const ReftableRef& b) { return a.name < b.name; });
+    std::vector<ReftableRef> unique;
+    for (auto& ref : refs) {
+        if (!unique.empty() && unique.back().name == ref.name) {
+            unique.back() = std::move(ref);
+        } else {
+            unique.push_back(std::move(ref));
+        }
+    }
+    std::stable_sort(logs.begin(), logs.end(), [](const ReftableLog& a, const ReftableLog& b) {
+        return a.name != b.name ? a.name < b.name : a.update_index > b.update_index;
+    });
+    logs.erase(std::unique(logs.begin(), logs.end(),
+                           [](const ReftableLog& a, const ReftableLog& b) {
+                               return a.name == b.name && a.update_index == b.update_index;
+                           }),
+               logs.end());
+    std::string contents = encode_table(kDefaultBlockSize, min_index, max_index, unique, logs);
+
+    static thread_local std::mt19937 random(std::random_device{}());
+    char name[64];
+    std::snprintf(name, sizeof(name), "0x%012llx-0x%012llx-%08x.ref", static_cast<unsigned long long>(min_index),
+                  static_cast<unsigned long long>(max_index), static_cast<unsigned>(random()));
+    std::string path = dir_ + "/" + name;
+
+    // Nothing names the table until tables.list does, so it can be written
+    // in place; its one fsync makes it durable before the rename does
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        throw GitException("Cannot create reftable: " + path);
+    }
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t n = ::write(fd, contents.data() + written, contents.size() - written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+    if (written != contents.size() || ::fsync(fd) != 0) {
+        ::close(fd);
+        ::unlink(path.c_str());
+        throw GitException("Cannot write reftable: " + path);
+    }
+    ::close(fd);
+    return name;
+}
+
+void ReftableStack::transact(const BuildFn& build) {
+    ListLock lock(list_path_, false);
+    reload();
+
+    uint64_t update_index = next_update_index();
+    std::vector<ReftableRef> refs;
+    std::vector<ReftableLog> logs;
+    build(update_index, refs, logs);
+    if (refs.empty() && logs.empty()) {
+        return;
+    }
+
+    std::string name = write_table(update_index, update_index, std::move(refs), std::move(logs));
+    std::vector<std::string> names = names_;
+    names.push_back(name);
+    try {
+        lock.commit(names);
+    } catch (...) {
+        fs::remove(dir_ + "/" + name);
+        throw;
+    }
+    reload();
+
+    if (auto_compact_) {
+        auto_compact();
+    }
+}
+
+std::vector<std::string> ReftableStack::compact_range(size_t first, size_t last) {
+    // Newer records replace older ones. Deletions only matter while an
+    // older table could still hold the ref.
+    std::map<std::string, ReftableRef> merged;
+    std::vector<ReftableLog> logs;
+    for (size_t i = first; i <= last; ++i) {
+        tables_[i]->for_each_ref("", [&](ReftableRef&& ref) {
+            merged[ref.name] = std::move(ref);
+            return true;
+        });
+        tables_[i]->for_each_log([&](ReftableLog&& log) { logs.push_back(std::move(log)); });
+    }
+    std::vector<ReftableRef> refs;
+    for (auto& entry : merged) {
+        if (first > 0 || entry.second.type != ReftableRef::Type::Deletion) {
+            refs.push_back(std::move(entry.second));
+        }
+    }
+
+    std::string name = write_table(tables_[first]->min_update_index(), tables_[last]->max_update_index(),
+                                   std::move(refs), std::move(logs));
+    std::vector<std::string> names(names_.begin(), names_.begin() + static_cast<std::ptrdiff_t>(first));
+    names.push_back(name);
+    names.insert(names.end(), names_.begin() + static_cast<std::ptrdiff_t>(last) + 1, names_.end());
+    return names;
+}
+
+void ReftableStack::auto_compact() {
+    // Another writer holding the lock will compact after its own update
+    ListLock lock(list_path_, true);
+    if (!lock.held()) {
+        return;
+    }
+    reload();
+    if (tables_.size() < 2) {
+        return;
+    }
+
+    // Geometric: every table should be at least twice the size of all the
+    // newer ones together, so n updates leave O(log n) tables
+    size_t last = tables_.size() - 1;
+    size_t first = last;
+    uint64_t newer = tables_[last]->size();
+    while (first > 0 && tables_[first - 1]->size() < 2 * newer) {
+        --first;
+        newer += tables_[first]->size();
+    }
+    if (first == last) {
+        return;
+    }
+
+    std::vector<std::string> old(names_.begin() + static_cast<std::ptrdiff_t>(first),
+                                 names_.begin() + static_cast<std::ptrdiff_t>(last) + 1);
+    lock.commit(compact_range(first, last));
+    // Readers that still map the old tables keep their open files
+    for (const auto& name : old) {
+        fs::remove(dir_ + "/" + name);
+    }
+    reload();
+}
+
+void ReftableStack::compact_all() {
+    ListLock lock(list_path_, false);
+    reload();
+    if (tables_.size() < 2) {
+        return;
+    }
+    std::vector<std::string> old = names_;
+    lock.commit(compact_range(0, tables_.size() - 1));
+    for (const auto& name : old) {
+        fs::remove(dir_ + "/" + name);
+    }
+    reload();
+}
+
+} // namespace dgit
@@ -0,0 +1,194 @@
+// Command benchmark suite
+// Builds a synthetic repository (20k files of 10 lines in 200 directories
+// by default) and times the everyday operations on it: add, status clean
+// and with 1% of the files touched, a series of commits each editing 1% of
+// the files, log over the whole history, packing every loose object,
+// checking out the first commit and back, and a merge against a branch
+// that edited other lines of overlapping files. Each step also prints the
+// trace2 counters it moved, so a change in the work done shows up even
+// when the timings are noisy.
+//
+// Usage: dgit_bench [file-count] [commit-count] [directory]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "dgit/checkout.hpp"
+#include "dgit/commands.hpp"
+#include "dgit/merge_tree.hpp"
+#include "dgit/repository.hpp"
+#include "dgit/status.hpp"
+#include "dgit/thread_pool.hpp"
+#include "dgit/trace.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t kFilesPerDirectory = 100;
+constexpr size_t kLinesPerFile = 10;
+
+// Times one step and reports the counters it moved
+class Step {
+public:
+    explicit Step(const char* label)
+        : label_(label), counts_(dgit::Trace2::totals()), start_(std::chrono::steady_clock::now()) {}
+
+    void report(const std::string& note = "") const {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        dgit::TraceCounts now = dgit::Trace2::totals();
+        auto moved = [&](dgit::TraceCounter counter) {
+            size_t i = static_cast<size_t>(counter);
+            return static_cast<unsigned long long>(now[i] - counts_[i]);
+        };
+        std::printf("%-24s %8.3f s  %8llu objects (%llu cached)  %7.1f MB inflated  %7.1f MB deflated  %8llu stats%s%s\n",
+                    label_, elapsed, moved(dgit::TraceCounter::ObjectLoads),
+                    moved(dgit::TraceCounter::ObjectCacheHits),
+                    moved(dgit::TraceCounter::BytesInflated) / 1e6, moved(dgit::TraceCounter::BytesDeflated) / 1e6,
+                    moved(dgit::TraceCounter::StatCalls), note.empty() ? "" : "  ", note.c_str());
+    }
+
+private:
+    const char* label_;
+    dgit::TraceCounts counts_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+std::string file_path(size_t i) {
+    size_t dir = i / kFilesPerDirectory;
+    return "d" + std::to_string(dir / 100) + "/" + std::to_string(dir % 100) + "/file" + std::to_string(i) + ".txt";
+}
+
+// Line `edited` (if any) carries `tag`, so two branches editing
+// different lines of one file merge cleanly
+void write_file(size_t i, size_t edited, const std::string& tag) {
+    std::string content;
+    for (size_t line = 0; line < kLinesPerFile; ++line) {
+        content += "file " + std::to_string(i) + " line " + std::to_string(line);
+        content += line == edited ? " " + tag + "\n" : "\n";
+    }
+    std::ofstream(file_path(i), std::ios::binary) << content;
+}
+
+void check(const dgit::CommandResult& result, const char* what) {
+    if (result.exit_code != 0) {
+        std::fprintf(stderr, "%s failed: %s", what, result.error.c_str());
+        std::exit(1);
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000;
+    size_t commits = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 50;
+    fs::path root = argc > 3 ? fs::path(argv[3]) : fs::temp_directory_path() / "dgit_bench";
+
+    fs::remove_all(root);
+    fs::create_directories(root);
+    fs::path original_dir = fs::current_path();
+    fs::current_path(root);
+    dgit::Trace2::enable_counters();
+
+    // Repository reports each init and commit on stdout; keep the table readable
+    std::ostringstream quiet;
+    std::streambuf* chatter = std::cout.rdbuf(quiet.rdbuf());
+
+    std::printf("Command benchmark: %zu files, %zu commits, %zu threads, %s\n\n", count, commits,
+                dgit::default_threads(), root.c_str());
+
+    auto repo = dgit::Repository::create(".");
+    dgit::Index& index = repo->index();
+    dgit::Person author("Bench", "bench@example.com", std::chrono::system_clock::now());
+
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < count; ++i) {
+        if (i % kFilesPerDirectory == 0) {
+            fs::create_directories(fs::path(file_path(i)).parent_path());
+        }
+        write_file(i, kLinesPerFile, "");
+        paths.push_back(file_path(i));
+    }
+
+    Step add("add");
+    index.add_files(paths);
+    index.save();
+    add.report();
+
+    dgit::StatusOptions status_options;
+    status_options.untracked = false;
+    Step status("status, clean");
+    auto clean = dgit::compute_status(index, ".", status_options);
+    status.report(std::to_string(clean.modified.size()) + " modified");
+
+    Step first("commit, initial");
+    repo->commit("Initial commit", author, author);
+    first.report();
+    dgit::ObjectId first_tree = repo->write_tree();
+
+    // Commit c edits line 1 of every file with i % 100 == c % 100
+    Step history("commits");
+    for (size_t c = 0; c < commits; ++c) {
+        std::vector<std::string> changed;
+        for (size_t i = c % 100; i < count; i += 100) {
+            write_file(i, 1, "commit " + std::to_string(c));
+            changed.push_back(file_path(i));
+        }
+        index.add_files(changed);
+        repo->commit("Commit " + std::to_string(c), author, author);
+    }
+    index.save();
+    history.report(std::to_string(commits) + " commits of " + std::to_string(count / 100) + " files");
+    dgit::ObjectId our_tree = repo->write_tree();
+
+    auto touched = fs::file_time_type::clock::now();
+    for (size_t i = 50; i < count; i += 100) {
+        fs::last_write_time(file_path(i), touched);
+    }
+    Step dirty("status, 1% touched");
+    auto rehashed = dgit::compute_status(index, ".", status_options);
+    dirty.report(std::to_string(rehashed.rehashed) + " rehashed");
+
+    Step log("log");
+    check(dgit::LogCommand().execute({"-n" + std::to_string(commits + 1)}), "log");
+    log.report();
+
+    Step pack("pack");
+    check(dgit::PackCommand().execute({}), "pack");
+    pack.report();
+
+    Step back("checkout first commit");
+    auto to_first = dgit::checkout_tree(repo->objects(), index, ".", first_tree);
+    back.report(std::to_string(to_first.written) + " written");
+
+    // Theirs edits line 8 of every 50th file, some of which ours edited too
+    std::vector<std::string> theirs_changed;
+    for (size_t i = 25; i < count; i += 50) {
+        write_file(i, 8, "theirs");
+        theirs_changed.push_back(file_path(i));
+    }
+    index.add_files(theirs_changed);
+    dgit::ObjectId their_tree = repo->write_tree();
+
+    Step forward("checkout latest");
+    auto to_latest = dgit::checkout_tree(repo->objects(), index, ".", our_tree);
+    index.save();
+    forward.report(std::to_string(to_latest.written) + " written");
+
+    Step merge("merge");
+    auto merged = dgit::merge_trees(repo->objects(), first_tree, our_tree, their_tree);
+    merge.report(std::to_string(merged.content_merges) + " content merges, " +
+                 std::to_string(merged.conflicts.size()) + " conflicts");
+
+    fs::current_path(original_dir);
+    fs::remove_all(root);
+    std::cout.rdbuf(chatter);
+    return 0;
+}
@@ -0,0 +1,132 @@
+// index-pack benchmark
+// Writes a synthetic pack of many files, each with a long chain of edited
+// versions (400 files x 50 versions of ~8 KiB by default), then streams it
+// through PackIndexer with 1, 2, 4, ... threads up to one per core and
+// reports the time and speedup of each run. Every run must produce the same
+// index.
+//
+// Usage: dgit_index_pack_bench [files] [versions] [directory]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "dgit/pack_indexer.hpp"
+#include "dgit/packfile.hpp"
+#include "dgit/thread_pool.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t kLinesPerFile = 200;
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string read_file(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+// Each version rewrites a few lines of the one before, so the writer
+// stores most versions as deltas against their neighbours
+size_t write_source_pack(const fs::path& pack_path, size_t files, size_t versions) {
+    dgit::PackWriter writer(pack_path.string(), fs::path(pack_path).replace_extension(".idx").string());
+    uint64_t seed = 12345;
+    auto next = [&seed] {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        return seed >> 33;
+    };
+    for (size_t file = 0; file < files; ++file) {
+        std::vector<std::string> lines;
+        for (size_t i = 0; i < kLinesPerFile; ++i) {
+            lines.push_back("file " + std::to_string(file) + " line " + std::to_string(i) + " value " +
+                            std::to_string(next()) + "\n");
+        }
+        for (size_t version = 0; version < versions; ++version) {
+            for (int edit = 0; edit < 3; ++edit) {
+                lines[next() % lines.size()] = "edited in version " + std::to_string(version) + " " +
+                                               std::to_string(next()) + "\n";
+            }
+            std::string content;
+            for (const auto& line : lines) {
+                content += line;
+            }
+            dgit::Blob blob(content);
+            writer.add_object(blob.id(), dgit::ObjectType::Blob, std::move(content), "f" + std::to_string(file));
+        }
+    }
+    writer.finalize();
+    return writer.entries().size();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t files = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 400;
+    size_t versions = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 50;
+    fs::path root = argc > 3 ? fs::path(argv[3]) : fs::temp_directory_path() / "dgit_index_pack_bench";
+
+    fs::remove_all(root);
+    fs::create_directories(root);
+
+    std::printf("index-pack benchmark: %zu files x %zu versions, %s\n\n", files, versions, root.c_str());
+
+    fs::path source = root / "source.pack";
+    auto start = std::chrono::steady_clock::now();
+    size_t objects = write_source_pack(source, files, versions);
+    std::string pack = read_file(source);
+    std::printf("%-28s %8.3f s  (%zu objects, %.1f MiB)\n\n", "write pack", seconds_since(start), objects,
+                pack.size() / (1024.0 * 1024.0));
+
+    std::vector<size_t> thread_counts;
+    size_t cores = dgit::default_threads();
+    for (size_t threads = 1; threads < cores; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(cores);
+
+    std::string expected_idx;
+    double serial = 0;
+    for (size_t threads : thread_counts) {
+        fs::path dir = root / ("threads-" + std::to_string(threads));
+        start = std::chrono::steady_clock::now();
+        std::string installed;
+        {
+            // Fed in 64 KiB chunks, as a transport delivers it
+            dgit::PackIndexer indexer(dir.string());
+            indexer.set_threads(threads);
+            constexpr size_t kChunk = 64 * 1024;
+            const auto* data = reinterpret_cast<const uint8_t*>(pack.data());
+            for (size_t pos = 0; pos < pack.size(); pos += kChunk) {
+                indexer.write(data + pos, std::min(kChunk, pack.size() - pos));
+            }
+            installed = indexer.finish();
+        }
+        double elapsed = seconds_since(start);
+        if (threads == 1) {
+            serial = elapsed;
+        }
+
+        char label[64];
+        std::snprintf(label, sizeof(label), "index-pack, %zu thread%s", threads, threads == 1 ? "" : "s");
+        std::printf("%-28s %8.3f s  (%.2fx)\n", label, elapsed, serial / elapsed);
+
+        std::string idx = read_file(fs::path(installed).replace_extension(".idx"));
+        if (expected_idx.empty()) {
+            expected_idx = idx;
+        } else if (idx != expected_idx) {
+            std::printf("  unexpected: index differs from the serial run\n");
+        }
+        fs::remove_all(dir);
+    }
+
+    fs::remove_all(root);
+    return 0;
+}
@@ -0,0 +1,190 @@
+// Merge-base benchmark
+// Builds a synthetic history of two long-lived branches (50k commits each
+// by default) that merge into each other every 1000 commits, plus a short
+// branch forked near the root, then times merge-base and ancestry queries:
+// a full-history walk collecting ancestors in a std::set as before, the
+// paint-down engine on parsed commits, and the engine over a commit-graph.
+//
+// Usage: dgit_merge_base_bench [commits-per-branch] [directory]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dgit/commit_graph.hpp"
+#include "dgit/merge_base.hpp"
+#include "dgit/object_database.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t kMergeInterval = 1000;
+
+struct History {
+    dgit::ObjectId main_tip;
+    dgit::ObjectId topic_tip;
+    dgit::ObjectId old_tip;   // forked near the root
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+dgit::ObjectId store_commit(dgit::ObjectDatabase& db, const std::vector<dgit::ObjectId>& parents, int64_t time) {
+    static const dgit::ObjectId tree = dgit::ObjectId::from_hex("4b825dc642cb6eb9a060e54bf8d69288fbee4904");
+    dgit::Person person("Bench", "bench@example.com", std::chrono::system_clock::time_point(std::chrono::seconds(time)));
+    auto commit = std::make_unique<dgit::Commit>(tree, parents, person, person, "commit " + std::to_string(time) + "\n");
+    dgit::ObjectId id = commit->id();
+    db.store(std::move(commit));
+    return id;
+}
+
+History create_history(dgit::ObjectDatabase& db, size_t per_branch) {
+    int64_t time = 1000000000;
+    History history;
+    history.main_tip = store_commit(db, {}, time++);
+    history.topic_tip = history.main_tip;
+    for (size_t i = 0; i < per_branch; ++i) {
+        // Each branch is merged into the other once per interval, half an
+        // interval apart
+        if (i % kMergeInterval == kMergeInterval / 2) {
+            history.main_tip = store_commit(db, {history.main_tip, history.topic_tip}, time++);
+        } else {
+            history.main_tip = store_commit(db, {history.main_tip}, time++);
+        }
+        if (i == 10) {
+            history.old_tip = history.main_tip;
+        }
+        if (i % kMergeInterval == kMergeInterval - 1) {
+            history.topic_tip = store_commit(db, {history.topic_tip, history.main_tip}, time++);
+        } else {
+            history.topic_tip = store_commit(db, {history.topic_tip}, time++);
+        }
+    }
+    for (size_t i = 0; i < 10; ++i) {
+        history.old_tip = store_commit(db, {history.old_tip}, time++);
+    }
+    // One last commit on main so its tip is past the last merge
+    history.main_tip = store_commit(db, {history.main_tip}, time++);
+    return history;
+}
+
+// The walk this replaces: every ancestor of one side as hex strings, then
+// the other side's history newest first until it meets one
+dgit::ObjectId naive_merge_base(dgit::ObjectDatabase& db, const dgit::ObjectId& one, const dgit::ObjectId& two) {
+    std::set<std::string> ancestors;
+    std::vector<dgit::ObjectId> stack{one};
+    while (!stack.empty()) {
+        dgit::ObjectId id = stack.back();
+        stack.pop_back();
+        if (!ancestors.insert(id.hex()).second) {
+            continue;
+        }
+        for (const auto& parent : dgit::read_commit_info(db, id).parents) {
+            stack.push_back(parent);
+        }
+    }
+
+    std::set<std::string> seen;
+    std::deque<dgit::ObjectId> pending{two};
+    while (!pending.empty()) {
+        dgit::ObjectId id = pending.front();
+        pending.pop_front();
+        if (ancestors.count(id.hex())) {
+            return id;
+        }
+        if (!seen.insert(id.hex()).second) {
+            continue;
+        }
+        for (const auto& parent : dgit::read_commit_info(db, id).parents) {
+            pending.push_back(parent);
+        }
+    }
+    return {};
+}
+
+void report(const char* label, double elapsed, const dgit::MergeBaseEngine* engine) {
+    if (engine) {
+        std::printf("%-34s %8.3f s  (%zu commits walked)\n", label, elapsed, engine->stats().commits_walked);
+    } else {
+        std::printf("%-34s %8.3f s\n", label, elapsed);
+    }
+}
+
+void run_queries(const char* mode, dgit::ObjectDatabase& db, const History& history) {
+    char label[64];
+
+    {
+        dgit::MergeBaseEngine engine(db);
+        auto start = std::chrono::steady_clock::now();
+        auto bases = engine.merge_bases(history.main_tip, {history.topic_tip});
+        std::snprintf(label, sizeof(label), "merge-base main topic, %s", mode);
+        report(label, seconds_since(start), &engine);
+        if (bases.size() != 1) {
+            std::printf("  unexpected: %zu bases\n", bases.size());
+        }
+    }
+    {
+        dgit::MergeBaseEngine engine(db);
+        auto start = std::chrono::steady_clock::now();
+        engine.merge_bases(history.main_tip, {history.old_tip});
+        std::snprintf(label, sizeof(label), "merge-base main old, %s", mode);
+        report(label, seconds_since(start), &engine);
+    }
+    {
+        dgit::MergeBaseEngine engine(db);
+        auto start = std::chrono::steady_clock::now();
+        engine.octopus_bases({history.main_tip, history.topic_tip, history.old_tip});
+        std::snprintf(label, sizeof(label), "octopus main topic old, %s", mode);
+        report(label, seconds_since(start), &engine);
+    }
+    {
+        dgit::MergeBaseEngine engine(db);
+        auto start = std::chrono::steady_clock::now();
+        bool reachable = engine.is_ancestor(history.old_tip, history.topic_tip);
+        std::snprintf(label, sizeof(label), "is-ancestor old topic, %s", mode);
+        report(label, seconds_since(start), &engine);
+        if (reachable) {
+            std::printf("  unexpected: old is reachable from topic\n");
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t per_branch = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 50000;
+    fs::path root = argc > 2 ? fs::path(argv[2]) : fs::temp_directory_path() / "dgit_merge_base_bench";
+
+    fs::remove_all(root);
+    fs::create_directories(root / ".git" / "objects");
+    fs::path original_dir = fs::current_path();
+    fs::current_path(root);
+
+    std::printf("Merge-base benchmark: %zu commits per branch, %s\n\n", per_branch, root.c_str());
+
+    dgit::ObjectDatabase db(".git");
+    auto start = std::chrono::steady_clock::now();
+    History history = create_history(db, per_branch);
+    std::printf("%-34s %8.3f s\n\n", "create history", seconds_since(start));
+
+    start = std::chrono::steady_clock::now();
+    naive_merge_base(db, history.main_tip, history.topic_tip);
+    report("merge-base main topic, std::set", seconds_since(start), nullptr);
+    run_queries("parsed", db, history);
+
+    start = std::chrono::steady_clock::now();
+    auto written = dgit::write_commit_graph(db, {history.main_tip, history.topic_tip, history.old_tip});
+    std::printf("\n%-34s %8.3f s  (%zu commits)\n", "write commit-graph", seconds_since(start), written.commits);
+    run_queries("graph", db, history);
+
+    fs::current_path(original_dir);
+    fs::remove_all(root);
+    return 0;
+}
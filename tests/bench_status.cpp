@@ -0,0 +1,142 @@
+// Status benchmark
+// Builds a synthetic work tree (500k files by default), stages it, and
+// times the stat pass serially through full paths, then through the
+// parallel status engine, plus the untracked walk (plain and through the
+// untracked cache) and a run with a percent of the files touched so they
+// must be rehashed.
+//
+// Usage: dgit_status_bench [file-count] [directory]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "dgit/index.hpp"
+#include "dgit/status.hpp"
+#include "dgit/thread_pool.hpp"
+#include "dgit/untracked_cache.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr size_t kFilesPerDirectory = 100;
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::vector<std::string> create_tree(size_t count) {
+    std::vector<std::string> paths;
+    paths.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        size_t dir = i / kFilesPerDirectory;
+        std::string parent = "d" + std::to_string(dir / 100) + "/" + std::to_string(dir % 100);
+        if (i % kFilesPerDirectory == 0) {
+            fs::create_directories(parent);
+        }
+        paths.push_back(parent + "/file" + std::to_string(i) + ".txt");
+
+        std::string content = "synthetic file " + std::to_string(i) + "\n";
+        int fd = ::open(paths.back().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ::write(fd, content.data(), content.size()) != static_cast<ssize_t>(content.size())) {
+            std::perror(paths.back().c_str());
+            std::exit(1);
+        }
+        ::close(fd);
+    }
+    return paths;
+}
+
+// What status did before: one lstat() per entry through the full path
+double bench_serial_lstat(const dgit::Index& index) {
+    auto start = std::chrono::steady_clock::now();
+    size_t changed = 0;
+    for (const auto& entry : index.entries()) {
+        struct stat st;
+        if (::lstat(entry.path.c_str(), &st) != 0 || !entry.stat.matches(st)) {
+            ++changed;
+        }
+    }
+    double elapsed = seconds_since(start);
+    if (changed) {
+        std::printf("  (serial pass saw %zu changed entries)\n", changed);
+    }
+    return elapsed;
+}
+
+void report_status(const char* label, dgit::Index& index, size_t threads) {
+    dgit::StatusOptions options;
+    options.threads = threads;
+    options.untracked = false;
+
+    auto start = std::chrono::steady_clock::now();
+    dgit::WorktreeStatus status = dgit::compute_status(index, ".", options);
+    double elapsed = seconds_since(start);
+    std::printf("%-28s %8.3f s  (%zu modified, %zu rehashed)\n", label, elapsed, status.modified.size(),
+                status.rehashed);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 500000;
+    fs::path root = argc > 2 ? fs::path(argv[2]) : fs::temp_directory_path() / "dgit_status_bench";
+    size_t threads = dgit::default_threads();
+
+    fs::remove_all(root);
+    fs::create_directories(root / ".git");
+    fs::path original_dir = fs::current_path();
+    fs::current_path(root);
+
+    std::printf("Status benchmark: %zu files, %zu threads, %s\n\n", count, threads, root.c_str());
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> paths = create_tree(count);
+    std::printf("%-28s %8.3f s\n", "create tree", seconds_since(start));
+
+    start = std::chrono::steady_clock::now();
+    {
+        dgit::Index index(".git");
+        index.add_files(paths);
+        index.save();
+    }
+    std::printf("%-28s %8.3f s\n", "stage and write index", seconds_since(start));
+
+    start = std::chrono::steady_clock::now();
+    dgit::Index index(".git");
+    std::printf("%-28s %8.3f s  (%zu entries)\n\n", "load index", seconds_since(start), index.entry_count());
+
+    std::printf("%-28s %8.3f s\n", "serial lstat, full paths", bench_serial_lstat(index));
+    report_status("status, 1 thread", index, 1);
+    report_status("status, all threads", index, threads);
+
+    start = std::chrono::steady_clock::now();
+    size_t untracked = dgit::find_untracked_files(index).size();
+    std::printf("%-28s %8.3f s  (%zu untracked)\n", "untracked walk", seconds_since(start), untracked);
+
+    // First pass fills the cache, the second only stats directories
+    index.set_untracked_cache_enabled(true);
+    dgit::find_untracked_files(index);
+    start = std::chrono::steady_clock::now();
+    untracked = dgit::find_untracked_files(index).size();
+    std::printf("%-28s %8.3f s  (%zu directories cached)\n\n", "untracked, cached", seconds_since(start),
+                index.untracked_cache()->directories().size());
+
+    // Touch 1% of the files: stat data changes but content does not
+    auto now = fs::file_time_type::clock::now();
+    for (size_t i = 0; i < paths.size(); i += 100) {
+        fs::last_write_time(paths[i], now);
+    }
+    report_status("status, 1% touched", index, threads);
+
+    fs::current_path(original_dir);
+    fs::remove_all(root);
+    return 0;
+}
@@ -1,16 +1,43 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <thread>
 
 #include "dgit/repository.hpp"
 #include "dgit/sha1.hpp"
 #include "dgit/object.hpp"
 #include "dgit/config.hpp"
 #include "dgit/index.hpp"
+#include "dgit/cache_tree.hpp"
+#include "dgit/checkout.hpp"
+#include "dgit/status.hpp"
+#include "dgit/untracked_cache.hpp"
+#include "dgit/fsmonitor.hpp"
+#include "dgit/packed_refs.hpp"
+#include "dgit/reftable.hpp"
+#include "dgit/merge_tree.hpp"
+#include "dgit/rename_detection.hpp"
+#include "dgit/tree_builder.hpp"
+#include "dgit/tree_iterator.hpp"
+#include "dgit/thread_pool.hpp"
+#include "dgit/trace.hpp"
+#include "dgit/pkt_line.hpp"
+#include "dgit/quote.hpp"
+#include "dgit/ssh_url.hpp"
 
 namespace fs = std::filesystem;
 
+// Deterministic stand-in object ID derived from a readable label
+static dgit::ObjectId fake_id(const std::string& label) {
+    auto digest = dgit::SHA1::hash_raw(reinterpret_cast<const uint8_t*>(label.data()), label.size());
+    return dgit::ObjectId::from_raw(digest.data());
+}
+
 // Test fixture for repository tests
 class RepositoryTest : public ::testing::Test {
 protected:
@@ -73,24 +100,24 @@ TEST(ObjectTest, BlobCreation) {
 
     EXPECT_EQ(blob->type(), dgit::ObjectType::Blob);
     EXPECT_EQ(blob->data(), content);
-    EXPECT_FALSE(blob->id().empty());
-    EXPECT_EQ(blob->id().length(), 40);
+    EXPECT_FALSE(blob->id().is_null());
+    EXPECT_EQ(blob->id().hex().length(), 40);
 }
 
 TEST(ObjectTest, TreeCreation) {
     auto tree = std::make_unique<dgit::Tree>();
 
     // Add some entries
-    tree->add_entry(dgit::FileMode::Regular, "abc123", "file1.txt");
-    tree->add_entry(dgit::FileMode::Executable, "def456", "file2.sh");
+    tree->add_entry(dgit::FileMode::Regular, fake_id("abc123"), "file1.txt");
+    tree->add_entry(dgit::FileMode::Executable, fake_id("def456"), "file2.sh");
 
     EXPECT_EQ(tree->type(), dgit::ObjectType::Tree);
-    EXPECT_FALSE(tree->id().empty());
+    EXPECT_FALSE(tree->id().is_null());
 }
 
 TEST(ObjectTest, CommitCreation) {
-    std::string tree_id = "abc123";
-    std::vector<std::string> parents = {"def456"};
+    dgit::ObjectId tree_id = fake_id("abc123");
+    std::vector<dgit::ObjectId> parents = {fake_id("def456")};
     dgit::Person author("Test Author", "author@example.com", std::chrono::system_clock::now());
     dgit::Person committer("Test Committer", "committer@example.com", std::chrono::system_clock::now());
     std::string message = "Test commit";
@@ -102,7 +129,7 @@ TEST(ObjectTest, CommitCreation) {
     EXPECT_EQ(commit->parent_ids(), parents);
     EXPECT_EQ(commit->author().name, author.name);
     EXPECT_EQ(commit->message(), message);
-    EXPECT_FALSE(commit->id().empty());
+    EXPECT_FALSE(commit->id().is_null());
 }
 
 // Test configuration system
@@ -183,8 +210,8 @@ TEST_F(RepositoryTest, BlobCreation) {
     // Write blob
     auto blob_id = repo.write_blob(filename);
 
-    EXPECT_FALSE(blob_id.empty());
-    EXPECT_EQ(blob_id.length(), 40);
+    EXPECT_FALSE(blob_id.is_null());
+    EXPECT_EQ(blob_id.hex().length(), 40);
 
     // Read blob content
     std::string read_content = repo.read_file(blob_id, "read_test.txt");
@@ -231,12 +258,467 @@ TEST_F(RepositoryTest, IndexOperations) {
     fs::remove(file2);
 }
 
+TEST_F(RepositoryTest, IndexRoundTripKeepsStatData) {
+    fs::create_directories(".git");
+    std::ofstream("tracked.txt") << "tracked";
+    fs::create_directories("dir/sub");
+    std::ofstream("dir/sub/deep.txt") << "deep";
+
+    for (uint32_t version : {2u, 4u}) {
+        {
+            dgit::Index index(".git");
+            index.set_version(version);
+            index.add_files({"tracked.txt", "dir/sub/deep.txt"});
+            index.save();
+            EXPECT_FALSE(fs::exists(".git/index.lock"));
+        }
+
+        // Cached stat data survives a reload, so nothing looks modified
+        dgit::Index reloaded(".git");
+        EXPECT_EQ(reloaded.version(), version);
+        EXPECT_EQ(reloaded.entry_count(), 2u);
+        EXPECT_EQ(reloaded.get_entry("dir/sub/deep.txt").blob_id, dgit::Blob("deep").id());
+        EXPECT_TRUE(reloaded.get_modified_files().empty());
+        fs::remove(".git/index");
+    }
+
+    {
+        dgit::Index index(".git");
+        index.add_file("tracked.txt");
+        index.save();
+    }
+    std::ofstream("tracked.txt") << "changed content";
+    EXPECT_EQ(dgit::Index(".git").get_modified_files(), std::vector<std::string>{"tracked.txt"});
+}
+
+TEST_F(RepositoryTest, IndexRejectsCorruptionAndConcurrentWriters) {
+    fs::create_directories(".git");
+    std::ofstream("file.txt") << "content";
+    {
+        dgit::Index index(".git");
+        index.add_file("file.txt");
+        index.save();
+    }
+
+    // A second writer holding the lock makes save() fail without damage
+    std::ofstream(".git/index.lock") << "";
+    {
+        dgit::Index index(".git");
+        index.remove_file("file.txt");
+        EXPECT_THROW(index.save(), dgit::GitException);
+    }
+    fs::remove(".git/index.lock");
+    EXPECT_EQ(dgit::Index(".git").entry_count(), 1u);
+
+    // Flipping one byte breaks the trailing checksum
+    std::string bytes;
+    {
+        std::ifstream in(".git/index", std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    bytes[20] ^= 1;
+    std::ofstream(".git/index", std::ios::binary) << bytes;
+    EXPECT_THROW(dgit::Index(".git").entry_count(), dgit::GitException);
+}
+
+TEST_F(RepositoryTest, IndexKeepsEveryStageOfUnmergedPaths) {
+    fs::create_directories(".git");
+
+    // A v2 index as git leaves it after a conflicted merge
+    auto be32 = [](std::string& out, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back(static_cast<char>(value >> shift));
+        }
+    };
+    std::string bytes = "DIRC";
+    be32(bytes, 2);
+    be32(bytes, 5);
+    auto entry = [&](const std::string& path, const std::string& label, uint16_t stage) {
+        size_t start = bytes.size();
+        for (int field = 0; field < 6; ++field) {
+            be32(bytes, 0);
+        }
+        be32(bytes, 0100644);
+        for (int field = 0; field < 3; ++field) {
+            be32(bytes, 0);
+        }
+        dgit::ObjectId id = fake_id(label);
+        bytes.append(reinterpret_cast<const char*>(id.data()), dgit::ObjectId::kRawSize);
+        uint16_t flags = static_cast<uint16_t>((stage << 12) | path.size());
+        bytes.push_back(static_cast<char>(flags >> 8));
+        bytes.push_back(static_cast<char>(flags));
+        bytes += path;
+        do {
+            bytes.push_back('\0');
+        } while ((bytes.size() - start) % 8 != 0);
+    };
+    entry("a.txt", "a", 0);
+    entry("conflict.txt", "base", 1);
+    entry("conflict.txt", "ours", 2);
+    entry("conflict.txt", "theirs", 3);
+    entry("z.txt", "z", 0);
+    auto checksum = dgit::SHA1::hash_raw(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+    bytes.append(reinterpret_cast<const char*>(checksum.data()), checksum.size());
+    std::ofstream(".git/index", std::ios::binary) << bytes;
+
+    auto stages_of = [](const dgit::Index& index, const std::string& path) {
+        std::vector<std::pair<int, dgit::ObjectId>> stages;
+        for (const auto& e : index.entries()) {
+            if (e.path == path) {
+                stages.emplace_back((e.flags >> 12) & 3, e.blob_id);
+            }
+        }
+        return stages;
+    };
+    std::vector<std::pair<int, dgit::ObjectId>> expected = {
+        {1, fake_id("base")}, {2, fake_id("ours")}, {3, fake_id("theirs")}};
+    {
+        dgit::Index index(".git");
+        EXPECT_EQ(index.entry_count(), 5u);
+        EXPECT_EQ(stages_of(index, "conflict.txt"), expected);
+
+        // A rewrite keeps the conflict
+        index.add_entry("b.txt", fake_id("b"), dgit::FileMode::Regular, {});
+        index.save();
+    }
+    {
+        dgit::Index index(".git");
+        EXPECT_EQ(index.entry_count(), 6u);
+        EXPECT_EQ(stages_of(index, "conflict.txt"), expected);
+
+        // Staging the path resolves it to a single stage-0 entry
+        index.add_entry("conflict.txt", fake_id("resolved"), dgit::FileMode::Regular, {});
+        std::vector<std::pair<int, dgit::ObjectId>> resolved = {{0, fake_id("resolved")}};
+        EXPECT_EQ(stages_of(index, "conflict.txt"), resolved);
+        EXPECT_EQ(index.entry_count(), 4u);
+    }
+}
+
+TEST_F(RepositoryTest, IndexBatchesOutOfOrderMutations) {
+    fs::create_directories(".git");
+    dgit::Index index(".git");
+
+    // Reverse order defeats the append fast path, so everything is merged
+    const int count = 50000;
+    for (int i = count - 1; i >= 0; --i) {
+        index.add_entry("dir/file" + std::to_string(i), fake_id(std::to_string(i)), dgit::FileMode::Regular, {});
+    }
+    for (int i = 0; i < count; i += 2) {
+        index.remove_entry("dir/file" + std::to_string(i));
+    }
+    index.add_entry("dir/file0", fake_id("again"), dgit::FileMode::Regular, {});
+    index.remove_entry("missing");
+
+    EXPECT_EQ(index.entry_count(), static_cast<size_t>(count / 2 + 1));
+    EXPECT_EQ(index.get_entry("dir/file0").blob_id, fake_id("again"));
+    EXPECT_FALSE(index.has_entry("dir/file2"));
+    EXPECT_TRUE(index.has_entry("dir/file3"));
+
+    auto files = index.list_files();
+    EXPECT_TRUE(std::is_sorted(files.begin(), files.end()));
+    EXPECT_EQ(std::adjacent_find(files.begin(), files.end()), files.end());
+
+    // Replacing in place and appending keep the order without a merge
+    index.add_entry("dir/file3", fake_id("replaced"), dgit::FileMode::Executable, {});
+    index.add_entry("zzz", fake_id("last"), dgit::FileMode::Regular, {});
+    EXPECT_EQ(index.get_entry("dir/file3").mode, dgit::FileMode::Executable);
+    EXPECT_EQ(index.list_files().back(), "zzz");
+
+    index.save();
+    EXPECT_EQ(dgit::Index(".git").list_files(), index.list_files());
+}
+
+TEST_F(RepositoryTest, StatusRehashesOnlyInconclusiveEntries) {
+    fs::create_directories(".git");
+    fs::create_directories("dir");
+    for (const char* path : {"a.txt", "dir/b.txt", "dir/c.txt", "gone.txt"}) {
+        std::ofstream(path) << "content of " << path;
+        // Well before the index write, so the entries are not racy
+        fs::last_write_time(path, fs::file_time_type::clock::now() - std::chrono::hours(1));
+    }
+    {
+        dgit::Index index(".git");
+        index.add_files({"a.txt", "dir/b.txt", "dir/c.txt", "gone.txt"});
+        index.save();
+    }
+
+    dgit::Index index(".git");
+    auto clean = dgit::compute_status(index);
+    EXPECT_TRUE(clean.modified.empty());
+    EXPECT_EQ(clean.rehashed, 0u);
+    EXPECT_TRUE(clean.untracked.empty());
+
+    // Same size and mtime but new content: only the ctime gives it away
+    auto mtime = fs::last_write_time("dir/b.txt");
+    std::ofstream("dir/b.txt") << "CONTENT OF dir/b.txt";
+    fs::last_write_time("dir/b.txt", mtime);
+    // Touched but unchanged
+    fs::last_write_time("a.txt", fs::file_time_type::clock::now());
+    fs::remove("gone.txt");
+    std::ofstream("new.txt") << "new";
+
+    dgit::StatusOptions options;
+    options.threads = 2;
+    auto status = dgit::compute_status(index, ".", options);
+    EXPECT_EQ(status.modified, std::vector<std::string>{"dir/b.txt"});
+    EXPECT_EQ(status.deleted, std::vector<std::string>{"gone.txt"});
+    EXPECT_EQ(status.untracked, std::vector<std::string>{"new.txt"});
+    EXPECT_EQ(status.rehashed, 2u);
+    EXPECT_EQ(index.get_modified_files(), (std::vector<std::string>{"dir/b.txt", "gone.txt"}));
+}
+
+TEST_F(RepositoryTest, StatusTreatsRacyEntriesAsSuspect) {
+    fs::create_directories(".git");
+    std::ofstream("racy.txt") << "before";
+    // Modified no earlier than the index write: stat data cannot be trusted
+    auto future = fs::file_time_type::clock::now() + std::chrono::hours(1);
+    fs::last_write_time("racy.txt", future);
+    {
+        dgit::Index index(".git");
+        index.add_file("racy.txt");
+        index.save();
+    }
+
+    dgit::Index index(".git");
+    EXPECT_TRUE(index.is_racy(index.get_entry("racy.txt")));
+    auto status = dgit::compute_status(index);
+    EXPECT_TRUE(status.modified.empty());
+    EXPECT_EQ(status.rehashed, 1u);
+    // Content still matched when written, so the size was kept
+    EXPECT_NE(index.get_entry("racy.txt").stat.size, 0u);
+
+    // A same-size edit inside the racy window is smudged on the next write
+    std::ofstream("racy.txt") << "after!";
+    fs::last_write_time("racy.txt", future);
+    std::ofstream("other.txt") << "other";
+    index.add_file("other.txt");
+    index.save();
+
+    dgit::Index reloaded(".git");
+    EXPECT_EQ(reloaded.get_entry("racy.txt").stat.size, 0u);
+    EXPECT_EQ(dgit::compute_status(reloaded).modified, std::vector<std::string>{"racy.txt"});
+}
+
+TEST_F(RepositoryTest, IndexSkipsOptionalExtensionsOnly) {
+    fs::create_directories(".git");
+    std::ofstream("file.txt") << "content";
+    {
+        dgit::Index index(".git");
+        index.add_file("file.txt");
+        index.save();
+    }
+    std::string bytes;
+    {
+        std::ifstream in(".git/index", std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    bytes.resize(bytes.size() - 20);
+
+    auto write_with_extension = [&](const std::string& signature) {
+        std::string body = bytes + signature + std::string("\0\0\0\4abcd", 8);
+        auto digest = dgit::SHA1::hash_raw(reinterpret_cast<const uint8_t*>(body.data()), body.size());
+        std::ofstream(".git/index", std::ios::binary) << body << std::string(digest.begin(), digest.end());
+    };
+
+    // Upper-case signatures (like git's TREE) may be ignored...
+    write_with_extension("TREE");
+    EXPECT_EQ(dgit::Index(".git").entry_count(), 1u);
+    // ...anything else changes how the index must be read
+    write_with_extension("link");
+    EXPECT_THROW(dgit::Index(".git").entry_count(), dgit::GitException);
+}
+
+TEST_F(RepositoryTest, UntrackedCacheSkipsUnchangedDirectories) {
+    fs::create_directories(".git");
+    fs::create_directories("src/lib");
+    fs::create_directories("docs");
+    for (const char* path : {"src/main.c", "src/lib/util.c", "src/lib/notes.txt", "docs/draft.md", "top.txt"}) {
+        std::ofstream(path) << path;
+    }
+    // Directories changed in the last second are never trusted
+    auto old = fs::file_time_type::clock::now() - std::chrono::hours(1);
+    for (const char* dir : {".", "src", "src/lib", "docs"}) {
+        fs::last_write_time(dir, old);
+    }
+
+    {
+        dgit::Index index(".git");
+        index.set_untracked_cache_enabled(true);
+        index.add_files({"src/main.c", "src/lib/util.c"});
+        EXPECT_EQ(dgit::find_untracked_files(index),
+                  (std::vector<std::string>{"docs/draft.md", "src/lib/notes.txt", "top.txt"}));
+        EXPECT_EQ(index.untracked_cache()->directories().size(), 4u);
+        index.save();
+    }
+
+    // The cache survives in the index and no directory is read again
+    dgit::Index index(".git");
+    index.set_untracked_cache_enabled(true);
+    dgit::UntrackedCache::ScanStats stats;
+    auto is_tracked = [&index](std::string_view path) { return index.has_entry(std::string(path)); };
+    auto untracked = index.untracked_cache()->scan(".", is_tracked, false, &stats);
+    EXPECT_EQ(untracked, (std::vector<std::string>{"docs/draft.md", "src/lib/notes.txt", "top.txt"}));
+    EXPECT_EQ(stats.directories_read, 0u);
+    EXPECT_EQ(stats.directories_reused, 4u);
+
+    // A new file moves its directory's mtime; only that one is re-read
+    std::ofstream("docs/new.md") << "new";
+    index.untracked_cache()->scan(".", is_tracked, false, &stats);
+    EXPECT_EQ(stats.directories_read, 1u);
+
+    // Staging a file invalidates its directory's cached list
+    index.add_file("docs/draft.md");
+    EXPECT_EQ(dgit::find_untracked_files(index),
+              (std::vector<std::string>{"docs/new.md", "src/lib/notes.txt", "top.txt"}));
+}
+
+namespace {
+// Scripted monitor: hands out queued answers and records the tokens asked
+class FakeFsMonitor : public dgit::FsMonitor {
+public:
+    dgit::FsMonitorChanges changes_since(const std::string& token) override {
+        tokens.push_back(token);
+        dgit::FsMonitorChanges next = answers.front();
+        answers.erase(answers.begin());
+        return next;
+    }
+
+    std::vector<dgit::FsMonitorChanges> answers;
+    std::vector<std::string> tokens;
+};
+}
+
+TEST_F(RepositoryTest, FsMonitorLimitsStatusToReportedPaths) {
+    fs::create_directories(".git");
+    fs::create_directories("dir");
+    for (const char* path : {"a.txt", "dir/b.txt", "dir/c.txt"}) {
+        std::ofstream(path) << path;
+        fs::last_write_time(path, fs::file_time_type::clock::now() - std::chrono::hours(1));
+    }
+    {
+        dgit::Index index(".git");
+        index.add_files({"a.txt", "dir/b.txt", "dir/c.txt"});
+        index.save();
+    }
+
+    FakeFsMonitor monitor;
+    monitor.answers.push_back({"t1", true, {}});
+    monitor.answers.push_back({"t2", false, {"dir/"}});
+    monitor.answers.push_back({"t3", false, {}});
+    dgit::StatusOptions options;
+    options.fsmonitor = &monitor;
+
+    {
+        dgit::Index index(".git");
+        auto full = dgit::compute_status(index, ".", options);
+        EXPECT_EQ(full.checked, 3u);
+        index.save_caches();
+    }
+
+    // Unreported changes are not seen: exactly what the monitor vouches for
+    std::ofstream("a.txt") << "edited but not reported";
+    std::ofstream("dir/b.txt") << "edited";
+
+    dgit::Index index(".git");
+    EXPECT_EQ(index.fsmonitor_token(), "t1");
+    auto narrowed = dgit::compute_status(index, ".", options);
+    EXPECT_EQ(narrowed.checked, 2u);
+    EXPECT_EQ(narrowed.modified, std::vector<std::string>{"dir/b.txt"});
+    index.save_caches();
+
+    // Still-dirty entries are rechecked even when nothing is reported
+    dgit::Index reloaded(".git");
+    EXPECT_EQ(reloaded.fsmonitor_dirty(), std::vector<std::string>{"dir/b.txt"});
+    auto again = dgit::compute_status(reloaded, ".", options);
+    EXPECT_EQ(again.checked, 1u);
+    EXPECT_EQ(again.modified, std::vector<std::string>{"dir/b.txt"});
+    EXPECT_EQ(monitor.tokens, (std::vector<std::string>{"", "t1", "t2"}));
+}
+
+TEST_F(RepositoryTest, FsMonitorHookAndInotify) {
+    std::ofstream("hook.sh") << "#!/bin/sh\n"
+                                "[ \"$1\" = 2 ] || exit 1\n"
+                                "printf 'next\\0a.txt\\0dir/\\0'\n";
+    fs::permissions("hook.sh", fs::perms::owner_all);
+    dgit::HookFsMonitor hook("./hook.sh", ".");
+    auto changes = hook.changes_since("previous");
+    EXPECT_FALSE(changes.everything);
+    EXPECT_EQ(changes.token, "next");
+    EXPECT_EQ(changes.paths, (std::vector<std::string>{"a.txt", "dir/"}));
+    // No previous token: nothing to be relative to
+    EXPECT_TRUE(hook.changes_since("").everything);
+
+#ifdef __linux__
+    fs::create_directories("watched/sub");
+    dgit::InotifyFsMonitor watcher(".");
+    std::string token = watcher.changes_since("").token;
+    std::ofstream("watched/sub/file.txt") << "x";
+    fs::create_directories("watched/newdir");
+    std::ofstream("watched/newdir/inner.txt") << "y";
+
+    auto seen = watcher.changes_since(token);
+    EXPECT_FALSE(seen.everything);
+    auto has = [&seen](const std::string& path) {
+        return std::find(seen.paths.begin(), seen.paths.end(), path) != seen.paths.end();
+    };
+    EXPECT_TRUE(has("watched/sub/file.txt"));
+    EXPECT_TRUE(has("watched/newdir/"));
+    EXPECT_TRUE(watcher.changes_since("someone else's token").everything);
+#endif
+}
+
+TEST_F(RepositoryTest, CacheTreeRebuildsOnlyDirtyDirectories) {
+    fs::create_directories(".git");
+    std::map<dgit::ObjectId, std::string> trees;
+    dgit::CacheTreeStore store;
+    store.has_object = [&trees](const dgit::ObjectId& id) { return trees.count(id) > 0; };
+    store.store_tree = [&trees](std::unique_ptr<dgit::Tree> tree) { trees[tree->id()] = tree->data(); };
+
+    dgit::ObjectId root;
+    {
+        dgit::Index index(".git");
+        for (int i = 0; i < 120; ++i) {
+            std::string dir = "d" + std::to_string(i % 4) + "/s" + std::to_string(i % 3);
+            index.add_entry(dir + "/f" + std::to_string(i), fake_id(std::to_string(i)), dgit::FileMode::Regular, {});
+        }
+        index.add_entry("top.txt", fake_id("top"), dgit::FileMode::Regular, {});
+
+        auto first = index.cache_tree().update(index.entries(), store);
+        EXPECT_EQ(first.trees_written, 17u);   // root, 4 directories, 12 subdirectories
+        EXPECT_EQ(index.cache_tree().update(index.entries(), store).trees_written, 0u);
+
+        // One changed file rewrites its directory and the ones above it
+        index.add_entry("d1/s2/f5", fake_id("changed"), dgit::FileMode::Regular, {});
+        auto second = index.cache_tree().update(index.entries(), store);
+        EXPECT_EQ(second.trees_written, 3u);
+        EXPECT_NE(second.root, first.root);
+        root = second.root;
+        index.save();
+    }
+
+    // The TREE extension survives a reload and still matches a full rebuild
+    dgit::Index index(".git");
+    ASSERT_NE(index.cache_tree().root(), nullptr);
+    EXPECT_EQ(index.cache_tree().root()->id, root);
+    EXPECT_EQ(index.cache_tree().update(index.entries(), store).trees_written, 0u);
+
+    dgit::CacheTree fresh;
+    EXPECT_EQ(fresh.update(index.entries(), store).root, root);
+
+    // Removing a directory's last entry drops it from the tree
+    for (int i = 2; i < 120; i += 12) {
+        index.remove_entry("d2/s2/f" + std::to_string(i));
+    }
+    index.cache_tree().update(index.entries(), store);
+    EXPECT_EQ(index.cache_tree().root()->find("d2")->find("s2"), nullptr);
+}
+
 // Test reference management
 TEST_F(RepositoryTest, RefManagement) {
     auto repo = dgit::Repository::create(".");
 
     // Create a commit first (simplified)
-    std::string commit_id = "abc123";
+    dgit::ObjectId commit_id = fake_id("abc123");
 
     // Create branch
     repo.refs().create_ref("refs/heads/test-branch", commit_id);
@@ -256,6 +738,627 @@ TEST_F(RepositoryTest, RefManagement) {
     EXPECT_FALSE(repo.refs().ref_exists("refs/heads/test-branch"));
 }
 
+TEST_F(RepositoryTest, PackedRefsWithLooseOverrides) {
+    auto repo = dgit::Repository::create(".");
+    dgit::Person person("Test", "test@example.com", std::chrono::system_clock::now());
+
+    auto commit = std::make_unique<dgit::Commit>(fake_id("tree"), std::vector<dgit::ObjectId>{}, person, person, "c\n");
+    dgit::ObjectId commit_id = commit->id();
+    repo->objects().store(std::move(commit));
+    auto tag = std::make_unique<dgit::Tag>(commit_id, dgit::ObjectType::Commit, "annotated", person, "t\n");
+    dgit::ObjectId tag_id = tag->id();
+    repo->objects().store(std::move(tag));
+
+    for (int i = 0; i < 50; ++i) {
+        repo->refs().create_ref("refs/tags/t" + std::to_string(i), commit_id);
+    }
+    repo->refs().create_ref("refs/tags/annotated", tag_id);
+    repo->refs().create_ref("refs/heads/topic", commit_id);
+
+    // Tags only, unless --all
+    EXPECT_EQ(repo->refs().pack_refs(repo->objects(), false), 51u);
+    EXPECT_FALSE(fs::exists(".git/refs/tags/t7"));
+    EXPECT_TRUE(fs::exists(".git/refs/heads/topic"));
+    EXPECT_EQ(repo->refs().read_ref("refs/tags/t7"), commit_id);
+    EXPECT_EQ(repo->refs().list_tags().size(), 51u);
+
+    auto annotated = repo->refs().list_refs("refs/tags/annotated");
+    ASSERT_EQ(annotated.size(), 1u);
+    EXPECT_EQ(annotated[0].id, tag_id);
+    EXPECT_EQ(annotated[0].peeled, commit_id);
+
+    // A loose file overrides its packed entry; deleting removes both
+    repo->refs().update_ref("refs/tags/t3", fake_id("moved"));
+    EXPECT_EQ(repo->refs().read_ref("refs/tags/t3"), fake_id("moved"));
+    repo->refs().delete_ref("refs/tags/t5");
+    EXPECT_FALSE(repo->refs().ref_exists("refs/tags/t5"));
+
+    // topic and the moved t3; the unborn master stays loose
+    EXPECT_EQ(repo->refs().pack_refs(repo->objects(), true), 2u);
+    EXPECT_FALSE(fs::exists(".git/refs/heads/topic"));
+
+    auto reopened = dgit::Repository::open(".");
+    EXPECT_EQ(reopened->refs().read_ref("refs/heads/topic"), commit_id);
+    EXPECT_EQ(reopened->refs().read_ref("refs/tags/t3"), fake_id("moved"));
+    EXPECT_FALSE(reopened->refs().read_ref("refs/tags/t5").has_value());
+    auto tags = reopened->refs().list_tags();
+    EXPECT_EQ(tags.size(), 50u);
+    EXPECT_TRUE(std::is_sorted(tags.begin(), tags.end()));
+
+    // Files from older writers may be unsorted and lack peeled lines
+    {
+        std::ofstream file(".git/packed-refs", std::ios::trunc);
+        file << fake_id("z") << " refs/tags/z\n" << fake_id("a") << " refs/tags/a\n";
+    }
+    dgit::PackedRefs old(".git/packed-refs");
+    EXPECT_EQ(old.find("refs/tags/a")->id, fake_id("a"));
+    EXPECT_FALSE(old.find("refs/tags/t1").has_value());
+}
+
+TEST_F(RepositoryTest, ReftableBatchesLogsAndCompaction) {
+    fs::create_directories(".git");
+    {
+        std::ofstream head(".git/HEAD");
+        head << "ref: refs/heads/master\n";
+        std::ofstream config(".git/config");
+        config << "[core]\n\trepositoryformatversion = 1\n[extensions]\n\trefStorage = reftable\n";
+    }
+    auto repo = dgit::Repository::open(".");
+    dgit::Refs& refs = repo->refs();
+
+    // Enough refs for several blocks and an index, in a single table
+    std::vector<dgit::RefUpdate> batch;
+    for (int i = 0; i < 500; ++i) {
+        batch.push_back({"refs/heads/b" + std::to_string(i), fake_id("b" + std::to_string(i)), std::nullopt});
+    }
+    batch.push_back({"refs/tags/v1", fake_id("v1"), std::nullopt});
+    refs.update_refs(batch);
+    EXPECT_FALSE(fs::exists(".git/refs/heads/b7"));
+    EXPECT_EQ(refs.read_ref("refs/heads/b7"), fake_id("b7"));
+    EXPECT_EQ(refs.read_ref("refs/heads/b499"), fake_id("b499"));
+    EXPECT_FALSE(refs.ref_exists("refs/heads/b500"));
+    EXPECT_EQ(refs.list_branches().size(), 500u);
+    EXPECT_EQ(refs.list_tags(), std::vector<dgit::RefName>{"refs/tags/v1"});
+
+    // A stale expected value rejects the whole batch
+    EXPECT_THROW(refs.update_refs({{"refs/heads/b1", fake_id("new"), std::nullopt},
+                                   {"refs/heads/b2", fake_id("new"), fake_id("wrong")}}),
+                 dgit::GitException);
+    EXPECT_EQ(refs.read_ref("refs/heads/b1"), fake_id("b1"));
+
+    // Single updates merge into the big table geometrically
+    for (int i = 0; i < 40; ++i) {
+        refs.update_ref("refs/heads/b1", fake_id("b1." + std::to_string(i)));
+    }
+    refs.delete_ref("refs/heads/b2");
+    EXPECT_EQ(refs.read_ref("refs/heads/b1"), fake_id("b1.39"));
+    EXPECT_FALSE(refs.ref_exists("refs/heads/b2"));
+    EXPECT_EQ(refs.list_branches().size(), 499u);
+
+    dgit::ReftableStack stack(".git/reftable");
+    EXPECT_LE(stack.table_count(), 8u);
+    auto log = stack.logs("refs/heads/b1");
+    ASSERT_EQ(log.size(), 41u);
+    EXPECT_EQ(log[0].new_id, fake_id("b1.39"));
+    EXPECT_EQ(log[0].old_id, fake_id("b1.38"));
+    EXPECT_EQ(log.back().new_id, fake_id("b1"));
+
+    // Full compaction drops the deletion but keeps every log entry
+    stack.compact_all();
+    EXPECT_EQ(stack.table_count(), 1u);
+    EXPECT_FALSE(stack.read("refs/heads/b2").has_value());
+    EXPECT_EQ(stack.logs("refs/heads/b1").size(), 41u);
+    EXPECT_EQ(stack.logs("refs/heads/b2").size(), 2u);
+
+    auto reopened = dgit::Repository::open(".");
+    EXPECT_EQ(reopened->refs().read_ref("refs/heads/b1"), fake_id("b1.39"));
+    EXPECT_EQ(reopened->refs().list_refs("refs/heads/b4").size(), 111u);
+}
+
+TEST_F(RepositoryTest, ReftableReloadRetriesWhenCompactionRemovesTables) {
+    const std::string dir = ".git/reftable";
+    auto set_ref = [](dgit::ReftableStack& stack, const std::string& name) {
+        stack.transact([&](uint64_t update_index, std::vector<dgit::ReftableRef>& refs, std::vector<dgit::ReftableLog>&) {
+            dgit::ReftableRef ref;
+            ref.name = name;
+            ref.update_index = update_index;
+            ref.value = fake_id(name);
+            refs.push_back(std::move(ref));
+        });
+    };
+
+    dgit::ReftableStack writer(dir);
+    writer.set_auto_compact(false);
+    set_ref(writer, "refs/heads/a");
+    set_ref(writer, "refs/heads/b");
+    dgit::ReftableStack reader(dir);
+    EXPECT_EQ(reader.table_count(), 2u);
+    set_ref(writer, "refs/heads/c");
+
+    // The reader sees three tables listed, then another process compacts
+    // them away before it opens the new one
+    int compactions = 0;
+    reader.set_reload_hook([&] {
+        if (compactions++ == 0) {
+            dgit::ReftableStack other(dir);
+            other.compact_all();
+        }
+    });
+    auto c = reader.read("refs/heads/c");
+    ASSERT_TRUE(c.has_value());
+    EXPECT_EQ(c->value, fake_id("refs/heads/c"));
+    EXPECT_EQ(reader.list("refs/heads/").size(), 3u);
+    EXPECT_EQ(reader.table_count(), 1u);
+    EXPECT_EQ(compactions, 2);
+
+    // A table missing from a list nobody replaced is still an error
+    reader.set_reload_hook(nullptr);
+    set_ref(writer, "refs/heads/d");
+    std::string newest;
+    for (const auto& entry : fs::directory_iterator(dir)) {
+        std::string name = entry.path().filename().string();
+        if (name != "tables.list" && (newest.empty() || name > newest)) {
+            newest = name;
+        }
+    }
+    fs::remove(fs::path(dir) / newest);
+    EXPECT_THROW(reader.read("refs/heads/d"), dgit::GitException);
+}
+
+TEST(MergeLinesTest, TakesEachSidesHunksAndMarksOverlaps) {
+    std::string base = "a\nb\nc\nd\ne\n";
+    auto clean = dgit::merge_lines(base, "a\nB\nc\nd\ne\n", "a\nb\nc\nD\ne\nf\n");
+    EXPECT_EQ(clean.conflicts, 0u);
+    EXPECT_EQ(clean.content, "a\nB\nc\nD\ne\nf\n");
+
+    // The same change on both sides is not a conflict
+    auto same = dgit::merge_lines(base, "a\nb\nX\nd\ne\n", "a\nb\nX\nd\ne\n");
+    EXPECT_EQ(same.conflicts, 0u);
+
+    auto overlap = dgit::merge_lines(base, "a\nb\nours\nd\ne\n", "a\nb\ntheirs\nd\ne\n", "HEAD", "topic");
+    EXPECT_EQ(overlap.conflicts, 1u);
+    EXPECT_EQ(overlap.content, "a\nb\n<<<<<<< HEAD\nours\n=======\ntheirs\n>>>>>>> topic\nd\ne\n");
+
+    // Markers go on lines of their own after a last line without newline
+    auto unterminated = dgit::merge_lines("a\nb", "a\nours", "a\ntheirs", "HEAD", "topic");
+    EXPECT_EQ(unterminated.content, "a\n<<<<<<< HEAD\nours\n=======\ntheirs\n>>>>>>> topic\n");
+
+    // Lines both sides added alike stay outside the conflict block
+    auto added = dgit::merge_lines("", "x\ny\nw\n", "x\nz\nw\n", "HEAD", "topic");
+    EXPECT_EQ(added.conflicts, 1u);
+    EXPECT_EQ(added.content, "x\n<<<<<<< HEAD\ny\n=======\nz\n>>>>>>> topic\nw\n");
+}
+
+namespace {
+// Blob content of `path` in a merged tree
+std::string merged_file(dgit::ObjectDatabase& objects, dgit::ObjectId tree, const std::string& path) {
+    std::string rest = path;
+    for (;;) {
+        auto raw = objects.read_raw(tree);
+        size_t slash = rest.find('/');
+        std::string name = rest.substr(0, slash);
+        std::optional<dgit::ObjectId> found;
+        for (const auto& entry : dgit::TreeView(raw->data)) {
+            if (entry.name == name) {
+                found = entry.id();
+            }
+        }
+        if (!found) {
+            return "<missing>";
+        }
+        if (slash == std::string::npos) {
+            return objects.read_raw(*found)->data;
+        }
+        tree = *found;
+        rest = rest.substr(slash + 1);
+    }
+}
+
+// dir0..dir19, each with f0..f49; `files` overrides contents by path and
+// adds any other file in those directories
+dgit::ObjectId write_test_tree(dgit::ObjectDatabase& objects, const std::map<std::string, std::string>& files) {
+    dgit::TreeBuilder root;
+    for (int d = 0; d < 20; ++d) {
+        std::string prefix = "dir" + std::to_string(d) + "/";
+        std::map<std::string, std::string> contents;
+        for (int f = 0; f < 50; ++f) {
+            std::string name = "f" + std::to_string(f);
+            contents[name] = "line 1\nline 2\n" + prefix + name + "\nline 4\n";
+        }
+        for (auto it = files.lower_bound(prefix); it != files.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            contents[it->first.substr(prefix.size())] = it->second;
+        }
+        dgit::TreeBuilder dir;
+        for (const auto& [name, content] : contents) {
+            if (content == "<deleted>") {
+                continue;
+            }
+            auto blob = std::make_unique<dgit::Blob>(content);
+            dir.add(dgit::FileMode::Regular, blob->id(), name);
+            objects.store(std::move(blob));
+        }
+        auto tree = dir.build();
+        root.add(dgit::FileMode::Directory, tree->id(), "dir" + std::to_string(d));
+        objects.store(std::move(tree));
+    }
+    auto tree = root.build();
+    dgit::ObjectId id = tree->id();
+    objects.store(std::move(tree));
+    return id;
+}
+}
+
+TEST_F(RepositoryTest, TreeMergeReadsOnlyWhatBothSidesChanged) {
+    auto repo = dgit::Repository::create(".");
+    auto& objects = repo->objects();
+
+    dgit::ObjectId base = write_test_tree(objects, {});
+    dgit::ObjectId ours = write_test_tree(objects, {{"dir3/f1", "line 1\nours\ndir3/f1\nline 4\n"},
+                                                    {"dir7/f2", "only ours\n"},
+                                                    {"dir9/f0", "ours\n"}});
+    dgit::ObjectId theirs = write_test_tree(objects, {{"dir3/f1", "line 1\nline 2\ndir3/f1\ntheirs\n"},
+                                                      {"dir12/f5", "only theirs\n"},
+                                                      {"dir9/f0", "<deleted>"},
+                                                      {"dir9/f1", "theirs\n"}});
+
+    auto result = dgit::merge_trees(objects, base, ours, theirs);
+    // Roots and dir3 and dir9 on each side; dir3/f1 on each side. Looking
+    // for a rename of dir9/f0 diffs the base against theirs: the roots,
+    // dir3, dir9 and dir12
+    EXPECT_EQ(result.trees_read, 17u);
+    EXPECT_EQ(result.blobs_read, 3u);
+    EXPECT_EQ(result.content_merges, 1u);
+
+    EXPECT_EQ(merged_file(objects, result.tree, "dir3/f1"), "line 1\nours\ndir3/f1\ntheirs\n");
+    EXPECT_EQ(merged_file(objects, result.tree, "dir7/f2"), "only ours\n");
+    EXPECT_EQ(merged_file(objects, result.tree, "dir12/f5"), "only theirs\n");
+    EXPECT_EQ(merged_file(objects, result.tree, "dir9/f1"), "theirs\n");
+
+    // Ours changed what theirs deleted; the changed file stays
+    ASSERT_EQ(result.conflicts.size(), 1u);
+    EXPECT_EQ(result.conflicts[0].path, "dir9/f0");
+    EXPECT_EQ(result.conflicts[0].kind, dgit::TreeConflictKind::ModifyDelete);
+    EXPECT_EQ(merged_file(objects, result.tree, "dir9/f0"), "ours\n");
+
+    // One side unchanged takes the other's tree without reading anything
+    auto fast = dgit::merge_trees(objects, base, base, theirs);
+    EXPECT_EQ(fast.tree, theirs);
+    EXPECT_EQ(fast.trees_read, 0u);
+}
+
+TEST(RenameDetectionTest, SignaturesCountSharedSpans) {
+    std::string text;
+    for (int i = 0; i < 100; ++i) {
+        text += "line " + std::to_string(i) + "\n";
+    }
+    std::string edited = text;
+    edited.replace(edited.find("line 42\n"), 8, "changed\n");
+
+    dgit::SimilaritySignature a(text);
+    dgit::SimilaritySignature b(edited);
+    EXPECT_EQ(a.size(), text.size());
+    EXPECT_EQ(a.common_bytes(a), text.size());
+    EXPECT_EQ(a.common_bytes(b), text.size() - 8);
+    EXPECT_EQ(b.common_bytes(a), a.common_bytes(b));
+    EXPECT_EQ(a.common_bytes(dgit::SimilaritySignature("unrelated\n")), 0u);
+}
+
+TEST_F(RepositoryTest, RenamesPairExactMovesBeforeScoring) {
+    auto repo = dgit::Repository::create(".");
+    auto& objects = repo->objects();
+
+    dgit::ObjectId base = write_test_tree(objects, {});
+    dgit::ObjectId moved = write_test_tree(objects, {{"dir1/f0", "<deleted>"},
+                                                     {"dir15/moved", "line 1\nline 2\ndir1/f0\nline 4\n"},
+                                                     {"dir2/f0", "<deleted>"},
+                                                     {"dir16/edited", "line 1\nline 2\nedited\nline 4\n"},
+                                                     {"dir5/f5", "changed in place\n"}});
+
+    auto diff = dgit::diff_trees(objects, base, moved);
+    // Roots, and the five changed directories on each side
+    EXPECT_EQ(diff.trees_read, 12u);
+    ASSERT_EQ(diff.deleted.size(), 2u);
+    ASSERT_EQ(diff.added.size(), 2u);
+    ASSERT_EQ(diff.modified.size(), 1u);
+    EXPECT_EQ(diff.modified[0].path, "dir5/f5");
+
+    auto result = dgit::find_renames(objects, diff);
+    ASSERT_EQ(result.renames.size(), 2u);
+    EXPECT_EQ(result.exact, 1u);
+    EXPECT_EQ(result.renames[0].source.path, "dir1/f0");
+    EXPECT_EQ(result.renames[0].target.path, "dir15/moved");
+    EXPECT_EQ(result.renames[0].score, 100);
+    // Three of the four lines survived the edit
+    EXPECT_EQ(result.renames[1].source.path, "dir2/f0");
+    EXPECT_EQ(result.renames[1].target.path, "dir16/edited");
+    EXPECT_EQ(result.renames[1].score, 72);
+    // Only the inexact pair was read
+    EXPECT_EQ(result.blobs_read, 2u);
+    EXPECT_EQ(result.pairs_scored, 1u);
+
+    // Past the limit only the exact rename is found
+    dgit::RenameOptions options;
+    options.limit = 1;
+    diff.deleted.push_back({"dir3/gone", dgit::FileMode::Regular, diff.deleted[1].id});
+    auto limited = dgit::find_renames(objects, diff, options);
+    EXPECT_TRUE(limited.limit_exceeded);
+    ASSERT_EQ(limited.renames.size(), 1u);
+    EXPECT_EQ(limited.renames[0].target.path, "dir15/moved");
+    EXPECT_EQ(limited.blobs_read, 0u);
+}
+
+TEST_F(RepositoryTest, TreeMergeFollowsRenamedFiles) {
+    auto repo = dgit::Repository::create(".");
+    auto& objects = repo->objects();
+
+    dgit::ObjectId base = write_test_tree(objects, {});
+    dgit::ObjectId ours = write_test_tree(objects, {{"dir3/f1", "<deleted>"},
+                                                    {"dir4/renamed", "line 1\nline 2\ndir3/f1\nline 4\nours\n"}});
+    dgit::ObjectId theirs = write_test_tree(objects, {{"dir3/f1", "theirs\nline 2\ndir3/f1\nline 4\n"}});
+
+    auto result = dgit::merge_trees(objects, base, ours, theirs);
+    EXPECT_TRUE(result.conflicts.empty());
+    ASSERT_EQ(result.renames.size(), 1u);
+    EXPECT_EQ(result.renames[0].source.path, "dir3/f1");
+    EXPECT_EQ(result.renames[0].target.path, "dir4/renamed");
+    EXPECT_EQ(merged_file(objects, result.tree, "dir4/renamed"), "theirs\nline 2\ndir3/f1\nline 4\nours\n");
+    EXPECT_EQ(merged_file(objects, result.tree, "dir3/f1"), "<missing>");
+    EXPECT_EQ(merged_file(objects, result.tree, "dir3/f2"), "line 1\nline 2\ndir3/f2\nline 4\n");
+
+    // Without detection the rename is a modify/delete conflict
+    dgit::TreeMergeOptions options;
+    options.detect_renames = false;
+    auto plain = dgit::merge_trees(objects, base, ours, theirs, options);
+    ASSERT_EQ(plain.conflicts.size(), 1u);
+    EXPECT_EQ(plain.conflicts[0].kind, dgit::TreeConflictKind::ModifyDelete);
+    EXPECT_TRUE(plain.renames.empty());
+}
+
+TEST_F(RepositoryTest, TreeMergeFollowsRenamesOfGrownFiles) {
+    auto repo = dgit::Repository::create(".");
+    auto& objects = repo->objects();
+
+    // Ours moved dir3/f1 and appended 20 bytes to its 29: sizes 0.59 apart
+    // and every original line kept, so it still scores over 50%
+    dgit::ObjectId base = write_test_tree(objects, {});
+    dgit::ObjectId ours = write_test_tree(
+        objects, {{"dir3/f1", "<deleted>"}, {"dir4/grown", "line 1\nline 2\ndir3/f1\nline 4\nline 5 added\nline 6\n"}});
+    dgit::ObjectId theirs = write_test_tree(objects, {{"dir3/f1", "theirs\nline 2\ndir3/f1\nline 4\n"}});
+
+    auto result = dgit::merge_trees(objects, base, ours, theirs);
+    EXPECT_TRUE(result.conflicts.empty());
+    ASSERT_EQ(result.renames.size(), 1u);
+    EXPECT_EQ(result.renames[0].source.path, "dir3/f1");
+    EXPECT_EQ(result.renames[0].target.path, "dir4/grown");
+    EXPECT_GE(result.renames[0].score, 50);
+    EXPECT_EQ(merged_file(objects, result.tree, "dir4/grown"),
+              "theirs\nline 2\ndir3/f1\nline 4\nline 5 added\nline 6\n");
+    EXPECT_EQ(merged_file(objects, result.tree, "dir3/f1"), "<missing>");
+}
+
+TEST_F(RepositoryTest, CheckoutWritesOnlyChangedPaths) {
+    auto repo = dgit::Repository::create(".");
+    auto& objects = repo->objects();
+    auto& index = repo->index();
+    auto read_text = [](const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    };
+
+    dgit::ObjectId base = write_test_tree(objects, {});
+    dgit::ObjectId ours = write_test_tree(objects, {{"dir3/f1", "ours\n"}, {"dir7/f2", "ours\n"}, {"dir9/f0", "ours\n"}});
+    dgit::ObjectId theirs = write_test_tree(objects, {{"dir3/f1", "theirs\n"},
+                                                      {"dir12/f5", "theirs\n"},
+                                                      {"dir9/f0", "<deleted>"},
+                                                      {"dir9/f1", "theirs\n"}});
+
+    auto initial = dgit::checkout_tree(objects, index, ".", base);
+    EXPECT_EQ(initial.written, 1000u);
+    EXPECT_EQ(index.entry_count(), 1000u);
+    EXPECT_EQ(read_text("dir4/f7"), "line 1\nline 2\ndir4/f7\nline 4\n");
+    EXPECT_EQ(repo->write_tree(), base);
+
+    // The cache tree matches every directory ours left alone
+    auto switched = dgit::checkout_tree(objects, index, ".", ours);
+    EXPECT_EQ(switched.written, 3u);
+    EXPECT_EQ(switched.removed, 0u);
+    EXPECT_EQ(switched.trees_read, 4u);
+    EXPECT_EQ(read_text("dir9/f0"), "ours\n");
+
+    // A local change to a path theirs replaces stops the checkout before
+    // anything is written
+    {
+        std::ofstream("dir12/f5") << "local edit\n";
+    }
+    EXPECT_THROW(dgit::checkout_tree(objects, index, ".", theirs), dgit::GitException);
+    EXPECT_EQ(read_text("dir12/f5"), "local edit\n");
+    EXPECT_EQ(read_text("dir3/f1"), "ours\n");
+    {
+        std::ofstream("dir12/f5") << "line 1\nline 2\ndir12/f5\nline 4\n";
+    }
+
+    auto result = dgit::checkout_tree(objects, index, ".", theirs);
+    EXPECT_EQ(result.written, 4u);
+    EXPECT_EQ(result.removed, 1u);
+    EXPECT_FALSE(fs::exists("dir9/f0"));
+    EXPECT_EQ(read_text("dir7/f2"), "line 1\nline 2\ndir7/f2\nline 4\n");
+    EXPECT_EQ(read_text("dir12/f5"), "theirs\n");
+    EXPECT_EQ(repo->write_tree(), theirs);
+
+    // Written entries carry fresh stat data, so status hashes nothing
+    dgit::StatusOptions options;
+    options.untracked = false;
+    auto status = dgit::compute_status(index, ".", options);
+    EXPECT_TRUE(status.modified.empty());
+    EXPECT_TRUE(status.deleted.empty());
+    EXPECT_EQ(status.rehashed, 0u);
+}
+
+TEST_F(RepositoryTest, TraceCountsObjectLoadsAcrossThreads) {
+    auto repo = dgit::Repository::create(".");
+    dgit::Trace2::enable_counters();
+    auto blob = std::make_unique<dgit::Blob>("traced\n");
+    dgit::ObjectId id = blob->id();
+    repo->objects().store(std::move(blob));
+
+    dgit::TraceCounts before = dgit::Trace2::totals();
+    repo->objects().load(id);
+    std::thread worker([] { dgit::Trace2::count(dgit::TraceCounter::StatCalls, 3); });
+    worker.join();
+    dgit::TraceCounts after = dgit::Trace2::totals();
+
+    auto moved = [&](dgit::TraceCounter counter) {
+        return after[static_cast<size_t>(counter)] - before[static_cast<size_t>(counter)];
+    };
+    EXPECT_GE(moved(dgit::TraceCounter::ObjectLoads), 1u);
+    EXPECT_EQ(moved(dgit::TraceCounter::StatCalls), 3u);
+    EXPECT_STREQ(dgit::Trace2::category(dgit::TraceCounter::StatCalls), "fs");
+    EXPECT_STREQ(dgit::Trace2::name(dgit::TraceCounter::StatCalls), "stat_calls");
+}
+
+TEST_F(RepositoryTest, TraceFinishReportsCountsOfEndedThreads) {
+    std::string target = (fs::current_path() / "trace.json").string();
+    setenv("DGIT_TRACE2_PERF", target.c_str(), 1);
+    char program[] = "dgit";
+    char* argv[] = {program};
+    dgit::Trace2::start_from_environment(1, argv);
+    unsetenv("DGIT_TRACE2_PERF");
+
+    // Each worker ends before finish(), as pool threads do
+    for (int i = 0; i < 20; ++i) {
+        std::thread worker([] { dgit::Trace2::count(dgit::TraceCounter::PackLookups, 2); });
+        worker.join();
+    }
+    dgit::Trace2::finish(0);
+
+    std::ifstream file(target);
+    std::string line;
+    std::vector<std::string> lookups;
+    bool exited = false;
+    while (std::getline(file, line)) {
+        if (line.find("\"event\":\"counter\"") != std::string::npos &&
+            line.find("\"name\":\"lookups\"") != std::string::npos) {
+            lookups.push_back(line);
+        }
+        exited = exited || line.find("\"event\":\"exit\"") != std::string::npos;
+    }
+    // One total for the process, not a line per ended thread
+    ASSERT_EQ(lookups.size(), 1u);
+    EXPECT_NE(lookups[0].find("\"thread\":\"main\""), std::string::npos);
+    size_t count = std::stoull(lookups[0].substr(lookups[0].find("\"count\":") + 8));
+    EXPECT_GE(count, 40u);
+    EXPECT_TRUE(exited);
+}
+
+TEST(ThreadTest, ParallelForRunsEveryIndexOnceAndRethrows) {
+    std::vector<std::atomic<int>> runs(1000);
+    dgit::parallel_for(runs.size(), 4, [&](size_t i) { runs[i].fetch_add(1); });
+    for (const auto& count : runs) {
+        EXPECT_EQ(count.load(), 1);
+    }
+
+    EXPECT_THROW(dgit::parallel_for(100, 4,
+                                    [](size_t i) {
+                                        if (i == 37) {
+                                            throw dgit::GitException("task 37");
+                                        }
+                                    }),
+                 dgit::GitException);
+    EXPECT_GE(dgit::default_threads(), 1u);
+}
+
+// Test SSH transport pieces that need no server
+TEST(NetworkTest, ParsesSshAndScpLikeUrls) {
+    auto full = dgit::parse_ssh_url("ssh://git@example.com:2222/srv/repo.git");
+    ASSERT_TRUE(full.has_value());
+    EXPECT_EQ(full->user, "git");
+    EXPECT_EQ(full->host, "example.com");
+    EXPECT_EQ(full->port, 2222);
+    EXPECT_EQ(full->path, "/srv/repo.git");
+
+    auto home = dgit::parse_ssh_url("ssh://example.com/~alice/repo");
+    ASSERT_TRUE(home.has_value());
+    EXPECT_EQ(home->user, "");
+    EXPECT_EQ(home->port, 0);
+    EXPECT_EQ(home->path, "~alice/repo");
+
+    auto ipv6 = dgit::parse_ssh_url("ssh://[::1]:22/repo");
+    ASSERT_TRUE(ipv6.has_value());
+    EXPECT_EQ(ipv6->host, "::1");
+    EXPECT_EQ(ipv6->port, 22);
+
+    auto scp = dgit::parse_ssh_url("git@github.com:owner/repo.git");
+    ASSERT_TRUE(scp.has_value());
+    EXPECT_EQ(scp->user, "git");
+    EXPECT_EQ(scp->host, "github.com");
+    EXPECT_EQ(scp->port, 0);
+    EXPECT_EQ(scp->path, "owner/repo.git");
+
+    auto scp_ipv6 = dgit::parse_ssh_url("me@[fe80::1]:repo");
+    ASSERT_TRUE(scp_ipv6.has_value());
+    EXPECT_EQ(scp_ipv6->host, "fe80::1");
+    EXPECT_EQ(scp_ipv6->path, "repo");
+
+    EXPECT_FALSE(dgit::parse_ssh_url("https://example.com/repo").has_value());
+    EXPECT_FALSE(dgit::parse_ssh_url("ssh://example.com").has_value());
+    EXPECT_FALSE(dgit::parse_ssh_url("example.com:").has_value());
+    EXPECT_FALSE(dgit::parse_ssh_url("/local/path").has_value());
+}
+
+TEST(NetworkTest, RejectsSshUrlsWithoutHostOrValidPort) {
+    EXPECT_THROW(dgit::parse_ssh_url("ssh:///repo"), dgit::GitException);
+    EXPECT_THROW(dgit::parse_ssh_url("ssh://git@/repo"), dgit::GitException);
+    EXPECT_THROW(dgit::parse_ssh_url(":repo"), dgit::GitException);
+    EXPECT_THROW(dgit::parse_ssh_url("ssh://host:/repo"), dgit::GitException);
+    EXPECT_THROW(dgit::parse_ssh_url("ssh://host:22x/repo"), dgit::GitException);
+    EXPECT_THROW(dgit::parse_ssh_url("ssh://host:0/repo"), dgit::GitException);
+    EXPECT_THROW(dgit::parse_ssh_url("ssh://host:65536/repo"), dgit::GitException);
+    EXPECT_THROW(dgit::parse_ssh_url("ssh://host:99999999999/repo"), dgit::GitException);
+    EXPECT_THROW(dgit::parse_ssh_url("ssh://[::1]x/repo"), dgit::GitException);
+}
+
+TEST(NetworkTest, FlushScannerFollowsPacketsAcrossReads) {
+    std::string reply;
+    dgit::pkt_line::append(reply, "0000 inside a payload is not a flush\n");
+    dgit::pkt_line::append_delim(reply);
+    dgit::pkt_line::append(reply, "last\n");
+    dgit::pkt_line::append_flush(reply);
+    std::string after = "0009next\n";
+    std::string stream = reply + after;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(stream.data());
+
+    // Every split point, including one inside a length header
+    for (size_t split = 1; split < reply.size(); ++split) {
+        dgit::FlushScanner scanner;
+        size_t first = scanner.feed(bytes, split);
+        EXPECT_EQ(first, split);
+        EXPECT_FALSE(scanner.done());
+        size_t second = scanner.feed(bytes + split, stream.size() - split);
+        EXPECT_TRUE(scanner.done());
+        EXPECT_EQ(first + second, reply.size()) << "split at " << split;
+    }
+
+    // One byte at a time
+    dgit::FlushScanner trickle;
+    size_t consumed = 0;
+    for (size_t i = 0; i < stream.size() && !trickle.done(); ++i) {
+        consumed += trickle.feed(bytes + i, 1);
+    }
+    EXPECT_EQ(consumed, reply.size());
+
+    dgit::FlushScanner bad;
+    const uint8_t garbage[] = {'0', '0', 'z', '1'};
+    EXPECT_THROW(bad.feed(garbage, sizeof(garbage)), dgit::GitException);
+}
+
+TEST(NetworkTest, ShellQuoteEscapesQuotesAndBangs) {
+    EXPECT_EQ(dgit::shell_quote(""), "''");
+    EXPECT_EQ(dgit::shell_quote("repo.git"), "'repo.git'");
+    EXPECT_EQ(dgit::shell_quote("a b;$(rm -rf)"), "'a b;$(rm -rf)'");
+    EXPECT_EQ(dgit::shell_quote("it's"), "'it'\\''s'");
+    EXPECT_EQ(dgit::shell_quote("hi!"), "'hi'\\!''");
+}
+
 // Test CLI functionality
 TEST(CLITest, CommandRegistration) {
     dgit::CLI cli;
@@ -297,7 +1400,7 @@ TEST(PerformanceTest, ObjectCreation) {
     for (int i = 0; i < 100; ++i) {
         std::string content(100, 'a' + (i % 26));
         auto blob = std::make_unique<dgit::Blob>(content);
-        EXPECT_FALSE(blob->id().empty());
+        EXPECT_FALSE(blob->id().is_null());
     }
 
     auto end = std::chrono::high_resolution_clock::now();
@@ -2,10 +2,23 @@
 #include "dgit/object.hpp"
 #include "dgit/repository.hpp"
 #include "dgit/object_database.hpp"
+#include "dgit/object_cache.hpp"
+#include "dgit/object_view.hpp"
+#include "dgit/commit_graph.hpp"
+#include "dgit/merge_base.hpp"
+#include "dgit/tree_builder.hpp"
+#include "dgit/tree_iterator.hpp"
 #include <filesystem>
+#include <fstream>
 
 namespace fs = std::filesystem;
 
+// Deterministic stand-in object ID derived from a readable label
+static dgit::ObjectId fake_id(const std::string& label) {
+    auto digest = dgit::SHA1::hash_raw(reinterpret_cast<const uint8_t*>(label.data()), label.size());
+    return dgit::ObjectId::from_raw(digest.data());
+}
+
 class ObjectTest : public ::testing::Test {
 protected:
     void SetUp() override {
@@ -39,8 +52,8 @@ TEST_F(ObjectTest, BlobSerialization) {
 TEST_F(ObjectTest, TreeSerialization) {
     auto tree = std::make_unique<dgit::Tree>();
 
-    tree->add_entry(dgit::FileMode::Regular, "abc123", "file1.txt");
-    tree->add_entry(dgit::FileMode::Executable, "def456", "script.sh");
+    tree->add_entry(dgit::FileMode::Regular, fake_id("abc123"), "file1.txt");
+    tree->add_entry(dgit::FileMode::Executable, fake_id("def456"), "script.sh");
 
     auto entries = tree->entries();
     EXPECT_EQ(entries.size(), 2);
@@ -49,8 +62,8 @@ TEST_F(ObjectTest, TreeSerialization) {
 }
 
 TEST_F(ObjectTest, CommitSerialization) {
-    std::string tree_id = "abc123";
-    std::vector<std::string> parents = {"def456", "ghi789"};
+    dgit::ObjectId tree_id = fake_id("abc123");
+    std::vector<dgit::ObjectId> parents = {fake_id("def456"), fake_id("ghi789")};
     dgit::Person author("John Doe", "john@example.com", std::chrono::system_clock::now());
     dgit::Person committer("Jane Smith", "jane@example.com", std::chrono::system_clock::now());
     std::string message = "Test commit\n\nThis is a test commit message.";
@@ -87,16 +100,16 @@ TEST_F(ObjectTest, ObjectDatabase) {
     // Test existence
     EXPECT_TRUE(repo.objects().exists(blob1->id()));
     EXPECT_TRUE(repo.objects().exists(blob2->id()));
-    EXPECT_FALSE(repo.objects().exists("nonexistent"));
+    EXPECT_FALSE(repo.objects().exists(fake_id("nonexistent")));
 }
 
 TEST_F(ObjectTest, TreeWithEntries) {
     auto tree = std::make_unique<dgit::Tree>();
 
     // Add various types of entries
-    tree->add_entry(dgit::FileMode::Regular, "abc123", "readme.txt");
-    tree->add_entry(dgit::FileMode::Executable, "def456", "build.sh");
-    tree->add_entry(dgit::FileMode::Directory, "ghi789", "src");
+    tree->add_entry(dgit::FileMode::Regular, fake_id("abc123"), "readme.txt");
+    tree->add_entry(dgit::FileMode::Executable, fake_id("def456"), "build.sh");
+    tree->add_entry(dgit::FileMode::Directory, fake_id("ghi789"), "src");
 
     auto entries = tree->entries();
     EXPECT_EQ(entries.size(), 3);
@@ -113,8 +126,8 @@ TEST_F(ObjectTest, TreeWithEntries) {
 }
 
 TEST_F(ObjectTest, CommitWithParents) {
-    std::string tree_id = "tree123";
-    std::vector<std::string> parents = {"parent1", "parent2", "parent3"};
+    dgit::ObjectId tree_id = fake_id("tree123");
+    std::vector<dgit::ObjectId> parents = {fake_id("parent1"), fake_id("parent2"), fake_id("parent3")};
 
     dgit::Person author("Multi Author", "multi@example.com", std::chrono::system_clock::now());
     dgit::Person committer("Merge Committer", "merge@example.com", std::chrono::system_clock::now());
@@ -125,13 +138,13 @@ TEST_F(ObjectTest, CommitWithParents) {
     auto commit = std::make_unique<dgit::Commit>(tree_id, parents, author, committer, message);
 
     EXPECT_EQ(commit->parent_ids().size(), 3);
-    EXPECT_EQ(commit->parent_ids()[0], "parent1");
-    EXPECT_EQ(commit->parent_ids()[1], "parent2");
-    EXPECT_EQ(commit->parent_ids()[2], "parent3");
+    EXPECT_EQ(commit->parent_ids()[0], fake_id("parent1"));
+    EXPECT_EQ(commit->parent_ids()[1], fake_id("parent2"));
+    EXPECT_EQ(commit->parent_ids()[2], fake_id("parent3"));
 }
 
 TEST(ObjectTest, TagCreation) {
-    std::string object_id = "abc123";
+    dgit::ObjectId object_id = fake_id("abc123");
     dgit::ObjectType object_type = dgit::ObjectType::Commit;
     std::string tag_name = "v1.0.0";
     dgit::Person tagger("Tagger Name", "tagger@example.com", std::chrono::system_clock::now());
@@ -168,8 +181,8 @@ TEST(ObjectTest, LargeBlobHandling) {
     auto blob = std::make_unique<dgit::Blob>(large_content);
 
     EXPECT_EQ(blob->data(), large_content);
-    EXPECT_FALSE(blob->id().empty());
-    EXPECT_EQ(blob->id().length(), 40);
+    EXPECT_FALSE(blob->id().is_null());
+    EXPECT_EQ(blob->id().hex().length(), 40);
 }
 
 TEST(ObjectTest, SpecialCharacters) {
@@ -178,17 +191,376 @@ TEST(ObjectTest, SpecialCharacters) {
     auto blob = std::make_unique<dgit::Blob>(special_content);
 
     EXPECT_EQ(blob->data(), special_content);
-    EXPECT_FALSE(blob->id().empty());
+    EXPECT_FALSE(blob->id().is_null());
 }
 
 TEST(ObjectTest, EmptyObjects) {
     // Test empty blob
     auto empty_blob = std::make_unique<dgit::Blob>("");
     EXPECT_EQ(empty_blob->data(), "");
-    EXPECT_FALSE(empty_blob->id().empty());
+    EXPECT_FALSE(empty_blob->id().is_null());
 
     // Test empty tree
     auto empty_tree = std::make_unique<dgit::Tree>();
     EXPECT_TRUE(empty_tree->entries().empty());
-    EXPECT_FALSE(empty_tree->id().empty());
+    EXPECT_FALSE(empty_tree->id().is_null());
+}
+
+TEST(TreeBuilderTest, MatchesIncrementalTreeInGitOrder) {
+    std::vector<std::pair<std::string, dgit::FileMode>> names = {
+        {"a", dgit::FileMode::Directory}, {"a.txt", dgit::FileMode::Regular}, {"zeta", dgit::FileMode::Symlink},
+        {"a-b", dgit::FileMode::Directory}, {"run.sh", dgit::FileMode::Executable}, {"a0", dgit::FileMode::Regular}};
+
+    dgit::TreeBuilder builder;
+    dgit::Tree incremental;
+    for (const auto& [name, mode] : names) {
+        builder.add(mode, fake_id(name), name);
+        incremental.add_entry(mode, fake_id(name), name);
+    }
+    auto tree = builder.build();
+    EXPECT_TRUE(builder.empty());
+    EXPECT_EQ(tree->id(), incremental.id());
+    EXPECT_EQ(tree->data(), incremental.data());
+
+    // "a/" sorts after "a-b/" and "a.txt" but before "a0"
+    std::vector<std::string> order;
+    for (const auto& entry : tree->entries()) {
+        order.push_back(entry.name);
+    }
+    EXPECT_EQ(order, (std::vector<std::string>{"a-b", "a.txt", "a", "a0", "run.sh", "zeta"}));
+
+    // Directory modes are written without a leading zero, as git does
+    EXPECT_EQ(tree->data().compare(0, 9, "40000 a-b"), 0);
+
+    builder.add(dgit::FileMode::Regular, fake_id("x"), "same");
+    builder.add(dgit::FileMode::Regular, fake_id("y"), "same");
+    EXPECT_THROW(builder.build(), dgit::GitException);
+}
+
+TEST(TreeBuilderTest, IteratorReadsEntriesInPlace) {
+    dgit::TreeBuilder builder;
+    builder.add(dgit::FileMode::Regular, fake_id("readme"), "README");
+    builder.add(dgit::FileMode::Directory, fake_id("src"), "src");
+    builder.add(dgit::FileMode::Executable, fake_id("build"), "build.sh");
+    auto tree = builder.build();
+
+    const std::string& data = tree->data();
+    std::vector<dgit::TreeEntryView> views(dgit::TreeView(data).begin(), dgit::TreeView(data).end());
+    ASSERT_EQ(views.size(), 3u);
+    EXPECT_EQ(views[0].name, "README");
+    EXPECT_EQ(views[1].mode, dgit::FileMode::Executable);
+    EXPECT_TRUE(views[2].is_directory());
+    EXPECT_EQ(views[2].id(), fake_id("src"));
+    // No copies: names and IDs point into the tree's own bytes
+    EXPECT_EQ(views[0].name.data(), data.data() + 7);
+    EXPECT_EQ(reinterpret_cast<const char*>(views[0].raw_id), data.data() + 14);
+
+    // Deserializing gives back the same entries and the same ID
+    std::string raw = "tree " + std::to_string(data.size()) + std::string(1, '\0') + data;
+    auto parsed = dgit::Object::deserialize(raw);
+    ASSERT_EQ(parsed->type(), dgit::ObjectType::Tree);
+    EXPECT_EQ(parsed->id(), tree->id());
+    EXPECT_EQ(static_cast<const dgit::Tree&>(*parsed).entries().size(), 3u);
+
+    // Truncated IDs and bad modes are rejected rather than read past the end
+    std::string truncated = data.substr(0, data.size() - 1);
+    EXPECT_THROW(for (const auto& entry : dgit::TreeView(truncated)) { (void)entry; }, dgit::GitException);
+    EXPECT_THROW(dgit::TreeView(std::string_view("10064x a\0")).begin(), dgit::GitException);
+}
+
+TEST(ObjectViewTest, CommitViewReadsHeadersInPlace) {
+    // As git writes it: time zones, a signature with continuation lines
+    std::string tree = fake_id("tree").hex();
+    std::string first = fake_id("p1").hex();
+    std::string second = fake_id("p2").hex();
+    std::string body = "tree " + tree + "\nparent " + first + "\nparent " + second +
+                       "\nauthor A U Thor <author@example.com> 1700000000 +0200"
+                       "\ncommitter C O Mitter <committer@example.com> 1700000100 -0500"
+                       "\ngpgsig -----BEGIN PGP SIGNATURE-----\n author fake\n -----END PGP SIGNATURE-----"
+                       "\n\nMerge branch\n\nDetails\n";
+
+    dgit::CommitView view(body);
+    EXPECT_EQ(view.tree_id(), fake_id("tree"));
+    EXPECT_EQ(view.parents(), (std::vector<dgit::ObjectId>{fake_id("p1"), fake_id("p2")}));
+    EXPECT_EQ(view.parent_count(), 2u);
+    EXPECT_EQ(view.author(), "A U Thor <author@example.com> 1700000000 +0200");
+    EXPECT_EQ(view.header("encoding"), "");
+    EXPECT_EQ(view.message(), "Merge branch\n\nDetails\n");
+    EXPECT_EQ(view.author().data(), body.data() + body.find("A U Thor"));
+
+    dgit::Person committer = dgit::parse_person(view.committer());
+    EXPECT_EQ(committer.name, "C O Mitter");
+    EXPECT_EQ(committer.email, "committer@example.com");
+    EXPECT_EQ(std::chrono::duration_cast<std::chrono::seconds>(committer.when.time_since_epoch()).count(),
+              1700000100);
+
+    // Parsed into a full Commit, the bytes and therefore the ID are kept
+    std::string raw = "commit " + std::to_string(body.size()) + std::string(1, '\0') + body;
+    auto commit = dgit::Object::deserialize(raw);
+    ASSERT_EQ(commit->type(), dgit::ObjectType::Commit);
+    EXPECT_EQ(commit->data(), body);
+    const auto& parsed = static_cast<const dgit::Commit&>(*commit);
+    EXPECT_EQ(parsed.tree_id(), fake_id("tree"));
+    EXPECT_EQ(parsed.parent_ids().size(), 2u);
+    EXPECT_EQ(parsed.author().name, "A U Thor");
+
+    EXPECT_THROW(dgit::CommitView("parent " + first + "\n"), dgit::GitException);
+    EXPECT_THROW(dgit::Object::deserialize("commit 9999" + std::string(1, '\0') + body), dgit::GitException);
+}
+
+TEST(ObjectViewTest, TagRoundTripsThroughDeserialize) {
+    dgit::Person tagger("Tagger", "tagger@example.com", std::chrono::system_clock::time_point(std::chrono::seconds(42)));
+    dgit::Tag tag(fake_id("target"), dgit::ObjectType::Commit, "v1.0", tagger, "Release\n");
+
+    std::string raw = "tag " + std::to_string(tag.data().size()) + std::string(1, '\0') + tag.data();
+    auto object = dgit::Object::deserialize(raw);
+    ASSERT_EQ(object->type(), dgit::ObjectType::Tag);
+    EXPECT_EQ(object->id(), tag.id());
+    const auto& parsed = static_cast<const dgit::Tag&>(*object);
+    EXPECT_EQ(parsed.object_id(), fake_id("target"));
+    EXPECT_EQ(parsed.object_type(), dgit::ObjectType::Commit);
+    EXPECT_EQ(parsed.tag_name(), "v1.0");
+    EXPECT_EQ(parsed.tagger().email, "tagger@example.com");
+    EXPECT_EQ(parsed.message(), "Release\n");
+}
+
+namespace {
+// Stores a commit with the given parents and commit time
+dgit::ObjectId store_commit(dgit::ObjectDatabase& db, const std::vector<dgit::ObjectId>& parents, int64_t time) {
+    dgit::Person person("Dev", "dev@example.com", std::chrono::system_clock::time_point(std::chrono::seconds(time)));
+    auto commit = std::make_unique<dgit::Commit>(fake_id("tree" + std::to_string(time)), parents, person, person,
+                                                 "commit " + std::to_string(time) + "\n");
+    dgit::ObjectId id = commit->id();
+    db.store(std::move(commit));
+    return id;
+}
+}
+
+TEST_F(ObjectTest, CommitGraphMatchesParsedCommits) {
+    dgit::ObjectDatabase db(".git");
+    dgit::ObjectId root = store_commit(db, {}, 1000);
+    dgit::ObjectId a = store_commit(db, {root}, 1001);
+    dgit::ObjectId b = store_commit(db, {a}, 1002);
+    dgit::ObjectId c = store_commit(db, {root}, 1003);
+    dgit::ObjectId merge = store_commit(db, {b, c}, 1004);
+    dgit::ObjectId octopus = store_commit(db, {merge, a, c, root}, 1005);
+
+    std::vector<dgit::CommitInfo> parsed;
+    std::vector<dgit::ObjectId> all = {root, a, b, c, merge, octopus};
+    for (const auto& id : all) {
+        parsed.push_back(dgit::read_commit_info(db, id));
+        EXPECT_EQ(parsed.back().generation, dgit::CommitGraph::kGenerationInfinity);
+    }
+
+    auto result = dgit::write_commit_graph(db, {octopus});
+    EXPECT_EQ(result.commits, 6u);
+    ASSERT_NE(db.commit_graph(), nullptr);
+    EXPECT_TRUE(fs::exists(".git/objects/info/commit-graph"));
+
+    // Same answers as parsing, plus generation numbers
+    std::vector<uint32_t> generations = {1, 2, 3, 2, 4, 5};
+    for (size_t i = 0; i < all.size(); ++i) {
+        dgit::CommitInfo info = dgit::read_commit_info(db, all[i]);
+        EXPECT_EQ(info.tree, parsed[i].tree);
+        EXPECT_EQ(info.parents, parsed[i].parents);
+        EXPECT_EQ(info.commit_time, parsed[i].commit_time);
+        EXPECT_EQ(info.generation, generations[i]);
+    }
+    EXPECT_FALSE(db.commit_graph()->find(fake_id("elsewhere")));
+}
+
+TEST_F(ObjectTest, CommitGraphSplitLayersMergeBySize) {
+    dgit::ObjectDatabase db(".git");
+    dgit::CommitGraphWriteOptions split;
+    split.split = true;
+
+    std::vector<dgit::ObjectId> history = {store_commit(db, {}, 2000)};
+    auto extend = [&](int count) {
+        for (int i = 0; i < count; ++i) {
+            history.push_back(store_commit(db, {history.back()}, 2000 + static_cast<int64_t>(history.size())));
+        }
+    };
+
+    extend(19);
+    EXPECT_EQ(dgit::write_commit_graph(db, {history.back()}, split).layers, 1u);
+
+    // A small addition goes on top; the base is not rewritten
+    extend(3);
+    auto second = dgit::write_commit_graph(db, {history.back()}, split);
+    EXPECT_EQ(second.commits, 3u);
+    EXPECT_EQ(second.layers, 2u);
+    EXPECT_EQ(dgit::write_commit_graph(db, {history.back()}, split).commits, 0u);
+
+    const dgit::CommitGraph* graph = db.commit_graph();
+    ASSERT_NE(graph, nullptr);
+    EXPECT_EQ(graph->size(), 23u);
+    dgit::CommitInfo tip = dgit::read_commit_info(db, history.back());
+    EXPECT_EQ(tip.generation, 23u);
+    EXPECT_EQ(tip.parents, std::vector<dgit::ObjectId>{history[21]});
+
+    // Once the top layer outgrows half of the one below, they merge
+    extend(10);
+    auto merged = dgit::write_commit_graph(db, {history.back()}, split);
+    EXPECT_EQ(merged.layers, 1u);
+    EXPECT_EQ(merged.commits, 33u);
+    size_t graph_files = 0;
+    for (const auto& entry : fs::directory_iterator(".git/objects/info/commit-graphs")) {
+        graph_files += entry.path().extension() == ".graph";
+    }
+    EXPECT_EQ(graph_files, 1u);
+    EXPECT_EQ(dgit::read_commit_info(db, history.back()).generation, 33u);
+}
+
+TEST_F(ObjectTest, MergeBasesMatchWithAndWithoutCommitGraph) {
+    dgit::ObjectDatabase db(".git");
+    // Criss-cross: x and y each merge a and b, so both are best bases
+    dgit::ObjectId root = store_commit(db, {}, 1000);
+    dgit::ObjectId a = store_commit(db, {root}, 1001);
+    dgit::ObjectId b = store_commit(db, {root}, 1002);
+    dgit::ObjectId x = store_commit(db, {store_commit(db, {a, b}, 1003)}, 1005);
+    dgit::ObjectId y = store_commit(db, {store_commit(db, {b, a}, 1004)}, 1006);
+    dgit::ObjectId c = store_commit(db, {root}, 1007);
+    dgit::ObjectId unrelated = store_commit(db, {}, 1008);
+
+    for (bool with_graph : {false, true}) {
+        if (with_graph) {
+            dgit::write_commit_graph(db, {x, y, c, unrelated});
+            ASSERT_NE(db.commit_graph(), nullptr);
+        }
+        dgit::MergeBaseEngine engine(db);
+        EXPECT_EQ(engine.merge_bases(x, {y}), (std::vector<dgit::ObjectId>{b, a}));
+        EXPECT_EQ(engine.merge_bases(a, {x}), std::vector<dgit::ObjectId>{a});
+        EXPECT_EQ(engine.merge_bases(x, {c}), std::vector<dgit::ObjectId>{root});
+        // Against the merge of y and c, a and b still win over root
+        EXPECT_EQ(engine.merge_bases(x, {y, c}), (std::vector<dgit::ObjectId>{b, a}));
+        EXPECT_TRUE(engine.merge_bases(x, {unrelated}).empty());
+
+        EXPECT_EQ(engine.octopus_bases({x, y}), (std::vector<dgit::ObjectId>{b, a}));
+        EXPECT_EQ(engine.octopus_bases({x, y, c}), std::vector<dgit::ObjectId>{root});
+        EXPECT_TRUE(engine.octopus_bases({x, y, unrelated}).empty());
+
+        EXPECT_TRUE(engine.is_ancestor(a, x));
+        EXPECT_TRUE(engine.is_ancestor(root, y));
+        EXPECT_TRUE(engine.is_ancestor(x, x));
+        EXPECT_FALSE(engine.is_ancestor(x, y));
+        EXPECT_FALSE(engine.is_ancestor(c, x));
+        EXPECT_FALSE(engine.is_ancestor(unrelated, x));
+        EXPECT_GT(engine.stats().commits_walked, 0u);
+    }
+}
+
+TEST(ObjectCacheTest, HitsShareOneInstance) {
+    dgit::ObjectCache cache;
+    auto blob = std::make_shared<const dgit::Blob>("shared content");
+    cache.put(blob);
+
+    auto first = cache.get(blob->id());
+    auto second = cache.get(blob->id());
+    EXPECT_EQ(first.get(), blob.get());
+    EXPECT_EQ(second.get(), blob.get());
+    EXPECT_EQ(cache.get(fake_id("missing")), nullptr);
+    EXPECT_EQ(cache.stats().hits, 2u);
+    EXPECT_EQ(cache.stats().misses, 1u);
+}
+
+TEST(ObjectCacheTest, EvictsLeastRecentlyUsedWithinBudget) {
+    std::vector<std::shared_ptr<const dgit::Object>> blobs;
+    for (int i = 0; i < 4; ++i) {
+        blobs.push_back(std::make_shared<const dgit::Blob>(std::string(1000, static_cast<char>('a' + i))));
+    }
+    size_t per_blob = dgit::ObjectCache::approximate_size(*blobs[0]);
+
+    dgit::ObjectCache cache(per_blob * 3);
+    cache.put(blobs[0]);
+    cache.put(blobs[1]);
+    cache.put(blobs[2]);
+    cache.get(blobs[0]->id()); // blobs[1] is now the oldest
+    cache.put(blobs[3]);
+
+    EXPECT_TRUE(cache.contains(blobs[0]->id()));
+    EXPECT_FALSE(cache.contains(blobs[1]->id()));
+    EXPECT_TRUE(cache.contains(blobs[3]->id()));
+    EXPECT_LE(cache.stats().bytes, cache.limit());
+    EXPECT_EQ(cache.stats().evictions, 1u);
+
+    // Handles stay valid after eviction
+    EXPECT_EQ(blobs[1]->data(), std::string(1000, 'b'));
+
+    // Objects bigger than the budget are never cached
+    auto huge = std::make_shared<const dgit::Blob>(std::string(per_blob * 4, 'z'));
+    cache.put(huge);
+    EXPECT_FALSE(cache.contains(huge->id()));
+
+    cache.set_limit(0);
+    EXPECT_EQ(cache.stats().entries, 0u);
+    EXPECT_EQ(cache.stats().bytes, 0u);
+}
+
+TEST_F(ObjectTest, StoreBlobFileStreamsToLooseObject) {
+    std::string content;
+    for (int i = 0; content.size() < 3 * 1024 * 1024; ++i) {
+        content += "streamed line " + std::to_string(i) + "\n";
+    }
+    std::ofstream("large.bin", std::ios::binary) << content;
+
+    dgit::ObjectDatabase odb((test_dir_ / ".git").string());
+    dgit::ObjectId id = odb.store_blob_file("large.bin");
+    EXPECT_EQ(id, dgit::Blob(content).id());
+    EXPECT_EQ(odb.load(id)->data(), content);
+
+    // Stored again: same id, still exactly one object and no temp files left
+    EXPECT_EQ(odb.store_blob_file("large.bin"), id);
+    size_t files = 0;
+    for (const auto& entry : fs::recursive_directory_iterator(test_dir_ / ".git/objects")) {
+        if (entry.is_regular_file()) {
+            files++;
+            EXPECT_EQ(entry.path().filename().string().rfind("tmp_obj_", 0), std::string::npos);
+        }
+    }
+    EXPECT_EQ(files, 1u);
+
+    EXPECT_THROW(odb.store_blob_file("missing.bin"), dgit::GitException);
+}
+
+TEST_F(ObjectTest, PromisorFetchesMissingObjectsInBatches) {
+    // A second database stands in for the remote the clone was filtered from
+    dgit::ObjectDatabase odb((test_dir_ / ".git").string());
+    dgit::ObjectDatabase remote((test_dir_ / "remote.git").string());
+    std::vector<dgit::ObjectId> ids;
+    for (int i = 0; i < 3; ++i) {
+        auto blob = std::make_unique<dgit::Blob>("promised " + std::to_string(i));
+        ids.push_back(blob->id());
+        remote.store(std::move(blob));
+    }
+    auto local = std::make_unique<dgit::Blob>("already here");
+    dgit::ObjectId local_id = local->id();
+    odb.store(std::move(local));
+
+    std::vector<std::vector<dgit::ObjectId>> requests;
+    odb.set_promisor([&](const std::vector<dgit::ObjectId>& wanted) {
+        requests.push_back(wanted);
+        for (const auto& id : wanted) {
+            if (auto raw = remote.read_raw(id)) {
+                odb.store(std::make_unique<dgit::Blob>(raw->data));
+            }
+        }
+    });
+
+    // Present and duplicate IDs are left out of the one request
+    odb.prefetch({ids[0], local_id, ids[1], ids[0]});
+    ASSERT_EQ(requests.size(), 1u);
+    EXPECT_EQ(requests[0], (std::vector<dgit::ObjectId>{ids[0], ids[1]}));
+    EXPECT_EQ(odb.load(ids[1])->data(), "promised 1");
+    EXPECT_EQ(requests.size(), 1u);
+
+    // A plain read fetches just the object it misses
+    EXPECT_EQ(odb.load(ids[2])->data(), "promised 2");
+    ASSERT_EQ(requests.size(), 2u);
+    EXPECT_EQ(requests[1], std::vector<dgit::ObjectId>{ids[2]});
+
+    // exists() never fetches; an object the remote lacks is still missing
+    EXPECT_FALSE(odb.exists(fake_id("nowhere")));
+    EXPECT_EQ(requests.size(), 2u);
+    EXPECT_THROW(odb.load(fake_id("nowhere")), dgit::GitException);
+    EXPECT_EQ(requests.size(), 3u);
 }
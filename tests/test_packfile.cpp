@@ -0,0 +1,759 @@
+#include <gtest/gtest.h>
+#include "dgit/packfile.hpp"
+#include "dgit/compression.hpp"
+#include "dgit/object_database.hpp"
+#include "dgit/pack_bitmap.hpp"
+#include "dgit/pack_indexer.hpp"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+void put_be32(std::string& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<char>((value >> shift) & 0xFF));
+    }
+}
+
+void put_be64(std::string& out, uint64_t value) {
+    put_be32(out, static_cast<uint32_t>(value >> 32));
+    put_be32(out, static_cast<uint32_t>(value));
+}
+
+dgit::ObjectId label_id(const std::string& label) {
+    auto digest = dgit::SHA1::hash_raw(reinterpret_cast<const uint8_t*>(label.data()), label.size());
+    return dgit::ObjectId::from_raw(digest.data());
+}
+
+struct IdxObject {
+    dgit::ObjectId id;
+    uint64_t offset;
+    uint32_t crc32;
+};
+
+// Builds a version 2 .idx image; offsets >= 2^31 go to the 64-bit table
+std::string build_idx(std::vector<IdxObject> objects, const std::string& pack_checksum = std::string(20, '\x5a')) {
+    std::sort(objects.begin(), objects.end(),
+              [](const IdxObject& a, const IdxObject& b) { return a.id < b.id; });
+
+    std::string out(dgit::packfile_format::IDX_SIGNATURE, 4);
+    put_be32(out, 2);
+
+    uint32_t counts[256] = {};
+    for (const auto& obj : objects) {
+        counts[obj.id.first_byte()]++;
+    }
+    uint32_t running = 0;
+    for (uint32_t count : counts) {
+        running += count;
+        put_be32(out, running);
+    }
+
+    for (const auto& obj : objects) {
+        out.append(reinterpret_cast<const char*>(obj.id.data()), dgit::ObjectId::kRawSize);
+    }
+    for (const auto& obj : objects) {
+        put_be32(out, obj.crc32);
+    }
+
+    std::vector<uint64_t> large;
+    for (const auto& obj : objects) {
+        if (obj.offset >= 0x80000000ull) {
+            put_be32(out, 0x80000000u | static_cast<uint32_t>(large.size()));
+            large.push_back(obj.offset);
+        } else {
+            put_be32(out, static_cast<uint32_t>(obj.offset));
+        }
+    }
+    for (uint64_t offset : large) {
+        put_be64(out, offset);
+    }
+
+    out += pack_checksum;
+    out.append(20, '\x5a'); // index checksum (not verified on read)
+    return out;
+}
+
+std::string deflate_string(const std::string& data) {
+    uLongf size = compressBound(data.size());
+    std::string out(size, '\0');
+    compress2(reinterpret_cast<Bytef*>(&out[0]), &size, reinterpret_cast<const Bytef*>(data.data()), data.size(),
+              Z_DEFAULT_COMPRESSION);
+    out.resize(size);
+    return out;
+}
+
+void put_entry_header(std::string& out, int type, size_t size) {
+    uint8_t byte = static_cast<uint8_t>((type << 4) | (size & 0x0F));
+    size >>= 4;
+    while (size) {
+        out.push_back(static_cast<char>(byte | 0x80));
+        byte = size & 0x7F;
+        size >>= 7;
+    }
+    out.push_back(static_cast<char>(byte));
+}
+
+void put_delta_size(std::string& out, size_t size) {
+    while (size >= 0x80) {
+        out.push_back(static_cast<char>((size & 0x7F) | 0x80));
+        size >>= 7;
+    }
+    out.push_back(static_cast<char>(size));
+}
+
+// Delta that copies base[offset, offset + length) then inserts `suffix`
+std::string copy_then_insert(size_t base_size, size_t offset, size_t length, const std::string& suffix) {
+    std::string delta;
+    put_delta_size(delta, base_size);
+    put_delta_size(delta, length + suffix.size());
+    delta.push_back(static_cast<char>(0x80 | 0x01 | 0x10));
+    delta.push_back(static_cast<char>(offset));
+    delta.push_back(static_cast<char>(length));
+    if (!suffix.empty()) {
+        delta.push_back(static_cast<char>(suffix.size()));
+        delta += suffix;
+    }
+    return delta;
+}
+
+dgit::ObjectId blob_id(const std::string& content) {
+    return dgit::Blob(content).id();
+}
+
+class PackIndexTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        test_dir_ = fs::temp_directory_path() / "dgit_packfile_test";
+        fs::create_directories(test_dir_);
+    }
+
+    void TearDown() override {
+        fs::remove_all(test_dir_);
+    }
+
+    std::string write_file(const std::string& name, const std::string& content) {
+        std::string path = (test_dir_ / name).string();
+        std::ofstream(path, std::ios::binary) << content;
+        return path;
+    }
+
+    fs::path test_dir_;
+};
+
+} // namespace
+
+TEST_F(PackIndexTest, LookupUsesFanoutAndLargeOffsets) {
+    std::vector<IdxObject> objects;
+    for (int i = 0; i < 2000; ++i) {
+        uint64_t offset = (i % 7 == 0) ? (uint64_t(5) << 32) + i : 12 + uint64_t(i) * 100;
+        objects.push_back({label_id("object " + std::to_string(i)), offset, static_cast<uint32_t>(i * 3)});
+    }
+
+    dgit::PackIndex index(write_file("pack.idx", build_idx(objects)));
+    ASSERT_EQ(index.get_object_count(), objects.size());
+
+    for (const auto& obj : objects) {
+        auto offset = index.find_offset(obj.id);
+        ASSERT_TRUE(offset.has_value());
+        EXPECT_EQ(*offset, obj.offset);
+        EXPECT_EQ(index.crc32_at(*index.find_position(obj.id)), obj.crc32);
+    }
+
+    EXPECT_FALSE(index.has_object(label_id("missing")));
+    EXPECT_FALSE(index.find_offset(dgit::ObjectId()).has_value());
+
+    // Entries come back in name order
+    auto entries = index.get_entries();
+    ASSERT_EQ(entries.size(), objects.size());
+    EXPECT_TRUE(std::is_sorted(entries.begin(), entries.end(),
+                               [](const dgit::PackIndexEntry& a, const dgit::PackIndexEntry& b) {
+                                   return a.sha1 < b.sha1;
+                               }));
+}
+
+TEST_F(PackIndexTest, EmptyIndex) {
+    dgit::PackIndex index(write_file("empty.idx", build_idx({})));
+    EXPECT_EQ(index.get_object_count(), 0u);
+    EXPECT_FALSE(index.has_object(label_id("anything")));
+}
+
+TEST_F(PackIndexTest, RejectsCorruptFiles) {
+    std::string good = build_idx({{label_id("a"), 12, 0}, {label_id("b"), 40, 0}});
+
+    EXPECT_THROW(dgit::PackIndex(write_file("short.idx", good.substr(0, 100))), dgit::GitException);
+
+    std::string bad_magic = good;
+    bad_magic[0] = 'X';
+    EXPECT_THROW(dgit::PackIndex(write_file("magic.idx", bad_magic)), dgit::GitException);
+
+    std::string truncated = good.substr(0, good.size() - 4);
+    EXPECT_THROW(dgit::PackIndex(write_file("trunc.idx", truncated)), dgit::GitException);
+
+    EXPECT_THROW(dgit::PackIndex((test_dir_ / "missing.idx").string()), dgit::GitException);
+}
+
+TEST(DeltaTest, DecodeCopyAndInsert) {
+    std::string base = "The quick brown fox";
+    EXPECT_EQ(dgit::Delta::decode(base, copy_then_insert(base.size(), 4, 5, " cat")), "quick cat");
+
+    // Size 0 in a copy instruction means 0x10000 bytes
+    std::string big(0x10000, 'x');
+    std::string delta;
+    put_delta_size(delta, big.size());
+    put_delta_size(delta, big.size());
+    delta.push_back(static_cast<char>(0x80));
+    EXPECT_EQ(dgit::Delta::decode(big, delta), big);
+}
+
+TEST(DeltaTest, DecodeRejectsCorruptDeltas) {
+    std::string base = "abcdef";
+    // Wrong base size
+    EXPECT_THROW(dgit::Delta::decode(base, copy_then_insert(5, 0, 2, "")), dgit::GitException);
+    // Copy past the end of the base
+    EXPECT_THROW(dgit::Delta::decode(base, copy_then_insert(base.size(), 4, 5, "")), dgit::GitException);
+    // Result shorter than announced
+    std::string delta = copy_then_insert(base.size(), 0, 2, "zz");
+    delta.pop_back();
+    EXPECT_THROW(dgit::Delta::decode(base, delta), dgit::GitException);
+    // Reserved opcode
+    std::string reserved;
+    put_delta_size(reserved, base.size());
+    put_delta_size(reserved, 1);
+    reserved.push_back('\0');
+    EXPECT_THROW(dgit::Delta::decode(base, reserved), dgit::GitException);
+}
+
+TEST(CompressionTest, ReusedContextsRoundTrip) {
+    std::string out;
+    std::string back;
+    for (int level : {dgit::kDefaultCompressionLevel, 0, 1, 9}) {
+        auto& deflater = dgit::Deflater::for_thread(level);
+        EXPECT_EQ(deflater.level(), level);
+        EXPECT_EQ(&deflater, &dgit::Deflater::for_thread(level));
+
+        for (const std::string& input : {std::string(), std::string("small"), std::string(100000, 'q')}) {
+            deflater.compress(input.data(), input.size(), out);
+            dgit::Inflater::for_thread().decompress(out.data(), out.size(), back, input.size());
+            EXPECT_EQ(back, input);
+            dgit::Inflater::for_thread().decompress(out.data(), out.size(), back);
+            EXPECT_EQ(back, input);
+        }
+    }
+
+    // Trailing bytes after the stream are not consumed
+    dgit::Deflater::for_thread(6).compress("payload", 7, out);
+    size_t stream_size = out.size();
+    out += "trailing";
+    size_t consumed = 0;
+    dgit::Inflater::for_thread().decompress(out.data(), out.size(), back, 7, &consumed);
+    EXPECT_EQ(back, "payload");
+    EXPECT_EQ(consumed, stream_size);
+
+    // Wrong expected size or truncated input is an error
+    EXPECT_THROW(dgit::Inflater::for_thread().decompress(out.data(), stream_size, back, 6), dgit::GitException);
+    EXPECT_THROW(dgit::Inflater::for_thread().decompress(out.data(), stream_size - 3, back), dgit::GitException);
+    EXPECT_THROW(dgit::Deflater::for_thread(42), dgit::GitException);
+}
+
+TEST_F(PackIndexTest, ReaderResolvesDeltaChains) {
+    std::string base = "line one\nline two\nline three\n";
+    std::string second = base.substr(0, 18) + "line 2b\n";     // OFS_DELTA on base
+    std::string third = second.substr(0, 9) + "tail\n";        // REF_DELTA on second
+
+    std::string pack(dgit::packfile_format::PACK_SIGNATURE, 4);
+    put_be32(pack, 2);
+    put_be32(pack, 3);
+
+    size_t base_offset = pack.size();
+    put_entry_header(pack, 3, base.size());
+    pack += deflate_string(base);
+
+    size_t second_offset = pack.size();
+    std::string delta2 = copy_then_insert(base.size(), 0, 18, "line 2b\n");
+    put_entry_header(pack, 6, delta2.size());
+    size_t distance = second_offset - base_offset;
+    ASSERT_LT(distance, 0x80u);
+    pack.push_back(static_cast<char>(distance));
+    pack += deflate_string(delta2);
+
+    size_t third_offset = pack.size();
+    std::string delta3 = copy_then_insert(second.size(), 0, 9, "tail\n");
+    put_entry_header(pack, 7, delta3.size());
+    dgit::ObjectId second_id = blob_id(second);
+    pack.append(reinterpret_cast<const char*>(second_id.data()), dgit::ObjectId::kRawSize);
+    pack += deflate_string(delta3);
+
+    auto checksum = dgit::SHA1::hash_raw(reinterpret_cast<const uint8_t*>(pack.data()), pack.size());
+    std::string checksum_bytes(reinterpret_cast<const char*>(checksum.data()), checksum.size());
+    pack += checksum_bytes;
+
+    std::string pack_path = write_file("test.pack", pack);
+    std::string idx_path = write_file("test.idx", build_idx({{blob_id(base), base_offset, 0},
+                                                            {second_id, second_offset, 0},
+                                                            {blob_id(third), third_offset, 0}},
+                                                           checksum_bytes));
+
+    dgit::PackReader reader(pack_path, idx_path);
+    auto read_third = reader.read_raw(blob_id(third));
+    ASSERT_TRUE(read_third.has_value());
+    EXPECT_EQ(read_third->type, dgit::ObjectType::Blob);
+    EXPECT_EQ(read_third->data, third);
+
+    // The chain's bases are cached, so these come straight from the cache
+    EXPECT_EQ(reader.read_raw(second_id)->data, second);
+    EXPECT_EQ(reader.read_raw(blob_id(base))->data, base);
+    auto stats = reader.stats();
+    EXPECT_EQ(stats.objects_read, 3u);
+    EXPECT_EQ(stats.delta_cache_hits, 2u);
+    EXPECT_GT(stats.delta_cache_hit_rate(), 0.0);
+
+    auto blob = reader.get_object(blob_id(third));
+    ASSERT_NE(blob, nullptr);
+    EXPECT_EQ(blob->id(), blob_id(third));
+    EXPECT_FALSE(reader.read_raw(blob_id("absent")).has_value());
+
+    // Without a cache every read inflates the whole chain again
+    dgit::PackReader uncached(pack_path, idx_path);
+    uncached.set_delta_base_cache_limit(0);
+    EXPECT_EQ(uncached.read_raw(blob_id(third))->data, third);
+    EXPECT_EQ(uncached.read_raw(blob_id(third))->data, third);
+    EXPECT_EQ(uncached.stats().delta_cache_hits, 0u);
+    EXPECT_EQ(uncached.stats().bytes_inflated,
+              2 * (base.size() + delta2.size() + delta3.size()));
+}
+
+TEST(DeltaTest, IndexEncodeRoundTrip) {
+    std::string base;
+    for (int i = 0; i < 500; ++i) {
+        base += "line " + std::to_string(i) + " of the base file\n";
+    }
+    std::string target = "new header\n" + base.substr(0, 4000) + "inserted in the middle\n" + base.substr(4100) +
+                         base.substr(0, 300);
+
+    dgit::DeltaIndex index(base);
+    std::string delta = index.encode(target);
+    EXPECT_LT(delta.size(), target.size() / 10);
+    EXPECT_EQ(dgit::Delta::decode(base, delta), target);
+
+    // Unrelated data and short targets still round-trip as inserts
+    std::string unrelated(1000, '\0');
+    for (size_t i = 0; i < unrelated.size(); ++i) {
+        unrelated[i] = static_cast<char>((i * 7919) >> 3);
+    }
+    EXPECT_EQ(dgit::Delta::decode(base, index.encode(unrelated)), unrelated);
+    EXPECT_EQ(dgit::Delta::decode(base, dgit::Delta::encode(base, "tiny")), "tiny");
+    EXPECT_EQ(dgit::Delta::decode("", dgit::Delta::encode("", target)), target);
+
+    // A delta that cannot fit the budget is abandoned
+    EXPECT_EQ(index.encode(unrelated, 100), "");
+}
+
+TEST_F(PackIndexTest, WriterRoundTripsThroughReader) {
+    std::string pack_path = (test_dir_ / "written.pack").string();
+    std::string idx_path = (test_dir_ / "written.idx").string();
+
+    std::vector<std::string> blobs;
+    std::string content;
+    for (int version = 0; version < 40; ++version) {
+        for (int i = 0; i < 50; ++i) {
+            content += "version " + std::to_string(version) + " line " + std::to_string(i) + "\n";
+        }
+        blobs.push_back(content);
+    }
+
+    dgit::PackWriteOptions options;
+    options.threads = 2;
+    options.window = 4;
+    options.depth = 3;
+    {
+        dgit::PackWriter writer(pack_path, idx_path, options);
+        for (const auto& blob : blobs) {
+            EXPECT_TRUE(writer.add_object(blob_id(blob), dgit::ObjectType::Blob, blob, "file.txt"));
+        }
+        EXPECT_FALSE(writer.add_object(blob_id(blobs[0]), dgit::ObjectType::Blob, blobs[0]));
+        ASSERT_TRUE(writer.finalize());
+
+        size_t deltas = 0;
+        for (const auto& entry : writer.entries()) {
+            deltas += entry.type == dgit::PackObjectType::OfsDelta;
+        }
+        EXPECT_GT(deltas, blobs.size() / 2);
+    }
+
+    dgit::PackReader reader(pack_path, idx_path);
+    ASSERT_EQ(reader.get_object_count(), blobs.size());
+    for (const auto& blob : blobs) {
+        auto raw = reader.read_raw(blob_id(blob));
+        ASSERT_TRUE(raw.has_value());
+        EXPECT_EQ(raw->data, blob);
+    }
+
+    // Index CRCs cover each entry's raw bytes in the pack
+    std::ifstream in(pack_path, std::ios::binary);
+    std::string pack((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    dgit::PackIndex index(idx_path);
+    std::vector<size_t> offsets;
+    for (size_t i = 0; i < index.get_object_count(); ++i) {
+        offsets.push_back(index.offset_at(i));
+    }
+    offsets.push_back(pack.size() - dgit::ObjectId::kRawSize);
+    std::sort(offsets.begin(), offsets.end());
+    for (size_t i = 0; i < index.get_object_count(); ++i) {
+        size_t offset = index.offset_at(i);
+        size_t end = *std::upper_bound(offsets.begin(), offsets.end(), offset);
+        uLong crc = crc32(0L, reinterpret_cast<const Bytef*>(pack.data()) + offset, static_cast<uInt>(end - offset));
+        EXPECT_EQ(index.crc32_at(i), static_cast<uint32_t>(crc));
+    }
+
+    auto trailer = dgit::SHA1::hash_raw(reinterpret_cast<const uint8_t*>(pack.data()), offsets.back());
+    EXPECT_EQ(std::memcmp(trailer.data(), index.pack_checksum(), trailer.size()), 0);
+}
+
+TEST_F(PackIndexTest, ObjectDatabaseReadsPacksAndLooseObjects) {
+    std::string git_dir = (test_dir_ / ".git").string();
+    dgit::ObjectDatabase odb(git_dir);
+    std::string pack_dir = git_dir + "/objects/pack";
+
+    std::string packed = "packed blob\n";
+    std::string later = "pack written after the first lookup\n";
+    {
+        dgit::PackWriter writer(pack_dir + "/pack-a.pack", pack_dir + "/pack-a.idx");
+        writer.add_object(blob_id(packed), dgit::ObjectType::Blob, packed);
+    }
+
+    EXPECT_TRUE(odb.exists(blob_id(packed)));
+    EXPECT_EQ(odb.read_raw(blob_id(packed))->data, packed);
+    EXPECT_EQ(odb.load(blob_id(packed))->id(), blob_id(packed));
+    EXPECT_EQ(odb.pack_count(), 1u);
+
+    // A miss is remembered until something is written
+    EXPECT_FALSE(odb.exists(blob_id(later)));
+    EXPECT_FALSE(odb.read_raw(blob_id(later)).has_value());
+    EXPECT_THROW(odb.load(blob_id(later)), dgit::GitException);
+
+    auto loose = std::make_unique<dgit::Blob>("loose blob\n");
+    dgit::ObjectId loose_id = loose->id();
+    EXPECT_FALSE(odb.exists(loose_id));
+    odb.store(std::move(loose));
+    EXPECT_TRUE(odb.exists(loose_id));
+
+    // New packs become visible once reloaded
+    {
+        dgit::PackWriter writer(pack_dir + "/pack-b.pack", pack_dir + "/pack-b.idx");
+        writer.add_object(blob_id(later), dgit::ObjectType::Blob, later);
+    }
+    odb.reload_packs();
+    EXPECT_EQ(odb.pack_count(), 2u);
+    EXPECT_EQ(odb.read_raw(blob_id(later))->data, later);
+}
+
+TEST(EwahBitmapTest, CompressRoundTripsRunsAndLiterals) {
+    dgit::Bitmap bitmap;
+    for (size_t bit = 64 * 3; bit < 64 * 7; ++bit) {
+        bitmap.set(bit);   // a run of ones after a run of zeros
+    }
+    bitmap.set(64 * 7 + 5);
+    bitmap.set(64 * 9 + 63);
+    bitmap.set(64 * 200);
+
+    auto ewah = dgit::EwahBitmap::compress(bitmap);
+    EXPECT_LT(ewah.word_count(), bitmap.words().size());
+    EXPECT_EQ(ewah.decompress(), bitmap);
+    EXPECT_EQ(ewah.decompress().count(), 64 * 4 + 3u);
+
+    std::string serialized;
+    ewah.serialize(serialized);
+    const auto* data = reinterpret_cast<const uint8_t*>(serialized.data());
+    const uint8_t* end = data + serialized.size();
+    auto parsed = dgit::EwahBitmap::parse(data, end);
+    EXPECT_EQ(data, end);
+    EXPECT_EQ(parsed.bit_size(), ewah.bit_size());
+    EXPECT_EQ(parsed.decompress(), bitmap);
+
+    auto empty = dgit::EwahBitmap::compress(dgit::Bitmap(1000));
+    EXPECT_TRUE(empty.decompress().empty());
+}
+
+TEST(EwahBitmapTest, ParseRejectsCorruptInput) {
+    dgit::Bitmap bitmap;
+    bitmap.set(3);
+    bitmap.set(64 * 5 + 1);
+    std::string serialized;
+    dgit::EwahBitmap::compress(bitmap).serialize(serialized);
+
+    auto parse = [](const std::string& bytes) {
+        const auto* data = reinterpret_cast<const uint8_t*>(bytes.data());
+        return dgit::EwahBitmap::parse(data, data + bytes.size());
+    };
+    EXPECT_NO_THROW(parse(serialized));
+    EXPECT_THROW(parse(serialized.substr(0, serialized.size() - 1)), dgit::GitException);
+
+    // A marker claiming more literal words than the buffer holds
+    std::string bad_literals = serialized;
+    bad_literals[8] = '\x7f';
+    EXPECT_THROW(parse(bad_literals), dgit::GitException);
+
+    // Words that expand past the bit count
+    std::string bad_size = serialized;
+    bad_size[0] = bad_size[1] = bad_size[2] = 0;
+    bad_size[3] = 1;
+    EXPECT_THROW(parse(bad_size), dgit::GitException);
+}
+
+TEST(EwahBitmapTest, SetOperations) {
+    dgit::Bitmap a;
+    dgit::Bitmap b;
+    for (size_t bit = 0; bit < 300; bit += 3) {
+        a.set(bit);
+    }
+    for (size_t bit = 0; bit < 500; bit += 5) {
+        b.set(bit);
+    }
+
+    dgit::Bitmap only_a = a;
+    only_a.and_not(b);
+    dgit::Bitmap either = a;
+    either.or_ewah(dgit::EwahBitmap::compress(b));
+    dgit::Bitmap one = a;
+    one.xor_with(b);
+    for (size_t bit = 0; bit < 600; ++bit) {
+        bool in_a = bit < 300 && bit % 3 == 0;
+        bool in_b = bit < 500 && bit % 5 == 0;
+        EXPECT_EQ(only_a.get(bit), in_a && !in_b) << bit;
+        EXPECT_EQ(either.get(bit), in_a || in_b) << bit;
+        EXPECT_EQ(one.get(bit), in_a != in_b) << bit;
+    }
+
+    std::vector<size_t> bits;
+    only_a.for_each([&](size_t bit) { bits.push_back(bit); });
+    EXPECT_EQ(bits.size(), only_a.count());
+    EXPECT_TRUE(std::is_sorted(bits.begin(), bits.end()));
+}
+
+TEST_F(PackIndexTest, BitmapsMatchObjectWalk) {
+    std::string git_dir = (test_dir_ / ".git").string();
+    std::string pack_dir = git_dir + "/objects/pack";
+    fs::create_directories(pack_dir);
+
+    // Each commit changes one file and shares a subdirectory with its parent
+    std::vector<std::unique_ptr<dgit::Object>> objects;
+    auto add = [&](std::unique_ptr<dgit::Object> object) {
+        dgit::ObjectId id = object->id();
+        objects.push_back(std::move(object));
+        return id;
+    };
+    dgit::Person person("Dev", "dev@example.com", std::chrono::system_clock::time_point(std::chrono::seconds(1000)));
+    auto shared = std::make_unique<dgit::Tree>();
+    shared->add_entry(dgit::FileMode::Regular, add(std::make_unique<dgit::Blob>("shared\n")), "lib.txt");
+    dgit::ObjectId shared_id = add(std::move(shared));
+
+    std::vector<dgit::ObjectId> commits;
+    for (int i = 0; i < 6; ++i) {
+        auto tree = std::make_unique<dgit::Tree>();
+        tree->add_entry(dgit::FileMode::Directory, shared_id, "lib");
+        tree->add_entry(dgit::FileMode::Regular, add(std::make_unique<dgit::Blob>("v" + std::to_string(i) + "\n")),
+                        "main.txt");
+        std::vector<dgit::ObjectId> parents;
+        if (!commits.empty()) {
+            parents.push_back(commits.back());
+        }
+        commits.push_back(add(std::make_unique<dgit::Commit>(add(std::move(tree)), parents, person, person,
+                                                             "commit " + std::to_string(i) + "\n")));
+    }
+
+    // The last commit and its new objects stay loose
+    {
+        dgit::PackWriter writer(pack_dir + "/pack-bitmap.pack", pack_dir + "/pack-bitmap.idx");
+        for (size_t i = 0; i + 3 < objects.size(); ++i) {
+            writer.add_object(objects[i]->id(), objects[i]->type(), objects[i]->data());
+        }
+        ASSERT_TRUE(writer.finalize());
+    }
+    dgit::ObjectDatabase odb(git_dir);
+    for (size_t i = objects.size() - 3; i < objects.size(); ++i) {
+        odb.store(objects[i]->clone());
+    }
+
+    // Walks without bitmaps are the reference
+    auto sorted = [](std::vector<dgit::ObjectId> ids) {
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    };
+    auto tip = commits.back();
+    auto everything = sorted(dgit::find_objects_to_send(odb, {tip}));
+    auto since_second = sorted(dgit::find_objects_to_send(odb, {tip}, {commits[1]}));
+    EXPECT_EQ(everything.size(), objects.size());
+    EXPECT_EQ(since_second.size(), 4 * 3u);
+    EXPECT_EQ(odb.pack_bitmap(), nullptr);
+
+    EXPECT_GE(dgit::write_pack_bitmap(odb, pack_dir + "/pack-bitmap.pack", {commits[4]}), 1u);
+    EXPECT_THROW(dgit::write_pack_bitmap(odb, pack_dir + "/pack-bitmap.pack", {tip}), dgit::GitException);
+    odb.reload_packs();
+    const dgit::PackBitmapIndex* bitmaps = odb.pack_bitmap();
+    ASSERT_NE(bitmaps, nullptr);
+    EXPECT_EQ(bitmaps->object_count(), objects.size() - 3);
+
+    auto position = bitmaps->position(commits[4]);
+    ASSERT_TRUE(position.has_value());
+    EXPECT_EQ(bitmaps->object_id(*position), commits[4]);
+    EXPECT_EQ(bitmaps->object_type(*position), dgit::ObjectType::Commit);
+    EXPECT_EQ(bitmaps->object_type(*bitmaps->position(shared_id)), dgit::ObjectType::Tree);
+    dgit::Bitmap reachable;
+    EXPECT_TRUE(bitmaps->or_commit_bitmap(*position, reachable));
+    EXPECT_EQ(reachable.count(), objects.size() - 3);
+
+    EXPECT_EQ(sorted(dgit::find_objects_to_send(odb, {tip})), everything);
+    EXPECT_EQ(sorted(dgit::find_objects_to_send(odb, {tip}, {commits[1]})), since_second);
+    EXPECT_TRUE(dgit::find_objects_to_send(odb, {commits[2]}, {commits[4]}).empty());
+    // Haves we do not have are ignored
+    EXPECT_EQ(sorted(dgit::find_objects_to_send(odb, {tip}, {blob_id("unknown")})), everything);
+}
+
+TEST_F(PackIndexTest, IndexerStreamsPackIntoInstalledIndex) {
+    std::string pack_path = (test_dir_ / "source.pack").string();
+    std::string idx_path = (test_dir_ / "source.idx").string();
+
+    // Enough similar blobs for OFS_DELTA chains, plus a REF_DELTA
+    std::vector<std::string> blobs;
+    std::string content;
+    for (int version = 0; version < 30; ++version) {
+        for (int i = 0; i < 40; ++i) {
+            content += "line " + std::to_string(i) + " of version " + std::to_string(version) + "\n";
+        }
+        blobs.push_back(content);
+    }
+    std::string target = blobs[0] + "appended\n";
+    {
+        dgit::PackWriter writer(pack_path, idx_path);
+        for (const auto& blob : blobs) {
+            writer.add_object(blob_id(blob), dgit::ObjectType::Blob, blob, "file.txt");
+        }
+        writer.add_delta(blob_id(target), blob_id(blobs[0]), dgit::Delta::encode(blobs[0], target));
+        ASSERT_TRUE(writer.finalize());
+    }
+    std::ifstream in(pack_path, std::ios::binary);
+    std::string pack((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    // Chunk sizes that split headers, zlib streams and the trailer
+    std::string installed;
+    {
+        dgit::PackIndexer indexer((test_dir_ / "received").string());
+        const auto* data = reinterpret_cast<const uint8_t*>(pack.data());
+        size_t sizes[] = {1, 7, 13, 100, 4096};
+        for (size_t pos = 0, i = 0; pos < pack.size(); ++i) {
+            size_t size = std::min(sizes[i % 5], pack.size() - pos);
+            indexer.write(data + pos, size);
+            pos += size;
+        }
+        EXPECT_EQ(indexer.object_count(), blobs.size() + 1);
+        EXPECT_EQ(indexer.bytes_received(), pack.size());
+        installed = indexer.finish();
+    }
+    EXPECT_TRUE(fs::exists(installed));
+    fs::path installed_idx = fs::path(installed).replace_extension(".idx");
+
+    // Same objects, offsets and CRCs as the writer's own index
+    std::ifstream expected_in(idx_path, std::ios::binary);
+    std::string expected((std::istreambuf_iterator<char>(expected_in)), std::istreambuf_iterator<char>());
+    std::ifstream actual_in(installed_idx, std::ios::binary);
+    std::string actual((std::istreambuf_iterator<char>(actual_in)), std::istreambuf_iterator<char>());
+    EXPECT_EQ(actual, expected);
+
+    dgit::PackReader reader(installed, installed_idx.string());
+    EXPECT_EQ(reader.read_raw(blob_id(target))->data, target);
+    size_t leftovers = 0;
+    for (const auto& entry : fs::directory_iterator(test_dir_ / "received")) {
+        leftovers += entry.path().filename().string().rfind("tmp_", 0) == 0;
+    }
+    EXPECT_EQ(leftovers, 0u);
+}
+
+TEST_F(PackIndexTest, IndexerRejectsDamagedPacks) {
+    std::string pack_path = (test_dir_ / "small.pack").string();
+    {
+        dgit::PackWriter writer(pack_path, (test_dir_ / "small.idx").string());
+        writer.add_object(blob_id("one\n"), dgit::ObjectType::Blob, "one\n");
+        writer.add_object(blob_id("two\n"), dgit::ObjectType::Blob, "two\n");
+    }
+    std::ifstream in(pack_path, std::ios::binary);
+    std::string pack((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::string received = (test_dir_ / "received").string();
+
+    auto index = [&](const std::string& bytes) {
+        dgit::PackIndexer indexer(received);
+        indexer.write(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+        return indexer.finish();
+    };
+    EXPECT_THROW(index(pack.substr(0, pack.size() - 5)), dgit::GitException);
+    EXPECT_THROW(index(pack + "x"), dgit::GitException);
+    EXPECT_THROW(index("NOPE" + pack.substr(4)), dgit::GitException);
+
+    std::string bad_checksum = pack;
+    bad_checksum.back() ^= 1;
+    EXPECT_THROW(index(bad_checksum), dgit::GitException);
+
+    // Failures leave nothing behind in the pack directory
+    EXPECT_TRUE(fs::is_empty(received));
+    EXPECT_NO_THROW(index(pack));
+}
+
+TEST_F(PackIndexTest, IndexerResolvesDeltasInParallel) {
+    // Many files with deep version chains, so the workers have to share
+    // the deltas of one base as well as separate bases
+    std::string pack_path = (test_dir_ / "history.pack").string();
+    std::vector<std::string> blobs;
+    {
+        dgit::PackWriter writer(pack_path, (test_dir_ / "history.idx").string());
+        for (int file = 0; file < 8; ++file) {
+            std::string content;
+            for (int version = 0; version < 60; ++version) {
+                content += "file " + std::to_string(file) + " version " + std::to_string(version) + "\n";
+                blobs.push_back(content);
+                writer.add_object(blob_id(content), dgit::ObjectType::Blob, content, "f" + std::to_string(file));
+            }
+        }
+        ASSERT_TRUE(writer.finalize());
+    }
+    std::ifstream in(pack_path, std::ios::binary);
+    std::string pack((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    auto index = [&](size_t threads, const std::string& dir) {
+        dgit::PackIndexer indexer((test_dir_ / dir).string());
+        indexer.set_threads(threads);
+        indexer.set_write_reverse_index(true);
+        indexer.write(reinterpret_cast<const uint8_t*>(pack.data()), pack.size());
+        return indexer.finish();
+    };
+    auto read = [](const fs::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        return std::string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    };
+    fs::path serial = index(1, "serial");
+    fs::path parallel = index(8, "parallel");
+    EXPECT_EQ(read(fs::path(serial).replace_extension(".idx")), read(fs::path(parallel).replace_extension(".idx")));
+
+    dgit::PackReader reader(parallel.string(), fs::path(parallel).replace_extension(".idx").string());
+    for (const auto& blob : blobs) {
+        ASSERT_EQ(reader.read_raw(blob_id(blob))->data, blob);
+    }
+
+    // The reverse index lists index positions in increasing pack offset
+    std::string rev = read(fs::path(parallel).replace_extension(".rev"));
+    ASSERT_EQ(rev.size(), 12 + 4 * blobs.size() + 40);
+    EXPECT_EQ(rev.substr(0, 4), "RIDX");
+    size_t last_offset = 0;
+    for (size_t i = 0; i < blobs.size(); ++i) {
+        const auto* p = reinterpret_cast<const uint8_t*>(rev.data() + 12 + 4 * i);
+        uint32_t position = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+        size_t offset = reader.index().offset_at(position);
+        EXPECT_GT(offset, last_offset);
+        last_offset = offset;
+    }
+}
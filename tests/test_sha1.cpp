@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 #include "dgit/sha1.hpp"
+#include "dgit/sha1_kernels.hpp"
+#include "dgit/batch_hash.hpp"
+#include "dgit/object_id.hpp"
+#include <unordered_set>
+#include <filesystem>
 
 TEST(SHA1Test, KnownHashValues) {
     // Test cases from SHA-1 specification and common test vectors
@@ -120,3 +125,161 @@ TEST(SHA1Test, LargeData) {
     // Should be reasonably fast (less than 5 seconds for 100k iterations)
     EXPECT_LT(duration.count(), 5000);
 }
+
+TEST(SHA1Test, PaddingBoundaries) {
+    // 56 bytes forces the length into a second padding block
+    EXPECT_EQ(dgit::SHA1::hash("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+              "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+
+    EXPECT_EQ(dgit::SHA1::hash(std::string(1000000, 'a')),
+              "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+}
+
+TEST(SHA1Test, RawDigestMatchesHex) {
+    std::string input = "abc";
+    auto digest = dgit::SHA1::hash_raw(reinterpret_cast<const uint8_t*>(input.data()), input.size());
+
+    EXPECT_EQ(digest.size(), 20u);
+    EXPECT_EQ(dgit::binary_to_hex(digest.data(), digest.size()), dgit::SHA1::hash(input));
+    EXPECT_EQ(digest[0], 0xa9);
+    EXPECT_EQ(digest[19], 0x9d);
+}
+
+TEST(SHA1Test, UnevenChunksMatchOneShot) {
+    std::string data;
+    for (int i = 0; i < 5000; ++i) {
+        data.push_back(static_cast<char>((i * 131) & 0xFF));
+    }
+
+    // Chunk sizes straddle the 64-byte block boundary in every direction
+    const size_t chunk_sizes[] = {1, 7, 63, 64, 65, 200, 1024};
+    for (size_t chunk : chunk_sizes) {
+        dgit::SHA1 sha1;
+        for (size_t pos = 0; pos < data.size(); pos += chunk) {
+            size_t len = std::min(chunk, data.size() - pos);
+            sha1.update(reinterpret_cast<const uint8_t*>(data.data() + pos), len);
+        }
+        EXPECT_EQ(sha1.final(), dgit::SHA1::hash(data)) << "chunk size " << chunk;
+    }
+}
+
+TEST(SHA1Test, KernelsAgreeWithGeneric) {
+    std::vector<uint8_t> data(64 * 37);
+    for (size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<uint8_t>((i * 2654435761u) >> 24);
+    }
+
+    for (const auto& kernel : dgit::sha1_kernels::available()) {
+        for (size_t blocks : {size_t(1), size_t(2), size_t(37)}) {
+            uint32_t expected[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+            uint32_t actual[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+
+            dgit::sha1_kernels::compress_generic(expected, data.data(), blocks);
+            // Offset by one byte so the kernel sees an unaligned buffer
+            std::vector<uint8_t> shifted(data.size() + 1);
+            std::copy(data.begin(), data.end(), shifted.begin() + 1);
+            kernel.compress(actual, shifted.data() + 1, blocks);
+
+            for (int i = 0; i < 5; ++i) {
+                EXPECT_EQ(actual[i], expected[i]) << kernel.name << " word " << i;
+            }
+        }
+    }
+}
+
+TEST(SHA1Test, BatchHashMatchesBlobIds) {
+    namespace fs = std::filesystem;
+    fs::path dir = fs::temp_directory_path() / "dgit_batch_hash_test";
+    fs::create_directories(dir);
+
+    // Sizes cover empty files, block edges, several lane refills and mmap
+    const size_t sizes[] = {0, 1, 55, 56, 64, 119, 120, 4096, 70000, (1 << 20) + 3};
+    std::vector<std::string> paths;
+    std::vector<std::string> contents;
+    for (int copy = 0; copy < 3; ++copy) {
+        for (size_t size : sizes) {
+            std::string content(size, '\0');
+            for (size_t i = 0; i < size; ++i) {
+                content[i] = static_cast<char>((i * 31 + size + copy) & 0xFF);
+            }
+            std::string path = (dir / ("f" + std::to_string(paths.size()))).string();
+            std::ofstream(path, std::ios::binary) << content;
+            paths.push_back(path);
+            contents.push_back(content);
+        }
+    }
+
+    using Lanes = dgit::BatchHashOptions::Lanes;
+    for (Lanes lanes : {Lanes::Always, Lanes::Never}) {
+        dgit::BatchHashOptions options;
+        options.lanes = lanes;
+        options.threads = 3;
+        auto results = dgit::hash_files(paths, options);
+
+        ASSERT_EQ(results.size(), paths.size());
+        for (size_t i = 0; i < results.size(); ++i) {
+            EXPECT_EQ(results[i].path, paths[i]);
+            EXPECT_EQ(static_cast<size_t>(results[i].st.st_size), contents[i].size());
+            EXPECT_EQ(results[i].id, dgit::hash_blob(reinterpret_cast<const uint8_t*>(contents[i].data()),
+                                                     contents[i].size()));
+        }
+    }
+
+    // Known ID for "hello world\n" as produced by git hash-object
+    std::string hello = "hello world\n";
+    EXPECT_EQ(dgit::hash_blob(reinterpret_cast<const uint8_t*>(hello.data()), hello.size()).hex(),
+              "3b18e512dba79e4c8300dd08aeb37f8e728b8dad");
+
+    EXPECT_THROW(dgit::hash_files({(dir / "missing").string()}), dgit::GitException);
+
+    fs::remove_all(dir);
+}
+
+TEST(SHA1Test, ObjectIdHexRoundTrip) {
+    std::string hex = "3b18e512dba79e4c8300dd08aeb37f8e728b8dad";
+    auto id = dgit::ObjectId::from_hex(hex);
+    EXPECT_EQ(id.hex(), hex);
+    EXPECT_EQ(id.short_hex(), "3b18e51");
+    EXPECT_EQ(id.first_byte(), 0x3b);
+    EXPECT_FALSE(id.is_null());
+    EXPECT_TRUE(dgit::ObjectId().is_null());
+
+    // Upper case is accepted on input, output is always lower case
+    EXPECT_EQ(dgit::ObjectId::from_hex("3B18E512DBA79E4C8300DD08AEB37F8E728B8DAD"), id);
+
+    // Every byte value survives the trip, including 0x0a/0xa0 nibble edges
+    for (int start = 0; start < 256; start += 20) {
+        uint8_t raw[20];
+        for (int i = 0; i < 20; ++i) {
+            raw[i] = static_cast<uint8_t>(start + i);
+        }
+        auto raw_id = dgit::ObjectId::from_raw(raw);
+        EXPECT_EQ(raw_id.hex(), dgit::binary_to_hex(raw, sizeof(raw)));
+        EXPECT_EQ(dgit::ObjectId::from_hex(raw_id.hex()), raw_id);
+    }
+
+    // A bad character at any position is rejected
+    for (size_t pos = 0; pos < hex.size(); ++pos) {
+        for (char bad : {'g', 'G', '/', ':', '@', '`', ' ', '\x80'}) {
+            std::string broken = hex;
+            broken[pos] = bad;
+            EXPECT_FALSE(dgit::ObjectId::parse_hex(broken).has_value()) << pos << " " << bad;
+        }
+    }
+    EXPECT_FALSE(dgit::ObjectId::parse_hex(hex.substr(0, 39)).has_value());
+    EXPECT_FALSE(dgit::ObjectId::parse_hex(hex + "0").has_value());
+    EXPECT_THROW(dgit::ObjectId::from_hex("abc123"), dgit::GitException);
+}
+
+TEST(SHA1Test, ObjectIdOrderingAndHashing) {
+    auto low = dgit::ObjectId::from_hex("00ff000000000000000000000000000000000000");
+    auto high = dgit::ObjectId::from_hex("0100000000000000000000000000000000000000");
+    EXPECT_LT(low, high);
+    EXPECT_NE(low, high);
+    EXPECT_EQ(low, dgit::ObjectId::from_hex(low.hex()));
+
+    std::unordered_set<dgit::ObjectId> ids = {low, high, low};
+    EXPECT_EQ(ids.size(), 2u);
+
+    static_assert(std::is_trivially_copyable<dgit::ObjectId>::value, "ObjectId must be trivially copyable");
+}